@@ -52,6 +52,9 @@ LICENSE@@@ */
 #include "ImageInfo.h"
 #include "ElementInfo.h"
 #include "JsonNPObject.h"
+#include "JsonSchemaRegistry.h"
+#include "NPObjectPool.h"
+#include "NPPropertyBag.h"
 #include "NPObjectEvent.h"
 
 #include <pbnjson.hpp>
@@ -83,6 +86,25 @@ const int ESC_KEY = 27;
 
 static const float kFrozenSurfaceScale = 0.5f;
 
+// Background adapters are rendered at kFrozenSurfaceScale so they are drawn
+// like a frozen surface, and repainted at most this often
+static const int kBackgroundPaintIntervalMs = 1000;
+
+// A server that has not confirmed background mode by then does not know it
+static const guint kBackgroundModeAckMs = 5000;
+
+// Quiet period after which the spare offscreen is given back, unless
+// BROWSER_ADAPTER_IDLE_TRIM_MS says otherwise
+static const guint kIdleTrimMs = 10000;
+
+// A server that has not acknowledged the bulk channel by then does not know
+// it, and the channel's shared memory is given back
+static const guint kBulkChannelAttachMs = 5000;
+
+// Frozen buffers BrowserServer has not confirmed letting go of by then are
+// deleted rather than handed to another adapter
+static const guint kFreezeAckMs = 5000;
+
 static const int kInvalidParam = -1;
 static const double kDoubleEqualityTolerance = 0.00001;
 
@@ -101,6 +123,9 @@ static const int kDoubleClickInterval = 400;
 static const int kTimerInterval = 16;
 static const int kZoomAnimationSteps = 5;
 
+// Queries without a reply after this long are dropped (and their callbacks released)
+static const uint32_t kQueryTimeoutMs = 30 * 1000;
+
 static const int kNumRecordedGestures = 5;
 static const int s_recordedGestureAvgWeights[] = { 1, 2, 4, 8, 16 };
 
@@ -127,6 +152,7 @@ static NPIdentifier gLoadStartedHandler = NULL;
 static NPIdentifier gLoadStoppedHandler = NULL;
 static NPIdentifier gScrollToHandler = NULL;
 static NPIdentifier gScrolledToHandler = NULL;
+static NPIdentifier gEventBatchHandler = NULL;
 static NPIdentifier gClickRejectedHandler = NULL;
 static NPIdentifier gPopupMenuShowHandler = NULL;
 static NPIdentifier gPopupMenuHideHandler = NULL;
@@ -201,6 +227,7 @@ NPError AdapterLibInitialize(void)// Called when proxy library is loaded by brow
     gPageDimensionsHandler = AdapterBase::NPN_GetStringIdentifier("pageDimensions");
     gScrollToHandler = AdapterBase::NPN_GetStringIdentifier("scrollTo");
     gScrolledToHandler = AdapterBase::NPN_GetStringIdentifier("scrolledTo");
+    gEventBatchHandler = AdapterBase::NPN_GetStringIdentifier("eventBatch");
     gPopupMenuShowHandler = AdapterBase::NPN_GetStringIdentifier("showPopupMenu");
     gPopupMenuHideHandler = AdapterBase::NPN_GetStringIdentifier("hidePopupMenu");
     gTitleChangeHandler = AdapterBase::NPN_GetStringIdentifier("titleChange");
@@ -229,6 +256,9 @@ NPError AdapterLibInitialize(void)// Called when proxy library is loaded by brow
     gMouseInInteractiveChangeHandler = AdapterBase::NPN_GetStringIdentifier("mouseInInteractiveChange");
     gShowPrintDialogHandler = AdapterBase::NPN_GetStringIdentifier("showPrintDialog");
     gServerConnectedHandler = AdapterBase::NPN_GetStringIdentifier("serverConnected");
+
+    // Property names of the reply objects
+    NPPropertyIndex::internAll();
     return NPERR_NO_ERROR;
 }
 
@@ -311,7 +341,19 @@ uint32_t AdapterGetMethods(const char*** outNames, const JSMethodPtr **outMethod
         "mouseHoldAt",
         "handleFlick",
         "setVisibleSize",
-        "setDNSServers"
+        "setDNSServers",
+        "startIpcTrace",
+        "stopIpcTrace",
+        "replayIpcTrace",
+        "getQueryLatencyStats",
+        "getObjectPoolStats",
+        "setEventBatching",
+        "setEventRateLimit",
+        "setMemoryBudget",
+        "hintActivation",
+        "setBackgroundMode",
+        "getResourceUsage",
+        "generateThumbnails"
     };
 
     const size_t kExposedMethodCount = G_N_ELEMENTS(names);
@@ -385,7 +427,19 @@ uint32_t AdapterGetMethods(const char*** outNames, const JSMethodPtr **outMethod
         BrowserAdapter::js_mouseHoldAt,
         BrowserAdapter::js_handleFlick,
         BrowserAdapter::js_setVisibleSize,
-        BrowserAdapter::js_setDNSServers
+        BrowserAdapter::js_setDNSServers,
+        BrowserAdapter::js_startIpcTrace,
+        BrowserAdapter::js_stopIpcTrace,
+        BrowserAdapter::js_replayIpcTrace,
+        BrowserAdapter::js_getQueryLatencyStats,
+        BrowserAdapter::js_getObjectPoolStats,
+        BrowserAdapter::js_setEventBatching,
+        BrowserAdapter::js_setEventRateLimit,
+        BrowserAdapter::js_setMemoryBudget,
+        BrowserAdapter::js_hintActivation,
+        BrowserAdapter::js_setBackgroundMode,
+        BrowserAdapter::js_getResourceUsage,
+        BrowserAdapter::js_generateThumbnails
     };
 
     static NPIdentifier ids[kExposedMethodCount] = {NULL};
@@ -409,7 +463,7 @@ static inline bool PrvIsEqual(double a, double b)
  * Constructor. The
  */
 BrowserAdapter::BrowserAdapter(NPP instance, GMainContext *ctxt, int16_t argc, char* argn[], char* argv[])
-    : BrowserClientBase("browser", ctxt)
+    : BrowserClientExtensions("browser", IpcReceiveThread::clientContext(ctxt))
     , AdapterBase(instance, true, true)
     , mScroller(0)
     , mDirtyPattern(0)
@@ -451,6 +505,8 @@ BrowserAdapter::BrowserAdapter(NPP instance, GMainContext *ctxt, int16_t argc, c
     , bEditorFocused(false)
     , m_useFastScaling(false)
     , mPageIdentifier(-1)
+    , m_pendingQueries(ctxt, QueryKindCount, kQueryTimeoutMs)
+    , mDocGeneration(0)
     , mBsQueryNum(0)
     , m_interrogateClicks(false)
     , mMouseMode(0)
@@ -464,7 +520,6 @@ BrowserAdapter::BrowserAdapter(NPP instance, GMainContext *ctxt, int16_t argc, c
     , mFlashGestureLock(false)
     , mMouseInInteractiveRect(false)
     , m_spotlightHandle(0)
-    , m_hitTestSchema("{}")
     , m_ft(0)
     , m_clickPt(0, 0)
     , m_penDownDoc(0, 0)
@@ -485,15 +540,50 @@ BrowserAdapter::BrowserAdapter(NPP instance, GMainContext *ctxt, int16_t argc, c
     , mScrollbarFadeSource(0)
     , m_bufferLock(0)
     , m_bufferLockName(0)
-{
-
-#ifdef ISIS_DESKTOP
-    QString schemaFile = QString("%1/.isis/conf/HitTest.schema").arg(QDir::homePath());
-#else
-    QString schemaFile("/etc/palm/browser/HitTest.schema");
+    , mIpcTrace(0)
+    , mIpcTraceReplayer(0)
+    , mServerStub(0)
+    , mIpcReceiver(0)
+    , mPreparsedJson(0)
+    , m_eventBatcher(this, ctxt)
+    , mBulkChannel(0)
+    , mBulkChannelAttached(false)
+    , mBulkChannelAttachSource(0)
+    , mBackgroundOffscreen(0)
+    , mBackgroundModeEntered(false)
+    , mBackgroundModeAckSource(0)
+    , mBackgroundInvalidateSource(0)
+    , mBackgroundInvalidateTime(0)
+    , mResourcePeakTotal(0)
+    , mFrozenSurfaceSpilled(false)
+    , mIdleTrimMs(kIdleTrimMs)
+    , mIdleTrimSource(0)
+    , mLastActivityTime(0)
+    , mSingleBuffered(false)
+    , mSingleBufferRequested(false)
+    , mFreezeAcksPending(0)
+    , mFreezeAckSource(0)
+{
+
+    // Record all BrowserServer traffic if a trace directory is configured
+    const char* traceDir = getenv("BROWSER_ADAPTER_IPC_TRACE_DIR");
+    if (traceDir) {
+        gchar* tracePath = g_strdup_printf("%s/browser-adapter-%d-%p.trace", traceDir, getpid(), this);
+        mIpcTrace = IpcTraceRecorder::create(tracePath);
+        g_free(tracePath);
+    }
+
+#ifdef BROWSER_SERVER_STUB
+    // Talk to an in-process stand-in instead of BrowserServer if requested
+    mServerStub = BrowserServerStub::createFromEnvironment(this, ctxt);
 #endif
 
-    m_hitTestSchema = pbnjson::JSchemaFile(qPrintable(schemaFile));
+    const char* idleTrimMs = getenv("BROWSER_ADAPTER_IDLE_TRIM_MS");
+    if (idleTrimMs)
+        mIdleTrimMs = MAX(0, atoi(idleTrimMs));
+
+    if (IpcReceiveThread::instance())
+        mIpcReceiver = new IpcReceiver(this, ctxt);
 
     //openlog("browser-adapter", 0, LOG_USER);
     g_message("%s: %p", __PRETTY_FUNCTION__, this);
@@ -537,13 +627,13 @@ BrowserAdapter::BrowserAdapter(NPP instance, GMainContext *ctxt, int16_t argc, c
     // selection reticle setup
     initSelectionReticleSurface();
 
-    BrowserAdapterManager::instance()->registerAdapter(this);
+    BrowserAdapterManager::instance()->registerAdapter(this, ctxt);
 
     TRACEF("pass events %d viewport %dx%d", m_passInputEvents,
            mViewportWidth, mViewportHeight);
 
     // Only at the end shall we inform our listener that we're initialized.
-    InvokeEventListener(gAdapterInitializedHandler, NULL, 0, NULL);
+    sendEvent(gAdapterInitializedHandler, NULL, 0, NULL);
 }
 
 BrowserAdapter::~BrowserAdapter()
@@ -552,8 +642,26 @@ BrowserAdapter::~BrowserAdapter()
 
     g_message("%s: %p", __PRETTY_FUNCTION__, this);
 
+    // Keep the reader thread away from us until YapClient is gone too
+    if (mIpcReceiver) {
+        IpcReceiveThread::instance()->pauseUntilIdle();
+        delete mIpcReceiver;
+        mIpcReceiver = 0;
+    }
+
     destroyBufferLock();
 
+    delete mIpcTraceReplayer;
+    mIpcTraceReplayer = 0;
+
+    delete mIpcTrace;
+    mIpcTrace = 0;
+
+#ifdef BROWSER_SERVER_STUB
+    delete mServerStub;
+    mServerStub = 0;
+#endif
+
     stopClickTimer();
     stopMouseHoldTimer();
     stopZoomAnimation();
@@ -572,11 +680,37 @@ BrowserAdapter::~BrowserAdapter()
     delete mDirtyPattern;
     mDirtyPattern = 0;
 
-    delete mFrozenSurface;
-    mFrozenSurface = 0;
+    dropFrozenSurface();
+    cancelIdleTrim();
+
+    // BrowserServer may draw into them until it sees the connection go away
+    cancelFreezeAck();
+    BrowserAdapterManager* manager = BrowserAdapterManager::instance();
+    manager->discardRetiredOffscreens(this);
+    if (mBrowserServerConnected) {
+        manager->discardOffscreen(mOffscreen0);
+        manager->discardOffscreen(mOffscreen1);
+    }
+    else {
+        manager->releaseOffscreen(mOffscreen0);
+        manager->releaseOffscreen(mOffscreen1);
+    }
 
-    delete mOffscreen0;
-    delete mOffscreen1;
+    cancelBulkChannelAttach();
+    delete mBulkChannel;
+    mBulkChannel = 0;
+
+    // BrowserServer drops the background buffer along with the connection
+    if (mBackgroundInvalidateSource) {
+        g_source_destroy(mBackgroundInvalidateSource);
+        g_source_unref(mBackgroundInvalidateSource);
+    }
+    cancelBackgroundModeAck();
+    manager->discardOffscreen(mBackgroundOffscreen);
+
+    BrowserAdapterManager::instance()->cancelThumbnails(this);
+    for (std::map<int, NPObject*>::iterator it = mThumbnailCallbacks.begin(); it != mThumbnailCallbacks.end(); ++it)
+        AdapterBase::NPN_ReleaseObject(it->second);
 
     std::list<UrlRedirectInfo*>::iterator i;
     for (i = m_urlRedirects.begin(); i != m_urlRedirects.end(); ++i) {
@@ -594,6 +728,8 @@ BrowserAdapter::~BrowserAdapter()
 
     BrowserAdapterManager::instance()->unregisterAdapter(this);
 
+    dumpQueryLatencyStats();
+
     stopFadeScrollbar();
 
     closelog();
@@ -744,6 +880,9 @@ BrowserAdapter::GetTextCaretArgs::GetTextCaretArgs(NPObject *cb, int queryNum) :
 
 BrowserAdapter::GetTextCaretArgs::~GetTextCaretArgs()
 {
+    if (m_callback) {
+        AdapterBase::NPN_ReleaseObject(m_callback);
+    }
 }
 
 /**
@@ -765,6 +904,10 @@ void BrowserAdapter::sendStateToServer()
 
     asyncCmdConnect(virtualPageWidth, virtualPageHeight, mOffscreen0->key(),
                     mOffscreen1->key(), mOffscreen0->size(), mPageIdentifier);
+
+    mResourcePeak = ResourceUsage();
+    mResourcePeakTotal = 0;
+    attachBulkChannel();
     asyncCmdSetWindowSize(mViewportWidth, mViewportHeight);
     asyncCmdPageFocused(mPageFocused);
     asyncCmdSetMouseMode(mMouseMode);
@@ -786,6 +929,77 @@ void BrowserAdapter::sendStateToServer()
     }
 }
 
+/**
+ * Offer BrowserServer the bulk channel for this connection. Until it
+ * acknowledges with BulkChannelAttached, everything goes through the socket:
+ * a server that does not know the channel ignores the command, and the
+ * channel is deleted if no acknowledgement comes within kBulkChannelAttachMs.
+ */
+void BrowserAdapter::attachBulkChannel()
+{
+    mBulkChannelAttached = false;
+    cancelBulkChannelAttach();
+
+    if (!mBulkChannel) {
+        mBulkChannel = BulkChannel::create();
+        if (!mBulkChannel) {
+            g_warning("%s: unable to create the bulk channel", __FUNCTION__);
+            return;
+        }
+    }
+
+    // Nothing in flight survives the old connection
+    mBulkChannel->reset();
+    asyncCmdAttachBulkChannel(mBulkChannel->key(), mBulkChannel->size());
+
+    mBulkChannelAttachSource = g_timeout_source_new(kBulkChannelAttachMs);
+    g_source_set_callback(mBulkChannelAttachSource, &BrowserAdapter::bulkChannelAttachCb, this, NULL);
+    g_source_attach(mBulkChannelAttachSource, g_main_loop_get_context(mMainLoop));
+}
+
+void BrowserAdapter::cancelBulkChannelAttach()
+{
+    if (mBulkChannelAttachSource) {
+        g_source_destroy(mBulkChannelAttachSource);
+        g_source_unref(mBulkChannelAttachSource);
+        mBulkChannelAttachSource = 0;
+    }
+}
+
+gboolean BrowserAdapter::bulkChannelAttachCb(gpointer data)
+{
+    BrowserAdapter* a = (BrowserAdapter*) data;
+
+    g_source_unref(a->mBulkChannelAttachSource);
+    a->mBulkChannelAttachSource = 0;
+
+    if (!a->mBulkChannelAttached && a->mBulkChannel) {
+        g_message("%s: %p: BrowserServer did not attach the bulk channel, freeing %d KiB",
+                  __FUNCTION__, a, a->mBulkChannel->size() / 1024);
+        delete a->mBulkChannel;
+        a->mBulkChannel = 0;
+    }
+
+    return FALSE;
+}
+
+/**
+ * Send a page body, through the bulk channel if it is large enough to be
+ * worth it and there is room.
+ */
+void BrowserAdapter::sendHtml(const char* url, const char* body)
+{
+    if (mBulkChannelAttached && ::strlen(body) >= BulkChannel::kMinPayloadSize) {
+        uint32_t position, length;
+        if (mBulkChannel->writeString(BulkChannel::ToServer, body, position, length)) {
+            asyncCmdSetHtmlBulk(url, position, length);
+            return;
+        }
+    }
+
+    asyncCmdSetHtml(url, body);
+}
+
 /**
  * Return the value of PalmSystem.isActivated.
  */
@@ -833,7 +1047,11 @@ bool BrowserAdapter::init()
 
     createBufferLock();
 
+#ifdef BROWSER_SERVER_STUB
+    bool successful = mServerStub ? mServerStub->connect() : connect();
+#else
     bool successful = connect();
+#endif
     if (successful) {
         sendStateToServer();
         serverConnected();
@@ -872,21 +1090,29 @@ bool BrowserAdapter::init()
 
 bool BrowserAdapter::initializeIpcBuffer()
 {
+    BrowserAdapterManager* manager = BrowserAdapterManager::instance();
+
+    // Our own buffers from before a freeze can be used again right away
+    if (!mOffscreen0)
+        mOffscreen0 = manager->reclaimOffscreen(this);
     if (!mOffscreen0)
-        mOffscreen0 = BrowserOffscreen::create();
+        mOffscreen0 = manager->acquireOffscreen(this);
 
     if (!mOffscreen0)
         return false;
 
     if (!mOffscreen1)
-        mOffscreen1 = BrowserOffscreen::create();
+        mOffscreen1 = manager->reclaimOffscreen(this);
+    if (!mOffscreen1)
+        mOffscreen1 = manager->acquireOffscreen(this);
 
     if (!mOffscreen1) {
-        delete mOffscreen0;
+        manager->releaseOffscreen(mOffscreen0);
         mOffscreen0 = 0;
         return false;
     }
 
+    raiseResourcePeaks();
     return true;
 }
 
@@ -1146,8 +1372,8 @@ void BrowserAdapter::handlePaint(NpPalmDrawEvent* event)
     gc->push();
         gc->setStrokeColor(QColor(0, 0, 0, 0));
         gc->setFillColor(QColor(255, 0, 0, 60));
-        for (RectMap::const_iterator i = mFlashRects.begin();
-             i != mFlashRects.end();
+        for (RectIndex::RectMap::const_iterator i = mFlashRects.rects().begin();
+             i != mFlashRects.rects().end();
              ++i)
         {
             BrowserRect r = i->second;
@@ -1228,6 +1454,8 @@ Event Handling
 
 bool BrowserAdapter::handlePenDown(NpPalmPenEvent *event)
 {
+    noteActivity(true);
+
     mFrozen = false;
     init();
 
@@ -1286,6 +1514,7 @@ bool BrowserAdapter::handlePenDown(NpPalmPenEvent *event)
 
 bool BrowserAdapter::handlePenUp(NpPalmPenEvent *event)
 {
+    noteActivity(true);
     init();
 
     stopMouseHoldTimer();
@@ -1331,6 +1560,7 @@ bool BrowserAdapter::handlePenUp(NpPalmPenEvent *event)
 
 bool BrowserAdapter::handlePenMove(NpPalmPenEvent *event)
 {
+    noteActivity(true);
     init();
 
     removeHighlight();
@@ -1437,6 +1667,7 @@ bool BrowserAdapter::handlePenDoubleClick(NpPalmPenEvent *event)
 bool BrowserAdapter::handleKeyDown(NpPalmKeyEvent *event)
 {
     EVENT_TRACEF("KeyDown %d/0x%08x\n", event->rawkeyCode, event->rawModifier);
+    noteActivity(true);
     asyncCmdKeyDown(event->rawkeyCode, event->rawModifier, event->chr);
     return event->rawkeyCode != ESC_KEY && bEditorFocused;
 }
@@ -1444,6 +1675,7 @@ bool BrowserAdapter::handleKeyDown(NpPalmKeyEvent *event)
 bool BrowserAdapter::handleKeyUp(NpPalmKeyEvent *event)
 {
     EVENT_TRACEF("KeyUp %d/0x%08x\n", event->rawkeyCode, event->rawModifier);
+    noteActivity(true);
     asyncCmdKeyUp(event->rawkeyCode, event->rawModifier, event->chr);
     return  event->rawkeyCode != ESC_KEY && bEditorFocused;
 }
@@ -1470,6 +1702,8 @@ bool BrowserAdapter::handleTouchCancelled(NpPalmTouchEvent *event)
 
 bool BrowserAdapter::doTouchEvent(int32_t type, NpPalmTouchEvent *event)
 {
+    noteActivity(true);
+
 #ifdef QT_FIXME
     if (shouldPassTouchEvents()) {
         pbnjson::JValue arr = pbnjson::Array();
@@ -1525,9 +1759,8 @@ bool BrowserAdapter::doTouchEvent(int32_t type, NpPalmTouchEvent *event)
         }
 
         pbnjson::JGenerator ser(NULL);
-        pbnjson::JSchemaFragment schema("{}");
         std::string json;
-        if (!ser.toString(arr, schema, json)) {
+        if (!ser.toString(arr, JsonSchemaRegistry::get(JsonSchemaRegistry::SchemaAny), json)) {
             syslog(LOG_DEBUG, "error generating json, dropping event");
         } else {
             EVENT_TRACEF("touches: %d, json: %s", arr.arraySize(), json.c_str());
@@ -1557,6 +1790,8 @@ bool BrowserAdapter::handleGesture(NpPalmGestureEvent *event)
                  event->type, event->x, event->y, event->center_x, event->center_y,
                  event->scale, event->rotate, event->modifiers);
 
+    noteActivity(true);
+
     mShowHighlight = false;
     stopMouseHoldTimer();
 
@@ -1793,11 +2028,7 @@ void BrowserAdapter::sendSingleTap(int cx, int cy, int modifiers)
                 asyncCmdMouseEvent(1 /*mouseup*/, docPt.x, docPt.y, 1);
             }
         } else {
-            int q = mBsQueryNum++;
-            HitTestArgs *callArgs = new HitTestArgs("click", docPt, modifiers, q);
-            m_hitTestArgs.add(callArgs);
-            TRACEF("x: %d, y: %d, q: %d", docPt.x, docPt.y, q);
-            asyncCmdHitTest(q, docPt.x, docPt.y);
+            sendHitTest("click", docPt, modifiers);
         }
     }
 }
@@ -1816,8 +2047,7 @@ const char* BrowserAdapter::js_openURL(AdapterBase *adapter, const NPVariant *ar
         a->asyncCmdOpenUrl(url);
         ::free(url);
 
-        delete a->mFrozenSurface;
-        a->mFrozenSurface = 0;
+        a->dropFrozenSurface();
 
         return NULL;
     }
@@ -2082,10 +2312,9 @@ const char* BrowserAdapter::js_setHTML(AdapterBase *adapter, const NPVariant *ar
     TRACE;
     char* arg0 =NPStringToString(NPVARIANT_TO_STRING(args[0]));
     char* arg1 =NPStringToString(NPVARIANT_TO_STRING(args[1]));
-    proxy->asyncCmdSetHtml(arg0,arg1);
+    proxy->sendHtml(arg0, arg1);
 
-    delete proxy->mFrozenSurface;
-    proxy->mFrozenSurface = 0;
+    proxy->dropFrozenSurface();
 
     ::free(arg0);
     ::free(arg1);
@@ -2105,6 +2334,133 @@ const char* BrowserAdapter::js_disableEnhancedViewport(AdapterBase *adapter, con
     proxy->asyncCmdDisableEnhancedViewport(disable);
     return NULL;
 }
+
+/**
+ * Send a query about document point (@a docX, @a docY) unless an identical one
+ * is still waiting for its reply, in which case @a args is completed by that
+ * reply instead. We now own @a args.
+ */
+void BrowserAdapter::sendPointQuery(QueryKind kind, BrowserServerCallArgs* args, int docX, int docY)
+{
+    uint64_t key = ((uint64_t) (uint32_t) docX << 32) | (uint32_t) docY;
+
+    args->m_docX = docX;
+    args->m_docY = docY;
+
+    if (m_pendingQueries.join(kind, key, args)) {
+        TRACEF("query %d joins an identical one at (%d, %d)", args->m_queryNum, docX, docY);
+        return;
+    }
+
+    int queryNum = args->m_queryNum;
+    m_pendingQueries.addShared(kind, key, args);
+    raiseResourcePeaks();
+
+    switch (kind) {
+    case QueryInspectUrlAtPoint:
+        asyncCmdInspectUrlAtPoint(queryNum, docX, docY);
+        break;
+    case QueryGetImageInfoAtPoint:
+        asyncCmdGetImageInfoAtPoint(queryNum, docX, docY);
+        break;
+    case QueryGetElementInfoAtPoint:
+        asyncCmdGetElementInfoAtPoint(queryNum, docX, docY);
+        break;
+    case QueryIsInteractiveAtPoint:
+        asyncCmdIsInteractiveAtPoint(queryNum, docX, docY);
+        break;
+    default:
+        g_critical("%s: %d is not a point query", __FUNCTION__, kind);
+        break;
+    }
+}
+
+/**
+ * The document changed in a way that may change the answer to any query
+ * about it: queries sent from now on must not share replies with earlier ones
+ * nor be answered from cached results.
+ */
+void BrowserAdapter::documentChanged()
+{
+    mDocGeneration++;
+    m_pendingQueries.unshareAll();
+    m_hitTestCache.setGeneration(mDocGeneration);
+}
+
+/**
+ * Answer isInteractiveAtPoint from what we already know: the interactive and
+ * plugin rects BrowserServer keeps us updated with, then cached replies.
+ */
+bool BrowserAdapter::cachedInteractiveAtPoint(const Point& docPt, bool& interactive)
+{
+    if (interactiveRectContainsPoint(docPt) || flashRectContainsPoint(docPt)) {
+        interactive = true;
+        return true;
+    }
+
+    return m_hitTestCache.findInteractive(docPt.x, docPt.y, interactive);
+}
+
+void BrowserAdapter::replyInteractiveAtPoint(IsInteractiveAtPointArgs* args, bool interactive)
+{
+    NPVariant jsCallResult, jsCallArgs;
+    NPObject* info = NPN_CreateObject(&InteractiveInfo::sInteractiveInfoClass);
+    if (info) {
+        OBJECT_TO_NPVARIANT(info, jsCallArgs);
+        static_cast<InteractiveInfo*>(info)->initialize(interactive, args->m_x, args->m_y);
+        if (NPN_InvokeDefault(args->m_callback, &jsCallArgs, 1, &jsCallResult))
+            TRACEF("isInteractiveAtPoint response call success.");
+        else
+            TRACEF("isInteractiveAtPoint response call FAILED.");
+
+        AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs);
+    }
+    else {
+        TRACEF("isInteractiveAtPoint: response obj NOT created.");
+    }
+}
+
+void BrowserAdapter::replyUrlAtPoint(InspectUrlAtPointArgs* args, const HitTestCache::CachedUrl& url)
+{
+    NPVariant jsCallResult, jsCallArgs;
+
+    NPObject* info = NPN_CreateObject(&UrlInfo::sUrlInfoClass);
+    if (info) {
+        OBJECT_TO_NPVARIANT(info, jsCallArgs);
+        static_cast<UrlInfo*>(info)->initialize(url.succeeded, url.url.c_str(), url.desc.c_str(),
+                url.left, url.top, url.right, url.bottom);
+        if (NPN_InvokeDefault(args->m_successCb, &jsCallArgs, 1, &jsCallResult))
+            TRACEF("inspectUrlAtPoint response call success.");
+        else
+            TRACEF("inspectUrlAtPoint response call FAILED.");
+
+        AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs);
+    }
+    else {
+        TRACEF("InspectUrlAtPointResponse: response obj NOT created.");
+    }
+}
+
+void BrowserAdapter::replyElementInfoAtPoint(GetElementInfoAtPointArgs* args, const HitTestCache::CachedElement& e)
+{
+    NPVariant jsCallResult, jsCallArgs;
+    NPObject* info = NPN_CreateObject(&ElementInfo::sElementInfoClass);
+    if (info) {
+        OBJECT_TO_NPVARIANT(info, jsCallArgs);
+        static_cast<ElementInfo*>(info)->initialize(e.succeeded, e.element.c_str(), e.id.c_str(), e.name.c_str(),
+                e.cname.c_str(), e.type.c_str(), e.left, e.top, e.right, e.bottom, args->m_x, args->m_y, e.isEditable);
+        if (NPN_InvokeDefault(args->m_callback, &jsCallArgs, 1, &jsCallResult))
+            TRACEF("getElementInfoAtPoint response call success.");
+        else
+            TRACEF("getElementInfoAtPoint response call FAILED.");
+
+        AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs);
+    }
+    else {
+        TRACEF("getElementInfoAtPoint: response obj NOT created.");
+    }
+}
+
 /**
  * See if there is a URL at a certain point and return information about it.
  */
@@ -2133,8 +2489,14 @@ const char* BrowserAdapter::js_inspectUrlAtPoint(AdapterBase *adapter, const NPV
         x = (x + proxy->mScrollPos.x) / proxy->mZoomLevel;
         y = (y + proxy->mScrollPos.y) / proxy->mZoomLevel;
 
-        proxy->m_inspectUrlArgs.add(inspectArgs);
-        proxy->asyncCmdInspectUrlAtPoint(nQueryNum, x, y);
+        const HitTestCache::CachedUrl* cached = proxy->m_hitTestCache.findUrl(x, y);
+        if (cached) {
+            std::auto_ptr<InspectUrlAtPointArgs> done(inspectArgs);
+            proxy->replyUrlAtPoint(inspectArgs, *cached);
+            return NULL;
+        }
+
+        proxy->sendPointQuery(QueryInspectUrlAtPoint, inspectArgs, x, y);
         return NULL;
     }
     else {
@@ -2167,8 +2529,7 @@ const char* BrowserAdapter::js_getImageInfoAtPoint(AdapterBase *adapter, const N
         x = (x + proxy->mScrollPos.x) / proxy->mZoomLevel;
         y = (y + proxy->mScrollPos.y) / proxy->mZoomLevel;
 
-        proxy->m_getImageInfoAtPointArgs.add(callArgs);
-        proxy->asyncCmdGetImageInfoAtPoint(nQueryNum, x, y);
+        proxy->sendPointQuery(QueryGetImageInfoAtPoint, callArgs, x, y);
         return NULL;
     }
     else {
@@ -2201,8 +2562,14 @@ const char* BrowserAdapter::js_getElementInfoAtPoint(AdapterBase *adapter, const
         x = (x + proxy->mScrollPos.x) / proxy->mZoomLevel;
         y = (y + proxy->mScrollPos.y) / proxy->mZoomLevel;
 
-        proxy->m_getElementInfoAtPointArgs.add(callArgs);
-        proxy->asyncCmdGetElementInfoAtPoint(nQueryNum, x, y);
+        const HitTestCache::CachedElement* cached = proxy->m_hitTestCache.findElement(x, y);
+        if (cached) {
+            std::auto_ptr<GetElementInfoAtPointArgs> done(callArgs);
+            proxy->replyElementInfoAtPoint(callArgs, *cached);
+            return NULL;
+        }
+
+        proxy->sendPointQuery(QueryGetElementInfoAtPoint, callArgs, x, y);
         return NULL;
     }
     else {
@@ -2301,26 +2668,29 @@ BrowserAdapter::msgGetImageInfoAtPointResponse(int32_t queryNum, bool succeeded,
         const char* title, const char* altText, int32_t width, int32_t height, const char* mimeType)
 {
     TRACEF("%c, '%s'", succeeded ? 'T' : 'F', baseUri);
-    std::auto_ptr<GetImageInfoAtPointArgs> args(m_getImageInfoAtPointArgs.get(queryNum));
+    std::auto_ptr<GetImageInfoAtPointArgs> args(m_pendingQueries.takeAs<GetImageInfoAtPointArgs>(QueryGetImageInfoAtPoint, queryNum));
     if (!args.get()) {
         TRACEF("Can't find response for this call.");
         return;
     }
 
-    NPVariant jsCallResult, jsCallArgs;
-    NPObject* info = NPN_CreateObject(&ImageInfo::sImageInfoClass);
-    if (info) {
-        OBJECT_TO_NPVARIANT(info, jsCallArgs);
-        static_cast<ImageInfo*>(info)->initialize(succeeded, baseUri, src, title, altText, width, height, mimeType);
-        if (NPN_InvokeDefault(args->m_callback, &jsCallArgs, 1, &jsCallResult))
-            TRACEF("getImageInfoAtPoint response call success.");
-        else
-            TRACEF("getImageInfoAtPoint response call FAILED.");
+    // Identical calls made while this one was in flight share its reply
+    for (GetImageInfoAtPointArgs* a = args.get(); a; a = static_cast<GetImageInfoAtPointArgs*>(a->m_joined)) {
+        NPVariant jsCallResult, jsCallArgs;
+        NPObject* info = NPN_CreateObject(&ImageInfo::sImageInfoClass);
+        if (info) {
+            OBJECT_TO_NPVARIANT(info, jsCallArgs);
+            static_cast<ImageInfo*>(info)->initialize(succeeded, baseUri, src, title, altText, width, height, mimeType);
+            if (NPN_InvokeDefault(a->m_callback, &jsCallArgs, 1, &jsCallResult))
+                TRACEF("getImageInfoAtPoint response call success.");
+            else
+                TRACEF("getImageInfoAtPoint response call FAILED.");
 
-        AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs);
-    }
-    else {
-        TRACEF("getImageInfoAtPoint: response obj NOT created.");
+            AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs);
+        }
+        else {
+            TRACEF("getImageInfoAtPoint: response obj NOT created.");
+        }
     }
 }
 
@@ -2350,8 +2720,14 @@ const char* BrowserAdapter::js_interactiveAtPoint(AdapterBase *adapter, const NP
         x = (x + proxy->mScrollPos.x) / proxy->mZoomLevel;
         y = (y + proxy->mScrollPos.y) / proxy->mZoomLevel;
 
-        proxy->m_isInteractiveAtPointArgs.add(callArgs);
-        proxy->asyncCmdIsInteractiveAtPoint(nQueryNum, x, y);
+        bool interactive;
+        if (proxy->cachedInteractiveAtPoint(Point(x, y), interactive)) {
+            std::auto_ptr<IsInteractiveAtPointArgs> done(callArgs);
+            proxy->replyInteractiveAtPoint(callArgs, interactive);
+            return NULL;
+        }
+
+        proxy->sendPointQuery(QueryIsInteractiveAtPoint, callArgs, x, y);
         return NULL;
     }
     else {
@@ -2362,27 +2738,16 @@ const char* BrowserAdapter::js_interactiveAtPoint(AdapterBase *adapter, const NP
 void BrowserAdapter::msgIsInteractiveAtPointResponse(int32_t queryNum, bool interactive)
 {
     TRACEF("'%c'", interactive ? 'T' : 'F');
-    std::auto_ptr<IsInteractiveAtPointArgs> args(m_isInteractiveAtPointArgs.get(queryNum));
+    std::auto_ptr<IsInteractiveAtPointArgs> args(m_pendingQueries.takeAs<IsInteractiveAtPointArgs>(QueryIsInteractiveAtPoint, queryNum));
     if (!args.get()) {
         TRACEF("Can't find response for this call.");
         return;
     }
 
-    NPVariant jsCallResult, jsCallArgs;
-    NPObject* info = NPN_CreateObject(&InteractiveInfo::sInteractiveInfoClass);
-    if (info) {
-        OBJECT_TO_NPVARIANT(info, jsCallArgs);
-        static_cast<InteractiveInfo*>(info)->initialize(interactive, args->m_x, args->m_y);
-        if (NPN_InvokeDefault(args->m_callback, &jsCallArgs, 1, &jsCallResult))
-            TRACEF("isInteractiveAtPoint response call success.");
-        else
-            TRACEF("isInteractiveAtPoint response call FAILED.");
+    m_hitTestCache.putInteractive(args->m_docX, args->m_docY, interactive);
 
-        AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs);
-    }
-    else {
-        TRACEF("isInteractiveAtPoint: response obj NOT created.");
-    }
+    for (IsInteractiveAtPointArgs* a = args.get(); a; a = static_cast<IsInteractiveAtPointArgs*>(a->m_joined))
+        replyInteractiveAtPoint(a, interactive);
 }
 
 /**
@@ -2403,7 +2768,8 @@ const char* BrowserAdapter::js_getHistoryState(AdapterBase *adapter, const NPVar
         int nQueryNum = proxy->mBsQueryNum++;
         GetHistoryStateArgs*  callArgs = new GetHistoryStateArgs(NPVARIANT_TO_OBJECT(args[0]), nQueryNum);
 
-        proxy->m_historyStateArgs.add(callArgs);
+        proxy->m_pendingQueries.add(QueryGetHistoryState, callArgs);
+        proxy->raiseResourcePeaks();
         proxy->asyncCmdGetHistoryState(nQueryNum);
         return NULL;
     }
@@ -2431,7 +2797,8 @@ const char* BrowserAdapter::js_isEditing(AdapterBase *adapter, const NPVariant *
     IsEditingArgs* callArgs = new IsEditingArgs(NPVARIANT_TO_OBJECT(args[0]), queryNum);
 
     // save async request args with unique query id to avoid overlapping responses
-    proxy->m_isEditingArgs.add(callArgs);
+    proxy->m_pendingQueries.add(QueryIsEditing, callArgs);
+    proxy->raiseResourcePeaks();
 
     // send message to BS with query number. BA will then match reply queryNum
     // with request queryNum
@@ -2559,28 +2926,28 @@ BrowserAdapter::msgGetElementInfoAtPointResponse(int32_t queryNum, bool succeede
         bool isEditable)
 {
     TRACEF("GetElementInfoAtPointResponse: succeeded: %c, element:'%s'", succeeded ? 'T' : 'F', element);
-    std::auto_ptr<GetElementInfoAtPointArgs> args(m_getElementInfoAtPointArgs.get(queryNum));
+    std::auto_ptr<GetElementInfoAtPointArgs> args(m_pendingQueries.takeAs<GetElementInfoAtPointArgs>(QueryGetElementInfoAtPoint, queryNum));
     if (!args.get()) {
         TRACEF("Can't find response for this call.");
         return;
     }
 
-    NPVariant jsCallResult, jsCallArgs;
-    NPObject* info = NPN_CreateObject(&ElementInfo::sElementInfoClass);
-    if (info) {
-        OBJECT_TO_NPVARIANT(info, jsCallArgs);
-        static_cast<ElementInfo*>(info)->initialize(succeeded, element, id, name, cname, type, left, top, right,
-                bottom, args->m_x, args->m_y, isEditable);
-        if (NPN_InvokeDefault(args->m_callback, &jsCallArgs, 1, &jsCallResult))
-            TRACEF("getElementInfoAtPoint response call success.");
-        else
-            TRACEF("getElementInfoAtPoint response call FAILED.");
+    HitTestCache::CachedElement e;
+    e.succeeded = succeeded;
+    e.element = element ? element : "";
+    e.id = id ? id : "";
+    e.name = name ? name : "";
+    e.cname = cname ? cname : "";
+    e.type = type ? type : "";
+    e.left = left;
+    e.top = top;
+    e.right = right;
+    e.bottom = bottom;
+    e.isEditable = isEditable;
+    m_hitTestCache.putElement(args->m_docX, args->m_docY, e);
 
-        AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs);
-    }
-    else {
-        TRACEF("getElementInfoAtPoint: response obj NOT created.");
-    }
+    for (GetElementInfoAtPointArgs* a = args.get(); a; a = static_cast<GetElementInfoAtPointArgs*>(a->m_joined))
+        replyElementInfoAtPoint(a, e);
 }
 
 /**
@@ -3425,7 +3792,8 @@ const char* BrowserAdapter::js_copy(AdapterBase *adapter, const NPVariant *args,
     }
 
     CopySuccessCallbackArgs* callbackArgs = new CopySuccessCallbackArgs(callback, queryNum);
-    proxy->m_copySuccessCallbackArgs.add(callbackArgs);
+    proxy->m_pendingQueries.add(QueryCopy, callbackArgs);
+    proxy->raiseResourcePeaks();
     proxy->asyncCmdCopy(queryNum);
 
     return NULL;
@@ -3749,7 +4117,7 @@ void BrowserAdapter::serverConnected()
 
     if (mBrowserServerConnected && !mServerConnectedInvoked) {
         mServerConnectedInvoking = true; // prevent reentry
-        mServerConnectedInvoked = InvokeEventListener(gServerConnectedHandler, NULL, 0, NULL);
+        mServerConnectedInvoked = sendEvent(gServerConnectedHandler, NULL, 0, NULL);
         mServerConnectedInvoking = false;
     }
 }
@@ -3757,11 +4125,17 @@ void BrowserAdapter::serverConnected()
 void BrowserAdapter::serverDisconnected()
 {
     TRACE;
+
+    if (mIpcReceiver && IpcReceiveThread::instance()->isCurrent()) {
+        mIpcReceiver->postDisconnected();
+        return;
+    }
+
     m_useFastScaling = false;
     bEditorFocused = false;
     if (!mNotifiedOfBrowserServerDisconnect) { // notify once
         TRACEF("%s: no connection with BrowserServer", __FUNCTION__);
-        if (InvokeEventListener(gBrowserServerDisconnectHandler, NULL, 0, NULL)) {
+        if (sendEvent(gBrowserServerDisconnectHandler, NULL, 0, NULL)) {
             mNotifiedOfBrowserServerDisconnect = true;
         }
         else {
@@ -3771,6 +4145,25 @@ void BrowserAdapter::serverDisconnected()
     mBrowserServerConnected = false;
     mServerConnectedInvoked = false;
     mSendFinishDocumentLoadNotification = false;
+    mBulkChannelAttached = false;
+    cancelBulkChannelAttach();
+
+    // The next server knows nothing of the background buffer
+    leaveBackgroundMode();
+
+    // init() gets the spare back before connecting again
+    cancelIdleTrim();
+    mSingleBuffered = false;
+    mSingleBufferRequested = false;
+
+    // The old server is gone, so are its mappings of the buffers we retired
+    cancelFreezeAck();
+    mFreezeAcksPending = 0;
+    BrowserAdapterManager::instance()->offscreensDetached(this);
+
+    // No reply is coming for anything we asked the old server
+    m_pendingQueries.clear();
+    documentChanged();
 }
 
 /*
@@ -3793,18 +4186,25 @@ void BrowserAdapter::msgPainted(int32_t sharedBufferKey)
                   sharedBufferKey);
 
     if (mFrozen) {
+        if (mBackgroundOffscreen && mBackgroundOffscreen->key() == sharedBufferKey)
+            backgroundPainted();
+
         if (m_bufferLock)
             sem_post(m_bufferLock);
         return;
     }
 
-    delete mFrozenSurface;
-    mFrozenSurface = NULL;
+    dropFrozenSurface();
+    noteActivity(false);
 
+    // What was hit tested may look different now
+    documentChanged();
+
+    // One of them is gone while single buffered
     int receivedBuffer = -1;
-    if (mOffscreen0->ipcBuffer()->key() == sharedBufferKey)
+    if (mOffscreen0 && mOffscreen0->ipcBuffer()->key() == sharedBufferKey)
         receivedBuffer = 0;
-    else if (mOffscreen1->ipcBuffer()->key() == sharedBufferKey)
+    else if (mOffscreen1 && mOffscreen1->ipcBuffer()->key() == sharedBufferKey)
         receivedBuffer = 1;
 
     if (receivedBuffer < 0) {
@@ -3814,6 +4214,14 @@ void BrowserAdapter::msgPainted(int32_t sharedBufferKey)
         return;
     }
 
+    // Single buffered, BrowserServer painted over what we show
+    if (mSingleBuffered && mOffscreenCurrent && mOffscreenCurrent->key() == sharedBufferKey) {
+        invalidate();
+        if (m_bufferLock)
+            sem_post(m_bufferLock);
+        return;
+    }
+
     if (mOffscreenCurrent) {
         assert(mOffscreenCurrent->ipcBuffer()->key() != sharedBufferKey);
         asyncCmdReturnBuffer(mOffscreenCurrent->key());
@@ -3827,7 +4235,7 @@ void BrowserAdapter::msgPainted(int32_t sharedBufferKey)
         sem_post(m_bufferLock);
 
     if (!mFirstPaintComplete) {
-        InvokeEventListener(gFirstPaintCompleteHandler, NULL, 0, NULL);
+        sendEvent(gFirstPaintCompleteHandler, NULL, 0, NULL);
         mFirstPaintComplete = true;
     }
 }
@@ -3841,7 +4249,7 @@ void BrowserAdapter::msgReportError(const char* url, int32_t code, const char* m
     INT32_TO_NPVARIANT(code, args[1]);
     STRINGZ_TO_NPVARIANT(msg, args[2]);
 
-    InvokeEventListener(gReportErrorHandler, args, G_N_ELEMENTS(args), 0 );
+    sendEvent(gReportErrorHandler, args, G_N_ELEMENTS(args), 0 );
 }
 
 void BrowserAdapter::msgEditorFocused(bool focused, int32_t fieldType, int32_t fieldActions)
@@ -3852,7 +4260,7 @@ void BrowserAdapter::msgEditorFocused(bool focused, int32_t fieldType, int32_t f
     BOOLEAN_TO_NPVARIANT(focused, args[0]);
     INT32_TO_NPVARIANT(fieldType, args[1]);
     INT32_TO_NPVARIANT(fieldActions, args[2]);
-    InvokeEventListener(gEditorFocusedHandler, args, G_N_ELEMENTS(args), 0 );
+    sendEvent(gEditorFocusedHandler, args, G_N_ELEMENTS(args), 0 );
 }
 
 void BrowserAdapter::msgFailedLoad(const char* domain, int errorCode,
@@ -3871,7 +4279,7 @@ void BrowserAdapter::msgFailedLoad(const char* domain, int errorCode,
     STRINGZ_TO_NPVARIANT(failingURL, args[2]);
     STRINGZ_TO_NPVARIANT(localizedDescription, args[3]);
 
-    InvokeEventListener(gFailedLoadHandler, args, G_N_ELEMENTS(args), 0 );
+    sendEvent(gFailedLoadHandler, args, G_N_ELEMENTS(args), 0 );
 }
 
 void BrowserAdapter::msgSetMainDocumentError(const char* domain, int errorCode,
@@ -3884,7 +4292,7 @@ void BrowserAdapter::msgSetMainDocumentError(const char* domain, int errorCode,
     STRINGZ_TO_NPVARIANT(failingURL, args[2]);
     STRINGZ_TO_NPVARIANT(localizedDescription, args[3]);
 
-    InvokeEventListener(gMainDocumentErrorHandler, args, G_N_ELEMENTS(args), 0 );
+    sendEvent(gMainDocumentErrorHandler, args, G_N_ELEMENTS(args), 0 );
 }
 
 /**
@@ -3900,6 +4308,8 @@ void BrowserAdapter::msgContentsSizeChanged(int32_t width, int32_t height)
     if (mPageWidth == width && mPageHeight == height)
         return;
 
+    documentChanged();
+
     if (width == 0 && height == 0) {
         // First content size after a page load. Zoom fit
         delete mMetaViewport;
@@ -3953,7 +4363,7 @@ void BrowserAdapter::msgContentsSizeChanged(int32_t width, int32_t height)
     NPVariant args[2];
     INT32_TO_NPVARIANT(width, args[0]);
     INT32_TO_NPVARIANT(height, args[1]);
-    InvokeEventListener(gPageDimensionsHandler, args, G_N_ELEMENTS(args), NULL);
+    queueEvent(gPageDimensionsHandler, args, G_N_ELEMENTS(args), EventBatcher::CoalesceHandler);
 }
 
 void BrowserAdapter::msgSmartZoomCalculateResponseSimple(int32_t inCenterX, int32_t inCenterY,
@@ -4099,7 +4509,7 @@ void BrowserAdapter::msgScrolledTo(int32_t scrollx, int32_t scrolly)
     NPVariant args[2];
     INT32_TO_NPVARIANT(scrollx,args[0]);
     INT32_TO_NPVARIANT(scrolly,args[1]);
-    InvokeEventListener(gScrollToHandler, args, G_N_ELEMENTS(args), 0 );
+    sendEvent(gScrollToHandler, args, G_N_ELEMENTS(args), 0 );
     }
     */
 }
@@ -4109,9 +4519,10 @@ void BrowserAdapter::msgLoadStarted()
     TRACE;
 
     mFirstPaintComplete = false;
+    documentChanged();
 
     if ( NULL != gLoadStartedHandler ) {
-        InvokeEventListener(gLoadStartedHandler, NULL, 0, NULL);
+        sendEvent(gLoadStartedHandler, NULL, 0, NULL);
     }
 }
 
@@ -4120,7 +4531,7 @@ void BrowserAdapter::msgLoadStopped()
     TRACE;
 
     if ( NULL != gLoadStoppedHandler ) {
-        InvokeEventListener(gLoadStoppedHandler, NULL, 0, NULL);
+        sendEvent(gLoadStoppedHandler, NULL, 0, NULL);
     }
 
 }
@@ -4138,19 +4549,19 @@ void BrowserAdapter::jsonToRects(const char* rectsArrayJson)
     pbnjson::JValue rectsArray;
     pbnjson::JDomParser parser(NULL);
 
-#ifdef ISIS_DESKTOP
-    QString schemaFile = QString("%1/.isis/conf/InteractiveWidgetRect.schema").arg(QDir::homePath());
-#else
-    QString schemaFile("/etc/palm/browser/InteractiveWidgetRect.schema");
-#endif
-
-    pbnjson::JSchemaFile schema(qPrintable(schemaFile));
-    if (!parser.parse(rectsArrayJson, schema, NULL)) {
-        TRACEF("%s: unable to parse string '%s'\n", __FUNCTION__, rectsArrayJson);
-        goto Done;
+    if (mPreparsedJson) {
+        rectsArray = *mPreparsedJson;
     }
+    else {
+        const pbnjson::JSchema& schema =
+            JsonSchemaRegistry::forServerMessage(JsonSchemaRegistry::SchemaInteractiveWidgetRect);
+        if (!parser.parse(rectsArrayJson, schema, NULL)) {
+            TRACEF("%s: unable to parse string '%s'\n", __FUNCTION__, rectsArrayJson);
+            goto Done;
+        }
 
-    rectsArray = parser.getDom();
+        rectsArray = parser.getDom();
+    }
     numRects = (int) rectsArray.arraySize();
 
     for (int i = 0; i < numRects; ++i)
@@ -4171,12 +4582,12 @@ void BrowserAdapter::jsonToRects(const char* rectsArrayJson)
 
         switch (type) {
         case InteractiveRectDefault:
-            mDefaultInteractiveRects.insert(RectMapItem(id, rect));
+            mDefaultInteractiveRects.insert(id, rect);
             TRACEF("inserting rect: type: %d, id: %d, left: %d, top: %d, width: %d, height: %d, new count: %d",
                    (int)type, (int)id, rect.x(), rect.y(), rect.w(), rect.h(), (int)mDefaultInteractiveRects.size());
             break;
         case InteractiveRectPlugin:
-            mFlashRects.insert(RectMapItem(id, rect));
+            mFlashRects.insert(id, rect);
             TRACEF("inserting rect: type: %d, id: %d, left: %d, top: %d, width: %d, height: %d, new count: %d",
                    (int)type, (int)id, rect.x(), rect.y(), rect.w(), rect.h(), (int)mFlashRects.size());
             break;
@@ -4186,6 +4597,8 @@ void BrowserAdapter::jsonToRects(const char* rectsArrayJson)
         }
     }
 
+    raiseResourcePeaks();
+
 Done:
     return;
 }
@@ -4203,24 +4616,29 @@ void BrowserAdapter::msgRemoveFlashRects(const char* rectIdJson)
     // numeric id and type are passed
     pbnjson::JValue rectId;
     pbnjson::JDomParser parser(NULL);
-    pbnjson::JSchemaFragment schema("{}");
+    const pbnjson::JSchema& schema = JsonSchemaRegistry::get(JsonSchemaRegistry::SchemaAny);
 
-    if (!parser.parse(rectIdJson, schema, NULL)) {
-        TRACEF("%s: unable to parse string '%s'\n", __FUNCTION__, rectIdJson);
-        return;
+    if (mPreparsedJson) {
+        rectId = *mPreparsedJson;
     }
+    else {
+        if (!parser.parse(rectIdJson, schema, NULL)) {
+            TRACEF("%s: unable to parse string '%s'\n", __FUNCTION__, rectIdJson);
+            return;
+        }
 
-    rectId = parser.getDom();
+        rectId = parser.getDom();
+    }
     uintptr_t id = (uintptr_t) rectId["id"].asNumber<int64_t>();
     InteractiveRectType type = (InteractiveRectType) rectId["type"].asNumber<int>();
 
     switch (type) {
     case InteractiveRectDefault:
-        mDefaultInteractiveRects.erase(id);
+        mDefaultInteractiveRects.remove(id);
         TRACEF("Removing rect type: %d, id: %d, new count: %d", type, (int)id, (int)mDefaultInteractiveRects.size());
         break;
     case InteractiveRectPlugin:
-        mFlashRects.erase(id);
+        mFlashRects.remove(id);
         TRACEF("Removing rect type: %d, id: %d, new count: %d", type, (int)id, (int)mFlashRects.size());
         break;
     default:
@@ -4233,7 +4651,7 @@ void BrowserAdapter::msgRemoveFlashRects(const char* rectIdJson)
 
 void BrowserAdapter::msgShowPrintDialog()
 {
-    InvokeEventListener(gShowPrintDialogHandler, NULL, 0, NULL);
+    sendEvent(gShowPrintDialogHandler, NULL, 0, NULL);
 }
 
 void BrowserAdapter::msgGetTextCaretBoundsResponse(int32_t queryNum, int32_t left, int32_t top, int32_t right, int32_t bottom)
@@ -4258,14 +4676,14 @@ void BrowserAdapter::msgUpdateGlobalHistory(const char* url, bool reload)
     NPVariant args[2];
     STRINGZ_TO_NPVARIANT(url, args[0]);
     BOOLEAN_TO_NPVARIANT(reload,args[1]);
-    InvokeEventListener(gUpdateGlobalHistoryHandler, args, G_N_ELEMENTS(args), 0 );
+    queueEvent(gUpdateGlobalHistoryHandler, args, G_N_ELEMENTS(args));
 }
 
 void BrowserAdapter::msgDidFinishDocumentLoad()
 {
     TRACE;
 
-    InvokeEventListener(gDidFinishDocumentLoadHandler, NULL, 0, NULL);
+    sendEvent(gDidFinishDocumentLoadHandler, NULL, 0, NULL);
     mSendFinishDocumentLoadNotification = false;
 }
 
@@ -4275,7 +4693,7 @@ void BrowserAdapter::msgLoadProgress(int32_t progress)
     INT32_TO_NPVARIANT(progress, arg);
 
     if ( NULL != gLoadProgressHandler ) {
-        InvokeEventListener(gLoadProgressHandler, &arg, 1, NULL);
+        queueEvent(gLoadProgressHandler, &arg, 1, EventBatcher::CoalesceHandler);
     }
 }
 
@@ -4289,7 +4707,7 @@ void BrowserAdapter::msgLocationChanged(const char* uri, bool canGoBack, bool ca
     BOOLEAN_TO_NPVARIANT(canGoBack, args[1]);
     BOOLEAN_TO_NPVARIANT(canGoForward, args[2]);
 
-    InvokeEventListener(gUrlChangeHandler, args, G_N_ELEMENTS(args), NULL);
+    queueEvent(gUrlChangeHandler, args, G_N_ELEMENTS(args), EventBatcher::CoalesceHandler);
 }
 
 void BrowserAdapter::msgTitleChanged(const char* title)
@@ -4300,7 +4718,7 @@ void BrowserAdapter::msgTitleChanged(const char* title)
 
     STRINGZ_TO_NPVARIANT(title, args[0]);
 
-    InvokeEventListener(gTitleChangeHandler, args, G_N_ELEMENTS(args), NULL);
+    queueEvent(gTitleChangeHandler, args, G_N_ELEMENTS(args), EventBatcher::CoalesceHandler);
 }
 
 void BrowserAdapter::msgTitleAndUrlChanged(const char* title, const char* url, bool canGoBack, bool canGoForward)
@@ -4320,7 +4738,7 @@ void BrowserAdapter::msgTitleAndUrlChanged(const char* title, const char* url, b
     BOOLEAN_TO_NPVARIANT(canGoBack, args[2]);
     BOOLEAN_TO_NPVARIANT(canGoForward, args[3]);
 
-    InvokeEventListener(gTitleURLChangeHandler, args, G_N_ELEMENTS(args), NULL);
+    queueEvent(gTitleURLChangeHandler, args, G_N_ELEMENTS(args), EventBatcher::CoalesceHandler);
 }
 
 void BrowserAdapter::msgDialogAlert(const char* syncPipePath, const char* msg)
@@ -4344,7 +4762,7 @@ void BrowserAdapter::msgDialogAlert(const char* syncPipePath, const char* msg)
     NPVariant args[1];
     STRINGZ_TO_NPVARIANT(msg, args[0]);
 
-    InvokeEventListener(gDialogAlertHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gDialogAlertHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgDialogConfirm(const char* syncPipePath, const char* msg)
@@ -4356,7 +4774,7 @@ void BrowserAdapter::msgDialogConfirm(const char* syncPipePath, const char* msg)
     NPVariant args[1];
     STRINGZ_TO_NPVARIANT(msg, args[0]);
 
-    InvokeEventListener(gDialogConfirmHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gDialogConfirmHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgDialogSSLConfirm(const char* syncPipePath, const char* host,int32_t code, const char* certFile)
@@ -4370,7 +4788,7 @@ void BrowserAdapter::msgDialogSSLConfirm(const char* syncPipePath, const char* h
     INT32_TO_NPVARIANT(code,args[1]);
     STRINGZ_TO_NPVARIANT(certFile, args[2]);
 
-    InvokeEventListener(gDialogConfirmSSLHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gDialogConfirmSSLHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgDialogPrompt(const char* syncPipePath, const char* msg, const char* defaultValue)
@@ -4383,7 +4801,7 @@ void BrowserAdapter::msgDialogPrompt(const char* syncPipePath, const char* msg,
     STRINGZ_TO_NPVARIANT(msg, args[0]);
     STRINGZ_TO_NPVARIANT(defaultValue, args[1]);
 
-    InvokeEventListener(gDialogPromptHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gDialogPromptHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgDialogUserPassword(const char* syncPipePath, const char* msg)
@@ -4395,7 +4813,7 @@ void BrowserAdapter::msgDialogUserPassword(const char* syncPipePath, const char*
     NPVariant args[1];
     STRINGZ_TO_NPVARIANT(msg, args[0]);
 
-    InvokeEventListener(gDialogUserPasswordHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gDialogUserPasswordHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 /**
@@ -4416,11 +4834,7 @@ void BrowserAdapter::msgPopupMenuShow(const char* menuId, const char* menuDataFi
             if (static_cast<size_t>(fsize) == ::fread(menuData, sizeof(char), fsize, file)) {
                 menuData[fsize] = '\0';
 
-                NPVariant args[2];
-                STRINGZ_TO_NPVARIANT(menuId, args[0]);
-                STRINGZ_TO_NPVARIANT(menuData, args[1]);
-
-                InvokeEventListener(gPopupMenuShowHandler, args, G_N_ELEMENTS(args), NULL);
+                showPopupMenu(menuId, menuData);
             }
             else {
                 TRACEF("ERROR reading menu data from file.");
@@ -4435,6 +4849,37 @@ void BrowserAdapter::msgPopupMenuShow(const char* menuId, const char* menuDataFi
     }
 }
 
+/**
+ * Same as msgPopupMenuShow() with the menu data in the bulk channel rather
+ * than in a file.
+ */
+void BrowserAdapter::msgPopupMenuShowBulk(const char* menuId, int32_t menuDataPosition, int32_t menuDataLength)
+{
+    TRACEF("showPopupMenu: %s", menuId);
+
+    const char* menuData = mBulkChannel ? mBulkChannel->readString(BulkChannel::ToClient,
+                                                                   menuDataPosition, menuDataLength) : 0;
+    if (!menuData) {
+        g_warning("%s: no menu data at %d (%d bytes)", __FUNCTION__, menuDataPosition, menuDataLength);
+        return;
+    }
+
+    // The handler may disconnect and take the channel with it
+    std::string menuDataCopy(menuData);
+    mBulkChannel->release(BulkChannel::ToClient, menuDataPosition, menuDataLength);
+
+    showPopupMenu(menuId, menuDataCopy.c_str());
+}
+
+void BrowserAdapter::showPopupMenu(const char* menuId, const char* menuData)
+{
+    NPVariant args[2];
+    STRINGZ_TO_NPVARIANT(menuId, args[0]);
+    STRINGZ_TO_NPVARIANT(menuData, args[1]);
+
+    sendEvent(gPopupMenuShowHandler, args, G_N_ELEMENTS(args), NULL);
+}
+
 /**
  * Sent by the browser server when the client needs to hide a popoup menu.
  */
@@ -4445,7 +4890,7 @@ void BrowserAdapter::msgPopupMenuHide(const char* menuId)
     NPVariant args[1];
     STRINGZ_TO_NPVARIANT(menuId, args[0]);
 
-    InvokeEventListener(gPopupMenuHideHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gPopupMenuHideHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgActionData(const char* dataType, const char* data)
@@ -4456,7 +4901,7 @@ void BrowserAdapter::msgActionData(const char* dataType, const char* data)
     STRINGZ_TO_NPVARIANT(dataType, args[0]);
     STRINGZ_TO_NPVARIANT(data, args[1]);
 
-    InvokeEventListener(gActionDataHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gActionDataHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgDownloadStart(const char* url)
@@ -4467,7 +4912,7 @@ void BrowserAdapter::msgDownloadStart(const char* url)
 
     STRINGZ_TO_NPVARIANT(url, args[0]);
 
-    InvokeEventListener(gDownloadStartHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gDownloadStartHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgDownloadProgress(const char* url, int32_t totalSizeSoFar, int32_t totalSize)
@@ -4481,7 +4926,7 @@ void BrowserAdapter::msgDownloadProgress(const char* url, int32_t totalSizeSoFar
     INT32_TO_NPVARIANT(totalSizeSoFar, args[1]);
     INT32_TO_NPVARIANT(totalSize, args[2]);
 
-    InvokeEventListener(gDownloadProgressHandler, args, G_N_ELEMENTS(args), NULL);
+    queueEvent(gDownloadProgressHandler, args, G_N_ELEMENTS(args), EventBatcher::CoalesceFirstArg);
 }
 
 void BrowserAdapter::msgDownloadError(const char* url, const char* errorMsg)
@@ -4494,7 +4939,7 @@ void BrowserAdapter::msgDownloadError(const char* url, const char* errorMsg)
     STRINGZ_TO_NPVARIANT(url, args[0]);
     STRINGZ_TO_NPVARIANT(errorMsg, args[1]);
 
-    InvokeEventListener(gDownloadErrorHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gDownloadErrorHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 /**
@@ -4597,14 +5042,28 @@ Done:
 #endif /* FIXME_QT */
 }
 
-void BrowserAdapter::msgLinkClicked(const char* url)
+/**
+ * BrowserServer attached to the bulk channel offered in attachBulkChannel().
+ */
+void BrowserAdapter::msgBulkChannelAttached(int32_t key)
 {
-    TRACEF("LinkClickedMsg: Url: %s", url);
+    if (!mBulkChannel || mBulkChannel->key() != key) {
+        g_warning("%s: unknown bulk channel %d", __FUNCTION__, key);
+        return;
+    }
+
+    cancelBulkChannelAttach();
+    mBulkChannelAttached = true;
+}
+
+void BrowserAdapter::msgLinkClicked(const char* url)
+{
+    TRACEF("LinkClickedMsg: Url: %s", url);
     NPVariant args[1];
 
     STRINGZ_TO_NPVARIANT(url, args[0]);
 
-    InvokeEventListener(gLinkClickedHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gLinkClickedHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgDownloadFinished(const char* url, const char* mimeType, const char* tmpFilePath)
@@ -4617,7 +5076,7 @@ void BrowserAdapter::msgDownloadFinished(const char* url, const char* mimeType,
     STRINGZ_TO_NPVARIANT(mimeType, args[1]);
     STRINGZ_TO_NPVARIANT(tmpFilePath, args[2]);
 
-    InvokeEventListener(gDownloadFinishedHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gDownloadFinishedHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgMimeHandoffUrl(const char* mimeType, const char* url)
@@ -4629,7 +5088,7 @@ void BrowserAdapter::msgMimeHandoffUrl(const char* mimeType, const char* url)
     STRINGZ_TO_NPVARIANT(mimeType, args[0]);
     STRINGZ_TO_NPVARIANT(url, args[1]);
 
-    InvokeEventListener(gMimeHandoffUrlHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gMimeHandoffUrlHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgMimeNotSupported(const char* mimeType, const char* url)
@@ -4641,7 +5100,7 @@ void BrowserAdapter::msgMimeNotSupported(const char* mimeType, const char* url)
     STRINGZ_TO_NPVARIANT(mimeType, args[0]);
     STRINGZ_TO_NPVARIANT(url, args[1]);
 
-    InvokeEventListener(gMimeNotSupportedHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gMimeNotSupportedHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgCreatePage(int32_t identifier)
@@ -4656,7 +5115,7 @@ void BrowserAdapter::msgCreatePage(int32_t identifier)
 
     STRINGZ_TO_NPVARIANT(idBuff, args[0]);
 
-    InvokeEventListener(gCreatePageHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gCreatePageHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 
@@ -4668,7 +5127,7 @@ void BrowserAdapter::msgClickRejected(int32_t counter)
 
     INT32_TO_NPVARIANT(counter, args[0]);
 
-    InvokeEventListener(gClickRejectedHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gClickRejectedHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::scale(double zoom)
@@ -4732,25 +5191,21 @@ void BrowserAdapter::msgInspectUrlAtPointResponse(int32_t queryNum, bool succeed
     TRACEF("Got inspectUrlAtPoint response qn=%d success=%c url='%s' desc='%s' (%d, %d) %d x %d.\n",
            queryNum, succeeded ? 'T' : 'F', url, desc, rectX, rectY, rectWidth, rectHeight);
 
-    std::auto_ptr<InspectUrlAtPointArgs> args( m_inspectUrlArgs.get(queryNum) );
+    std::auto_ptr<InspectUrlAtPointArgs> args( m_pendingQueries.takeAs<InspectUrlAtPointArgs>(QueryInspectUrlAtPoint, queryNum) );
 
     if (NULL != args.get()) {
-        NPVariant jsCallResult, jsCallArgs;
-
-        NPObject* info = NPN_CreateObject(&UrlInfo::sUrlInfoClass);
-        if (info) {
-            OBJECT_TO_NPVARIANT(info, jsCallArgs);
-            static_cast<UrlInfo*>(info)->initialize(succeeded, url, desc, rectX, rectY, rectX + rectWidth, rectY + rectHeight);
-            if (NPN_InvokeDefault(args->m_successCb, &jsCallArgs, 1, &jsCallResult))
-                TRACEF("inspectUrlAtPoint response call success.");
-            else
-                TRACEF("inspectUrlAtPoint response call FAILED.");
-
-            AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs);
-        }
-        else {
-            TRACEF("InspectUrlAtPointResponse: response obj NOT created.");
-        }
+        HitTestCache::CachedUrl u;
+        u.succeeded = succeeded;
+        u.url = url ? url : "";
+        u.desc = desc ? desc : "";
+        u.left = rectX;
+        u.top = rectY;
+        u.right = rectX + rectWidth;
+        u.bottom = rectY + rectHeight;
+        m_hitTestCache.putUrl(args->m_docX, args->m_docY, u);
+
+        for (InspectUrlAtPointArgs* a = args.get(); a; a = static_cast<InspectUrlAtPointArgs*>(a->m_joined))
+            replyUrlAtPoint(a, u);
     }
     else {
         TRACEF("Can't find args");
@@ -4763,14 +5218,14 @@ void BrowserAdapter::msgUrlRedirected(const char* url, const char* userData)
     NPVariant args[2];
     STRINGZ_TO_NPVARIANT(url, args[0]);
     STRINGZ_TO_NPVARIANT(userData, args[1]);
-    InvokeEventListener(gUrlRedirectedHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gUrlRedirectedHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgIsEditing(int32_t queryNum, bool isEditing)
 {
     TRACEF("is editable field in focus? %s\n", isEditing? "True" : "False");
 
-    std::auto_ptr<IsEditingArgs> args(m_isEditingArgs.get(queryNum));
+    std::auto_ptr<IsEditingArgs> args(m_pendingQueries.takeAs<IsEditingArgs>(QueryIsEditing, queryNum));
 
     if (!args.get()) {
         TRACEF("Args requests are overlapping");
@@ -4795,7 +5250,7 @@ void BrowserAdapter::msgGetHistoryStateResponse(int32_t queryNum, bool canGoBack
     TRACEF("Got historyState response back=%c, forward=%c\n", canGoBack ? 'Y' : 'N',
            canGoForward ? 'Y' : 'N' );
 
-    std::auto_ptr<GetHistoryStateArgs> args( m_historyStateArgs.get(queryNum) );
+    std::auto_ptr<GetHistoryStateArgs> args( m_pendingQueries.takeAs<GetHistoryStateArgs>(QueryGetHistoryState, queryNum) );
 
     if (NULL != args.get()) {
         NPVariant jsCallResult;
@@ -4836,12 +5291,12 @@ void BrowserAdapter::msgMetaViewportSet(double initialScale, double minimumScale
     INT32_TO_NPVARIANT(height, args[4]);
     BOOLEAN_TO_NPVARIANT(userScalable, args[5]);
 
-    InvokeEventListener(gMetaViewportSetHandler, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gMetaViewportSetHandler, args, G_N_ELEMENTS(args), NULL);
 }
 
 void BrowserAdapter::msgCopySuccessResponse(int32_t queryNum, bool isEditing)
 {
-    std::auto_ptr<CopySuccessCallbackArgs> args(m_copySuccessCallbackArgs.get(queryNum));
+    std::auto_ptr<CopySuccessCallbackArgs> args(m_pendingQueries.takeAs<CopySuccessCallbackArgs>(QueryCopy, queryNum));
 
     if (!args.get()) {
         TRACEF("Args requests are overlapping");
@@ -4867,7 +5322,129 @@ bool BrowserAdapter::isFrozen()
     return mFrozen;
 }
 
-void BrowserAdapter::freeze()
+size_t BrowserAdapter::memoryFootprint() const
+{
+    size_t bytes = 0;
+
+    if (mOffscreen0)
+        bytes += mOffscreen0->size();
+    if (mOffscreen1)
+        bytes += mOffscreen1->size();
+    if (mFrozenSurface && !mFrozenSurfaceSpilled)
+        bytes += mFrozenSurface->byteCount();
+    if (mBulkChannel)
+        bytes += mBulkChannel->size();
+    if (mBackgroundOffscreen)
+        bytes += mBackgroundOffscreen->size();
+
+    return bytes;
+}
+
+ResourceUsage BrowserAdapter::resourceUsage()
+{
+    ResourceUsage usage;
+
+    if (mOffscreen0)
+        usage.sharedMemory += mOffscreen0->size();
+    if (mOffscreen1)
+        usage.sharedMemory += mOffscreen1->size();
+    if (mBackgroundOffscreen)
+        usage.sharedMemory += mBackgroundOffscreen->size();
+    if (mBulkChannel)
+        usage.sharedMemory += mBulkChannel->size();
+
+    if (mFrozenSurface && mFrozenSurfaceSpilled)
+        usage.spilledSurface = mFrozenSurface->byteCount();
+    else if (mFrozenSurface)
+        usage.frozenSurface = mFrozenSurface->byteCount();
+
+    usage.pendingQueries = m_pendingQueries.memoryUsage();
+
+    usage.rects = mHighlightRects.capacity() * sizeof(BrowserRect)
+                  + mFlashRects.memoryUsage()
+                  + mDefaultInteractiveRects.memoryUsage()
+                  + mScrollableLayers.size() * sizeof(BrowserScrollableLayerMap::value_type);
+
+    usage.cachedObjects = m_hitTestCache.memoryUsage();
+
+    mResourcePeak.raiseTo(usage);
+    mResourcePeakTotal = MAX(mResourcePeakTotal, usage.total());
+
+    return usage;
+}
+
+/**
+ * Memory was just taken: let this adapter's and the process wide high-water
+ * marks see it, rather than only what the next sample finds.
+ */
+void BrowserAdapter::raiseResourcePeaks()
+{
+    // Samples this adapter too
+    BrowserAdapterManager::instance()->resourceUsage();
+}
+
+size_t BrowserAdapter::trimCaches()
+{
+    size_t bytes = m_hitTestCache.memoryUsage();
+    m_hitTestCache.trim();
+
+    return bytes;
+}
+
+bool BrowserAdapter::discardFrozenSurface()
+{
+    if (!mFrozen || isBackground() || !mFrozenSurface)
+        return false;
+
+    dropFrozenSurface();
+    return true;
+}
+
+/**
+ * Move the frozen surface into the FrozenSurfaceCache, if there is one, so
+ * it stays out of the heap while the adapter is frozen. Kept on the heap if
+ * it cannot be spilled.
+ */
+void BrowserAdapter::spillFrozenSurface()
+{
+    FrozenSurfaceCache* cache = BrowserAdapterManager::instance()->frozenSurfaceCache();
+    if (!cache || !mFrozenSurface || mFrozenSurfaceSpilled)
+        return;
+
+    QImage* spilled = cache->spill(this, *mFrozenSurface);
+    if (!spilled)
+        return;
+
+    delete mFrozenSurface;
+    mFrozenSurface = spilled;
+    mFrozenSurfaceSpilled = true;
+}
+
+void BrowserAdapter::dropFrozenSurface()
+{
+    if (mFrozenSurfaceSpilled)
+        BrowserAdapterManager::instance()->frozenSurfaceCache()->release(this);
+    else
+        delete mFrozenSurface;
+
+    mFrozenSurface = 0;
+    mFrozenSurfaceSpilled = false;
+}
+
+/**
+ * The cache needs the room. The surface goes back on the heap so the card
+ * is still drawn until thawed.
+ */
+void BrowserAdapter::frozenSurfaceEvicted()
+{
+    g_message("%s: %p", __PRETTY_FUNCTION__, this);
+
+    // The cache unmaps the spilled image once this returns
+    mFrozenSurface = new QImage(mFrozenSurface->copy());
+    mFrozenSurfaceSpilled = false;
+}
+
+void BrowserAdapter::freeze(bool keepSurface)
 {
     const char* identifier = (const char*) NPN_GetValue((NPNVariable) npPalmApplicationIdentifier);
     g_message("%s: %p: %s", __PRETTY_FUNCTION__, this, identifier);
@@ -4877,10 +5454,9 @@ void BrowserAdapter::freeze()
 
     mFrozen = true;
 
-    delete mFrozenSurface;
-    mFrozenSurface = 0;
+    dropFrozenSurface();
 
-    if (mOffscreenCurrent) {
+    if (mOffscreenCurrent && keepSurface) {
 
         BrowserOffscreenInfo* info = mOffscreenCurrent->header();
         QImage offscreenSurf = mOffscreenCurrent->surface();
@@ -4889,6 +5465,10 @@ void BrowserAdapter::freeze()
         int height = offscreenSurf.height() * kFrozenSurfaceScale;
 
         mFrozenSurface = new QImage(offscreenSurf.scaled(width, height));
+        spillFrozenSurface();
+
+        // The surface and the offscreens it was taken from, both at once
+        raiseResourcePeaks();
 
         mFrozenRenderPos.x = info->renderedX;
         mFrozenRenderPos.y = info->renderedY;
@@ -4900,15 +5480,86 @@ void BrowserAdapter::freeze()
 
     // ---------------------------------------------------------------
 
-    delete mOffscreen0;
-    mOffscreen0 = 0;
+    // Thawing brings back both buffers
+    cancelIdleTrim();
+    mSingleBuffered = false;
+    mSingleBufferRequested = false;
 
-    delete mOffscreen1;
-    mOffscreen1 = 0;
+    retireOffscreens();
+}
+
+/**
+ * Hand the offscreens back to the manager and tell BrowserServer to stop
+ * drawing into them. They only go to the pool for another adapter once
+ * BrowserServer confirms with Frozen; a server that never does gets them
+ * deleted after kFreezeAckMs instead.
+ */
+void BrowserAdapter::retireOffscreens()
+{
+    BrowserAdapterManager* manager = BrowserAdapterManager::instance();
+
+    if (mBrowserServerConnected) {
+        manager->retireOffscreen(this, mOffscreen0);
+        manager->retireOffscreen(this, mOffscreen1);
+    }
+    else {
+        manager->releaseOffscreen(mOffscreen0);
+        manager->releaseOffscreen(mOffscreen1);
+    }
 
+    mOffscreen0 = 0;
+    mOffscreen1 = 0;
     mOffscreenCurrent = 0;
 
     asyncCmdFreeze();
+
+    if (!mBrowserServerConnected)
+        return;
+
+    mFreezeAcksPending++;
+
+    cancelFreezeAck();
+    mFreezeAckSource = g_timeout_source_new(kFreezeAckMs);
+    g_source_set_callback(mFreezeAckSource, &BrowserAdapter::freezeAckCb, this, NULL);
+    g_source_attach(mFreezeAckSource, g_main_loop_get_context(mMainLoop));
+}
+
+void BrowserAdapter::cancelFreezeAck()
+{
+    if (mFreezeAckSource) {
+        g_source_destroy(mFreezeAckSource);
+        g_source_unref(mFreezeAckSource);
+        mFreezeAckSource = 0;
+    }
+}
+
+gboolean BrowserAdapter::freezeAckCb(gpointer data)
+{
+    BrowserAdapter* a = (BrowserAdapter*) data;
+
+    g_source_unref(a->mFreezeAckSource);
+    a->mFreezeAckSource = 0;
+
+    g_message("%s: %p: BrowserServer did not confirm %d freezes, deleting the buffers",
+              __FUNCTION__, a, a->mFreezeAcksPending);
+
+    a->mFreezeAcksPending = 0;
+    BrowserAdapterManager::instance()->discardRetiredOffscreens(a);
+
+    return FALSE;
+}
+
+/**
+ * BrowserServer processed a Freeze. Once it has processed all we sent, it
+ * draws into none of the buffers we retired.
+ */
+void BrowserAdapter::msgFrozen()
+{
+    if (mFreezeAcksPending <= 0 || --mFreezeAcksPending > 0)
+        return;
+
+    cancelFreezeAck();
+    BrowserAdapterManager::instance()->offscreensDetached(this);
 }
 
 void BrowserAdapter::thaw()
@@ -4921,6 +5572,15 @@ void BrowserAdapter::thaw()
 
     TRACEF("BrowserAdapter::thaw %p\n", this);
 
+    leaveBackgroundMode();
+
+    // Without buffers stay frozen rather than report BrowserServer gone, a
+    // later activation tries again
+    if (!initializeIpcBuffer()) {
+        g_warning("%s: %p: no offscreens, staying frozen", __PRETTY_FUNCTION__, this);
+        return;
+    }
+
     mFrozen = false;
 
     if (!init()) {
@@ -4934,6 +5594,321 @@ void BrowserAdapter::thaw()
     // don't release frozen at this point, wait msgPainted event coming back!
 }
 
+void BrowserAdapter::setBackgroundMode(bool background)
+{
+    // Already asked for, confirmed or not
+    if (background == (mBackgroundOffscreen != 0))
+        return;
+
+    if (!background) {
+        leaveBackgroundMode();
+        return;
+    }
+
+    if (!mBrowserServerConnected) {
+        g_warning("%s: not connected to BrowserServer", __FUNCTION__);
+        return;
+    }
+
+    freeze();
+
+    mBackgroundOffscreen = BrowserAdapterManager::instance()->acquireOffscreen(this, kFrozenSurfaceScale);
+    if (!mBackgroundOffscreen) {
+        g_warning("%s: unable to create background buffer", __FUNCTION__);
+        return;
+    }
+    raiseResourcePeaks();
+
+    asyncCmdSetBackgroundMode(true, mBackgroundOffscreen->key(), mBackgroundOffscreen->size(),
+                              (int32_t) (kFrozenSurfaceScale * 100), kBackgroundPaintIntervalMs);
+
+    mBackgroundModeAckSource = g_timeout_source_new(kBackgroundModeAckMs);
+    g_source_set_callback(mBackgroundModeAckSource, &BrowserAdapter::backgroundModeAckCb, this, NULL);
+    g_source_attach(mBackgroundModeAckSource, g_main_loop_get_context(mMainLoop));
+}
+
+void BrowserAdapter::msgBackgroundModeEntered(int32_t sharedBufferKey)
+{
+    // Late confirmation of a buffer we already gave up on
+    if (!mBackgroundOffscreen || mBackgroundOffscreen->key() != sharedBufferKey)
+        return;
+
+    cancelBackgroundModeAck();
+    mBackgroundModeEntered = true;
+}
+
+void BrowserAdapter::cancelBackgroundModeAck()
+{
+    if (mBackgroundModeAckSource) {
+        g_source_destroy(mBackgroundModeAckSource);
+        g_source_unref(mBackgroundModeAckSource);
+        mBackgroundModeAckSource = 0;
+    }
+}
+
+/**
+ * BrowserServer does not know background mode. The adapter stays frozen
+ * and the buffer is given back.
+ */
+gboolean BrowserAdapter::backgroundModeAckCb(gpointer data)
+{
+    BrowserAdapter* a = (BrowserAdapter*) data;
+
+    g_source_unref(a->mBackgroundModeAckSource);
+    a->mBackgroundModeAckSource = 0;
+
+    g_message("%s: %p: BrowserServer did not enter background mode", __FUNCTION__, a);
+    a->leaveBackgroundMode();
+
+    return FALSE;
+}
+
+/**
+ * The adapter stays frozen, showing the last background paint.
+ */
+void BrowserAdapter::leaveBackgroundMode()
+{
+    if (mBackgroundInvalidateSource) {
+        g_source_destroy(mBackgroundInvalidateSource);
+        g_source_unref(mBackgroundInvalidateSource);
+        mBackgroundInvalidateSource = 0;
+    }
+
+    cancelBackgroundModeAck();
+    mBackgroundModeEntered = false;
+
+    if (!mBackgroundOffscreen)
+        return;
+
+    // Also sent if unconfirmed, in case BrowserServer is only slow
+    if (mBrowserServerConnected)
+        asyncCmdSetBackgroundMode(false, 0, 0, 0, 0);
+
+    BrowserAdapterManager::instance()->discardOffscreen(mBackgroundOffscreen);
+    mBackgroundOffscreen = 0;
+}
+
+/**
+ * BrowserServer painted into the background buffer. The pixels are scaled
+ * down by kFrozenSurfaceScale: the header holds the rendered position in
+ * full resolution page coordinates but the size of the scaled pixels, which
+ * is scaled back up here.
+ */
+void BrowserAdapter::backgroundPainted()
+{
+    BrowserOffscreenInfo* info = mBackgroundOffscreen->header();
+    QImage surf = mBackgroundOffscreen->surface();
+
+    if (!surf.isNull()) {
+        dropFrozenSurface();
+        mFrozenSurface = new QImage(surf.copy());
+        raiseResourcePeaks();
+
+        mFrozenRenderPos.x = info->renderedX;
+        mFrozenRenderPos.y = info->renderedY;
+        mFrozenRenderWidth = surf.width() / kFrozenSurfaceScale;
+        mFrozenRenderHeight = surf.height() / kFrozenSurfaceScale;
+        mFrozenZoomFactor = info->contentZoom;
+    }
+
+    // We have our copy, BrowserServer may paint the next one
+    asyncCmdReturnBuffer(mBackgroundOffscreen->key());
+
+    // A pending repaint picks up the new surface
+    if (mBackgroundInvalidateSource)
+        return;
+
+    uint64_t now = LatencyHistogram::now();
+    uint64_t due = mBackgroundInvalidateTime + (uint64_t) kBackgroundPaintIntervalMs * 1000;
+    if (now >= due) {
+        mBackgroundInvalidateTime = now;
+        invalidate();
+        return;
+    }
+
+    mBackgroundInvalidateSource = g_timeout_source_new((due - now + 999) / 1000);
+    g_source_set_callback(mBackgroundInvalidateSource, &BrowserAdapter::backgroundInvalidateCb, this, NULL);
+    g_source_attach(mBackgroundInvalidateSource, g_main_loop_get_context(mMainLoop));
+}
+
+gboolean BrowserAdapter::backgroundInvalidateCb(gpointer data)
+{
+    BrowserAdapter* a = (BrowserAdapter*) data;
+
+    g_source_unref(a->mBackgroundInvalidateSource);
+    a->mBackgroundInvalidateSource = 0;
+
+    a->mBackgroundInvalidateTime = LatencyHistogram::now();
+    a->invalidate();
+
+    return FALSE;
+}
+
+/**
+ * Something happened on the page. Input also brings back the spare
+ * offscreen, a paint or scroll only restarts the quiet period.
+ */
+void BrowserAdapter::noteActivity(bool input)
+{
+    mLastActivityTime = LatencyHistogram::now();
+
+    if (input && (mSingleBuffered || mSingleBufferRequested))
+        restoreSpareBuffer();
+
+    scheduleIdleTrim(mIdleTrimMs);
+}
+
+void BrowserAdapter::scheduleIdleTrim(guint delayMs)
+{
+    // The timer checks for activity when it fires rather than being reset
+    // by every event
+    if (!mIdleTrimMs || mIdleTrimSource || mSingleBuffered || mSingleBufferRequested || mFrozen)
+        return;
+
+    mIdleTrimSource = g_timeout_source_new(delayMs);
+    g_source_set_callback(mIdleTrimSource, &BrowserAdapter::idleTrimCb, this, NULL);
+    g_source_attach(mIdleTrimSource, g_main_loop_get_context(mMainLoop));
+}
+
+void BrowserAdapter::cancelIdleTrim()
+{
+    if (mIdleTrimSource) {
+        g_source_destroy(mIdleTrimSource);
+        g_source_unref(mIdleTrimSource);
+        mIdleTrimSource = 0;
+    }
+}
+
+gboolean BrowserAdapter::idleTrimCb(gpointer data)
+{
+    BrowserAdapter* a = (BrowserAdapter*) data;
+
+    g_source_unref(a->mIdleTrimSource);
+    a->mIdleTrimSource = 0;
+
+    uint64_t quiet = LatencyHistogram::now() - a->mLastActivityTime;
+    uint64_t period = (uint64_t) a->mIdleTrimMs * 1000;
+    if (quiet < period)
+        a->scheduleIdleTrim((period - quiet + 999) / 1000);
+    else
+        a->trimSpareBuffer();
+
+    return FALSE;
+}
+
+/**
+ * Ask BrowserServer to paint over the offscreen on screen. The spare is only
+ * given back once it confirms, see msgSingleBufferChanged().
+ */
+void BrowserAdapter::trimSpareBuffer()
+{
+    if (mFrozen || mSingleBuffered || mSingleBufferRequested || !mBrowserServerConnected
+        || !mOffscreenCurrent || !mOffscreen0 || !mOffscreen1)
+        return;
+
+    g_message("%s: %p: idle for %u ms, going single buffered", __FUNCTION__, this, mIdleTrimMs);
+
+    asyncCmdSetSingleBuffer(true, mOffscreenCurrent->key(), mOffscreenCurrent->size());
+    mSingleBufferRequested = true;
+}
+
+void BrowserAdapter::restoreSpareBuffer()
+{
+    if (!mOffscreenCurrent)
+        return;
+
+    BrowserOffscreen*& spare = mOffscreenCurrent == mOffscreen0 ? mOffscreen1 : mOffscreen0;
+
+    // Not confirmed yet, the spare is still here. Undone once it is.
+    if (mSingleBufferRequested) {
+        asyncCmdSetSingleBuffer(false, spare->key(), spare->size());
+        mSingleBufferRequested = false;
+        return;
+    }
+
+    // Already asked for
+    if (spare)
+        return;
+
+    spare = BrowserAdapterManager::instance()->acquireOffscreen(this);
+    if (!spare) {
+        g_warning("%s: %p: no offscreen, staying single buffered", __FUNCTION__, this);
+        return;
+    }
+    raiseResourcePeaks();
+
+    // Still single buffered until confirmed, paints in flight go to mOffscreenCurrent
+    asyncCmdSetSingleBuffer(false, spare->key(), spare->size());
+}
+
+/**
+ * BrowserServer paints in place into @a sharedBufferKey, or again into
+ * both offscreens.
+ */
+void BrowserAdapter::msgSingleBufferChanged(bool enabled, int32_t sharedBufferKey)
+{
+    if (mFrozen || !mOffscreenCurrent)
+        return;
+
+    if (!enabled) {
+        if (mSingleBuffered && mOffscreen0 && mOffscreen1
+            && (mOffscreen0->key() == sharedBufferKey || mOffscreen1->key() == sharedBufferKey)) {
+            mSingleBuffered = false;
+            scheduleIdleTrim(mIdleTrimMs);
+        }
+        return;
+    }
+
+    // Whatever was asked, BrowserServer paints in place until told otherwise
+    mSingleBuffered = true;
+
+    // Input came first and the spare is already on its way back
+    if (!mSingleBufferRequested)
+        return;
+    mSingleBufferRequested = false;
+
+    BrowserOffscreen*& spare = mOffscreenCurrent == mOffscreen0 ? mOffscreen1 : mOffscreen0;
+
+    // A paint into the spare switched buffers meanwhile, hand back the one
+    // BrowserServer dropped
+    if (mOffscreenCurrent->key() != sharedBufferKey) {
+        asyncCmdSetSingleBuffer(false, mOffscreenCurrent->key(), mOffscreenCurrent->size());
+        return;
+    }
+
+    g_message("%s: %p: giving back %d KB", __FUNCTION__, this, spare->size() / 1024);
+
+    BrowserAdapterManager::instance()->discardOffscreen(spare);
+    spare = 0;
+}
+
+bool BrowserAdapter::renderThumbnailSource(QImage& image)
+{
+    if ((!mFrozenSurface && !mOffscreenCurrent) || !mWindow.width || !mWindow.height)
+        return false;
+
+    image = QImage(mWindow.width, mWindow.height, QImage::Format_ARGB32_Premultiplied);
+    if (image.isNull())
+        return false;
+    image.fill(0xFFFFFFFF);
+
+    QPainter gc(&image);
+    gc.translate(-mWindow.x, -mWindow.y);
+
+    NpPalmDrawEvent event;
+    ::memset(&event, 0, sizeof(event));
+    event.graphicsContext = &gc;
+
+    // The page only, not the scrollbars
+    int scrollbarOpacity = mScrollbarOpacity;
+    mScrollbarOpacity = 0;
+    handlePaint(&event);
+    mScrollbarOpacity = scrollbarOpacity;
+
+    gc.end();
+    return true;
+}
+
 void BrowserAdapter::handlePaintInFrozenState(NpPalmDrawEvent* event)
 {
     if (!mFrozenSurface) {
@@ -4941,6 +5916,9 @@ void BrowserAdapter::handlePaintInFrozenState(NpPalmDrawEvent* event)
         return;
     }
 
+    if (mFrozenSurfaceSpilled)
+        BrowserAdapterManager::instance()->frozenSurfaceCache()->touch(this);
+
     QPainter* gc = (QPainter*) event->graphicsContext;
     gc->save();
 
@@ -5206,33 +6184,20 @@ int BrowserAdapter::showHighlight(QPainter* gc)
         BrowserRect r = *rect_iter;
         BrowserRect d[4];
         int count = 0;
-        for (RectMap::const_iterator i = mFlashRects.begin();
-                i != mFlashRects.end();
-                ++i)
-        {
-            BrowserRect f = i->second;
-            if (r.intersects(f)) {
-                // just do one for now
-                /*
-                TRACEF("rect %d,%d,%d,%d intersects with flash rect %d,%d,%d,%d", r.x(), r.y(), r.r(), r.b(), f.x(), f.y(), f.r(), f.b());
-                */
-                count = r.subtract(f, d);
-                break;
-            }
+        BrowserRect f;
+        if (mFlashRects.findIntersecting(r, f)) {
+            // just do one for now
+            /*
+            TRACEF("rect %d,%d,%d,%d intersects with flash rect %d,%d,%d,%d", r.x(), r.y(), r.r(), r.b(), f.x(), f.y(), f.r(), f.b());
+            */
+            count = r.subtract(f, d);
         }
-        for (RectMap::const_iterator i = mDefaultInteractiveRects.begin();
-                i != mDefaultInteractiveRects.end();
-                ++i)
-        {
-            BrowserRect f = i->second;
-            if (r.intersects(f)) {
-                // just do one for now
-                /*
-                TRACEF("rect %d,%d,%d,%d intersects with irect %d,%d,%d,%d", r.x(), r.y(), r.r(), r.b(), f.x(), f.y(), f.r(), f.b());
-                */
-                count = r.subtract(f, d);
-                break;
-            }
+        if (mDefaultInteractiveRects.findIntersecting(r, f)) {
+            // just do one for now
+            /*
+            TRACEF("rect %d,%d,%d,%d intersects with irect %d,%d,%d,%d", r.x(), r.y(), r.r(), r.b(), f.x(), f.y(), f.r(), f.b());
+            */
+            count = r.subtract(f, d);
         }
 
 
@@ -5273,7 +6238,7 @@ void BrowserAdapter::updateMouseInFlashStatus(bool inFlashRect)
         TRACEF("Updating mouseInFlash status to : %d\n", inFlashRect);
         NPVariant arg;
         BOOLEAN_TO_NPVARIANT(inFlashRect, arg);
-        InvokeEventListener(gMouseInFlashChangeHandler, &arg, 1, 0);
+        sendEvent(gMouseInFlashChangeHandler, &arg, 1, 0);
     }
 }
 
@@ -5286,7 +6251,7 @@ void BrowserAdapter::updateMouseInInteractiveStatus(bool inInteractiveRect)
         TRACEF("Updating mouseInInteractive status to : %d\n", inInteractiveRect);
         NPVariant arg;
         BOOLEAN_TO_NPVARIANT(inInteractiveRect, arg);
-        InvokeEventListener(gMouseInInteractiveChangeHandler, &arg, 1, 0);
+        queueEvent(gMouseInInteractiveChangeHandler, &arg, 1, EventBatcher::CoalesceHandler);
     }
 }
 
@@ -5306,7 +6271,7 @@ void BrowserAdapter::updateFlashGestureLockStatus(bool gestureLockEnabled)
         TRACEF("Updating flashGestureLock status to : %d\n", gestureLockEnabled);
         NPVariant arg;
         BOOLEAN_TO_NPVARIANT(gestureLockEnabled, arg);
-        InvokeEventListener(gFlashGestureLockHandler, &arg, 1, 0);
+        sendEvent(gFlashGestureLockHandler, &arg, 1, 0);
     }
 }
 
@@ -5336,24 +6301,9 @@ bool BrowserAdapter::interactiveRectContainsPoint(const Point& pt)
     return ret;
 }
 
-bool BrowserAdapter::rectContainsPoint(RectMap &rectMap, const Point& pt)
+bool BrowserAdapter::rectContainsPoint(const RectIndex& rects, const Point& pt)
 {
-    if (rectMap.size() == 0) {
-        return false;
-    }
-
-    BrowserRect point(pt.x, pt.y, 1, 1);
-    for (RectMap::const_iterator i = rectMap.begin();
-            i != rectMap.end();
-            ++i)
-    {
-        BrowserRect r = i->second;
-
-        if (r.overlaps(point)) {
-            return true;
-        }
-    }
-    return false;
+    return rects.containsPoint(pt.x, pt.y);
 }
 
 const char* BrowserAdapter::js_saveImageAtPoint(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
@@ -5379,7 +6329,8 @@ const char* BrowserAdapter::js_saveImageAtPoint(AdapterBase *adapter, const NPVa
         int nQueryNum = proxy->mBsQueryNum++;
         SaveImageAtPointArgs*  callArgs = new SaveImageAtPointArgs(x, y,
                 NPVARIANT_TO_OBJECT(args[3]), nQueryNum);
-        proxy->m_saveImageAtPointArgs.add(callArgs);
+        proxy->m_pendingQueries.add(QuerySaveImageAtPoint, callArgs);
+        proxy->raiseResourcePeaks();
 
         x = (x + proxy->mScrollPos.x) / proxy->mZoomLevel;
         y = (y + proxy->mScrollPos.y) / proxy->mZoomLevel;
@@ -5397,7 +6348,7 @@ void
 BrowserAdapter::msgSaveImageAtPointResponse(int32_t queryNum, bool succeeded, const char* filepath)
 {
     TRACEF("SaveImageAtPointResponse: %c, '%s'", succeeded ? 'T' : 'F', filepath);
-    std::auto_ptr<SaveImageAtPointArgs> args(m_saveImageAtPointArgs.get(queryNum));
+    std::auto_ptr<SaveImageAtPointArgs> args(m_pendingQueries.takeAs<SaveImageAtPointArgs>(QuerySaveImageAtPoint, queryNum));
     if (!args.get()) {
         TRACEF("Can't find response for this call.");
         return;
@@ -5521,14 +6472,14 @@ BrowserAdapter::msgPluginFullscreenSpotlightCreate(int32_t spotlightHandle,
     DOUBLE_TO_NPVARIANT((double)rectY+rectHeight, args[3]);
     STRINGZ_TO_NPVARIANT("fullscreen", args[4]);
     BOOLEAN_TO_NPVARIANT(true, args[5]);
-    InvokeEventListener(gPluginSpotlightCreate, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gPluginSpotlightCreate, args, G_N_ELEMENTS(args), NULL);
 }
 
 void
 BrowserAdapter::msgPluginFullscreenSpotlightRemove()
 {
     NPVariant args[0];
-    InvokeEventListener(gPluginSpotlightRemove, args, G_N_ELEMENTS(args), NULL);
+    sendEvent(gPluginSpotlightRemove, args, G_N_ELEMENTS(args), NULL);
 }
 
 
@@ -5542,72 +6493,193 @@ BrowserAdapter::msgSpellingWidgetVisibleRectUpdate(int32_t rectX, int32_t rectY,
     DOUBLE_TO_NPVARIANT((double)rectY, args[1]);
     DOUBLE_TO_NPVARIANT((double)rectWidth, args[2]);
     DOUBLE_TO_NPVARIANT((double)rectHeight, args[3]);
-    InvokeEventListener(gMsgSpellingWidgetVisibleRectUpdate, args, G_N_ELEMENTS(args), NULL);
+    queueEvent(gMsgSpellingWidgetVisibleRectUpdate, args, G_N_ELEMENTS(args), EventBatcher::CoalesceHandler);
+}
+
+/**
+ * Hit test @a docPt and let the page owner handle the @a type event there, see
+ * fireHitTestEvent(). A recent result for the same point is used right away.
+ */
+void BrowserAdapter::sendHitTest(const char* type, const Point& docPt, int modifiers)
+{
+    const char* cached = m_hitTestCache.findHitTest(docPt.x, docPt.y);
+    if (cached) {
+        TRACEF("x: %d, y: %d, cached", docPt.x, docPt.y);
+        std::string json(cached); // the cache may change while the event is handled
+        fireHitTestEvent(type, docPt, modifiers, json.c_str());
+        return;
+    }
+
+    int q = mBsQueryNum++;
+    HitTestArgs *callArgs = new HitTestArgs(type, docPt, modifiers, q);
+    m_pendingQueries.add(QueryHitTest, callArgs);
+    raiseResourcePeaks();
+    TRACEF("x: %d, y: %d, q: %d", docPt.x, docPt.y, q);
+    asyncCmdHitTest(q, docPt.x, docPt.y);
 }
 
 void BrowserAdapter::msgHitTestResponse(int32_t queryNum,
                                         const char *hitTestResultJson)
 {
     TRACEF("json: %s", hitTestResultJson);
-    std::auto_ptr<HitTestArgs> args(m_hitTestArgs.get(queryNum));
+    std::auto_ptr<HitTestArgs> args(m_pendingQueries.takeAs<HitTestArgs>(QueryHitTest, queryNum));
     if ((args.get() != NULL)) {
-        NPVariant jsCallResult, jsCallArgs[2];
-        NPObject *event = NPN_CreateObject(&NPObjectEvent::sNPObjectEventClass);
-        if (event) {
-            NPObject *hitTest =
-                NPN_CreateObject(&JsonNPObject::sJsonNPObjectClass);
-            if (hitTest) {
-                OBJECT_TO_NPVARIANT(event, jsCallArgs[0]);
-                OBJECT_TO_NPVARIANT(hitTest, jsCallArgs[1]);
-
-                static_cast<NPObjectEvent*>(event)->initialize(args->m_type,
-                        args->m_pt.x * mZoomLevel - mScrollPos.x,
-                        args->m_pt.y * mZoomLevel - mScrollPos.y, args->m_modifiers);
-                static_cast<JsonNPObject *>(hitTest)->initialize(
-                    m_hitTestSchema, hitTestResultJson);
-
-                InvokeEventListener(gEventFiredHandler, jsCallArgs, 2,
-                                    &jsCallResult);
-                TRACEF("result %d %s", !VariantToBoolean(jsCallResult), args->m_type);
-                if (!VariantToBoolean(jsCallResult)) {
-                    if (!strcmp(args->m_type, "click")) {
-                        asyncCmdClickAt(args->m_pt.x, args->m_pt.y, 1, 1);
-                    } else if (!strcmp(args->m_type, "mousehold")) {
-                        m_didHold = true;
-                        asyncCmdHoldAt(args->m_pt.x, args->m_pt.y);
-                    }
+        m_hitTestCache.putHitTest(args->m_pt.x, args->m_pt.y, hitTestResultJson);
+        fireHitTestEvent(args->m_type, args->m_pt, args->m_modifiers, hitTestResultJson);
+    }
+}
+
+void BrowserAdapter::fireHitTestEvent(const char* type, const Point& docPt, int modifiers,
+                                      const char* hitTestResultJson)
+{
+    NPVariant jsCallResult, jsCallArgs[2];
+    NPObject *event = NPN_CreateObject(&NPObjectEvent::sNPObjectEventClass);
+    if (event) {
+        NPObject *hitTest =
+            NPN_CreateObject(&JsonNPObject::sJsonNPObjectClass);
+        if (hitTest) {
+            OBJECT_TO_NPVARIANT(event, jsCallArgs[0]);
+            OBJECT_TO_NPVARIANT(hitTest, jsCallArgs[1]);
+
+            static_cast<NPObjectEvent*>(event)->initialize(type,
+                    docPt.x * mZoomLevel - mScrollPos.x,
+                    docPt.y * mZoomLevel - mScrollPos.y, modifiers);
+            static_cast<JsonNPObject *>(hitTest)->initialize(
+                JsonSchemaRegistry::forServerMessage(JsonSchemaRegistry::SchemaHitTest), hitTestResultJson);
+
+            sendEvent(gEventFiredHandler, jsCallArgs, 2, &jsCallResult);
+            TRACEF("result %d %s", !VariantToBoolean(jsCallResult), type);
+            if (!VariantToBoolean(jsCallResult)) {
+                if (!strcmp(type, "click")) {
+                    asyncCmdClickAt(docPt.x, docPt.y, 1, 1);
+                    m_hitTestCache.dropHitTests();
+                } else if (!strcmp(type, "mousehold")) {
+                    m_didHold = true;
+                    asyncCmdHoldAt(docPt.x, docPt.y);
+                    m_hitTestCache.dropHitTests();
                 }
-
-                AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs[0]);
-                AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs[1]);
             }
+
+            AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs[0]);
+            AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs[1]);
         }
     }
-}
+}
+
+bool BrowserAdapter::shouldPassInputEvents()
+{
+    return m_passInputEvents
+           || (mContentWidth <= mViewportWidth
+               && mContentHeight <= mViewportHeight
+               && mMetaViewport && !mMetaViewport->userScalable);
+}
+
+// Touch events can be safely passed even if the content dimensions exceed the viewport dimensions
+bool BrowserAdapter::shouldPassTouchEvents()
+{
+    return m_passInputEvents || (mMetaViewport && !mMetaViewport->userScalable);
+}
+
+void BrowserAdapter::fireScrolledToEvent(int x, int y)
+{
+    if( gScrolledToHandler ) {
+        NPVariant args[2];
+        INT32_TO_NPVARIANT(x, args[0]);
+        INT32_TO_NPVARIANT(y, args[1]);
+        queueEvent(gScrolledToHandler, args, G_N_ELEMENTS(args), EventBatcher::CoalesceHandler);
+    }
+
+}
+
+/**
+ * Call the JS handler right away. Whatever is still queued goes first so
+ * handlers see events in the order BrowserServer sent them.
+ */
+bool BrowserAdapter::sendEvent(NPIdentifier handler, NPVariant* args, uint32_t argCount, NPVariant* result)
+{
+    m_eventBatcher.flush();
+    return InvokeEventListener(handler, args, argCount, result);
+}
+
+/**
+ * Call the JS handler once the current main loop iteration is over, see
+ * EventBatcher.
+ */
+void BrowserAdapter::queueEvent(NPIdentifier handler, NPVariant* args, uint32_t argCount,
+                                EventBatcher::Coalesce coalesce)
+{
+    m_eventBatcher.queue(handler, args, argCount, coalesce);
+}
+
+void BrowserAdapter::deliverEvent(NPIdentifier handler, NPVariant* args, uint32_t argCount)
+{
+    InvokeEventListener(handler, args, argCount, NULL);
+}
+
+void BrowserAdapter::deliverEventBatch(pbnjson::JValue& events)
+{
+    NPObject* batch = NPN_CreateObject(&JsonNPObject::sJsonNPObjectClass);
+    if (!batch) {
+        g_critical("%s: out of memory, dropping %d events", __FUNCTION__, (int) events.arraySize());
+        return;
+    }
+
+    static_cast<JsonNPObject*>(batch)->initialize(events);
+
+    NPVariant arg;
+    OBJECT_TO_NPVARIANT(batch, arg);
+    InvokeEventListener(gEventBatchHandler, &arg, 1, NULL);
+
+    NPN_ReleaseObject(batch);
+}
+
+void BrowserAdapter::thumbnailsReady(int batchId, const std::vector<ThumbnailResult>& results)
+{
+    std::map<int, NPObject*>::iterator it = mThumbnailCallbacks.find(batchId);
+    if (it == mThumbnailCallbacks.end())
+        return;
+
+    NPObject* callback = it->second;
+    mThumbnailCallbacks.erase(it);
+
+    pbnjson::JValue dom = pbnjson::Array();
+    for (size_t i = 0; i < results.size(); i++) {
+        pbnjson::JValue entry = pbnjson::Object();
+        entry.put("pageIdentifier", (int64_t) results[i].pageIdentifier);
+        entry.put("path", results[i].path);
+        entry.put("succeeded", results[i].succeeded);
+        dom.append(entry);
+    }
+
+    NPObject* thumbnails = NPN_CreateObject(&JsonNPObject::sJsonNPObjectClass);
+    if (thumbnails) {
+        static_cast<JsonNPObject*>(thumbnails)->initialize(dom);
+
+        NPVariant jsCallResult, jsCallArgs;
+        OBJECT_TO_NPVARIANT(thumbnails, jsCallArgs);
+        if (!NPN_InvokeDefault(callback, &jsCallArgs, 1, &jsCallResult))
+            TRACEF("generateThumbnails response call FAILED.");
+
+        AdapterBase::NPN_ReleaseVariantValue(&jsCallArgs);
+    }
+    else {
+        g_critical("%s: out of memory, dropping %d thumbnails", __FUNCTION__, (int) results.size());
+    }
 
-bool BrowserAdapter::shouldPassInputEvents()
-{
-    return m_passInputEvents
-           || (mContentWidth <= mViewportWidth
-               && mContentHeight <= mViewportHeight
-               && mMetaViewport && !mMetaViewport->userScalable);
+    AdapterBase::NPN_ReleaseObject(callback);
 }
 
-// Touch events can be safely passed even if the content dimensions exceed the viewport dimensions
-bool BrowserAdapter::shouldPassTouchEvents()
+std::string BrowserAdapter::eventName(NPIdentifier handler)
 {
-    return m_passInputEvents || (mMetaViewport && !mMetaViewport->userScalable);
-}
+    std::string name;
 
-void BrowserAdapter::fireScrolledToEvent(int x, int y)
-{
-    if( gScrolledToHandler ) {
-        NPVariant args[2];
-        INT32_TO_NPVARIANT(x, args[0]);
-        INT32_TO_NPVARIANT(y, args[1]);
-        InvokeEventListener(gScrolledToHandler, args, G_N_ELEMENTS(args), 0 );
+    NPUTF8* utf8 = NPN_UTF8FromIdentifier(handler);
+    if (utf8) {
+        name = utf8;
+        AdapterBase::NPN_MemFree(utf8);
     }
 
+    return name;
 }
 
 void BrowserAdapter::scrollTo(int x, int y)
@@ -5620,6 +6692,8 @@ void BrowserAdapter::scrollTo(int x, int y)
     mScrollPos.x = (mContentWidth > (int) mWindow.width) ? -x : 0;
     mScrollPos.y = -y;
 
+    noteActivity(false);
+
     asyncCmdSetScrollPosition(mScrollPos.x, mScrollPos.y,
                               mScrollPos.x + mWindow.width,
                               mScrollPos.y + mWindow.height);
@@ -5631,14 +6705,10 @@ void BrowserAdapter::scrollTo(int x, int y)
 gboolean BrowserAdapter::clickTimeoutCb(gpointer arg)
 {
     BrowserAdapter *a = (BrowserAdapter *)arg;
+    a->stopClickTimer();
     if (a->mBrowserServerConnected) {
-        int q = a->mBsQueryNum++;
-        HitTestArgs *callArgs = new HitTestArgs("click", a->m_clickPt, 0, q);
-        a->m_hitTestArgs.add(callArgs);
-        TRACEF("x: %d, y: %d, q: %d", a->m_clickPt.x, a->m_clickPt.y, q);
-        a->asyncCmdHitTest(q, a->m_clickPt.x, a->m_clickPt.y);
+        a->sendHitTest("click", a->m_clickPt, 0);
     }
-    a->stopClickTimer();
     return FALSE;
 }
 
@@ -5664,15 +6734,11 @@ void BrowserAdapter::stopClickTimer()
 gboolean BrowserAdapter::mouseHoldTimeoutCb(gpointer arg)
 {
     BrowserAdapter *a = (BrowserAdapter *)arg;
+    a->stopMouseHoldTimer();
     if (a->mBrowserServerConnected
             && !a->flashRectContainsPoint(a->m_penDownDoc)) {
-        int q = a->mBsQueryNum++;
-        HitTestArgs *callArgs = new HitTestArgs("mousehold", a->m_penDownDoc, 0, q);
-        a->m_hitTestArgs.add(callArgs);
-        TRACEF("x: %d, y: %d, q: %d", a->m_penDownDoc.x, a->m_penDownDoc.y, q);
-        a->asyncCmdHitTest(q, a->m_penDownDoc.x, a->m_penDownDoc.y);
+        a->sendHitTest("mousehold", a->m_penDownDoc, 0);
     }
-    a->stopMouseHoldTimer();
     return FALSE;
 }
 
@@ -5764,6 +6830,8 @@ void BrowserAdapter::stopZoomAnimation()
 
 void BrowserAdapter::msgUpdateScrollableLayers(const char* json)
 {
+    documentChanged();
+
 #ifdef FIXME_QT
     if (!json)
         return;
@@ -6081,3 +7149,531 @@ void BrowserAdapter::stoppedAnimating()
 {
     startFadeScrollbar();
 }
+
+void BrowserAdapter::handleAsyncMessage(YapPacket* msg)
+{
+    // Only queue it up when called on the reader thread, see IpcReceiver.h
+    if (mIpcReceiver && IpcReceiveThread::instance()->isCurrent()) {
+        mIpcReceiver->post(msg);
+        return;
+    }
+
+    if (mIpcTrace)
+        mIpcTrace->record(IpcTraceIncoming, msg);
+
+    BrowserClientExtensions::handleAsyncMessage(msg);
+}
+
+void BrowserAdapter::commandSent(YapPacket* cmd)
+{
+    if (mIpcTrace)
+        mIpcTrace->record(IpcTraceOutgoing, cmd);
+
+#ifdef BROWSER_SERVER_STUB
+    if (mServerStub)
+        mServerStub->handleCommand(cmd);
+#endif
+}
+
+void BrowserAdapter::replayRecord(IpcTraceDirection direction, uint8_t* data, uint32_t length)
+{
+    if (direction == IpcTraceOutgoing) {
+        // The stub's replies come back through stubMessage() like live ones
+#ifdef BROWSER_SERVER_STUB
+        if (mServerStub)
+            mServerStub->handleCommand(data, length);
+#endif
+        return;
+    }
+
+    // Bypass our own handleAsyncMessage so a replay is never re-recorded
+    YapPacket* packet = IpcTraceCreatePacket(data, length);
+    BrowserClientExtensions::handleAsyncMessage(packet);
+    delete packet;
+}
+
+void BrowserAdapter::replayFinished()
+{
+    g_message("%s: %p: replayed %u messages", __PRETTY_FUNCTION__, this,
+              mIpcTraceReplayer ? mIpcTraceReplayer->replayedCount() : 0);
+
+    delete mIpcTraceReplayer;
+    mIpcTraceReplayer = 0;
+}
+
+void BrowserAdapter::stubMessage(YapPacket* msg)
+{
+    handleAsyncMessage(msg);
+}
+
+void BrowserAdapter::stubDisconnected()
+{
+    serverDisconnected();
+}
+
+void BrowserAdapter::ipcMessageReceived(IpcMessage* msg)
+{
+    if (msg->type == IpcMessage::Disconnected) {
+        serverDisconnected();
+        return;
+    }
+
+    YapPacket* packet = IpcTraceCreatePacket(msg->data, msg->length);
+
+    mPreparsedJson = msg->hasJson ? &msg->json : 0;
+    handleAsyncMessage(packet);
+    mPreparsedJson = 0;
+
+    delete packet;
+}
+
+/**
+ * Start recording the BrowserServer traffic of this adapter.
+ *
+ * @param path The trace file to create. An existing file is overwritten.
+ */
+const char* BrowserAdapter::js_startIpcTrace(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount != 1 || !NPVARIANT_IS_STRING(args[0])) {
+        return "BrowserAdapter::startIpcTrace(path): Bad arguments.";
+    }
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+
+    char* path = NPStringToString(NPVARIANT_TO_STRING(args[0]));
+    if (!isSafeDir(path)) {
+        ::free(path);
+        return "BrowserAdapter::startIpcTrace(path): path must be in /var or /tmp.";
+    }
+
+    delete a->mIpcTrace;
+    a->mIpcTrace = IpcTraceRecorder::create(path);
+    ::free(path);
+
+    BOOLEAN_TO_NPVARIANT(a->mIpcTrace != NULL, *result);
+    return NULL;
+}
+
+const char* BrowserAdapter::js_stopIpcTrace(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+
+    delete a->mIpcTrace;
+    a->mIpcTrace = 0;
+
+    return NULL;
+}
+
+/**
+ * Feed the incoming messages of a trace file to this adapter, or its
+ * outgoing commands to the server stand-in (see BrowserServerStub.h).
+ *
+ * @param path The trace file to replay.
+ * @param maxSpeed (optional) Replay as fast as possible instead of with the original timing.
+ * @param outgoing (optional) Replay the commands instead of the messages.
+ */
+const char* BrowserAdapter::js_replayIpcTrace(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount < 1 || argCount > 3
+            || !NPVARIANT_IS_STRING(args[0])
+            || (argCount >= 2 && !IsBooleanVariant(args[1]))
+            || (argCount == 3 && !IsBooleanVariant(args[2]))) {
+        return "BrowserAdapter::replayIpcTrace(path, [maxSpeed], [outgoing]): Bad arguments.";
+    }
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+    if (a->mIpcTraceReplayer) {
+        return "BrowserAdapter::replayIpcTrace(): replay already in progress.";
+    }
+
+    bool outgoing = (argCount == 3) && VariantToBoolean(args[2]);
+    if (outgoing && !a->mServerStub) {
+        return "BrowserAdapter::replayIpcTrace(): replaying commands needs a SERVER_STUB=1 build and BROWSER_ADAPTER_SERVER_STUB.";
+    }
+
+    char* path = NPStringToString(NPVARIANT_TO_STRING(args[0]));
+    IpcTraceReader* reader = IpcTraceReader::open(path);
+    ::free(path);
+
+    if (!reader) {
+        return "BrowserAdapter::replayIpcTrace(): unable to open trace.";
+    }
+
+    bool maxSpeed = (argCount >= 2) && VariantToBoolean(args[1]);
+
+    a->mIpcTraceReplayer = new IpcTraceReplayer(reader,
+            outgoing ? IpcTraceOutgoing : IpcTraceIncoming, a,
+            g_main_loop_get_context(a->mMainLoop), maxSpeed);
+    a->mIpcTraceReplayer->start(); // may finish (and delete the replayer) right away
+
+    return NULL;
+}
+
+/**
+ * Reply latency of every kind of query sent to BrowserServer.
+ *
+ * @return an object with one {count, p50, p90, p99, max, pending, lost,
+ * unmatched, joined} object per query kind, durations in microseconds. Lost queries
+ * timed out or were dropped when the server went away.
+ */
+pbnjson::JValue BrowserAdapter::queryLatencyStats()
+{
+    // Indexed by QueryKind
+    static const char* const names[] = {
+        "inspectUrlAtPoint",
+        "getHistoryState",
+        "isEditing",
+        "getImageInfoAtPoint",
+        "isInteractiveAtPoint",
+        "saveImageAtPoint",
+        "getElementInfoAtPoint",
+        "copy",
+        "hitTest"
+    };
+
+    pbnjson::JValue stats = pbnjson::Object();
+
+    for (int kind = 0; kind < QueryKindCount; kind++) {
+        const LatencyHistogram& latency = m_pendingQueries.latency(kind);
+
+        pbnjson::JValue entry = pbnjson::Object();
+        entry.put("count", (int64_t) latency.count());
+        entry.put("p50", (int64_t) latency.percentile(50));
+        entry.put("p90", (int64_t) latency.percentile(90));
+        entry.put("p99", (int64_t) latency.percentile(99));
+        entry.put("max", (int64_t) latency.max());
+        entry.put("pending", (int64_t) m_pendingQueries.pendingCount(kind));
+        entry.put("lost", (int64_t) m_pendingQueries.lostCount(kind));
+        entry.put("unmatched", (int64_t) m_pendingQueries.unmatchedCount(kind));
+        entry.put("joined", (int64_t) m_pendingQueries.joinedCount(kind));
+
+        stats.put(names[kind], entry);
+    }
+
+    return stats;
+}
+
+void BrowserAdapter::dumpQueryLatencyStats()
+{
+    pbnjson::JValue stats = queryLatencyStats();
+
+    for (pbnjson::JValue::ObjectIterator it = stats.begin(); it != stats.end(); ++it) {
+        pbnjson::JValue entry = (*it).second;
+        if (!entry["count"].asNumber<int64_t>() && !entry["lost"].asNumber<int64_t>()
+            && !entry["pending"].asNumber<int64_t>())
+            continue;
+
+        g_message("%s: %s: %lld replies, p50 %lld us, p90 %lld us, p99 %lld us, max %lld us, %lld pending, %lld lost, %lld unmatched, %lld joined",
+                  __FUNCTION__, (*it).first.asString().c_str(),
+                  (long long) entry["count"].asNumber<int64_t>(),
+                  (long long) entry["p50"].asNumber<int64_t>(),
+                  (long long) entry["p90"].asNumber<int64_t>(),
+                  (long long) entry["p99"].asNumber<int64_t>(),
+                  (long long) entry["max"].asNumber<int64_t>(),
+                  (long long) entry["pending"].asNumber<int64_t>(),
+                  (long long) entry["lost"].asNumber<int64_t>(),
+                  (long long) entry["unmatched"].asNumber<int64_t>(),
+                  (long long) entry["joined"].asNumber<int64_t>());
+    }
+}
+
+/**
+ * Get the reply latency statistics of the queries sent to BrowserServer.
+ *
+ * @param log (optional) Also write the statistics to the log.
+ * @return an object keyed by query name, see queryLatencyStats().
+ */
+const char* BrowserAdapter::js_getQueryLatencyStats(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount > 1 || (argCount == 1 && !IsBooleanVariant(args[0]))) {
+        return "BrowserAdapter::getQueryLatencyStats([log]): Bad arguments.";
+    }
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+
+    if (argCount == 1 && VariantToBoolean(args[0])) {
+        a->dumpQueryLatencyStats();
+    }
+
+    NPObject* stats = a->NPN_CreateObject(&JsonNPObject::sJsonNPObjectClass);
+    if (!stats) {
+        return "BrowserAdapter::getQueryLatencyStats(): out of memory.";
+    }
+
+    pbnjson::JValue dom = a->queryLatencyStats();
+    static_cast<JsonNPObject*>(stats)->initialize(dom);
+    OBJECT_TO_NPVARIANT(stats, *result);
+
+    return NULL;
+}
+
+/**
+ * Get the allocation counts of the pooled NPObject classes, shared by all
+ * adapters in the process.
+ *
+ * @return an object keyed by class name with live, pooled, allocated and
+ *         reused counts. A live count that keeps growing is a leak.
+ */
+const char* BrowserAdapter::js_getObjectPoolStats(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount != 0) {
+        return "BrowserAdapter::getObjectPoolStats(): Bad arguments.";
+    }
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+
+    NPObject* stats = a->NPN_CreateObject(&JsonNPObject::sJsonNPObjectClass);
+    if (!stats) {
+        return "BrowserAdapter::getObjectPoolStats(): out of memory.";
+    }
+
+    pbnjson::JValue dom = pbnjson::Object();
+    for (NPObjectPoolBase* pool = NPObjectPoolBase::first(); pool; pool = pool->next()) {
+        pbnjson::JValue entry = pbnjson::Object();
+        entry.put("live", (int64_t) pool->live());
+        entry.put("pooled", (int64_t) pool->pooled());
+        entry.put("allocated", (int64_t) pool->allocated());
+        entry.put("reused", (int64_t) pool->reused());
+        dom.put(pool->name(), entry);
+    }
+
+    static_cast<JsonNPObject*>(stats)->initialize(dom);
+    OBJECT_TO_NPVARIANT(stats, *result);
+
+    return NULL;
+}
+
+/**
+ * Deliver the non-urgent notifications (load progress, title and url changes,
+ * scroll position, ...) gathered during a main loop iteration in a single
+ * eventBatch(events) call, events being an array of {type, args} objects in
+ * the order they happened. Off by default: every handler is called on its own.
+ *
+ * @param batching
+ */
+const char* BrowserAdapter::js_setEventBatching(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount != 1 || !IsBooleanVariant(args[0])) {
+        return "BrowserAdapter::setEventBatching(bool): Bad arguments.";
+    }
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+
+    // Whatever was queued under the previous mode is delivered that way
+    a->m_eventBatcher.flush();
+    a->m_eventBatcher.setBatching(VariantToBoolean(args[0]));
+
+    return NULL;
+}
+
+/**
+ * Limit how often a high frequency listener (scrolledTo, loadProgress,
+ * downloadProgress, pageDimensions, ...) is called. Updates in between are
+ * folded into the newest one, which is always delivered eventually, so the
+ * listener still sees the final state.
+ *
+ * @param name Listener name, e.g. "scrolledTo".
+ * @param maxPerSecond At most this many calls per second, 0 for no limit.
+ * @param minChange (optional) Skip updates whose numbers all moved by less
+ *        than this since the last call, the latest is still delivered once
+ *        updates settle.
+ *
+ * 0 for both restores immediate delivery. Listeners that report every
+ * occurrence (e.g. updateGlobalHistory) are never limited.
+ */
+const char* BrowserAdapter::js_setEventRateLimit(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount < 2 || argCount > 3
+        || !NPVARIANT_IS_STRING(args[0])
+        || !IsIntegerVariant(args[1])
+        || (argCount == 3 && !IsDoubleVariant(args[2]))) {
+        return "BrowserAdapter::setEventRateLimit(string, int, [double]): Bad arguments.";
+    }
+
+    int32_t maxPerSecond = VariantToInteger(args[1]);
+    double minChange = argCount == 3 ? VariantToDouble(args[2]) : 0;
+    if (maxPerSecond < 0 || minChange < 0) {
+        return "BrowserAdapter::setEventRateLimit(): Bad arguments.";
+    }
+
+    char* name = NPStringToString(NPVARIANT_TO_STRING(args[0]));
+    NPIdentifier handler = AdapterBase::NPN_GetStringIdentifier(name);
+    ::free(name);
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+
+    // Let anything held under the old policy go first
+    a->m_eventBatcher.flush();
+    a->m_eventBatcher.setPolicy(handler, maxPerSecond ? (1000 + maxPerSecond - 1) / maxPerSecond : 0, minChange);
+
+    return NULL;
+}
+
+/**
+ * Set how much memory all adapters in the process may keep for their pixels
+ * before the least recently used inactive ones are frozen, see
+ * BrowserAdapterManager.
+ *
+ * @param megabytes 0 freezes every inactive adapter.
+ */
+const char* BrowserAdapter::js_setMemoryBudget(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount != 1 || !IsIntegerVariant(args[0]) || VariantToInteger(args[0]) < 0) {
+        return "BrowserAdapter::setMemoryBudget(int): Bad arguments.";
+    }
+
+    BrowserAdapterManager::instance()->setMemoryBudget((size_t) VariantToInteger(args[0]) * 1024 * 1024);
+
+    return NULL;
+}
+
+/**
+ * Tell BrowserAdapterManager this card is likely the next one to be
+ * activated, so it thaws it ahead of time when idle.
+ *
+ * @param likely optional, false takes the hint back.
+ */
+const char* BrowserAdapter::js_hintActivation(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount > 1 || (argCount == 1 && !IsBooleanVariant(args[0]))) {
+        return "BrowserAdapter::hintActivation([boolean]): Bad arguments.";
+    }
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+    BrowserAdapterManager::instance()->hintActivation(a, argCount ? VariantToBoolean(args[0]) : true);
+
+    return NULL;
+}
+
+/**
+ * Show this card at low resolution and frame rate while it is not focused,
+ * see setBackgroundMode(). Activating the card leaves the mode.
+ */
+const char* BrowserAdapter::js_setBackgroundMode(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount != 1 || !IsBooleanVariant(args[0])) {
+        return "BrowserAdapter::setBackgroundMode(boolean): Bad arguments.";
+    }
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+    a->setBackgroundMode(VariantToBoolean(args[0]));
+
+    return NULL;
+}
+
+static void PrvPutResourceUsage(pbnjson::JValue& dom, const ResourceUsage& usage,
+                                const ResourceUsage& peak, size_t peakTotal)
+{
+    static const char* const kNames[] = {
+        "sharedMemory", "frozenSurface", "spilledSurface", "pendingQueries", "rects", "cachedObjects", "total"
+    };
+    size_t bytes[] = {
+        usage.sharedMemory, usage.frozenSurface, usage.spilledSurface, usage.pendingQueries, usage.rects,
+        usage.cachedObjects, usage.total()
+    };
+    size_t peaks[] = {
+        peak.sharedMemory, peak.frozenSurface, peak.spilledSurface, peak.pendingQueries, peak.rects,
+        peak.cachedObjects, peakTotal
+    };
+
+    for (size_t i = 0; i < G_N_ELEMENTS(kNames); i++) {
+        pbnjson::JValue entry = pbnjson::Object();
+        entry.put("bytes", (int64_t) bytes[i]);
+        entry.put("peak", (int64_t) peaks[i]);
+        dom.put(kNames[i], entry);
+    }
+}
+
+/**
+ * Bytes held by this adapter and by all adapters of the process, by
+ * category, with their high-water marks: {adapter: {sharedMemory:
+ * {bytes, peak}, frozenSurface, spilledSurface, pendingQueries, rects,
+ * cachedObjects, total}, all: {..., adapters, frozen, pressure: {some, full,
+ * cachesTrimmed, surfacesDropped, adaptersFrozen, offscreensDeleted,
+ * bytesFreed}}}. Cheap enough to poll every second.
+ */
+const char* BrowserAdapter::js_getResourceUsage(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount != 0) {
+        return "BrowserAdapter::getResourceUsage(): Bad arguments.";
+    }
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+
+    NPObject* usage = a->NPN_CreateObject(&JsonNPObject::sJsonNPObjectClass);
+    if (!usage) {
+        return "BrowserAdapter::getResourceUsage(): out of memory.";
+    }
+
+    BrowserAdapterManager* manager = BrowserAdapterManager::instance();
+
+    pbnjson::JValue mine = pbnjson::Object();
+    PrvPutResourceUsage(mine, a->resourceUsage(), a->resourceUsagePeak(), a->resourceUsagePeakTotal());
+
+    pbnjson::JValue all = pbnjson::Object();
+    PrvPutResourceUsage(all, manager->resourceUsage(), manager->resourceUsagePeak(), manager->resourceUsagePeakTotal());
+    all.put("adapters", (int64_t) manager->adapterCount());
+    all.put("frozen", (int64_t) manager->frozenAdapterCount());
+
+    const BrowserAdapterManager::PressureStats& stats = manager->pressureStats();
+    pbnjson::JValue pressure = pbnjson::Object();
+    pressure.put("some", (int64_t) stats.someEvents);
+    pressure.put("full", (int64_t) stats.fullEvents);
+    pressure.put("cachesTrimmed", (int64_t) stats.cachesTrimmed);
+    pressure.put("surfacesDropped", (int64_t) stats.surfacesDropped);
+    pressure.put("adaptersFrozen", (int64_t) stats.adaptersFrozen);
+    pressure.put("offscreensDeleted", (int64_t) stats.offscreensDeleted);
+    pressure.put("bytesFreed", (int64_t) stats.bytesFreed);
+    all.put("pressure", pressure);
+
+    pbnjson::JValue dom = pbnjson::Object();
+    dom.put("adapter", mine);
+    dom.put("all", all);
+
+    static_cast<JsonNPObject*>(usage)->initialize(dom);
+    OBJECT_TO_NPVARIANT(usage, *result);
+
+    return NULL;
+}
+
+/**
+ * Write a thumbnail of every card with a page identifier to
+ * directory/<pageIdentifier>.png, from the pixels it shows right now, and
+ * call back with an array of {pageIdentifier, path, succeeded} once all are
+ * written. Unlike saveViewToFile() nothing is rendered again by BrowserServer.
+ *
+ * @param directory Must be under /var or /tmp.
+ * @param width Bounds of the thumbnails, the aspect ratio is kept.
+ * @param height
+ * @param callback
+ *
+ * @return the batch id.
+ */
+const char* BrowserAdapter::js_generateThumbnails(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result)
+{
+    if (argCount != 4 || !NPVARIANT_IS_STRING(args[0]) || !IsIntegerVariant(args[1]) || !IsIntegerVariant(args[2])
+        || !NPVARIANT_IS_OBJECT(args[3]) || VariantToInteger(args[1]) <= 0 || VariantToInteger(args[2]) <= 0) {
+        return "BrowserAdapter::generateThumbnails(string, int, int, function): Bad arguments.";
+    }
+
+    char* directory = NPStringToString(NPVARIANT_TO_STRING(args[0]));
+    if (!isSafeDir(directory)) {
+        ::free(directory);
+        return "BrowserAdapter::generateThumbnails - Invalid directory";
+    }
+
+    ::g_mkdir_with_parents(directory, S_IRWXU);
+
+    BrowserAdapter *a = static_cast<BrowserAdapter*>(adapter);
+    int batchId = BrowserAdapterManager::instance()->generateThumbnails(directory,
+                  VariantToInteger(args[1]), VariantToInteger(args[2]), a);
+    ::free(directory);
+
+    NPObject* callback = NPVARIANT_TO_OBJECT(args[3]);
+    AdapterBase::NPN_RetainObject(callback);
+    a->mThumbnailCallbacks[batchId] = callback;
+
+    INT32_TO_NPVARIANT(batchId, *result);
+
+    return NULL;
+}
@@ -19,9 +19,20 @@ LICENSE@@@ */
 #ifndef BROWSERADAPTER_H
 #define BROWSERADAPTER_H
 
-#include "BrowserClientBase.h"
+#include "BrowserClientExtensions.h"
 #include "AdapterBase.h"
 #include "KineticScroller.h"
+#include "IpcTrace.h"
+#include "BrowserServerStub.h"
+#include "IpcReceiver.h"
+#include "PendingQueryTable.h"
+#include "HitTestCache.h"
+#include "RectIndex.h"
+#include "EventBatcher.h"
+#include "BulkChannel.h"
+#include "ResourceUsage.h"
+#include "ThumbnailGenerator.h"
+#include "FrozenSurfaceCache.h"
 
 #include <glib.h>
 #include <string>
@@ -58,19 +69,109 @@ struct BrowserMetaViewport;
  * The handle* methods are called by the browser via the AdapterBase::PrvNPP_HandleEvent
  * NPAPI plugin callback event handler.
  */
-class BrowserAdapter : public BrowserClientBase
+class BrowserAdapter : public BrowserClientExtensions
     , public AdapterBase
     , public KineticScrollerListener
+    , public IpcTraceReplayListener
+    , public BrowserServerStubClient
+    , public IpcReceiverListener
+    , public EventBatcherListener
+    , public ThumbnailListener
+    , public FrozenSurfaceCacheListener
 {
 public:
 
     BrowserAdapter(NPP instance, GMainContext *ctxt, int16_t argc, char* argn[], char* argv[]);
     virtual ~BrowserAdapter();
 
-    void freeze();
+    /**
+     * Stop BrowserServer painting and give back the offscreens. A scaled
+     * down copy of the page is kept to draw the card with, unless
+     * @a keepSurface is false, e.g. when memory is short and it would be
+     * dropped straight away.
+     */
+    void freeze(bool keepSurface = true);
     void thaw();
     bool isFrozen();
 
+    /**
+     * Keep showing a frozen adapter's page, rendered by BrowserServer at a
+     * fraction of the resolution and repainted at a low rate, e.g. for a card
+     * view thumbnail. Freezes the adapter if needed, thaw() leaves the mode.
+     *
+     * The mode starts once BrowserServer confirms it with
+     * BackgroundModeEntered. Until then, or if it never does, the adapter is
+     * simply frozen.
+     */
+    void setBackgroundMode(bool background);
+    bool isBackground() const {
+        return mBackgroundModeEntered;
+    }
+
+    /// Holds a background buffer, confirmed by BrowserServer or not
+    bool hasBackgroundOffscreen() const {
+        return mBackgroundOffscreen != 0;
+    }
+
+    /**
+     * After a quiet period without input, paints or scrolling BrowserServer
+     * is asked to paint over the offscreen on screen. The spare is given
+     * back once it confirms with SingleBufferChanged, with a server that does
+     * not both are kept. The next input restores double buffering.
+     */
+    bool isSingleBuffered() const {
+        return mSingleBuffered;
+    }
+
+    /**
+     * Bytes held for this adapter's pixels: offscreen buffers, frozen surface
+     * and bulk channel. A frozen surface spilled to the FrozenSurfaceCache
+     * is not counted, the kernel can reclaim it.
+     */
+    size_t memoryFootprint() const;
+
+    /**
+     * What this adapter holds right now. Also raises the high-water marks,
+     * which are raised as well whenever offscreens, frozen surfaces, pending
+     * queries or interactive rects are added.
+     */
+    ResourceUsage resourceUsage();
+
+    /**
+     * Forget what can be asked of BrowserServer again, e.g. hit test replies.
+     *
+     * @return bytes given back, roughly.
+     */
+    size_t trimCaches();
+
+    /**
+     * Drop the frozen surface, the card is drawn empty until thawed. Not in
+     * background mode, where the surface is repainted anyway.
+     *
+     * @return false if there was none to drop.
+     */
+    bool discardFrozenSurface();
+
+    /// High-water marks since the last connect to BrowserServer
+    const ResourceUsage& resourceUsagePeak() const {
+        return mResourcePeak;
+    }
+    size_t resourceUsagePeakTotal() const {
+        return mResourcePeakTotal;
+    }
+
+    int32_t pageIdentifier() const {
+        return mPageIdentifier;
+    }
+
+    /**
+     * Draw what this adapter shows right now, from its current offscreen or
+     * its frozen surface, into a new window sized @a image.
+     *
+     * @return false if there is nothing to show yet.
+     */
+    bool renderThumbnailSource(QImage& image);
+
     bool flashGestureLock() const {
         return mFlashGestureLock;
     }
@@ -147,6 +248,18 @@ public:
     static const char* js_handleFlick(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
     static const char* js_setVisibleSize(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
     static const char* js_setDNSServers(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_startIpcTrace(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_stopIpcTrace(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_replayIpcTrace(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_getQueryLatencyStats(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_getObjectPoolStats(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_setEventBatching(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_setEventRateLimit(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_setMemoryBudget(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_hintActivation(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_setBackgroundMode(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_getResourceUsage(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const char* js_generateThumbnails(AdapterBase *adapter, const NPVariant *args, uint32_t argCount, NPVariant *result);
     static const int kRecordBufferEmptyError = -10;
 
     static const int kExceptionMessageLength = 128;
@@ -183,6 +296,30 @@ protected:
     // BrowserClientBase overrides:
     virtual void serverConnected();
     virtual void serverDisconnected();
+    virtual void handleAsyncMessage(YapPacket* msg);
+    virtual void commandSent(YapPacket* cmd);
+
+    // IpcTraceReplayListener overrides:
+    virtual void replayRecord(IpcTraceDirection direction, uint8_t* data, uint32_t length);
+    virtual void replayFinished();
+
+    // BrowserServerStubClient overrides:
+    virtual void stubMessage(YapPacket* msg);
+    virtual void stubDisconnected();
+
+    // IpcReceiverListener overrides:
+    virtual void ipcMessageReceived(IpcMessage* msg);
+
+    // EventBatcherListener overrides:
+    virtual void deliverEvent(NPIdentifier handler, NPVariant* args, uint32_t argCount);
+    virtual void deliverEventBatch(pbnjson::JValue& events);
+    virtual std::string eventName(NPIdentifier handler);
+
+    // ThumbnailListener overrides:
+    virtual void thumbnailsReady(int batchId, const std::vector<ThumbnailResult>& results);
+
+    // FrozenSurfaceCacheListener overrides:
+    virtual void frozenSurfaceEvicted();
 
     // Async message handlers inherited from BrowserClientBase:
     virtual void msgPainted(int32_t sharedBufferKey);
@@ -246,6 +383,13 @@ protected:
     virtual void msgGetTextCaretBoundsResponse(int32_t queryNum, int32_t left, int32_t top, int32_t right, int32_t bottom);
     virtual void msgUpdateScrollableLayers(const char* json);
 
+    // Async message handlers inherited from BrowserClientExtensions:
+    virtual void msgBulkChannelAttached(int32_t key);
+    virtual void msgPopupMenuShowBulk(const char* identifier, int32_t menuDataPosition, int32_t menuDataLength);
+    virtual void msgFrozen();
+    virtual void msgBackgroundModeEntered(int32_t sharedBufferKey);
+    virtual void msgSingleBufferChanged(bool enabled, int32_t sharedBufferKey);
+
 private:
     /* TODO: We should get this from the webkit headers */
     enum InteractiveRectType {
@@ -275,10 +419,27 @@ private:
         int y;
     };
 
-    struct BrowserServerCallArgs {
-        BrowserServerCallArgs(int queryNum) : m_queryNum(queryNum) {}
-        virtual ~BrowserServerCallArgs() {}
-        int			m_queryNum;		///< The query number used to associate the reply with the correct call.
+    struct BrowserServerCallArgs : public PendingQuery {
+        BrowserServerCallArgs(int queryNum) : PendingQuery(queryNum), m_docX(0), m_docY(0) {}
+
+        int			m_docX;			///< Document point of a point query, see sendPointQuery().
+        int			m_docY;
+    };
+
+    /**
+     * The kinds of BrowserServerCallArgs waiting in m_pendingQueries.
+     */
+    enum QueryKind {
+        QueryInspectUrlAtPoint = 0,
+        QueryGetHistoryState,
+        QueryIsEditing,
+        QueryGetImageInfoAtPoint,
+        QueryIsInteractiveAtPoint,
+        QuerySaveImageAtPoint,
+        QueryGetElementInfoAtPoint,
+        QueryCopy,
+        QueryHitTest,
+        QueryKindCount
     };
 
     /**
@@ -387,50 +548,6 @@ private:
         bool show;
     };
 
-    /**
-     * A collection of arguments that have been used for a call into BrowserServer that we're waiting
-     * for a reply on.
-     */
-    template<typename T>
-    class ArgList
-    {
-    private:
-        typedef std::list<T*>  myArgList;
-    public:
-        ~ArgList() {
-            typename myArgList::const_iterator i;
-            for (i = m_args.begin(); i != m_args.end(); ++i) {
-                delete *i;
-            }
-        }
-
-        /**
-         * Add an argument object to this list. We now own the pointer.
-         */
-        void add(T* arg) {
-            m_args.push_back(arg);
-        }
-
-        /**
-         * Find an argument object whose query number matches the one provided.
-         * <strong>The caller now owns the argument object.</strong>
-         */
-        T* get(int queryNum) {
-            typename myArgList::iterator i;
-            for (i = m_args.begin(); i != m_args.end(); ++i) {
-                T* args = *i;
-                if (args->m_queryNum == queryNum) {
-                    m_args.erase(i);	// Caller now owns this pointer
-                    return args;
-                }
-            }
-            return NULL;	// Not found
-        };
-
-    private:
-        myArgList	m_args;
-    };
-
     KineticScroller* mScroller;
     QImage* mDirtyPattern;
 
@@ -493,16 +610,9 @@ private:
 
     int32_t         mPageIdentifier;
 
-    ArgList<InspectUrlAtPointArgs>	m_inspectUrlArgs;
-    ArgList<GetHistoryStateArgs>	m_historyStateArgs;
-    ArgList<IsEditingArgs>        	m_isEditingArgs;
-    ArgList<GetImageInfoAtPointArgs>m_getImageInfoAtPointArgs;
-    ArgList<IsInteractiveAtPointArgs>m_isInteractiveAtPointArgs;
-    ArgList<SaveImageAtPointArgs>	m_saveImageAtPointArgs;
-    ArgList<GetElementInfoAtPointArgs>	m_getElementInfoAtPointArgs;
-    ArgList<CopySuccessCallbackArgs> m_copySuccessCallbackArgs;
-    ArgList<HitTestArgs> m_hitTestArgs;
-    ArgList<GetTextCaretArgs> m_getTextCaretArgs;
+    PendingQueryTable m_pendingQueries;	///< Calls into BrowserServer waiting for a reply
+    uint32_t mDocGeneration;	///< Bumped by documentChanged()
+    HitTestCache m_hitTestCache;
 
     int				mBsQueryNum;
     bool            m_interrogateClicks;
@@ -519,12 +629,10 @@ private:
     Point mLastPointSentToFlash;
     bool mMouseInFlashRect;
     bool mFlashGestureLock;
-    typedef std::map<uintptr_t, BrowserRect> RectMap;
-    typedef std::pair<uintptr_t, BrowserRect> RectMapItem;
-    RectMap mFlashRects;
+    RectIndex mFlashRects;
 
     bool mMouseInInteractiveRect;
-    RectMap mDefaultInteractiveRects;
+    RectIndex mDefaultInteractiveRects;
 
     BrowserScrollableLayerMap mScrollableLayers;
     BrowserScrollableLayerScrollSession mScrollableLayerScrollSession;
@@ -538,12 +646,15 @@ private:
     int m_spotlightAlpha; // 0~ 255
     BrowserRect m_spotlightRect;
 
-    pbnjson::JSchemaFile m_hitTestSchema;
-
     bool init();
     bool initializeIpcBuffer();
     void setDefaultViewportSize();
     void sendStateToServer();
+    void attachBulkChannel();
+    void cancelBulkChannelAttach();
+    static gboolean bulkChannelAttachCb(gpointer data);
+    void sendHtml(const char* url, const char* body);
+    void showPopupMenu(const char* menuId, const char* menuData);
 
     // gesture handling
     void doGestureStart(int cx, int cy, float scale, float rotate, int center_x, int center_y);
@@ -580,11 +691,27 @@ private:
     void updateMouseInFlashStatus(bool inFlashRect);
     void updateFlashGestureLockStatus(bool gestureLockEnabled);
     bool flashRectContainsPoint(const Point& pt);
-    bool rectContainsPoint(RectMap &rectMap, const Point& pt);
+    bool rectContainsPoint(const RectIndex& rects, const Point& pt);
     void updateMouseInInteractiveStatus(bool inInteractiveRect);
     bool interactiveRectContainsPoint(const Point& pt);
     void jsonToRects(const char* rectsArrayJson);
 
+    void sendPointQuery(QueryKind kind, BrowserServerCallArgs* args, int docX, int docY);
+    void documentChanged();
+    bool cachedInteractiveAtPoint(const Point& docPt, bool& interactive);
+    void replyInteractiveAtPoint(IsInteractiveAtPointArgs* args, bool interactive);
+    void replyUrlAtPoint(InspectUrlAtPointArgs* args, const HitTestCache::CachedUrl& url);
+    void replyElementInfoAtPoint(GetElementInfoAtPointArgs* args, const HitTestCache::CachedElement& e);
+    void sendHitTest(const char* type, const Point& docPt, int modifiers);
+    void fireHitTestEvent(const char* type, const Point& docPt, int modifiers, const char* hitTestResultJson);
+
+    pbnjson::JValue queryLatencyStats();
+    void dumpQueryLatencyStats();
+
+    bool sendEvent(NPIdentifier handler, NPVariant* args, uint32_t argCount, NPVariant* result);
+    void queueEvent(NPIdentifier handler, NPVariant* args, uint32_t argCount,
+                    EventBatcher::Coalesce coalesce = EventBatcher::CoalesceNone);
+
     bool detectScrollableLayerUnderMouseDown(const Point& pagePt, const Point& mousePt);
     bool scrollLayerUnderMouse(const Point& currentMousePtDoc);
     void resetScrollableLayerScrollSession();
@@ -688,6 +815,53 @@ private:
     sem_t* m_bufferLock;
     char* m_bufferLockName;
 
+    IpcTraceRecorder* mIpcTrace;        ///< Records Yap traffic while set
+    IpcTraceReplayer* mIpcTraceReplayer; ///< Replays a trace into this adapter while set
+    BrowserServerStub* mServerStub;     ///< Stands in for BrowserServer while set
+    IpcReceiver* mIpcReceiver;          ///< Set if messages are received on the reader thread
+    const pbnjson::JValue* mPreparsedJson; ///< JSON argument of the message being handled, if parsed already
+    EventBatcher m_eventBatcher;        ///< Non-urgent JS notifications waiting for the end of the loop iteration
+    BulkChannel* mBulkChannel;          ///< Large payloads to and from BrowserServer, kept across reconnects
+    bool mBulkChannelAttached;          ///< BrowserServer acknowledged mBulkChannel on this connection
+    GSource* mBulkChannelAttachSource;  ///< Gives up on the acknowledgement, see attachBulkChannel()
+    BrowserOffscreen* mBackgroundOffscreen; ///< Low resolution buffer BrowserServer paints into in background mode
+    bool mBackgroundModeEntered;        ///< BrowserServer confirmed mBackgroundOffscreen
+    GSource* mBackgroundModeAckSource;  ///< Gives up on the confirmation, see setBackgroundMode()
+    GSource* mBackgroundInvalidateSource;
+    uint64_t mBackgroundInvalidateTime; ///< Last background repaint, see LatencyHistogram::now()
+    ResourceUsage mResourcePeak;        ///< See resourceUsagePeak()
+    size_t mResourcePeakTotal;
+    std::map<int, NPObject*> mThumbnailCallbacks;   ///< By batch id, see js_generateThumbnails()
+    bool mFrozenSurfaceSpilled;         ///< mFrozenSurface belongs to the FrozenSurfaceCache
+    guint mIdleTrimMs;                  ///< Quiet period before going single buffered, 0 for never
+    GSource* mIdleTrimSource;
+    uint64_t mLastActivityTime;         ///< Last input, paint or scroll, see LatencyHistogram::now()
+    bool mSingleBuffered;               ///< BrowserServer paints in place, see isSingleBuffered()
+    bool mSingleBufferRequested;        ///< Asked to, waiting for SingleBufferChanged
+    int mFreezeAcksPending;             ///< Freeze commands BrowserServer has not confirmed yet
+    GSource* mFreezeAckSource;          ///< Gives up on the confirmations, see freeze()
+
+    void noteActivity(bool input);
+    void scheduleIdleTrim(guint delayMs);
+    void cancelIdleTrim();
+    void trimSpareBuffer();
+    void restoreSpareBuffer();
+    static gboolean idleTrimCb(gpointer data);
+
+    void retireOffscreens();
+    void raiseResourcePeaks();
+    void cancelFreezeAck();
+    static gboolean freezeAckCb(gpointer data);
+
+    void spillFrozenSurface();
+    void dropFrozenSurface();
+
+    void leaveBackgroundMode();
+    void cancelBackgroundModeAck();
+    static gboolean backgroundModeAckCb(gpointer data);
+    void backgroundPainted();
+    static gboolean backgroundInvalidateCb(gpointer data);
+
     friend class BrowserAdapterData;
 };
 
@@ -16,9 +16,15 @@
 *
 LICENSE@@@ */
 
+#include <stdlib.h>
+
 #include "BrowserAdapterManager.h"
 
 #include "BrowserAdapter.h"
+#include "BrowserOffscreen.h"
+#include "FrozenSurfaceCache.h"
+#include "LatencyHistogram.h"
+#include "ThumbnailGenerator.h"
 
 BrowserAdapterManager* BrowserAdapterManager::instance()
 {
@@ -33,22 +39,456 @@ BrowserAdapterManager* BrowserAdapterManager::instance()
 
 BrowserAdapterManager::BrowserAdapterManager()
     : m_adapterList(0)
+    , m_budget(0)
+    , m_offscreenCount(0)
+    , m_maxOffscreens(0)
+    , m_ctxt(0)
+    , m_active(0)
+    , m_hint(0)
+    , m_prethawed(0)
+    , m_prethawSource(0)
+    , m_prethawCount(0)
+    , m_prethawHits(0)
+    , m_thumbnails(0)
+    , m_frozenSurfaceCache(0)
+    , m_pressureMonitor(0)
+    , m_fullPressureTime(0)
+    , m_resourcePeakTotal(0)
 {
+    const char* budget = getenv("BROWSER_ADAPTER_MEMORY_BUDGET_MB");
+    if (budget)
+        m_budget = (size_t) MAX(0, atoi(budget)) * 1024 * 1024;
+
+    const char* maxOffscreens = getenv("BROWSER_ADAPTER_MAX_OFFSCREENS");
+    if (maxOffscreens)
+        m_maxOffscreens = MAX(0, atoi(maxOffscreens));
+
+    m_frozenSurfaceCache = FrozenSurfaceCache::createFromEnvironment();
 }
 
 BrowserAdapterManager::~BrowserAdapterManager()
 {
+    cancelPrethaw();
+    delete m_pressureMonitor;
+    delete m_thumbnails;
+    delete m_frozenSurfaceCache;
     g_list_free(m_adapterList);
+
+    for (size_t i = 0; i < m_offscreenPool.size(); i++)
+        delete m_offscreenPool[i];
+    for (size_t i = 0; i < m_retiredOffscreens.size(); i++)
+        delete m_retiredOffscreens[i].second;
 }
 
-void BrowserAdapterManager::registerAdapter(BrowserAdapter* adapter)
+void BrowserAdapterManager::registerAdapter(BrowserAdapter* adapter, GMainContext* ctxt)
 {
     m_adapterList = g_list_prepend(m_adapterList, adapter);
+    m_ctxt = ctxt;
+
+    if (!m_pressureMonitor) {
+        const char* enabled = getenv("BROWSER_ADAPTER_MEMORY_PRESSURE");
+        if (!enabled || atoi(enabled) != 0)
+            m_pressureMonitor = new MemoryPressureMonitor(this, m_ctxt);
+    }
 }
 
 void BrowserAdapterManager::unregisterAdapter(BrowserAdapter* adapter)
 {
     m_adapterList = g_list_remove(m_adapterList, adapter);
+    m_warmFootprints.erase(adapter);
+
+    if (m_active == adapter) {
+        cancelPrethaw();
+        m_active = 0;
+    }
+    if (m_hint == adapter)
+        m_hint = 0;
+    if (m_prethawed == adapter)
+        m_prethawed = 0;
+
+    std::map<Transition, uint32_t>::iterator it = m_transitions.begin();
+    while (it != m_transitions.end()) {
+        if (it->first.first == adapter || it->first.second == adapter)
+            m_transitions.erase(it++);
+        else
+            ++it;
+    }
+}
+
+void BrowserAdapterManager::setMemoryBudget(size_t bytes)
+{
+    m_budget = bytes;
+
+    GList* head = g_list_first(m_adapterList);
+    if (head)
+        enforceBudget((BrowserAdapter*) head->data);
+}
+
+size_t BrowserAdapterManager::memoryUsed() const
+{
+    size_t used = 0;
+    for (GList* iter = g_list_first(m_adapterList); iter; iter = g_list_next(iter))
+        used += ((BrowserAdapter*) iter->data)->memoryFootprint();
+
+    for (size_t i = 0; i < m_offscreenPool.size(); i++)
+        used += m_offscreenPool[i]->size();
+
+    // Retired buffers are counted as what is left of them once BrowserServer
+    // lets go: the pool keeps a few, the rest are deleted
+    size_t kept = m_offscreenPool.size() < (size_t) kMaxPooledOffscreens
+                  ? kMaxPooledOffscreens - m_offscreenPool.size() : 0;
+    for (size_t i = 0; i < m_retiredOffscreens.size() && i < kept; i++)
+        used += m_retiredOffscreens[i].second->size();
+
+    return used;
+}
+
+ResourceUsage BrowserAdapterManager::resourceUsage()
+{
+    ResourceUsage usage;
+    for (GList* iter = g_list_first(m_adapterList); iter; iter = g_list_next(iter))
+        usage.add(((BrowserAdapter*) iter->data)->resourceUsage());
+
+    for (size_t i = 0; i < m_offscreenPool.size(); i++)
+        usage.sharedMemory += m_offscreenPool[i]->size();
+    for (size_t i = 0; i < m_retiredOffscreens.size(); i++)
+        usage.sharedMemory += m_retiredOffscreens[i].second->size();
+
+    m_resourcePeak.raiseTo(usage);
+    m_resourcePeakTotal = MAX(m_resourcePeakTotal, usage.total());
+
+    return usage;
+}
+
+int BrowserAdapterManager::generateThumbnails(const char* directory, int width, int height, ThumbnailListener* listener)
+{
+    if (!m_thumbnails)
+        m_thumbnails = new ThumbnailGenerator(m_ctxt);
+
+    int batchId = m_thumbnails->begin(listener);
+
+    // Most recently used first, the order card view usually shows them in
+    for (GList* iter = g_list_first(m_adapterList); iter; iter = g_list_next(iter)) {
+
+        BrowserAdapter* a = (BrowserAdapter*) iter->data;
+        if (a->pageIdentifier() < 0)
+            continue;
+
+        // Left null, and reported as failed, if there is nothing to show
+        QImage image;
+        a->renderThumbnailSource(image);
+
+        gchar* path = g_strdup_printf("%s/%d.png", directory, a->pageIdentifier());
+        m_thumbnails->add(a->pageIdentifier(), image, path, width, height);
+        g_free(path);
+    }
+
+    m_thumbnails->commit();
+
+    return batchId;
+}
+
+void BrowserAdapterManager::cancelThumbnails(ThumbnailListener* listener)
+{
+    if (m_thumbnails)
+        m_thumbnails->cancel(listener);
+}
+
+void BrowserAdapterManager::memoryPressure(MemoryPressure level)
+{
+    bool full = level == MemoryPressureFull;
+    size_t before = memoryUsed();
+
+    if (full) {
+        m_pressureStats.fullEvents++;
+        m_fullPressureTime = LatencyHistogram::now();
+        cancelPrethaw();
+        m_prethawed = 0;
+    }
+    else {
+        m_pressureStats.someEvents++;
+    }
+
+    int trimmed = 0;
+    int dropped = 0;
+    int frozen = 0;
+    int position = 0;
+    size_t cacheBytes = 0;
+
+    for (GList* iter = g_list_first(m_adapterList); iter; iter = g_list_next(iter), position++) {
+
+        BrowserAdapter* a = (BrowserAdapter*) iter->data;
+        if (a == m_active || (!full && position < kPressureKeptAdapters))
+            continue;
+
+        if (full && !a->isFrozen()) {
+            m_warmFootprints[a] = a->memoryFootprint();
+            a->freeze(false);
+            frozen++;
+        }
+
+        cacheBytes += a->trimCaches();
+        trimmed++;
+
+        if (a->discardFrozenSurface())
+            dropped++;
+    }
+
+    int deleted = deletePooledOffscreens();
+
+    // Offscreens and heap surfaces are in memoryUsed(), caches are not
+    size_t after = memoryUsed();
+    size_t freed = cacheBytes + (after < before ? before - after : 0);
+
+    m_pressureStats.cachesTrimmed += trimmed;
+    m_pressureStats.surfacesDropped += dropped;
+    m_pressureStats.adaptersFrozen += frozen;
+    m_pressureStats.offscreensDeleted += deleted;
+    m_pressureStats.bytesFreed += freed;
+
+    g_message("%s: %s: trimmed %d adapters, dropped %d frozen surfaces, froze %d adapters, "
+              "deleted %d offscreens, %lu KB freed, %lu KB still in use", __FUNCTION__,
+              full ? "full" : "some", trimmed, dropped, frozen, deleted,
+              (unsigned long) (freed / 1024), (unsigned long) (after / 1024));
+}
+
+/**
+ * @return how many were deleted.
+ */
+int BrowserAdapterManager::deletePooledOffscreens()
+{
+    int count = m_offscreenPool.size();
+    for (size_t i = 0; i < m_offscreenPool.size(); i++)
+        delete m_offscreenPool[i];
+
+    m_offscreenPool.clear();
+    m_offscreenCount -= count;
+
+    return count;
+}
+
+int BrowserAdapterManager::frozenAdapterCount() const
+{
+    int count = 0;
+    for (GList* iter = g_list_first(m_adapterList); iter; iter = g_list_next(iter)) {
+        if (((BrowserAdapter*) iter->data)->isFrozen())
+            count++;
+    }
+
+    return count;
+}
+
+BrowserOffscreen* BrowserAdapterManager::acquireOffscreen(BrowserAdapter* adapter, float scale)
+{
+    // Only full size buffers are pooled
+    bool pooled = scale == 1.0f;
+
+    // At the limit, take buffers away from whoever was used longest ago
+    while ((!pooled || m_offscreenPool.empty()) && m_maxOffscreens && m_offscreenCount >= m_maxOffscreens) {
+
+        // BrowserServer may still draw into a retired buffer, but not into a
+        // new one created in its place
+        if (!m_retiredOffscreens.empty()) {
+            discardOffscreen(m_retiredOffscreens.front().second);
+            m_retiredOffscreens.erase(m_retiredOffscreens.begin());
+            continue;
+        }
+
+        if (!m_offscreenPool.empty()) {
+            discardOffscreen(m_offscreenPool.back());
+            m_offscreenPool.pop_back();
+            continue;
+        }
+
+        if (!leaveBackgroundLeastRecentlyUsed(adapter) && !freezeLeastRecentlyUsed(adapter)) {
+            g_warning("%s: all %d offscreens are in use", __FUNCTION__, m_offscreenCount);
+            return 0;
+        }
+    }
+
+    if (pooled && !m_offscreenPool.empty()) {
+        BrowserOffscreen* offscreen = m_offscreenPool.back();
+        m_offscreenPool.pop_back();
+        return offscreen;
+    }
+
+    BrowserOffscreen* offscreen = BrowserOffscreen::create(scale);
+    if (offscreen)
+        m_offscreenCount++;
+
+    return offscreen;
+}
+
+void BrowserAdapterManager::releaseOffscreen(BrowserOffscreen* offscreen)
+{
+    if (!offscreen)
+        return;
+
+    if ((int) m_offscreenPool.size() >= kMaxPooledOffscreens) {
+        delete offscreen;
+        m_offscreenCount--;
+        return;
+    }
+
+    // The next owner must not see this adapter's render parameters or pixels
+    offscreen->resetBuffer();
+    offscreen->clear();
+    m_offscreenPool.push_back(offscreen);
+}
+
+void BrowserAdapterManager::discardOffscreen(BrowserOffscreen* offscreen)
+{
+    if (!offscreen)
+        return;
+
+    delete offscreen;
+    m_offscreenCount--;
+}
+
+void BrowserAdapterManager::retireOffscreen(BrowserAdapter* adapter, BrowserOffscreen* offscreen)
+{
+    if (offscreen)
+        m_retiredOffscreens.push_back(std::make_pair(adapter, offscreen));
+}
+
+void BrowserAdapterManager::offscreensDetached(BrowserAdapter* adapter)
+{
+    RetiredOffscreens::iterator it = m_retiredOffscreens.begin();
+    while (it != m_retiredOffscreens.end()) {
+        if (it->first == adapter) {
+            releaseOffscreen(it->second);
+            it = m_retiredOffscreens.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void BrowserAdapterManager::discardRetiredOffscreens(BrowserAdapter* adapter)
+{
+    RetiredOffscreens::iterator it = m_retiredOffscreens.begin();
+    while (it != m_retiredOffscreens.end()) {
+        if (it->first == adapter) {
+            discardOffscreen(it->second);
+            it = m_retiredOffscreens.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+BrowserOffscreen* BrowserAdapterManager::reclaimOffscreen(BrowserAdapter* adapter)
+{
+    for (RetiredOffscreens::iterator it = m_retiredOffscreens.begin(); it != m_retiredOffscreens.end(); ++it) {
+        if (it->first == adapter) {
+            BrowserOffscreen* offscreen = it->second;
+            m_retiredOffscreens.erase(it);
+            return offscreen;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @return false if there is no warm adapter but @a except.
+ */
+bool BrowserAdapterManager::freezeLeastRecentlyUsed(BrowserAdapter* except)
+{
+    for (GList* iter = g_list_last(m_adapterList); iter; iter = g_list_previous(iter)) {
+
+        BrowserAdapter* a = (BrowserAdapter*) iter->data;
+        if (a == except || a->isFrozen())
+            continue;
+
+        m_warmFootprints[a] = a->memoryFootprint();
+        a->freeze();
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Background buffers belong to frozen adapters, which
+ * freezeLeastRecentlyUsed() passes over.
+ *
+ * @return false if no adapter but @a except has one.
+ */
+bool BrowserAdapterManager::leaveBackgroundLeastRecentlyUsed(BrowserAdapter* except)
+{
+    for (GList* iter = g_list_last(m_adapterList); iter; iter = g_list_previous(iter)) {
+
+        BrowserAdapter* a = (BrowserAdapter*) iter->data;
+        if (a == except || !a->hasBackgroundOffscreen())
+            continue;
+
+        a->setBackgroundMode(false);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * What @a adapter needs once thawed, as far as we know. One that was never
+ * warm is assumed to need as much as the largest one seen, offscreen buffers
+ * are sized by the screen, not the page.
+ */
+size_t BrowserAdapterManager::warmFootprint(BrowserAdapter* adapter) const
+{
+    if (!adapter->isFrozen())
+        return adapter->memoryFootprint();
+
+    std::map<BrowserAdapter*, size_t>::const_iterator it = m_warmFootprints.find(adapter);
+    if (it != m_warmFootprints.end())
+        return it->second;
+
+    size_t largest = 0;
+    for (it = m_warmFootprints.begin(); it != m_warmFootprints.end(); ++it)
+        largest = MAX(largest, it->second);
+
+    for (GList* iter = g_list_first(m_adapterList); iter; iter = g_list_next(iter)) {
+        BrowserAdapter* a = (BrowserAdapter*) iter->data;
+        if (!a->isFrozen())
+            largest = MAX(largest, a->memoryFootprint());
+    }
+
+    return largest;
+}
+
+/**
+ * Freeze warm adapters, least recently used first, until everything fits
+ * the budget again, counting what @a active needs if it is still frozen.
+ */
+void BrowserAdapterManager::enforceBudget(BrowserAdapter* active)
+{
+    size_t pending = active->isFrozen() ? warmFootprint(active) : 0;
+
+    for (GList* iter = g_list_last(m_adapterList); iter; iter = g_list_previous(iter)) {
+
+        BrowserAdapter* a = (BrowserAdapter*) iter->data;
+        if (a == active || a->isFrozen())
+            continue;
+
+        // Without a budget the one thawed ahead of time is the only exception
+        if (!m_budget && a == m_prethawed)
+            continue;
+
+        if (m_budget) {
+            size_t used = memoryUsed() + pending;
+            if (used <= m_budget)
+                break;
+
+            g_message("%s: %lu KB in use, budget %lu KB, freezing %p", __FUNCTION__,
+                      (unsigned long) (used / 1024), (unsigned long) (m_budget / 1024), a);
+        }
+
+        m_warmFootprints[a] = a->memoryFootprint();
+        a->freeze();
+    }
 }
 
 void BrowserAdapterManager::adapterActivated(BrowserAdapter* adapter, bool activated)
@@ -62,17 +502,26 @@ void BrowserAdapterManager::adapterActivated(BrowserAdapter* adapter, bool activ
             m_adapterList = g_list_prepend(m_adapterList, adapter);
         }
 
-        // Freeze all the other adapters and thaw this one
-        for (GList* iter = g_list_first(m_adapterList); iter; iter = g_list_next(iter)) {
+        cancelPrethaw();
+
+        if (adapter != m_active) {
+            if (m_active)
+                m_transitions[Transition(m_active, adapter)]++;
 
-            BrowserAdapter* a = (BrowserAdapter*) iter->data;
-            if (a == adapter)
-                continue;
+            if (m_prethawed == adapter)
+                m_prethawHits++;
 
-            a->freeze();
+            // A wrong guess is now an ordinary inactive adapter
+            m_prethawed = 0;
+            m_hint = 0;
+            m_active = adapter;
         }
 
+        // Make room before thawing so we never go over the budget in between
+        enforceBudget(adapter);
         adapter->thaw();
+
+        schedulePrethaw();
     }
     /*
     // if we are really concerned about memory we should enable this
@@ -81,18 +530,134 @@ void BrowserAdapterManager::adapterActivated(BrowserAdapter* adapter, bool activ
     }
     */
 }
+
+/**
+ * Thaw the most recently used frozen adapters that fit the budget, without
+ * one only the most recent.
+ */
 void BrowserAdapterManager::inactiveAdaptersActivate()
 {
+    size_t used = memoryUsed();
 
     for (GList* iter = g_list_first(m_adapterList); iter; iter = g_list_next(iter)) {
 
         BrowserAdapter* a = (BrowserAdapter*) iter->data;
-        //thaw the first frozen adapter that is encountered
-        if(a->isFrozen()) {
+        if (!a->isFrozen())
+            continue;
 
+        if (!m_budget) {
+            //thaw the first frozen adapter that is encountered
             a->thaw();
             break;
         }
 
+        size_t needed = warmFootprint(a);
+        if (!needed || used + needed > m_budget)
+            continue;
+
+        a->thaw();
+        used = memoryUsed();
+    }
+}
+
+void BrowserAdapterManager::hintActivation(BrowserAdapter* adapter, bool likely)
+{
+    if (likely) {
+        m_hint = adapter;
+        if (adapter != m_active && adapter != m_prethawed)
+            schedulePrethaw();
+    }
+    else if (m_hint == adapter) {
+        m_hint = 0;
+    }
+}
+
+/**
+ * @return NULL if there is nothing to go by.
+ */
+BrowserAdapter* BrowserAdapterManager::predictNext(BrowserAdapter* active) const
+{
+    if (m_hint && m_hint != active)
+        return m_hint;
+
+    BrowserAdapter* best = 0;
+    uint32_t bestCount = 0;
+    for (std::map<Transition, uint32_t>::const_iterator it = m_transitions.begin(); it != m_transitions.end(); ++it) {
+        if (it->first.first == active && it->second > bestCount) {
+            best = it->first.second;
+            bestCount = it->second;
+        }
+    }
+    if (best)
+        return best;
+
+    // The list is in activation order, so the one after the head was active before
+    GList* head = g_list_first(m_adapterList);
+    if (head && head->data == active && g_list_next(head))
+        return (BrowserAdapter*) g_list_next(head)->data;
+
+    return 0;
+}
+
+void BrowserAdapterManager::schedulePrethaw()
+{
+    // Unbounded it would double what the active adapter holds
+    if (m_prethawSource || !m_active || (!m_budget && !m_maxOffscreens))
+        return;
+
+    m_prethawSource = g_timeout_source_new(kPrethawDelayMs);
+    g_source_set_priority(m_prethawSource, G_PRIORITY_LOW);
+    g_source_set_callback(m_prethawSource, prethawCb, this /*data*/, NULL);
+    g_source_attach(m_prethawSource, m_ctxt);
+}
+
+void BrowserAdapterManager::cancelPrethaw()
+{
+    if (m_prethawSource) {
+        g_source_destroy(m_prethawSource);
+        g_source_unref(m_prethawSource);
+        m_prethawSource = 0;
+    }
+}
+
+gboolean BrowserAdapterManager::prethawCb(gpointer data)
+{
+    BrowserAdapterManager* manager = (BrowserAdapterManager*) data;
+
+    g_source_unref(manager->m_prethawSource);
+    manager->m_prethawSource = 0;
+
+    // The budget may have been lifted since it was scheduled
+    if (!manager->m_budget && !manager->m_maxOffscreens)
+        return FALSE;
+
+    BrowserAdapter* next = manager->predictNext(manager->m_active);
+    if (!next || !next->isFrozen())
+        return FALSE;
+
+    // Whatever it would take was just given back
+    if (manager->m_fullPressureTime
+        && LatencyHistogram::now() - manager->m_fullPressureTime < (uint64_t) kPressureQuietMs * 1000)
+        return FALSE;
+
+    // Only into room we have, never at the expense of another adapter
+    if (manager->m_budget && manager->memoryUsed() + manager->warmFootprint(next) > manager->m_budget)
+        return FALSE;
+    if (manager->m_maxOffscreens && manager->m_offscreenPool.empty()
+        && manager->m_offscreenCount >= manager->m_maxOffscreens)
+        return FALSE;
+
+    // One adapter at a time is thawed ahead
+    if (manager->m_prethawed && manager->m_prethawed != next && !manager->m_prethawed->isFrozen()) {
+        manager->m_warmFootprints[manager->m_prethawed] = manager->m_prethawed->memoryFootprint();
+        manager->m_prethawed->freeze();
     }
+
+    g_message("%s: thawing %p ahead of activation", __FUNCTION__, next);
+
+    manager->m_prethawed = next;
+    manager->m_prethawCount++;
+    next->thaw();
+
+    return FALSE;
 }
@@ -20,28 +20,288 @@ LICENSE@@@ */
 #define BROWSERADAPTERMANAGER_H
 
 #include <glib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "ResourceUsage.h"
+#include "MemoryPressureMonitor.h"
+
+class FrozenSurfaceCache;
+class ThumbnailGenerator;
+class ThumbnailListener;
 
 class BrowserAdapter;
+class BrowserOffscreen;
 
-class BrowserAdapterManager
+/**
+ * Decides which adapters keep their offscreen buffers.
+ *
+ * Adapters are kept in most recently activated order. Without a memory
+ * budget only the active adapter stays warm and every other one is frozen.
+ * With one, the most recently used adapters stay warm as long as the memory
+ * of all adapters (see BrowserAdapter::memoryFootprint()) fits the budget,
+ * the least recently used are frozen first. The active adapter is never
+ * frozen, even if it alone exceeds the budget.
+ *
+ * The budget is set by BROWSER_ADAPTER_MEMORY_BUDGET_MB or setMemoryBudget().
+ *
+ * The manager also owns the offscreen buffers. A frozen or destroyed adapter
+ * gives its buffers back and the next adapter to thaw takes them over, so a
+ * card switch neither creates shared memory segments nor makes BrowserServer
+ * attach new ones. BROWSER_ADAPTER_MAX_OFFSCREENS caps the number of buffers
+ * in the process: once it is reached, the least recently used adapter in
+ * background mode gives up its background buffer, failing that the least
+ * recently used warm adapter is frozen to free its buffers.
+ *
+ * After an activation the manager guesses which adapter comes next and,
+ * once the main loop is idle, thaws it if it is frozen and fits the budget,
+ * so its page is rendered before the switch. The guess is, in that order:
+ * the adapter the application hinted at with hintActivation(), the one most
+ * often activated after the current one, the next one in the adapter list
+ * (the previously active one once every adapter has been activated). A wrong
+ * guess is undone like any other warm adapter: it is frozen by the next
+ * enforceBudget(), or without a budget as soon as another one is activated.
+ * This needs a memory budget or an offscreen cap to bound what it takes,
+ * without either nothing is thawed ahead.
+ *
+ * Under system memory pressure (see MemoryPressureMonitor) the manager gives
+ * memory back without waiting for a card to be closed. For "some" pressure
+ * the cards past the kPressureKeptAdapters most recently activated lose
+ * their caches and frozen surfaces and the offscreen pool is emptied. For
+ * "full" pressure every adapter but the active one is frozen and loses them,
+ * and nothing is thawed ahead of time for kPressureQuietMs. Setting
+ * BROWSER_ADAPTER_MEMORY_PRESSURE to 0 turns this off.
+ */
+class BrowserAdapterManager : public MemoryPressureListener
 {
 public:
 
+    /// What was done about memory pressure since the process started
+    struct PressureStats {
+        uint32_t someEvents;
+        uint32_t fullEvents;
+        uint32_t cachesTrimmed;         ///< Adapters whose caches were cleared
+        uint32_t surfacesDropped;
+        uint32_t adaptersFrozen;
+        uint32_t offscreensDeleted;
+        uint64_t bytesFreed;
+
+        PressureStats()
+            : someEvents(0)
+            , fullEvents(0)
+            , cachesTrimmed(0)
+            , surfacesDropped(0)
+            , adaptersFrozen(0)
+            , offscreensDeleted(0)
+            , bytesFreed(0)
+        {
+        }
+    };
+
     static BrowserAdapterManager* instance();
 
-    void registerAdapter(BrowserAdapter* adapter);
+    void registerAdapter(BrowserAdapter* adapter, GMainContext* ctxt);
     void unregisterAdapter(BrowserAdapter* adapter);
     void adapterActivated(BrowserAdapter* adapter, bool activated);
     void inactiveAdaptersActivate();
 
+    /**
+     * @param bytes 0 to freeze every inactive adapter.
+     */
+    void setMemoryBudget(size_t bytes);
+    size_t memoryBudget() const {
+        return m_budget;
+    }
+
+    /**
+     * Memory held by all adapters and the offscreen pool right now.
+     */
+    size_t memoryUsed() const;
+
+    /**
+     * An offscreen buffer for @a adapter, recycled if possible. Buffers
+     * scaled down by @a scale count against the limit like any other but
+     * are never pooled: give them back with discardOffscreen().
+     *
+     * @return NULL if no buffer can be created or freed up.
+     */
+    BrowserOffscreen* acquireOffscreen(BrowserAdapter* adapter, float scale = 1.0f);
+
+    /**
+     * Take back a buffer obtained with acquireOffscreen(). NULL is ignored.
+     */
+    void releaseOffscreen(BrowserOffscreen* offscreen);
+
+    /**
+     * Like releaseOffscreen() but the buffer is deleted rather than pooled,
+     * to give its memory back to the system.
+     */
+    void discardOffscreen(BrowserOffscreen* offscreen);
+
+    /**
+     * Take back a buffer @a adapter asked BrowserServer to stop drawing into.
+     * It is kept aside, not pooled, until offscreensDetached() confirms
+     * BrowserServer let go of it. NULL is ignored.
+     */
+    void retireOffscreen(BrowserAdapter* adapter, BrowserOffscreen* offscreen);
+
+    /**
+     * BrowserServer no longer draws into the buffers @a adapter retired,
+     * they can be cleared and pooled.
+     */
+    void offscreensDetached(BrowserAdapter* adapter);
+
+    /**
+     * Delete the buffers @a adapter retired, e.g. because BrowserServer never
+     * confirmed it let go of them.
+     */
+    void discardRetiredOffscreens(BrowserAdapter* adapter);
+
+    /**
+     * A buffer @a adapter retired and can use again as is, since it is still
+     * the only one BrowserServer draws into it for.
+     *
+     * @return NULL if there is none.
+     */
+    BrowserOffscreen* reclaimOffscreen(BrowserAdapter* adapter);
+
+    /**
+     * Tell the manager @a adapter is likely the next to be activated, e.g.
+     * the card next to the active one in the stack.
+     *
+     * @param likely false to take the hint back.
+     */
+    void hintActivation(BrowserAdapter* adapter, bool likely);
+
+    /// Adapters thawed ahead of time, and how many of them were activated next
+    uint32_t prethawCount() const {
+        return m_prethawCount;
+    }
+    uint32_t prethawHits() const {
+        return m_prethawHits;
+    }
+
+    /**
+     * What all adapters and the offscreen pool hold right now. Also raises
+     * the process wide high-water marks.
+     */
+    ResourceUsage resourceUsage();
+
+    /// High-water marks since the process started
+    const ResourceUsage& resourceUsagePeak() const {
+        return m_resourcePeak;
+    }
+    size_t resourceUsagePeakTotal() const {
+        return m_resourcePeakTotal;
+    }
+
+    /**
+     * Write a thumbnail of every adapter with a page identifier, from the
+     * pixels it shows right now, to @a directory/<pageIdentifier>.png. The
+     * pixels are copied here, scaling and encoding happen on worker threads.
+     *
+     * @return the batch id @a listener is called back with.
+     */
+    int generateThumbnails(const char* directory, int width, int height, ThumbnailListener* listener);
+
+    /**
+     * @a listener is going away, drop its pending thumbnail results.
+     */
+    void cancelThumbnails(ThumbnailListener* listener);
+
+    /**
+     * Where frozen adapters keep their snapshots, see FrozenSurfaceCache.
+     *
+     * @return NULL if frozen surfaces stay on the heap.
+     */
+    FrozenSurfaceCache* frozenSurfaceCache() const {
+        return m_frozenSurfaceCache;
+    }
+
+    // MemoryPressureListener overrides:
+    virtual void memoryPressure(MemoryPressure level);
+
+    const PressureStats& pressureStats() const {
+        return m_pressureStats;
+    }
+
+    int adapterCount() const {
+        return g_list_length(m_adapterList);
+    }
+    int frozenAdapterCount() const;
+
+    int offscreenCount() const {
+        return m_offscreenCount;
+    }
+    int pooledOffscreenCount() const {
+        return m_offscreenPool.size();
+    }
+
 private:
 
+    /// Enough for one adapter to thaw into what another one just gave back
+    static const int kMaxPooledOffscreens = 2;
+
+    /// Leave the active adapter's first paint alone before pre-thawing
+    static const guint kPrethawDelayMs = 500;
+
+    /// Keep the active and the previously active adapter through "some" pressure
+    static const int kPressureKeptAdapters = 2;
+
+    /// No pre-thawing this long after "full" pressure
+    static const uint32_t kPressureQuietMs = 30000;
+
     BrowserAdapterManager();
-    ~BrowserAdapterManager();
+    virtual ~BrowserAdapterManager();
+
+    size_t warmFootprint(BrowserAdapter* adapter) const;
+    void enforceBudget(BrowserAdapter* active);
+    bool freezeLeastRecentlyUsed(BrowserAdapter* except);
+    bool leaveBackgroundLeastRecentlyUsed(BrowserAdapter* except);
+    int deletePooledOffscreens();
+
+    BrowserAdapter* predictNext(BrowserAdapter* active) const;
+    void schedulePrethaw();
+    void cancelPrethaw();
+    static gboolean prethawCb(gpointer data);
 
 private:
 
-    GList* m_adapterList;
+    GList* m_adapterList;               ///< Most recently activated first
+    size_t m_budget;
+
+    /// Footprint of each adapter when last seen warm, to tell if a thaw fits
+    std::map<BrowserAdapter*, size_t> m_warmFootprints;
+
+    typedef std::vector<std::pair<BrowserAdapter*, BrowserOffscreen*> > RetiredOffscreens;
+
+    std::vector<BrowserOffscreen*> m_offscreenPool;
+    RetiredOffscreens m_retiredOffscreens;  ///< Oldest first, see retireOffscreen()
+    int m_offscreenCount;               ///< Created and not deleted, pooled, retired or not
+    int m_maxOffscreens;                ///< 0 for no limit
+
+    typedef std::pair<BrowserAdapter*, BrowserAdapter*> Transition;
+
+    GMainContext* m_ctxt;
+    BrowserAdapter* m_active;           ///< Last one activated
+    BrowserAdapter* m_hint;             ///< See hintActivation()
+    BrowserAdapter* m_prethawed;        ///< Thawed ahead of time, not activated yet
+    std::map<Transition, uint32_t> m_transitions;   ///< Activations of second right after first
+    GSource* m_prethawSource;
+    uint32_t m_prethawCount;
+    uint32_t m_prethawHits;
+
+    ThumbnailGenerator* m_thumbnails;   ///< Created on first use
+    FrozenSurfaceCache* m_frozenSurfaceCache;
+
+    MemoryPressureMonitor* m_pressureMonitor;   ///< Created with the first adapter
+    PressureStats m_pressureStats;
+    uint64_t m_fullPressureTime;        ///< See LatencyHistogram::now()
+
+    ResourceUsage m_resourcePeak;
+    size_t m_resourcePeakTotal;
 };
 
 
@@ -3,15 +3,15 @@
 #ifndef BROWSERCLIENTBASE_H
 #define BROWSERCLIENTBASE_H
 
-#include <YapClient.h>
+#include <YapClientHook.h>
 #include <YapPacket.h>
 
-class BrowserClientBase : public YapClient
+class BrowserClientBase : public YapClientHook
 {
 public:
 
-    BrowserClientBase(const char* name) : YapClient(name) {}
-    BrowserClientBase(const char* name, GMainContext *ctxt) : YapClient(name, ctxt) {}
+    BrowserClientBase(const char* name) : YapClientHook(name) {}
+    BrowserClientBase(const char* name, GMainContext *ctxt) : YapClientHook(name, ctxt) {}
     virtual ~BrowserClientBase() {}
 
 
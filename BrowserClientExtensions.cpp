@@ -0,0 +1,142 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <stdlib.h>
+#include <glib.h>
+
+#include <YapPacket.h>
+
+#include "BrowserClientExtensions.h"
+#include "IpcTrace.h"
+
+void BrowserClientExtensions::asyncCmdAttachBulkChannel(int32_t key, int32_t size)
+{
+    YapPacket* _cmd = packetCommand();
+    (*_cmd) << (int16_t) 0x1511; // AttachBulkChannel
+    (*_cmd) << key;
+    (*_cmd) << size;
+    sendAsyncCommand();
+}
+
+void BrowserClientExtensions::asyncCmdSetHtmlBulk(const char* url, int32_t bodyPosition, int32_t bodyLength)
+{
+    YapPacket* _cmd = packetCommand();
+    (*_cmd) << (int16_t) 0x1512; // SetHtmlBulk
+    (*_cmd) << url;
+    (*_cmd) << bodyPosition;
+    (*_cmd) << bodyLength;
+    sendAsyncCommand();
+}
+
+void BrowserClientExtensions::asyncCmdSetBackgroundMode(bool enabled, int32_t sharedBufferKey, int32_t sharedBufferSize, int32_t scalePercent, int32_t paintIntervalMs)
+{
+    YapPacket* _cmd = packetCommand();
+    (*_cmd) << (int16_t) 0x1513; // SetBackgroundMode
+    (*_cmd) << enabled;
+    (*_cmd) << sharedBufferKey;
+    (*_cmd) << sharedBufferSize;
+    (*_cmd) << scalePercent;
+    (*_cmd) << paintIntervalMs;
+    sendAsyncCommand();
+}
+
+void BrowserClientExtensions::asyncCmdSetSingleBuffer(bool enabled, int32_t sharedBufferKey, int32_t sharedBufferSize)
+{
+    YapPacket* _cmd = packetCommand();
+    (*_cmd) << (int16_t) 0x1514; // SetSingleBuffer
+    (*_cmd) << enabled;
+    (*_cmd) << sharedBufferKey;
+    (*_cmd) << sharedBufferSize;
+    sendAsyncCommand();
+}
+
+void BrowserClientExtensions::handleAsyncMessage(YapPacket* msg)
+{
+    // The id is read from a copy so that msg reaches BrowserClientBase unread
+    const uint8_t* bytes = 0;
+    uint32_t length = 0;
+    if (!IpcTracePacketBytes(msg, bytes, length)) {
+        BrowserClientBase::handleAsyncMessage(msg);
+        return;
+    }
+
+    YapPacket* _msg = IpcTraceCreatePacket((uint8_t*) bytes, length);
+    int16_t msgValue = 0;
+    bool handled = true;
+
+    (*_msg) >> msgValue;
+
+    switch (msgValue) {
+    case 0x203c: { // BulkChannelAttached
+
+        int32_t key = 0;
+
+        (*_msg) >> key;
+
+        msgBulkChannelAttached(key);
+        break;
+    }
+    case 0x203d: { // PopupMenuShowBulk
+
+        char* identifier = 0;
+        int32_t menuDataPosition = 0;
+        int32_t menuDataLength = 0;
+
+        (*_msg) >> identifier;
+        (*_msg) >> menuDataPosition;
+        (*_msg) >> menuDataLength;
+
+        msgPopupMenuShowBulk(identifier, menuDataPosition, menuDataLength);
+        free(identifier);
+        break;
+    }
+    case 0x203f: { // Frozen
+
+        msgFrozen();
+        break;
+    }
+    case 0x2040: { // BackgroundModeEntered
+
+        int32_t sharedBufferKey = 0;
+
+        (*_msg) >> sharedBufferKey;
+
+        msgBackgroundModeEntered(sharedBufferKey);
+        break;
+    }
+    case 0x2041: { // SingleBufferChanged
+
+        bool enabled = 0;
+        int32_t sharedBufferKey = 0;
+
+        (*_msg) >> enabled;
+        (*_msg) >> sharedBufferKey;
+
+        msgSingleBufferChanged(enabled, sharedBufferKey);
+        break;
+    }
+    default:
+        handled = false;
+        break;
+    }
+
+    delete _msg;
+
+    if (!handled)
+        BrowserClientBase::handleAsyncMessage(msg);
+}
@@ -0,0 +1,59 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef BROWSERCLIENTEXTENSIONS_H
+#define BROWSERCLIENTEXTENSIONS_H
+
+#include "BrowserClientBase.h"
+
+/**
+ * Commands and messages added to the BrowserServer protocol since
+ * BrowserClientBase was last generated. Written like the generated ones so
+ * they can move to the YapCodeGen template unchanged.
+ *
+ * Messages with an id handled here never reach BrowserClientBase, all others
+ * are passed on untouched.
+ */
+class BrowserClientExtensions : public BrowserClientBase
+{
+public:
+
+    BrowserClientExtensions(const char* name) : BrowserClientBase(name) {}
+    BrowserClientExtensions(const char* name, GMainContext *ctxt) : BrowserClientBase(name, ctxt) {}
+    virtual ~BrowserClientExtensions() {}
+
+    // Async commands
+    void asyncCmdAttachBulkChannel(int32_t key, int32_t size);
+    void asyncCmdSetHtmlBulk(const char* url, int32_t bodyPosition, int32_t bodyLength);
+    void asyncCmdSetBackgroundMode(bool enabled, int32_t sharedBufferKey, int32_t sharedBufferSize, int32_t scalePercent, int32_t paintIntervalMs);
+    void asyncCmdSetSingleBuffer(bool enabled, int32_t sharedBufferKey, int32_t sharedBufferSize);
+
+protected:
+
+    // Async messages
+    virtual void msgBulkChannelAttached(int32_t key) = 0;
+    virtual void msgPopupMenuShowBulk(const char* identifier, int32_t menuDataPosition, int32_t menuDataLength) = 0;
+    virtual void msgFrozen() = 0;
+    virtual void msgBackgroundModeEntered(int32_t sharedBufferKey) = 0;
+    virtual void msgSingleBufferChanged(bool enabled, int32_t sharedBufferKey) = 0;
+
+    // Overriden functions
+    virtual void handleAsyncMessage(YapPacket* msg);
+};
+
+#endif /* BROWSERCLIENTEXTENSIONS_H */
@@ -71,7 +71,7 @@ static inline bool PrvIsEqual(double a, double b)
     return (fabs(a-b) < kDoubleZeroTolerance);
 }
 
-BrowserOffscreen* BrowserOffscreen::create()
+BrowserOffscreen* BrowserOffscreen::create(float scale)
 {
     int screenWidth, screenHeight;
     if (!PrvGetScreenDimensions(screenWidth, screenHeight)) {
@@ -82,7 +82,8 @@ BrowserOffscreen* BrowserOffscreen::create()
     int bufferSize = screenWidth *
                      screenHeight *
                      sizeof(unsigned int) *
-                     kOffscreenSizeAsScreenSizeMultiplier;
+                     kOffscreenSizeAsScreenSizeMultiplier *
+                     scale * scale;
 
     IpcBuffer* buffer = IpcBuffer::create(bufferSize + sizeof(BrowserOffscreenInfo));
     if (!buffer) {
@@ -30,7 +30,11 @@ class BrowserOffscreen
 {
 public:
 
-    static BrowserOffscreen* create();
+    /**
+     * @param scale of the screen the buffer has room for, e.g. 0.5f for a
+     *        buffer rendered at half the resolution.
+     */
+    static BrowserOffscreen* create(float scale = 1.0f);
     static BrowserOffscreen* attach(int key, int size);
     ~BrowserOffscreen();
 
@@ -60,10 +64,15 @@ public:
     }
     int rasterSize() const;
 
+    /**
+     * Forget what was rendered, e.g. before handing the buffer to another
+     * adapter. The pixels are left alone.
+     */
+    void resetBuffer();
+
 private:
 
     BrowserOffscreen(IpcBuffer* buffer);
-    void resetBuffer();
 
     IpcBuffer* m_ipcBuffer;
     unsigned char* m_buffer;
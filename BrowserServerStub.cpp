@@ -0,0 +1,1024 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include <YapPacket.h>
+#include <QImage>
+#include <QPainter>
+#include <QLinearGradient>
+
+#include "BrowserServerStub.h"
+#include "BrowserOffscreen.h"
+#include "BulkChannel.h"
+#include "IpcTrace.h"
+#include "Debug.h"
+
+// Commands we react to, see BrowserClientBase.cpp
+static const int16_t kCmdConnect = 0x1000;
+static const int16_t kCmdSetWindowSize = 0x1001;
+static const int16_t kCmdOpenUrl = 0x1004;
+static const int16_t kCmdSetHtml = 0x1005;
+static const int16_t kCmdReload = 0x100C;
+static const int16_t kCmdStop = 0x100D;
+static const int16_t kCmdExit = 0x1011;
+static const int16_t kCmdDisconnect = 0x110E;
+static const int16_t kCmdGetHistoryState = 0x1111;
+static const int16_t kCmdIsEditing = 0x1117;
+static const int16_t kCmdIsInteractiveAtPoint = 0x111D;
+static const int16_t kCmdCopy = 0x1120;
+static const int16_t kCmdSetScrollPosition = 0x1500;
+static const int16_t kCmdSetVirtualWindowSize = 0x1506;
+static const int16_t kCmdGetTextCaretBounds = 0x150a;
+static const int16_t kCmdFreeze = 0x150b;
+static const int16_t kCmdThaw = 0x150c;
+static const int16_t kCmdReturnBuffer = 0x150d;
+static const int16_t kCmdSetZoomAndScroll = 0x150e;
+static const int16_t kCmdAttachBulkChannel = 0x1511;
+static const int16_t kCmdSetHtmlBulk = 0x1512;
+static const int16_t kCmdSetBackgroundMode = 0x1513;
+static const int16_t kCmdSetSingleBuffer = 0x1514;
+
+// Messages we send, see BrowserClientBase::handleAsyncMessage()
+static const int16_t kMsgPainted = 0x2000;
+static const int16_t kMsgContentsSizeChanged = 0x2002;
+static const int16_t kMsgScrolledTo = 0x2004;
+static const int16_t kMsgLoadStarted = 0x2005;
+static const int16_t kMsgLoadStopped = 0x2006;
+static const int16_t kMsgLoadProgress = 0x2007;
+static const int16_t kMsgLocationChanged = 0x2008;
+static const int16_t kMsgTitleChanged = 0x2009;
+static const int16_t kMsgDidFinishDocumentLoad = 0x201E;
+static const int16_t kMsgGetHistoryStateResponse = 0x2024;
+static const int16_t kMsgIsEditing = 0x2029;
+static const int16_t kMsgIsInteractiveAtPointResponse = 0x202D;
+static const int16_t kMsgCopySuccessResponse = 0x2032;
+static const int16_t kMsgAddFlashRects = 0x2037;
+static const int16_t kMsgRemoveFlashRects = 0x2038;
+static const int16_t kMsgGetTextCaretBoundsResponse = 0x203a;
+static const int16_t kMsgUpdateScrollableLayers = 0x203b;
+static const int16_t kMsgBulkChannelAttached = 0x203c;
+static const int16_t kMsgPopupMenuShowBulk = 0x203d;
+static const int16_t kMsgFrozen = 0x203f;
+static const int16_t kMsgBackgroundModeEntered = 0x2040;
+static const int16_t kMsgSingleBufferChanged = 0x2041;
+
+// Room for the message id, numeric arguments and string framing
+static const uint32_t kMessageOverhead = 256;
+
+// Used until the script reports a contents size
+static const int32_t kDefaultContentWidth = 1024;
+static const int32_t kDefaultContentHeight = 4096;
+
+// Synthetic page layout, in document pixels
+static const int kMargin = 16;
+static const int kLineHeight = 20;
+static const int kGlyphHeight = 10;
+
+// Run when no script file is given: a plain page load
+static const char* kDefaultScript[] = {
+    "loadStarted",
+    "progress 10",
+    "delay 50",
+    "location",
+    "contentsSize 1024 4096",
+    "progress 50",
+    "delay 50",
+    "title",
+    "documentLoaded",
+    "progress 100",
+    "loadStopped",
+    NULL
+};
+
+/**
+ * A message under construction, sized for @a payload bytes of strings.
+ */
+class PrvMessage
+{
+public:
+
+    PrvMessage(int16_t msgId, uint32_t payload = 0)
+        : m_buffer(kMessageOverhead + payload)
+        , m_packet(IpcTraceCreateWritePacket(&m_buffer[0], m_buffer.size()))
+    {
+        (*m_packet) << msgId;
+    }
+    ~PrvMessage() {
+        delete m_packet;
+    }
+
+    YapPacket& operator*() {
+        return *m_packet;
+    }
+    YapPacket* packet() {
+        return m_packet;
+    }
+
+private:
+
+    std::vector<uint8_t> m_buffer;
+    YapPacket* m_packet;
+};
+
+static inline uint32_t PrvHash(uint32_t a, uint32_t b)
+{
+    uint32_t h = a * 2654435761u ^ (b + 0x9e3779b9 + (a << 6) + (a >> 2));
+    return h ^ (h >> 15);
+}
+
+BrowserServerStub* BrowserServerStub::createFromEnvironment(BrowserServerStubClient* client, GMainContext* ctxt)
+{
+    const char* script = getenv("BROWSER_ADAPTER_SERVER_STUB");
+    if (!script)
+        return 0;
+
+    if (!script[0] || !strcmp(script, "1"))
+        script = 0;
+
+    int latencyMs = 0;
+    const char* latency = getenv("BROWSER_ADAPTER_SERVER_STUB_LATENCY");
+    if (latency)
+        latencyMs = MAX(0, atoi(latency));
+
+    return new BrowserServerStub(client, ctxt, script, latencyMs);
+}
+
+BrowserServerStub::BrowserServerStub(BrowserServerStubClient* client, GMainContext* ctxt,
+                                     const char* scriptPath, int latencyMs)
+    : m_client(client)
+    , m_glibCtxt(ctxt)
+    , m_latencyMs(latencyMs)
+    , m_connected(false)
+    , m_deliverySource(0)
+    , m_paintSource(0)
+    , m_paintPending(false)
+    , m_bulkChannel(0)
+    , m_backgroundScale(0)
+    , m_backgroundIntervalMs(0)
+    , m_singleBuffer(false)
+    , m_pageIdentifier(-1)
+    , m_windowWidth(0)
+    , m_windowHeight(0)
+    , m_contentWidth(0)
+    , m_contentHeight(0)
+    , m_scrollX(0)
+    , m_scrollY(0)
+    , m_zoom(1.0)
+    , m_frame(0)
+    , m_commandCount(0)
+    , m_messageCount(0)
+    , m_paintCount(0)
+    , m_paintTime(0)
+    , m_bufferReturnCount(0)
+    , m_bufferReturnTime(0)
+    , m_bufferReturnMax(0)
+{
+    m_offscreens[0] = m_offscreens[1] = 0;
+    m_bufferBusy[0] = m_bufferBusy[1] = false;
+    m_bufferSentTime[0] = m_bufferSentTime[1] = 0;
+
+    if (scriptPath)
+        loadScript(scriptPath);
+
+    if (m_script.empty()) {
+        for (int i = 0; kDefaultScript[i]; i++)
+            parseScriptLine(kDefaultScript[i]);
+    }
+
+    g_message("BrowserServer stub: %u script directives, %d ms latency",
+              (unsigned) m_script.size(), m_latencyMs);
+}
+
+BrowserServerStub::~BrowserServerStub()
+{
+    disconnect();
+}
+
+bool BrowserServerStub::connect()
+{
+    m_connected = true;
+    return true;
+}
+
+void BrowserServerStub::disconnect()
+{
+    if (m_deliverySource) {
+        g_source_destroy(m_deliverySource);
+        g_source_unref(m_deliverySource);
+        m_deliverySource = 0;
+    }
+
+    if (m_paintSource) {
+        g_source_destroy(m_paintSource);
+        g_source_unref(m_paintSource);
+        m_paintSource = 0;
+    }
+
+    m_queue.clear();
+    detachBuffers();
+
+    delete m_bulkChannel;
+    m_bulkChannel = 0;
+
+    if (m_connected)
+        dumpStats();
+
+    m_connected = false;
+}
+
+void BrowserServerStub::dumpStats()
+{
+    g_message("BrowserServer stub: %u commands, %u messages, %u paints (avg %llu us), "
+              "buffer turnaround avg %llu us max %llu us",
+              m_commandCount, m_messageCount, m_paintCount,
+              (unsigned long long) (m_paintCount ? m_paintTime / m_paintCount : 0),
+              (unsigned long long) (m_bufferReturnCount ? m_bufferReturnTime / m_bufferReturnCount : 0),
+              (unsigned long long) m_bufferReturnMax);
+}
+
+void BrowserServerStub::loadScript(const char* path)
+{
+    FILE* file = ::fopen(path, "r");
+    if (!file) {
+        g_warning("Unable to open BrowserServer stub script %s", path);
+        return;
+    }
+
+    char line[4096];
+    while (::fgets(line, sizeof(line), file))
+        parseScriptLine(line);
+
+    ::fclose(file);
+}
+
+void BrowserServerStub::parseScriptLine(const char* line)
+{
+    while (*line == ' ' || *line == '\t')
+        line++;
+
+    if (!*line || *line == '#' || *line == '\n')
+        return;
+
+    const char* end = line + strcspn(line, " \t\r\n");
+
+    Directive d;
+    d.name.assign(line, end - line);
+
+    end += strspn(end, " \t");
+    d.arg.assign(end, strcspn(end, "\r\n"));
+
+    m_script.push_back(d);
+}
+
+/**
+ * Queues the messages of the script for a load of @a url.
+ */
+void BrowserServerStub::runScript(const char* url)
+{
+    m_url = url ? url : "";
+
+    int delayMs = 0;
+
+    std::vector<Directive>::const_iterator it;
+    for (it = m_script.begin(); it != m_script.end(); ++it) {
+
+        const std::string& name = it->name;
+        const char* arg = it->arg.c_str();
+
+        if (name == "delay") {
+            delayMs += atoi(arg);
+        }
+        else if (name == "loadStarted") {
+            PrvMessage msg(kMsgLoadStarted);
+            enqueueMessage(msg.packet(), delayMs);
+        }
+        else if (name == "loadStopped") {
+            PrvMessage msg(kMsgLoadStopped);
+            enqueueMessage(msg.packet(), delayMs);
+        }
+        else if (name == "progress") {
+            PrvMessage msg(kMsgLoadProgress);
+            (*msg) << (int32_t) atoi(arg);
+            enqueueMessage(msg.packet(), delayMs);
+        }
+        else if (name == "contentsSize" || name == "scrolledTo") {
+            int32_t a = 0, b = 0;
+            sscanf(arg, "%d %d", &a, &b);
+
+            if (name == "scrolledTo") {
+                PrvMessage msg(kMsgScrolledTo);
+                (*msg) << a;
+                (*msg) << b;
+                enqueueMessage(msg.packet(), delayMs);
+            }
+            else {
+                Item item;
+                item.type = ItemContentsSize;
+                item.arg0 = a;
+                item.arg1 = b;
+                enqueue(item, delayMs);
+            }
+        }
+        else if (name == "title") {
+            const char* title = *arg ? arg : m_url.c_str();
+            PrvMessage msg(kMsgTitleChanged, strlen(title));
+            (*msg) << title;
+            enqueueMessage(msg.packet(), delayMs);
+        }
+        else if (name == "location") {
+            const char* location = *arg ? arg : m_url.c_str();
+            PrvMessage msg(kMsgLocationChanged, strlen(location));
+            (*msg) << location;
+            (*msg) << false; // canGoBack
+            (*msg) << false; // canGoForward
+            enqueueMessage(msg.packet(), delayMs);
+        }
+        else if (name == "documentLoaded") {
+            PrvMessage msg(kMsgDidFinishDocumentLoad);
+            enqueueMessage(msg.packet(), delayMs);
+        }
+        else if (name == "flashRects" || name == "removeFlashRects" || name == "scrollableLayers") {
+            int16_t msgId = name == "flashRects" ? kMsgAddFlashRects :
+                            name == "removeFlashRects" ? kMsgRemoveFlashRects :
+                            kMsgUpdateScrollableLayers;
+            PrvMessage msg(msgId, it->arg.size());
+            (*msg) << arg;
+            enqueueMessage(msg.packet(), delayMs);
+        }
+        else if (name == "popupMenu") {
+            std::string id(arg, strcspn(arg, " \t"));
+            const char* menu = arg + id.size();
+            menu += strspn(menu, " \t");
+
+            uint32_t position, length;
+            if (!m_bulkChannel
+                || !m_bulkChannel->writeString(BulkChannel::ToClient, menu, position, length)) {
+                g_warning("BrowserServer stub: no room for popup menu '%s'", id.c_str());
+                continue;
+            }
+
+            PrvMessage msg(kMsgPopupMenuShowBulk, id.size());
+            (*msg) << id.c_str();
+            (*msg) << (int32_t) position;
+            (*msg) << (int32_t) length;
+            enqueueMessage(msg.packet(), delayMs);
+        }
+        else if (name == "damage" || name == "disconnect") {
+            Item item;
+            item.type = name == "damage" ? ItemDamage : ItemDisconnect;
+            item.arg0 = item.arg1 = 0;
+            enqueue(item, delayMs);
+        }
+        else {
+            g_warning("BrowserServer stub: unknown script directive '%s'", name.c_str());
+        }
+    }
+}
+
+void BrowserServerStub::handleCommand(YapPacket* cmd)
+{
+    const uint8_t* bytes = 0;
+    uint32_t length = 0;
+    if (IpcTracePacketBytes(cmd, bytes, length))
+        handleCommand(bytes, length);
+}
+
+void BrowserServerStub::handleCommand(const uint8_t* bytes, uint32_t length)
+{
+    if (!m_connected || !length)
+        return;
+
+    // Decode from a copy so the outgoing packet stays untouched
+    std::vector<uint8_t> data(bytes, bytes + length);
+    YapPacket* packet = IpcTraceCreatePacket(&data[0], length);
+
+    m_commandCount++;
+
+    int16_t cmdValue = 0;
+    (*packet) >> cmdValue;
+
+    switch (cmdValue) {
+    case kCmdConnect: {
+
+        int32_t pageWidth = 0, pageHeight = 0;
+        int32_t key0 = 0, key1 = 0, size = 0;
+
+        (*packet) >> pageWidth;
+        (*packet) >> pageHeight;
+        (*packet) >> key0;
+        (*packet) >> key1;
+        (*packet) >> size;
+        (*packet) >> m_pageIdentifier;
+
+        attachBuffers(key0, key1, size);
+
+        if (!m_contentWidth || !m_contentHeight) {
+            Item item;
+            item.type = ItemContentsSize;
+            item.arg0 = MAX(pageWidth, kDefaultContentWidth);
+            item.arg1 = MAX(pageHeight, kDefaultContentHeight);
+            enqueue(item, 0);
+        }
+        break;
+    }
+    case kCmdSetWindowSize:
+    case kCmdSetVirtualWindowSize: {
+
+        (*packet) >> m_windowWidth;
+        (*packet) >> m_windowHeight;
+
+        schedulePaint();
+        break;
+    }
+    case kCmdSetScrollPosition: {
+
+        (*packet) >> m_scrollX;
+        (*packet) >> m_scrollY;
+
+        schedulePaint();
+        break;
+    }
+    case kCmdSetZoomAndScroll: {
+
+        (*packet) >> m_zoom;
+        (*packet) >> m_scrollX;
+        (*packet) >> m_scrollY;
+
+        if (m_zoom <= 0.0)
+            m_zoom = 1.0;
+
+        schedulePaint();
+        break;
+    }
+    case kCmdOpenUrl:
+    case kCmdSetHtml: {
+
+        char* url = 0;
+        (*packet) >> url;
+
+        runScript(url);
+        free(url);
+        break;
+    }
+    case kCmdAttachBulkChannel: {
+
+        int32_t key = 0, size = 0;
+
+        (*packet) >> key;
+        (*packet) >> size;
+
+        delete m_bulkChannel;
+        m_bulkChannel = BulkChannel::attach(key, size);
+        if (m_bulkChannel) {
+            PrvMessage msg(kMsgBulkChannelAttached);
+            (*msg) << key;
+            enqueueMessage(msg.packet(), 0);
+        }
+        break;
+    }
+    case kCmdSetHtmlBulk: {
+
+        char* url = 0;
+        int32_t position = 0, length = 0;
+
+        (*packet) >> url;
+        (*packet) >> position;
+        (*packet) >> length;
+
+        // The body itself is of no use to the stub
+        if (m_bulkChannel && m_bulkChannel->readString(BulkChannel::ToServer, position, length))
+            m_bulkChannel->release(BulkChannel::ToServer, position, length);
+        else
+            g_warning("BrowserServer stub: no html body at %d (%d bytes)", position, length);
+
+        runScript(url);
+        free(url);
+        break;
+    }
+    case kCmdReload: {
+
+        std::string url(m_url);
+        runScript(url.c_str());
+        break;
+    }
+    case kCmdStop: {
+
+        PrvMessage msg(kMsgLoadStopped);
+        enqueueMessage(msg.packet(), 0);
+        break;
+    }
+    case kCmdFreeze: {
+
+        detachBuffers();
+
+        PrvMessage msg(kMsgFrozen);
+        enqueueMessage(msg.packet(), 0);
+        break;
+    }
+    case kCmdThaw: {
+
+        int32_t key0 = 0, key1 = 0, size = 0;
+
+        (*packet) >> key0;
+        (*packet) >> key1;
+        (*packet) >> size;
+
+        attachBuffers(key0, key1, size);
+        break;
+    }
+    case kCmdSetBackgroundMode: {
+
+        bool enabled = false;
+        int32_t key = 0, size = 0, scalePercent = 0, intervalMs = 0;
+
+        (*packet) >> enabled;
+        (*packet) >> key;
+        (*packet) >> size;
+        (*packet) >> scalePercent;
+        (*packet) >> intervalMs;
+
+        detachBuffers();
+        m_backgroundScale = 0;
+
+        if (!enabled)
+            break;
+
+        m_offscreens[0] = BrowserOffscreen::attach(key, size);
+        if (!m_offscreens[0]) {
+            g_warning("BrowserServer stub: unable to attach to background buffer %d", key);
+            break;
+        }
+
+        m_backgroundScale = CLAMP(scalePercent, 1, 100) / 100.0f;
+        m_backgroundIntervalMs = MAX(0, intervalMs);
+
+        PrvMessage msg(kMsgBackgroundModeEntered);
+        (*msg) << key;
+        enqueueMessage(msg.packet(), 0);
+
+        schedulePaint();
+        break;
+    }
+    case kCmdSetSingleBuffer: {
+
+        bool enabled = false;
+        int32_t key = 0, size = 0;
+
+        (*packet) >> enabled;
+        (*packet) >> key;
+        (*packet) >> size;
+
+        if (!m_offscreens[0] || m_backgroundScale)
+            break;
+
+        if (enabled) {
+            // Keep the buffer the client shows, in the first slot
+            int kept = m_offscreens[1] && m_offscreens[1]->key() == key ? 1 : 0;
+            if (m_offscreens[kept]->key() != key) {
+                g_warning("BrowserServer stub: %d is not one of our buffers", key);
+                break;
+            }
+
+            if (kept) {
+                std::swap(m_offscreens[0], m_offscreens[1]);
+                std::swap(m_bufferBusy[0], m_bufferBusy[1]);
+                std::swap(m_bufferSentTime[0], m_bufferSentTime[1]);
+            }
+
+            delete m_offscreens[1];
+            m_offscreens[1] = 0;
+            m_bufferBusy[0] = true;
+            m_bufferBusy[1] = false;
+            m_singleBuffer = true;
+        }
+        else if (m_singleBuffer) {
+
+            m_offscreens[1] = BrowserOffscreen::attach(key, size);
+            if (!m_offscreens[1]) {
+                g_warning("BrowserServer stub: unable to attach to buffer %d", key);
+                break;
+            }
+
+            m_bufferBusy[1] = false;
+            m_singleBuffer = false;
+        }
+        else {
+            break;
+        }
+
+        PrvMessage msg(kMsgSingleBufferChanged);
+        (*msg) << m_singleBuffer;
+        (*msg) << key;
+        enqueueMessage(msg.packet(), 0);
+
+        // The last paint may have gone into the buffer just dropped
+        schedulePaint();
+        break;
+    }
+    case kCmdReturnBuffer: {
+
+        int32_t key = 0;
+        (*packet) >> key;
+
+        for (int i = 0; i < 2; i++) {
+            if (!m_offscreens[i] || m_offscreens[i]->key() != key || !m_bufferBusy[i])
+                continue;
+
+            m_bufferBusy[i] = false;
+
+            uint64_t turnaround = IpcTraceMonotonicTime() - m_bufferSentTime[i];
+            m_bufferReturnCount++;
+            m_bufferReturnTime += turnaround;
+            m_bufferReturnMax = MAX(m_bufferReturnMax, turnaround);
+        }
+
+        if (m_paintPending)
+            schedulePaint();
+        break;
+    }
+    case kCmdGetHistoryState: {
+
+        int32_t queryNum = 0;
+        (*packet) >> queryNum;
+
+        PrvMessage msg(kMsgGetHistoryStateResponse);
+        (*msg) << queryNum;
+        (*msg) << false; // canGoBack
+        (*msg) << false; // canGoForward
+        enqueueMessage(msg.packet(), 0);
+        break;
+    }
+    case kCmdIsEditing:
+    case kCmdIsInteractiveAtPoint:
+    case kCmdCopy: {
+
+        int32_t queryNum = 0;
+        (*packet) >> queryNum;
+
+        PrvMessage msg(cmdValue == kCmdIsEditing ? kMsgIsEditing :
+                       cmdValue == kCmdCopy ? kMsgCopySuccessResponse :
+                       kMsgIsInteractiveAtPointResponse);
+        (*msg) << queryNum;
+        (*msg) << false;
+        enqueueMessage(msg.packet(), 0);
+        break;
+    }
+    case kCmdGetTextCaretBounds: {
+
+        int32_t queryNum = 0;
+        (*packet) >> queryNum;
+
+        PrvMessage msg(kMsgGetTextCaretBoundsResponse);
+        (*msg) << queryNum;
+        (*msg) << (int32_t) 0;
+        (*msg) << (int32_t) 0;
+        (*msg) << (int32_t) 0;
+        (*msg) << (int32_t) 0;
+        enqueueMessage(msg.packet(), 0);
+        break;
+    }
+    case kCmdDisconnect:
+    case kCmdExit: {
+
+        // The real server closes the socket once it is done
+        Item item;
+        item.type = ItemDisconnect;
+        item.arg0 = item.arg1 = 0;
+        enqueue(item, 0);
+        break;
+    }
+    default:
+        break;
+    }
+
+    delete packet;
+}
+
+void BrowserServerStub::enqueue(Item& item, int delayMs)
+{
+    item.due = IpcTraceMonotonicTime() + (uint64_t) (m_latencyMs + delayMs) * 1000;
+
+    // Keep the queue ordered, items due at the same time stay in FIFO order
+    std::list<Item>::iterator it = m_queue.end();
+    while (it != m_queue.begin()) {
+        std::list<Item>::iterator prev = it;
+        --prev;
+        if (prev->due <= item.due)
+            break;
+        it = prev;
+    }
+    m_queue.insert(it, item);
+
+    scheduleDelivery();
+}
+
+void BrowserServerStub::enqueueMessage(YapPacket* msg, int delayMs)
+{
+    const uint8_t* bytes = 0;
+    uint32_t length = 0;
+    if (!IpcTracePacketBytes(msg, bytes, length))
+        return;
+
+    Item item;
+    item.type = ItemMessage;
+    item.arg0 = item.arg1 = 0;
+    item.data.assign((const char*) bytes, length);
+    enqueue(item, delayMs);
+}
+
+void BrowserServerStub::scheduleDelivery()
+{
+    if (m_deliverySource) {
+        g_source_destroy(m_deliverySource);
+        g_source_unref(m_deliverySource);
+        m_deliverySource = 0;
+    }
+
+    if (m_queue.empty())
+        return;
+
+    uint64_t now = IpcTraceMonotonicTime();
+    uint64_t due = m_queue.front().due;
+    guint delayMs = due > now ? (due - now + 999) / 1000 : 0;
+
+    m_deliverySource = g_timeout_source_new(delayMs);
+    g_source_set_callback(m_deliverySource, deliveryCb, this /*data*/, NULL);
+    g_source_attach(m_deliverySource, m_glibCtxt);
+}
+
+void BrowserServerStub::deliverDue()
+{
+    uint64_t now = IpcTraceMonotonicTime();
+
+    while (m_connected && !m_queue.empty() && m_queue.front().due <= now) {
+
+        // The client may send commands (and so queue items) while handling a message
+        Item item = m_queue.front();
+        m_queue.pop_front();
+
+        switch (item.type) {
+        case ItemMessage:
+            deliver((const uint8_t*) item.data.data(), item.data.size());
+            break;
+        case ItemPainted: {
+            // Dropped if the buffers went away (freeze) after painting
+            BrowserOffscreen* offscreen = m_offscreens[item.arg0];
+            if (!offscreen || !m_bufferBusy[item.arg0])
+                break;
+
+            m_bufferSentTime[item.arg0] = IpcTraceMonotonicTime();
+
+            PrvMessage msg(kMsgPainted);
+            (*msg) << (int32_t) offscreen->key();
+            deliver(msg.packet());
+            break;
+        }
+        case ItemContentsSize: {
+            m_contentWidth = item.arg0;
+            m_contentHeight = item.arg1;
+
+            PrvMessage msg(kMsgContentsSizeChanged);
+            (*msg) << m_contentWidth;
+            (*msg) << m_contentHeight;
+            deliver(msg.packet());
+
+            schedulePaint();
+            break;
+        }
+        case ItemDamage:
+            schedulePaint();
+            break;
+        case ItemDisconnect:
+            g_message("BrowserServer stub: closing connection");
+            disconnect();
+            m_client->stubDisconnected();
+            return;
+        }
+    }
+
+    scheduleDelivery();
+}
+
+void BrowserServerStub::deliver(YapPacket* msg)
+{
+    const uint8_t* bytes = 0;
+    uint32_t length = 0;
+
+    if (IpcTracePacketBytes(msg, bytes, length))
+        deliver(bytes, length);
+}
+
+void BrowserServerStub::deliver(const uint8_t* data, uint32_t length)
+{
+    YapPacket* packet = IpcTraceCreatePacket((uint8_t*) data, length);
+    m_messageCount++;
+    m_client->stubMessage(packet);
+    delete packet;
+}
+
+gboolean BrowserServerStub::deliveryCb(gpointer data)
+{
+    BrowserServerStub* s = (BrowserServerStub*) data;
+
+    // Returning FALSE destroys the source, we only drop our reference
+    g_source_unref(s->m_deliverySource);
+    s->m_deliverySource = 0;
+
+    s->deliverDue();
+    return FALSE;
+}
+
+void BrowserServerStub::attachBuffers(int32_t key0, int32_t key1, int32_t size)
+{
+    detachBuffers();
+    m_backgroundScale = 0;
+
+    m_offscreens[0] = BrowserOffscreen::attach(key0, size);
+    m_offscreens[1] = BrowserOffscreen::attach(key1, size);
+
+    if (!m_offscreens[0] || !m_offscreens[1]) {
+        g_warning("BrowserServer stub: unable to attach to buffers %d/%d", key0, key1);
+        detachBuffers();
+        return;
+    }
+
+    schedulePaint();
+}
+
+void BrowserServerStub::detachBuffers()
+{
+    for (int i = 0; i < 2; i++) {
+        delete m_offscreens[i];
+        m_offscreens[i] = 0;
+        m_bufferBusy[i] = false;
+    }
+
+    m_paintPending = false;
+    m_singleBuffer = false;
+}
+
+void BrowserServerStub::schedulePaint()
+{
+    // Coalesce bursts of scroll and zoom commands into one paint
+    if (m_paintSource)
+        return;
+
+    // In background mode at a reduced rate
+    m_paintSource = m_backgroundScale ? g_timeout_source_new(m_backgroundIntervalMs) : g_idle_source_new();
+    g_source_set_callback(m_paintSource, paintCb, this /*data*/, NULL);
+    g_source_attach(m_paintSource, m_glibCtxt);
+}
+
+gboolean BrowserServerStub::paintCb(gpointer data)
+{
+    BrowserServerStub* s = (BrowserServerStub*) data;
+
+    g_source_unref(s->m_paintSource);
+    s->m_paintSource = 0;
+
+    s->paint();
+    return FALSE;
+}
+
+/**
+ * Renders the synthetic page around the current scroll position into a free
+ * buffer and queues the Painted message for it.
+ */
+void BrowserServerStub::paint()
+{
+    if (!m_connected || !m_offscreens[0] || (!m_offscreens[1] && !m_backgroundScale && !m_singleBuffer))
+        return;
+
+    if (m_windowWidth <= 0 || m_windowHeight <= 0 || m_contentWidth <= 0 || m_contentHeight <= 0)
+        return;
+
+    // Single buffered the client's buffer is painted over in place
+    int index = m_singleBuffer || !m_bufferBusy[0] ? 0 : (m_offscreens[1] && !m_bufferBusy[1]) ? 1 : -1;
+    if (index < 0) {
+        // Painted again as soon as the client returns a buffer
+        m_paintPending = true;
+        return;
+    }
+    m_paintPending = false;
+
+    uint64_t startTime = IpcTraceMonotonicTime();
+    BrowserOffscreen* offscreen = m_offscreens[index];
+
+    // Render the window plus half a window on each side, limited by the
+    // scaled contents and by what fits in the buffer. A background buffer
+    // holds the same area at m_backgroundScale.
+    float pixelScale = m_backgroundScale ? m_backgroundScale : 1.0f;
+    int scaledWidth = (int) (m_contentWidth * m_zoom);
+    int scaledHeight = (int) (m_contentHeight * m_zoom);
+    int maxPixels = offscreen->rasterSize() / sizeof(uint32_t) / (pixelScale * pixelScale);
+
+    int renderWidth = MIN(m_windowWidth * 2, scaledWidth);
+    int renderHeight = MIN(m_windowHeight * 2, scaledHeight);
+    if (renderWidth <= 0 || renderHeight <= 0)
+        return;
+    if (renderWidth > maxPixels)
+        renderWidth = maxPixels;
+    if ((int64_t) renderWidth * renderHeight > maxPixels)
+        renderHeight = maxPixels / renderWidth;
+
+    int renderX = CLAMP(m_scrollX - (renderWidth - m_windowWidth) / 2, 0, MAX(0, scaledWidth - renderWidth));
+    int renderY = CLAMP(m_scrollY - (renderHeight - m_windowHeight) / 2, 0, MAX(0, scaledHeight - renderHeight));
+
+    int pixelWidth = MAX(1, (int) (renderWidth * pixelScale));
+    int pixelHeight = MAX(1, (int) (renderHeight * pixelScale));
+
+    // The position is in page coordinates, the size is that of the pixels
+    // since BrowserOffscreen::surface() takes its dimensions from it
+    BrowserOffscreenInfo* info = offscreen->header();
+    info->bufferWidth = pixelWidth;
+    info->bufferHeight = pixelHeight;
+    info->contentZoom = m_zoom;
+    info->renderedX = renderX;
+    info->renderedY = renderY;
+    info->renderedWidth = pixelWidth;
+    info->renderedHeight = pixelHeight;
+
+    QImage surface = offscreen->surface();
+    QPainter gc(&surface);
+
+    gc.scale(pixelScale, pixelScale);
+    gc.translate(-renderX, -renderY);
+    gc.scale(m_zoom, m_zoom);
+
+    // Visible document rectangle
+    int docLeft = (int) (renderX / m_zoom);
+    int docTop = (int) (renderY / m_zoom);
+    int docRight = (int) ((renderX + renderWidth) / m_zoom) + 1;
+    int docBottom = (int) ((renderY + renderHeight) / m_zoom) + 1;
+
+    QLinearGradient gradient(0, 0, m_contentWidth, m_contentHeight);
+    gradient.setColorAt(0.0, QColor(0xF8, 0xF8, 0xFF));
+    gradient.setColorAt(0.5, QColor(0xE0, 0xF0, 0xE0));
+    gradient.setColorAt(1.0, QColor(0xFF, 0xE8, 0xD0));
+    gc.fillRect(QRect(docLeft, docTop, docRight - docLeft, docBottom - docTop), gradient);
+
+    // Rows of "words" whose widths are derived from their position so every
+    // paint of the same area looks the same
+    QColor ink(0x40, 0x40, 0x40);
+    int firstLine = MAX(0, (docTop - kMargin) / kLineHeight);
+    int lastLine = (docBottom - kMargin) / kLineHeight + 1;
+    for (int line = firstLine; line <= lastLine; line++) {
+
+        int y = kMargin + line * kLineHeight;
+        if (y > m_contentHeight - kMargin)
+            break;
+
+        int x = kMargin;
+        for (int word = 0; x < m_contentWidth - kMargin; word++) {
+            int w = 12 + PrvHash(line, word) % 64;
+            if (x + w > m_contentWidth - kMargin || x > docRight)
+                break;
+            if (x + w >= docLeft)
+                gc.fillRect(QRect(x, y, w, kGlyphHeight), ink);
+            x += w + 6;
+        }
+    }
+
+    gc.resetTransform();
+    gc.scale(pixelScale, pixelScale);
+    gc.translate(-renderX, -renderY);
+
+    // Frame marker in the top left of the window so repaints are visible
+    m_frame++;
+    QRect marker(m_scrollX + 8, m_scrollY + 8, 64, 24);
+    gc.fillRect(marker, QColor::fromHsv((m_frame * 37) % 360, 0xC0, 0xE0));
+    gc.setPen(Qt::black);
+    gc.drawText(marker, Qt::AlignCenter, QString::number(m_frame));
+
+    gc.end();
+
+    m_paintCount++;
+    m_paintTime += IpcTraceMonotonicTime() - startTime;
+
+    m_bufferBusy[index] = true;
+
+    Item item;
+    item.type = ItemPainted;
+    item.arg0 = index;
+    item.arg1 = 0;
+    enqueue(item, 0);
+}
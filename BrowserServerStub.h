@@ -0,0 +1,197 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef BROWSERSERVERSTUB_H
+#define BROWSERSERVERSTUB_H
+
+#include <stdint.h>
+#include <glib.h>
+#include <list>
+#include <string>
+#include <vector>
+
+class YapPacket;
+class BrowserOffscreen;
+class BulkChannel;
+
+class BrowserServerStubClient
+{
+public:
+
+    BrowserServerStubClient() {}
+    virtual ~BrowserServerStubClient() {}
+
+    /**
+     * Delivers a serialized BrowserServer message, exactly as it would
+     * have been read from the server socket.
+     */
+    virtual void stubMessage(YapPacket* msg) = 0;
+    virtual void stubDisconnected() = 0;
+};
+
+/**
+ * In-process stand-in for BrowserServer.
+ *
+ * Decodes the serialized commands of a BrowserClientBase, attaches to the
+ * shared buffers it offers and answers with synthetic paints and scripted
+ * message sequences. Everything runs on the client's GLib main context, every
+ * message is delayed by a configurable latency.
+ *
+ * A script is a text file with one directive per line, '#' starts a comment:
+ *
+ *   delay <ms>                 Following directives fire <ms> later
+ *   loadStarted
+ *   loadStopped
+ *   progress <percent>
+ *   contentsSize <w> <h>       Also repaints
+ *   title [text]               Defaults to the last opened url
+ *   location [url]             Defaults to the last opened url
+ *   documentLoaded             DidFinishDocumentLoad
+ *   scrolledTo <x> <y>
+ *   flashRects <json>
+ *   removeFlashRects <json>
+ *   scrollableLayers <json>
+ *   popupMenu <id> <json>      Through the bulk channel, dropped if not attached
+ *   damage                     Repaints the current view
+ *   disconnect                 Simulates a server crash
+ *
+ * The script is run on every OpenUrl, SetHtml and Reload command.
+ *
+ * Only built into test builds, with make SERVER_STUB=1, which define
+ * BROWSER_SERVER_STUB.
+ */
+class BrowserServerStub
+{
+public:
+
+    /**
+     * Creates a stub if BROWSER_ADAPTER_SERVER_STUB is set. Its value is the
+     * script to run, an empty value or "1" selects the built-in page load.
+     * BROWSER_ADAPTER_SERVER_STUB_LATENCY sets the message latency in ms.
+     *
+     * @return the stub or NULL if not enabled.
+     */
+    static BrowserServerStub* createFromEnvironment(BrowserServerStubClient* client, GMainContext* ctxt);
+
+    BrowserServerStub(BrowserServerStubClient* client, GMainContext* ctxt,
+                      const char* scriptPath, int latencyMs);
+    ~BrowserServerStub();
+
+    bool connect();
+    bool isConnected() const {
+        return m_connected;
+    }
+
+    /**
+     * Processes a serialized command. The packet is not modified.
+     */
+    void handleCommand(YapPacket* cmd);
+
+    /**
+     * Processes the bytes of a serialized command, e.g. one read back
+     * from an IPC trace.
+     */
+    void handleCommand(const uint8_t* bytes, uint32_t length);
+
+private:
+
+    enum ItemType {
+        ItemMessage = 0,
+        ItemPainted,
+        ItemContentsSize,
+        ItemDamage,
+        ItemDisconnect
+    };
+
+    struct Item {
+        uint64_t due;               ///< IpcTraceMonotonicTime() to deliver at
+        ItemType type;
+        int32_t arg0;               ///< Buffer index or width
+        int32_t arg1;               ///< Height
+        std::string data;           ///< Serialized message for ItemMessage
+    };
+
+    struct Directive {
+        std::string name;
+        std::string arg;
+    };
+
+    void loadScript(const char* path);
+    void parseScriptLine(const char* line);
+    void runScript(const char* url);
+
+    void enqueue(Item& item, int delayMs);
+    void enqueueMessage(YapPacket* msg, int delayMs);
+
+    void scheduleDelivery();
+    void deliverDue();
+    void deliver(YapPacket* msg);
+    void deliver(const uint8_t* data, uint32_t length);
+    static gboolean deliveryCb(gpointer data);
+
+    void attachBuffers(int32_t key0, int32_t key1, int32_t size);
+    void detachBuffers();
+
+    void schedulePaint();
+    void paint();
+    static gboolean paintCb(gpointer data);
+
+    void disconnect();
+    void dumpStats();
+
+    BrowserServerStubClient* m_client;
+    GMainContext* m_glibCtxt;
+    int m_latencyMs;
+    bool m_connected;
+
+    std::vector<Directive> m_script;
+    std::list<Item> m_queue;
+    GSource* m_deliverySource;
+    GSource* m_paintSource;
+    bool m_paintPending;            ///< Paint requested while no buffer was free
+
+    BulkChannel* m_bulkChannel;
+    BrowserOffscreen* m_offscreens[2];
+    bool m_bufferBusy[2];           ///< Handed to the client and not yet returned
+    float m_backgroundScale;        ///< Set in background mode, painting into m_offscreens[0] only
+    int32_t m_backgroundIntervalMs;
+    bool m_singleBuffer;            ///< Painting into the buffer the client shows, m_offscreens[0] only
+    uint64_t m_bufferSentTime[2];
+
+    std::string m_url;
+    int32_t m_pageIdentifier;
+    int32_t m_windowWidth;
+    int32_t m_windowHeight;
+    int32_t m_contentWidth;
+    int32_t m_contentHeight;
+    int32_t m_scrollX;
+    int32_t m_scrollY;
+    double m_zoom;
+    uint32_t m_frame;
+
+    // Throughput and latency counters, logged on disconnect and destruction
+    uint32_t m_commandCount;
+    uint32_t m_messageCount;
+    uint32_t m_paintCount;
+    uint64_t m_paintTime;
+    uint32_t m_bufferReturnCount;
+    uint64_t m_bufferReturnTime;
+    uint64_t m_bufferReturnMax;
+};
+
+#endif /* BROWSERSERVERSTUB_H */
@@ -0,0 +1,151 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "BulkChannel.h"
+
+static const uint32_t kBulkChannelMagic = 0x424c4b43; // 'BLKC'
+static const uint32_t kBulkChannelVersion = 1;
+
+BulkChannel* BulkChannel::create(uint32_t ringSize)
+{
+    if (!ringSize || (ringSize & (ringSize - 1))) {
+        g_critical("%s: ring size %u is not a power of 2", __FUNCTION__, ringSize);
+        return 0;
+    }
+
+    IpcBuffer* buffer = IpcBuffer::create(sizeof(BulkChannelInfo) + 2 * ringSize);
+    if (!buffer)
+        return 0;
+
+    BulkChannelInfo* header = (BulkChannelInfo*) buffer->buffer();
+    ::memset(header, 0, sizeof(BulkChannelInfo));
+    header->magic = kBulkChannelMagic;
+    header->version = kBulkChannelVersion;
+    header->ringSize = ringSize;
+
+    return new BulkChannel(buffer);
+}
+
+BulkChannel* BulkChannel::attach(int key, int size)
+{
+    if (size < (int) sizeof(BulkChannelInfo))
+        return 0;
+
+    IpcBuffer* buffer = IpcBuffer::attach(key, size);
+    if (!buffer)
+        return 0;
+
+    BulkChannelInfo* header = (BulkChannelInfo*) buffer->buffer();
+    uint32_t ringSize = header->ringSize;
+    if (header->magic != kBulkChannelMagic || header->version != kBulkChannelVersion
+        || !ringSize || (ringSize & (ringSize - 1))
+        || sizeof(BulkChannelInfo) + 2 * (uint64_t) ringSize > (uint64_t) size) {
+        g_warning("%s: buffer %d is not a bulk channel", __FUNCTION__, key);
+        delete buffer;
+        return 0;
+    }
+
+    return new BulkChannel(buffer);
+}
+
+BulkChannel::BulkChannel(IpcBuffer* buffer)
+    : m_ipcBuffer(buffer)
+    , m_header((BulkChannelInfo*) buffer->buffer())
+    , m_data((char*) buffer->buffer() + sizeof(BulkChannelInfo))
+    , m_ringSize(m_header->ringSize)
+{
+}
+
+BulkChannel::~BulkChannel()
+{
+    delete m_ipcBuffer;
+}
+
+void BulkChannel::reset()
+{
+    for (int dir = ToServer; dir <= ToClient; dir++) {
+        m_header->rings[dir].head = 0;
+        m_header->rings[dir].tail = 0;
+    }
+    __sync_synchronize();
+}
+
+bool BulkChannel::writeString(Direction dir, const char* str, uint32_t& position, uint32_t& length)
+{
+    size_t len = ::strlen(str) + 1;
+    if (len > m_ringSize)
+        return false;
+
+    BulkRingInfo* info = ring(dir);
+    uint32_t head = info->head;
+    uint32_t tail = info->tail;
+    __sync_synchronize();   // read the tail before reusing what it released
+
+    // Payloads are contiguous, skip what is left at the end of the ring
+    uint32_t pos = head;
+    uint32_t offset = pos & (m_ringSize - 1);
+    if (offset + len > m_ringSize)
+        pos += m_ringSize - offset;
+
+    if (pos + len - tail > m_ringSize)
+        return false;   // the receiver has not caught up
+
+    ::memcpy(ringData(dir) + (pos & (m_ringSize - 1)), str, len);
+
+    __sync_synchronize();   // the data has to be visible before the new head
+    info->head = pos + len;
+
+    position = pos;
+    length = len;
+    return true;
+}
+
+const char* BulkChannel::readString(Direction dir, uint32_t position, uint32_t length) const
+{
+    BulkRingInfo* info = ring(dir);
+    uint32_t head = info->head;
+    __sync_synchronize();
+
+    uint32_t offset = position & (m_ringSize - 1);
+    uint32_t published = head - position;
+    if (!length || length > m_ringSize || offset + length > m_ringSize
+        || published < length || published > m_ringSize)
+        return 0;
+
+    const char* str = ringData(dir) + offset;
+    if (str[length - 1] != '\0')
+        return 0;
+
+    return str;
+}
+
+void BulkChannel::release(Direction dir, uint32_t position, uint32_t length)
+{
+    BulkRingInfo* info = ring(dir);
+    uint32_t end = position + length;
+
+    // Never move the tail backwards, e.g. for a payload released twice
+    if ((int32_t) (end - info->tail) <= 0 || (int32_t) (info->head - end) < 0)
+        return;
+
+    __sync_synchronize();   // done reading before the sender may overwrite
+    info->tail = end;
+}
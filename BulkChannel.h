@@ -0,0 +1,127 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef BULKCHANNEL_H
+#define BULKCHANNEL_H
+
+#include <stdint.h>
+
+#include "IpcBuffer.h"
+
+/**
+ * Shared memory side channel for payloads too large to be worth copying
+ * through the Yap socket: page HTML, popup menu data, rect lists.
+ *
+ * The client creates one per connection and announces it with
+ * AttachBulkChannel. The buffer holds two byte rings, one per direction. The
+ * sender copies a payload into its ring once and sends the usual message with
+ * the payload's position and length in place of the data; the receiver reads
+ * it in place and releases it when done.
+ *
+ * Positions are free running 32-bit byte counters, a payload is stored at
+ * position % ring size. A payload never wraps: if it does not fit before the
+ * end of the ring it starts over at the beginning. Each side only ever writes
+ * its own head or the other ring's tail, so no lock is needed.
+ */
+
+struct BulkRingInfo {
+    uint32_t head;          ///< Written up to here by the sender
+    uint32_t tail;          ///< Released up to here by the receiver
+};
+
+struct BulkChannelInfo {
+    uint32_t magic;         ///< kBulkChannelMagic
+    uint32_t version;       ///< kBulkChannelVersion
+    uint32_t ringSize;      ///< Bytes per ring, a power of 2
+    uint32_t reserved;
+    BulkRingInfo rings[2];  ///< Indexed by BulkChannel::Direction
+};
+
+class BulkChannel
+{
+public:
+
+    enum Direction {
+        ToServer = 0,
+        ToClient = 1
+    };
+
+    static const uint32_t kDefaultRingSize = 1 << 20;
+
+    /**
+     * Payloads below this are cheaper to send through the socket.
+     */
+    static const uint32_t kMinPayloadSize = 4096;
+
+    static BulkChannel* create(uint32_t ringSize = kDefaultRingSize);
+    static BulkChannel* attach(int key, int size);
+    ~BulkChannel();
+
+    int key() const {
+        return m_ipcBuffer->key();
+    }
+    int size() const {
+        return m_ipcBuffer->size();
+    }
+
+    /**
+     * Empty both rings, for a new connection.
+     */
+    void reset();
+
+    /**
+     * Copy the NUL terminated @a str into the ring of @a dir.
+     *
+     * @return false if there is no room, the payload then has to go through
+     *         the socket. Otherwise @a position and @a length (including the
+     *         terminating NUL) identify it for readString().
+     */
+    bool writeString(Direction dir, const char* str, uint32_t& position, uint32_t& length);
+
+    /**
+     * The string the other side wrote at @a position.
+     *
+     * @return NULL if @a position and @a length do not describe a complete
+     *         string the sender has published. Valid until released.
+     */
+    const char* readString(Direction dir, uint32_t position, uint32_t length) const;
+
+    /**
+     * Give the payload at @a position back to the sender, along with
+     * everything before it.
+     */
+    void release(Direction dir, uint32_t position, uint32_t length);
+
+private:
+
+    BulkChannel(IpcBuffer* buffer);
+
+    BulkRingInfo* ring(Direction dir) const {
+        return &m_header->rings[dir];
+    }
+    char* ringData(Direction dir) const {
+        return m_data + dir * m_ringSize;
+    }
+
+    IpcBuffer* m_ipcBuffer;
+    BulkChannelInfo* m_header;
+    char* m_data;
+    uint32_t m_ringSize;
+};
+
+#endif /* BULKCHANNEL_H */
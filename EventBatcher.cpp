@@ -0,0 +1,509 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include <npruntime.h>
+
+#include "EventBatcher.h"
+#include "LatencyHistogram.h"
+
+EventBatcher::EventBatcher(EventBatcherListener* listener, GMainContext* ctxt)
+    : m_listener(listener)
+    , m_ctxt(ctxt)
+    , m_flushSource(0)
+    , m_releaseSource(0)
+    , m_releaseDeadline(0)
+    , m_batching(false)
+    , m_queuedCount(0)
+    , m_coalescedCount(0)
+    , m_flushCount(0)
+    , m_heldCount(0)
+{
+}
+
+EventBatcher::~EventBatcher()
+{
+    cancelFlush();
+    cancelRelease();
+}
+
+bool EventBatcher::sameKey(const Event& a, const Event& b)
+{
+    if (a.handler != b.handler || a.coalesce != b.coalesce)
+        return false;
+
+    switch (a.coalesce) {
+    case CoalesceHandler:
+        return true;
+    case CoalesceFirstArg:
+        if (a.args.empty() || b.args.empty())
+            return a.args.empty() && b.args.empty();
+        return a.args[0].type == b.args[0].type
+               && a.args[0].boolValue == b.args[0].boolValue
+               && a.args[0].intValue == b.args[0].intValue
+               && a.args[0].doubleValue == b.args[0].doubleValue
+               && a.args[0].stringValue == b.args[0].stringValue;
+    default:
+        return false;
+    }
+}
+
+bool EventBatcher::sameArgs(const Event& a, const Event& b)
+{
+    return !changedBy(a, b, 0);
+}
+
+/**
+ * @return true if an argument of @a b differs from that of @a a, numbers by
+ *         at least @a minChange, if 0 by any amount.
+ */
+bool EventBatcher::changedBy(const Event& a, const Event& b, double minChange)
+{
+    if (a.args.size() != b.args.size())
+        return true;
+
+    for (size_t i = 0; i < a.args.size(); i++) {
+        const Arg& x = a.args[i];
+        const Arg& y = b.args[i];
+        if (x.type != y.type)
+            return true;
+
+        double delta = 0;
+        switch (x.type) {
+        case NPVariantType_Bool:
+            if (x.boolValue != y.boolValue)
+                return true;
+            break;
+        case NPVariantType_String:
+            if (x.stringValue != y.stringValue)
+                return true;
+            break;
+        case NPVariantType_Int32:
+            delta = fabs((double) x.intValue - y.intValue);
+            break;
+        case NPVariantType_Double:
+            delta = fabs(x.doubleValue - y.doubleValue);
+            break;
+        default:
+            break;
+        }
+
+        if (delta > 0 && delta >= minChange)
+            return true;
+    }
+
+    return false;
+}
+
+void EventBatcher::setPolicy(NPIdentifier handler, uint32_t minIntervalMs, double minChange)
+{
+    if (!minIntervalMs && minChange <= 0) {
+        m_policies.erase(handler);
+        return;
+    }
+
+    Policy& policy = m_policies[handler];
+    policy.minIntervalUs = (uint64_t) minIntervalMs * 1000;
+    policy.minChange = minChange > 0 ? minChange : 0;
+}
+
+EventBatcher::Admitted* EventBatcher::findAdmitted(Policy& policy, const Event& event)
+{
+    for (size_t i = 0; i < policy.admitted.size(); i++) {
+        if (sameKey(policy.admitted[i].event, event))
+            return &policy.admitted[i];
+    }
+    return 0;
+}
+
+/**
+ * @return false and sets @a due to when @a event may go if @a policy holds
+ *         it back.
+ */
+bool EventBatcher::admit(Policy& policy, const Event& event, uint64_t now, uint64_t& due)
+{
+    const Admitted* last = findAdmitted(policy, event);
+    if (!last)
+        return true;
+
+    if (now < last->time + policy.minIntervalUs) {
+        due = last->time + policy.minIntervalUs;
+        return false;
+    }
+
+    if (policy.minChange > 0 && !changedBy(last->event, event, policy.minChange)) {
+        due = now + (uint64_t) kSettleMs * 1000;
+        return false;
+    }
+
+    return true;
+}
+
+void EventBatcher::enqueue(const Event& event, uint64_t now)
+{
+    PolicyMap::iterator policy = m_policies.find(event.handler);
+    if (policy != m_policies.end()) {
+        Policy& p = policy->second;
+
+        Admitted* last = findAdmitted(p, event);
+        if (!last) {
+            p.admitted.push_back(Admitted());
+            last = &p.admitted.back();
+        }
+        last->event = event;
+        last->time = now;
+
+        // Anything held for the key is older than this one
+        for (EventQueue::iterator it = m_held.begin(); it != m_held.end(); ) {
+            if (sameKey(*it, event)) {
+                it = m_held.erase(it);
+                m_coalescedCount++;
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    // The newest occurrence takes the place of older ones at the end of the queue
+    if (event.coalesce != CoalesceNone) {
+        for (EventQueue::iterator it = m_events.begin(); it != m_events.end(); ) {
+            if (sameKey(*it, event)) {
+                it = m_events.erase(it);
+                m_coalescedCount++;
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    m_events.push_back(event);
+    m_queuedCount++;
+
+    scheduleFlush();
+}
+
+void EventBatcher::hold(const Event& event, uint64_t due)
+{
+    for (EventQueue::iterator it = m_held.begin(); it != m_held.end(); ++it) {
+        if (sameKey(*it, event)) {
+            // Keep the earlier deadline, or a steady trickle would never settle
+            due = std::min(due, it->due);
+            m_held.erase(it);
+            m_coalescedCount++;
+            break;
+        }
+    }
+
+    m_held.push_back(event);
+    m_held.back().due = due;
+    m_heldCount++;
+
+    scheduleRelease(due);
+}
+
+/**
+ * Queue the held events that are due, or all of them. One that matches what
+ * was last delivered for its key carries no news and is dropped.
+ */
+void EventBatcher::release(bool all)
+{
+    cancelRelease();
+
+    if (m_held.empty())
+        return;
+
+    uint64_t now = LatencyHistogram::now();
+    uint64_t next = 0;
+
+    EventQueue held;
+    held.swap(m_held);
+
+    for (EventQueue::iterator it = held.begin(); it != held.end(); ++it) {
+        if (!all && it->due > now) {
+            m_held.push_back(*it);
+            if (!next || it->due < next)
+                next = it->due;
+            continue;
+        }
+
+        bool stale = false;
+        PolicyMap::iterator policy = m_policies.find(it->handler);
+        if (policy != m_policies.end()) {
+            const Admitted* last = findAdmitted(policy->second, *it);
+            stale = last && sameArgs(last->event, *it);
+        }
+
+        if (stale)
+            m_coalescedCount++;
+        else
+            enqueue(*it, now);
+    }
+
+    if (next)
+        scheduleRelease(next);
+}
+
+void EventBatcher::queue(NPIdentifier handler, const NPVariant* args, uint32_t argCount, Coalesce coalesce)
+{
+    if (!handler)
+        return;
+
+    Event event;
+    event.handler = handler;
+    event.coalesce = coalesce;
+    event.args.resize(argCount);
+    event.due = 0;
+
+    for (uint32_t i = 0; i < argCount; i++) {
+        Arg& arg = event.args[i];
+        arg.type = args[i].type;
+        arg.boolValue = false;
+        arg.intValue = 0;
+        arg.doubleValue = 0;
+
+        switch (args[i].type) {
+        case NPVariantType_Void:
+        case NPVariantType_Null:
+            break;
+        case NPVariantType_Bool:
+            arg.boolValue = NPVARIANT_TO_BOOLEAN(args[i]);
+            break;
+        case NPVariantType_Int32:
+            arg.intValue = NPVARIANT_TO_INT32(args[i]);
+            break;
+        case NPVariantType_Double:
+            arg.doubleValue = NPVARIANT_TO_DOUBLE(args[i]);
+            break;
+        case NPVariantType_String: {
+            const NPString& s = NPVARIANT_TO_STRING(args[i]);
+            if (s.UTF8Characters)
+                arg.stringValue.assign(s.UTF8Characters, s.UTF8Length);
+            break;
+        }
+        default:
+            // Objects can not outlive the caller's reference, so no batching
+            g_critical("%s: can not queue an object argument, delivering now", __FUNCTION__);
+            flush();
+            std::vector<NPVariant> copy(args, args + argCount);
+            m_listener->deliverEvent(handler, &copy[0], argCount);
+            return;
+        }
+    }
+
+    uint64_t now = LatencyHistogram::now();
+
+    // Only coalesced events can be held back: the others all have to go
+    PolicyMap::iterator policy = m_policies.find(handler);
+    if (policy != m_policies.end() && coalesce != CoalesceNone) {
+        uint64_t due = 0;
+        if (!admit(policy->second, event, now, due)) {
+            hold(event, due);
+            return;
+        }
+    }
+
+    enqueue(event, now);
+}
+
+void EventBatcher::clear()
+{
+    cancelFlush();
+    cancelRelease();
+    m_events.clear();
+    m_held.clear();
+
+    for (PolicyMap::iterator it = m_policies.begin(); it != m_policies.end(); ++it)
+        it->second.admitted.clear();
+}
+
+void EventBatcher::toVariant(const Arg& arg, NPVariant& variant)
+{
+    switch (arg.type) {
+    case NPVariantType_Bool:
+        BOOLEAN_TO_NPVARIANT(arg.boolValue, variant);
+        break;
+    case NPVariantType_Int32:
+        INT32_TO_NPVARIANT(arg.intValue, variant);
+        break;
+    case NPVariantType_Double:
+        DOUBLE_TO_NPVARIANT(arg.doubleValue, variant);
+        break;
+    case NPVariantType_String:
+        STRINGN_TO_NPVARIANT(arg.stringValue.c_str(), arg.stringValue.size(), variant);
+        break;
+    case NPVariantType_Void:
+        VOID_TO_NPVARIANT(variant);
+        break;
+    default:
+        NULL_TO_NPVARIANT(variant);
+        break;
+    }
+}
+
+pbnjson::JValue EventBatcher::toJson(const Arg& arg)
+{
+    switch (arg.type) {
+    case NPVariantType_Bool:
+        return pbnjson::JValue(arg.boolValue);
+    case NPVariantType_Int32:
+        return pbnjson::JValue((int64_t) arg.intValue);
+    case NPVariantType_Double:
+        return pbnjson::JValue(arg.doubleValue);
+    case NPVariantType_String:
+        return pbnjson::JValue(arg.stringValue);
+    default:
+        return pbnjson::JValue();   // null
+    }
+}
+
+void EventBatcher::deliverOne(const Event& event)
+{
+    std::vector<NPVariant> args(event.args.size());
+    for (size_t i = 0; i < event.args.size(); i++)
+        toVariant(event.args[i], args[i]);
+
+    m_listener->deliverEvent(event.handler, args.empty() ? NULL : &args[0], args.size());
+}
+
+void EventBatcher::deliverBatch()
+{
+    pbnjson::JValue events = pbnjson::Array();
+
+    EventQueue pending;
+    pending.swap(m_events);
+
+    for (EventQueue::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+        std::map<NPIdentifier, std::string>::iterator name = m_names.find(it->handler);
+        if (name == m_names.end())
+            name = m_names.insert(std::make_pair(it->handler, m_listener->eventName(it->handler))).first;
+
+        pbnjson::JValue args = pbnjson::Array();
+        for (size_t i = 0; i < it->args.size(); i++)
+            args.append(toJson(it->args[i]));
+
+        pbnjson::JValue event = pbnjson::Object();
+        event.put("type", name->second);
+        event.put("args", args);
+        events.append(event);
+    }
+
+    m_listener->deliverEventBatch(events);
+}
+
+void EventBatcher::flush()
+{
+    release(true);
+    deliverQueued();
+}
+
+void EventBatcher::deliverQueued()
+{
+    cancelFlush();
+
+    if (m_events.empty())
+        return;
+
+    m_flushCount++;
+
+    if (m_batching) {
+        deliverBatch();
+        return;
+    }
+
+    // One at a time off the front: a handler may queue more events or flush
+    // again, and those have to come after the rest of this queue
+    while (!m_events.empty()) {
+        Event event = m_events.front();
+        m_events.pop_front();
+        deliverOne(event);
+    }
+}
+
+void EventBatcher::scheduleFlush()
+{
+    if (m_flushSource)
+        return;
+
+    m_flushSource = g_timeout_source_new(0);
+    g_source_set_callback(m_flushSource, flushCb, this /*data*/, NULL);
+    g_source_attach(m_flushSource, m_ctxt);
+}
+
+void EventBatcher::cancelFlush()
+{
+    if (m_flushSource) {
+        g_source_destroy(m_flushSource);
+        g_source_unref(m_flushSource);
+        m_flushSource = 0;
+    }
+}
+
+gboolean EventBatcher::flushCb(gpointer data)
+{
+    EventBatcher* batcher = (EventBatcher*) data;
+
+    g_source_unref(batcher->m_flushSource);
+    batcher->m_flushSource = 0;
+
+    batcher->deliverQueued();
+
+    return FALSE;
+}
+
+void EventBatcher::scheduleRelease(uint64_t due)
+{
+    if (m_releaseSource) {
+        if (m_releaseDeadline <= due)
+            return;
+        cancelRelease();
+    }
+
+    uint64_t now = LatencyHistogram::now();
+    guint interval = due > now ? (guint) ((due - now + 999) / 1000) : 0;
+
+    m_releaseSource = g_timeout_source_new(interval);
+    g_source_set_callback(m_releaseSource, releaseCb, this /*data*/, NULL);
+    g_source_attach(m_releaseSource, m_ctxt);
+    m_releaseDeadline = due;
+}
+
+void EventBatcher::cancelRelease()
+{
+    if (m_releaseSource) {
+        g_source_destroy(m_releaseSource);
+        g_source_unref(m_releaseSource);
+        m_releaseSource = 0;
+    }
+}
+
+gboolean EventBatcher::releaseCb(gpointer data)
+{
+    EventBatcher* batcher = (EventBatcher*) data;
+
+    g_source_unref(batcher->m_releaseSource);
+    batcher->m_releaseSource = 0;
+
+    batcher->release(false);
+
+    return FALSE;
+}
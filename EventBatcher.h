@@ -0,0 +1,220 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef EVENTBATCHER_H
+#define EVENTBATCHER_H
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+#include <npupp.h>
+#include <npapi.h>
+#include <pbnjson.hpp>
+
+/**
+ * Receives the events an EventBatcher releases.
+ */
+class EventBatcherListener
+{
+public:
+
+    EventBatcherListener() {}
+    virtual ~EventBatcherListener() {}
+
+    /**
+     * Deliver one event to its JS handler.
+     */
+    virtual void deliverEvent(NPIdentifier handler, NPVariant* args, uint32_t argCount) = 0;
+
+    /**
+     * Deliver @a events, an array of {"type": handler name, "args": [...]}
+     * objects in the order they were queued, in one call.
+     */
+    virtual void deliverEventBatch(pbnjson::JValue& events) = 0;
+
+    /**
+     * Name of @a handler, as used in the "type" of batched events.
+     */
+    virtual std::string eventName(NPIdentifier handler) = 0;
+};
+
+/**
+ * Holds back non-urgent JS notifications until the current main loop
+ * iteration is over, so a burst of messages from BrowserServer costs one
+ * transition into JS instead of one per message.
+ *
+ * Queued events with the same coalescing key are superseded by the newest
+ * one: only the last load progress or scroll position of a burst is worth
+ * delivering. Anything that must reach JS right away, and in order with the
+ * queued events, has to flush() first.
+ *
+ * Coalesced events can further be rate limited per handler, see setPolicy().
+ * Events a policy holds back are not lost: the newest one for each key is
+ * delivered once the policy allows, so the handler always ends up seeing the
+ * final state.
+ */
+class EventBatcher
+{
+public:
+
+    enum Coalesce {
+        CoalesceNone = 0,       ///< Deliver every occurrence
+        CoalesceHandler,        ///< Keep only the newest event for the handler
+        CoalesceFirstArg        ///< Keep only the newest event for the handler and first argument
+    };
+
+    EventBatcher(EventBatcherListener* listener, GMainContext* ctxt);
+    ~EventBatcher();
+
+    /**
+     * Queue an event for @a handler. Only null, boolean, number and string
+     * arguments can be queued, strings are copied.
+     */
+    void queue(NPIdentifier handler, const NPVariant* args, uint32_t argCount, Coalesce coalesce);
+
+    /**
+     * Deliver everything queued now, including events held back by a policy.
+     */
+    void flush();
+
+    /**
+     * Drop everything queued.
+     */
+    void clear();
+
+    /**
+     * Limit how often the coalesced events of @a handler are delivered.
+     *
+     * @param minIntervalMs Deliver at most one event per key every
+     *        @a minIntervalMs.
+     * @param minChange Hold back an event while none of its number arguments
+     *        moved by at least @a minChange since the last one delivered for
+     *        the key (and its other arguments are unchanged). Held events are
+     *        delivered kSettleMs later if nothing else came along.
+     *
+     * Both 0 removes the policy.
+     */
+    void setPolicy(NPIdentifier handler, uint32_t minIntervalMs, double minChange);
+
+    /**
+     * Deliver queued events through EventBatcherListener::deliverEventBatch()
+     * instead of one listener call each.
+     */
+    void setBatching(bool batching) {
+        m_batching = batching;
+    }
+    bool batching() const {
+        return m_batching;
+    }
+
+    uint32_t queuedCount() const {
+        return m_queuedCount;
+    }
+    uint32_t coalescedCount() const {
+        return m_coalescedCount;
+    }
+    uint32_t flushCount() const {
+        return m_flushCount;
+    }
+    uint32_t heldCount() const {
+        return m_heldCount;
+    }
+
+private:
+
+    static const uint32_t kSettleMs = 100;
+
+    struct Arg {
+        NPVariantType type;
+        bool boolValue;
+        int32_t intValue;
+        double doubleValue;
+        std::string stringValue;
+    };
+
+    struct Event {
+        NPIdentifier handler;
+        Coalesce coalesce;
+        std::vector<Arg> args;
+        uint64_t due;           ///< When a held event may go, see LatencyHistogram::now()
+    };
+
+    typedef std::deque<Event> EventQueue;
+
+    struct Admitted {
+        Event event;                    ///< Last one of its key that went into the queue
+        uint64_t time;                  ///< When it did
+    };
+
+    struct Policy {
+        Policy() : minIntervalUs(0), minChange(0) {}
+
+        uint64_t minIntervalUs;
+        double minChange;
+        std::vector<Admitted> admitted; ///< One per key
+    };
+
+    typedef std::map<NPIdentifier, Policy> PolicyMap;
+
+    static bool sameKey(const Event& a, const Event& b);
+    static bool sameArgs(const Event& a, const Event& b);
+    static bool changedBy(const Event& a, const Event& b, double minChange);
+    static void toVariant(const Arg& arg, NPVariant& variant);
+    static pbnjson::JValue toJson(const Arg& arg);
+
+    static Admitted* findAdmitted(Policy& policy, const Event& event);
+
+    bool admit(Policy& policy, const Event& event, uint64_t now, uint64_t& due);
+    void enqueue(const Event& event, uint64_t now);
+    void hold(const Event& event, uint64_t due);
+    void release(bool all);
+
+    void deliverQueued();
+    void deliverOne(const Event& event);
+    void deliverBatch();
+
+    void scheduleFlush();
+    void cancelFlush();
+    static gboolean flushCb(gpointer data);
+
+    void scheduleRelease(uint64_t due);
+    void cancelRelease();
+    static gboolean releaseCb(gpointer data);
+
+    EventBatcherListener* m_listener;
+    GMainContext* m_ctxt;
+    GSource* m_flushSource;
+    GSource* m_releaseSource;
+    uint64_t m_releaseDeadline;
+    EventQueue m_events;
+    EventQueue m_held;                  ///< Held back by a policy, oldest first
+    PolicyMap m_policies;
+    bool m_batching;
+    std::map<NPIdentifier, std::string> m_names;
+
+    uint32_t m_queuedCount;
+    uint32_t m_coalescedCount;
+    uint32_t m_flushCount;
+    uint32_t m_heldCount;
+};
+
+#endif /* EVENTBATCHER_H */
@@ -0,0 +1,218 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "FrozenSurfaceCache.h"
+#include "LatencyHistogram.h"
+
+static const char* const kDefaultDirectory = "/var/tmp/browser-adapter";
+static const char* const kFilePrefix = "frozen-";
+
+FrozenSurfaceCache* FrozenSurfaceCache::createFromEnvironment()
+{
+    const char* capacity = getenv("BROWSER_ADAPTER_FROZEN_CACHE_MB");
+    if (!capacity || atoi(capacity) <= 0)
+        return 0;
+
+    const char* directory = getenv("BROWSER_ADAPTER_FROZEN_CACHE_DIR");
+    if (!directory || !directory[0])
+        directory = kDefaultDirectory;
+
+    return new FrozenSurfaceCache(directory, (size_t) atoi(capacity) * 1024 * 1024);
+}
+
+FrozenSurfaceCache::FrozenSurfaceCache(const char* directory, size_t capacity)
+    : m_directory(directory)
+    , m_capacity(capacity)
+    , m_used(0)
+    , m_evictions(0)
+{
+    if (g_mkdir_with_parents(directory, S_IRWXU) != 0)
+        g_warning("%s: unable to create %s: %s", __FUNCTION__, directory, strerror(errno));
+
+    removeStaleFiles();
+
+    g_message("%s: up to %lu KB of frozen surfaces in %s", __FUNCTION__,
+              (unsigned long) (m_capacity / 1024), directory);
+}
+
+FrozenSurfaceCache::~FrozenSurfaceCache()
+{
+    while (!m_entries.empty())
+        drop(m_entries.begin());
+}
+
+/**
+ * Files are unlinked right after they are mapped, so only a process killed
+ * in between leaves one behind. Its name carries the pid.
+ */
+void FrozenSurfaceCache::removeStaleFiles()
+{
+    DIR* dir = opendir(m_directory.c_str());
+    if (!dir)
+        return;
+
+    size_t prefixLength = strlen(kFilePrefix);
+    while (struct dirent* entry = readdir(dir)) {
+
+        if (strncmp(entry->d_name, kFilePrefix, prefixLength) != 0)
+            continue;
+
+        pid_t pid = (pid_t) atoi(entry->d_name + prefixLength);
+        if (pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH))
+            continue;
+
+        std::string path = m_directory + "/" + entry->d_name;
+        if (unlink(path.c_str()) == 0)
+            g_message("%s: removed %s", __FUNCTION__, path.c_str());
+    }
+
+    closedir(dir);
+}
+
+/**
+ * @return a shared mapping of a new, already unlinked, file. NULL on failure.
+ */
+void* FrozenSurfaceCache::mapFile(size_t length)
+{
+    gchar* path = g_strdup_printf("%s/%s%d-XXXXXX", m_directory.c_str(), kFilePrefix, (int) getpid());
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        g_warning("%s: unable to create %s: %s", __FUNCTION__, path, strerror(errno));
+        g_free(path);
+        return 0;
+    }
+
+    // Allocate the blocks up front: with a merely truncated file a full disk
+    // would only show up as SIGBUS while copying into the mapping
+    void* data = MAP_FAILED;
+    int error = posix_fallocate(fd, 0, length);
+    if (error == 0) {
+        data = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            error = errno;
+    }
+
+    if (data == MAP_FAILED)
+        g_warning("%s: unable to map %lu bytes: %s", __FUNCTION__, (unsigned long) length, strerror(error));
+
+    // The mapping keeps the file alive
+    unlink(path);
+    close(fd);
+    g_free(path);
+
+    return data == MAP_FAILED ? 0 : data;
+}
+
+QImage* FrozenSurfaceCache::spill(FrozenSurfaceCacheListener* owner, const QImage& image)
+{
+    release(owner);
+
+    size_t length = image.byteCount();
+    if (image.isNull() || length > m_capacity)
+        return 0;
+
+    while (m_used + length > m_capacity) {
+        if (!evictLeastRecentlyUsed())
+            return 0;
+    }
+
+    void* data = mapFile(length);
+    if (!data)
+        return 0;
+
+    ::memcpy(data, image.bits(), length);
+
+    // Start writing it out now so the pages are clean, and cheap to drop,
+    // by the time memory runs short
+    msync(data, length, MS_ASYNC);
+
+    Entry entry;
+    entry.data = data;
+    entry.length = length;
+    entry.image = new QImage((uchar*) data, image.width(), image.height(), image.bytesPerLine(), image.format());
+    entry.lastUsed = LatencyHistogram::now();
+
+    m_entries[owner] = entry;
+    m_used += length;
+
+    return entry.image;
+}
+
+void FrozenSurfaceCache::release(FrozenSurfaceCacheListener* owner)
+{
+    EntryMap::iterator it = m_entries.find(owner);
+    if (it != m_entries.end())
+        drop(it);
+}
+
+void FrozenSurfaceCache::touch(FrozenSurfaceCacheListener* owner)
+{
+    EntryMap::iterator it = m_entries.find(owner);
+    if (it != m_entries.end())
+        it->second.lastUsed = LatencyHistogram::now();
+}
+
+void FrozenSurfaceCache::drop(EntryMap::iterator it)
+{
+    // The image refers to the mapping, it goes first
+    delete it->second.image;
+    munmap(it->second.data, it->second.length);
+
+    m_used -= it->second.length;
+    m_entries.erase(it);
+}
+
+/**
+ * @return false if there is nothing left to evict.
+ */
+bool FrozenSurfaceCache::evictLeastRecentlyUsed()
+{
+    if (m_entries.empty())
+        return false;
+
+    EntryMap::iterator oldest = m_entries.begin();
+    for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->second.lastUsed < oldest->second.lastUsed)
+            oldest = it;
+    }
+
+    FrozenSurfaceCacheListener* owner = oldest->first;
+    owner->frozenSurfaceEvicted();
+
+    // The listener may have released it already
+    EntryMap::iterator it = m_entries.find(owner);
+    if (it != m_entries.end())
+        drop(it);
+
+    m_evictions++;
+    return true;
+}
@@ -0,0 +1,122 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef FROZENSURFACECACHE_H
+#define FROZENSURFACECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+
+#include <QImage>
+
+class FrozenSurfaceCacheListener
+{
+public:
+
+    FrozenSurfaceCacheListener() {}
+    virtual ~FrozenSurfaceCacheListener() {}
+
+    /**
+     * The surface spilled for this listener is about to be dropped to make
+     * room. The image must not be used once this returns, copy it if it is
+     * still needed.
+     */
+    virtual void frozenSurfaceEvicted() = 0;
+};
+
+/**
+ * Frozen surfaces kept in memory mapped files instead of the heap, so the
+ * kernel can write them out and drop their pages under memory pressure and
+ * fault them back in when a frozen card is painted.
+ *
+ * Each surface gets its own file in the cache directory, unlinked as soon as
+ * it is mapped: nothing is left behind if the process dies. Files of dead
+ * processes that crashed before unlinking are removed when a cache is
+ * created. Once the cache holds @a capacity bytes the least recently painted
+ * surfaces are evicted.
+ */
+class FrozenSurfaceCache
+{
+public:
+
+    /**
+     * Set up from BROWSER_ADAPTER_FROZEN_CACHE_MB, the capacity, and
+     * BROWSER_ADAPTER_FROZEN_CACHE_DIR.
+     *
+     * @return NULL if not enabled.
+     */
+    static FrozenSurfaceCache* createFromEnvironment();
+
+    FrozenSurfaceCache(const char* directory, size_t capacity);
+    ~FrozenSurfaceCache();
+
+    /**
+     * Copy @a image into a mapped file, replacing what was spilled for
+     * @a owner before.
+     *
+     * @return the mapped image, owned by the cache until release() or
+     *         eviction. NULL if it could not be spilled.
+     */
+    QImage* spill(FrozenSurfaceCacheListener* owner, const QImage& image);
+
+    /**
+     * Drop what was spilled for @a owner, if anything.
+     */
+    void release(FrozenSurfaceCacheListener* owner);
+
+    /**
+     * @a owner's surface was just used, it is evicted last.
+     */
+    void touch(FrozenSurfaceCacheListener* owner);
+
+    size_t used() const {
+        return m_used;
+    }
+    size_t capacity() const {
+        return m_capacity;
+    }
+    uint32_t evictions() const {
+        return m_evictions;
+    }
+
+private:
+
+    struct Entry {
+        void* data;
+        size_t length;
+        QImage* image;
+        uint64_t lastUsed;          ///< See LatencyHistogram::now()
+    };
+
+    typedef std::map<FrozenSurfaceCacheListener*, Entry> EntryMap;
+
+    void removeStaleFiles();
+    void* mapFile(size_t length);
+    void drop(EntryMap::iterator it);
+    bool evictLeastRecentlyUsed();
+
+    std::string m_directory;
+    size_t m_capacity;
+    size_t m_used;
+    uint32_t m_evictions;
+    EntryMap m_entries;
+};
+
+#endif /* FROZENSURFACECACHE_H */
@@ -0,0 +1,197 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include "HitTestCache.h"
+#include "LatencyHistogram.h"
+
+HitTestCache::HitTestCache()
+    : m_next(0)
+    , m_generation(0)
+    , m_hits(0)
+    , m_misses(0)
+{
+}
+
+void HitTestCache::setGeneration(uint32_t generation)
+{
+    if (generation != m_generation) {
+        clear();
+        m_generation = generation;
+    }
+}
+
+void HitTestCache::clear()
+{
+    m_entries.clear();
+    m_next = 0;
+}
+
+void HitTestCache::trim()
+{
+    std::vector<Entry>().swap(m_entries);
+    m_next = 0;
+}
+
+HitTestCache::Entry& HitTestCache::store(What what, int left, int top, int right, int bottom)
+{
+    Entry* entry;
+    if ((int) m_entries.size() < kMaxEntries) {
+        m_entries.push_back(Entry());
+        entry = &m_entries.back();
+    }
+    else {
+        entry = &m_entries[m_next];
+        m_next = (m_next + 1) % kMaxEntries;
+    }
+
+    entry->what = what;
+    entry->left = left;
+    entry->top = top;
+    entry->right = right;
+    entry->bottom = bottom;
+    entry->time = LatencyHistogram::now();
+
+    return *entry;
+}
+
+/**
+ * Newest matching entry first so a fresher reply wins over an older one
+ * covering the same point.
+ */
+HitTestCache::Entry* HitTestCache::find(What what, int x, int y)
+{
+    int count = m_entries.size();
+    uint64_t oldest = LatencyHistogram::now() - (uint64_t) kTtlMs * 1000;
+
+    for (int n = 1; n <= count; n++) {
+        int i = count < kMaxEntries ? count - n : (m_next - n + kMaxEntries) % kMaxEntries;
+        Entry* entry = &m_entries[i];
+
+        if (entry->time < oldest)
+            break; // everything older has expired too
+
+        if (entry->what == what
+            && x >= entry->left && x < entry->right
+            && y >= entry->top && y < entry->bottom)
+            return entry;
+    }
+
+    return 0;
+}
+
+void HitTestCache::putInteractive(int x, int y, bool interactive)
+{
+    store(WhatInteractive, x, y, x + 1, y + 1).interactive = interactive;
+}
+
+void HitTestCache::putUrl(int x, int y, const CachedUrl& url)
+{
+    // A link covers its whole rect, anything else is only known for the point
+    bool isLink = url.succeeded && !url.url.empty()
+                  && url.left <= x && x < url.right && url.top <= y && y < url.bottom;
+
+    Entry& entry = isLink ? store(WhatUrl, url.left, url.top, url.right, url.bottom)
+                          : store(WhatUrl, x, y, x + 1, y + 1);
+    entry.url = url;
+}
+
+void HitTestCache::putElement(int x, int y, const CachedElement& element)
+{
+    // A child element may cover other points in the bounds, so the point only
+    store(WhatElement, x, y, x + 1, y + 1).element = element;
+}
+
+void HitTestCache::putHitTest(int x, int y, const char* json)
+{
+    if (json)
+        store(WhatHitTest, x, y, x + 1, y + 1).json = json;
+}
+
+void HitTestCache::dropHitTests()
+{
+    // An empty region matches no point, the entry stays in the ring so the
+    // newest first scan in find() keeps its order
+    for (std::vector<Entry>::iterator i = m_entries.begin(); i != m_entries.end(); ++i) {
+        if (i->what == WhatHitTest)
+            i->right = i->left;
+    }
+}
+
+size_t HitTestCache::memoryUsage() const
+{
+    size_t bytes = m_entries.capacity() * sizeof(Entry);
+
+    for (std::vector<Entry>::const_iterator i = m_entries.begin(); i != m_entries.end(); ++i) {
+        bytes += i->url.url.capacity() + i->url.desc.capacity()
+                 + i->element.element.capacity() + i->element.id.capacity()
+                 + i->element.name.capacity() + i->element.cname.capacity()
+                 + i->element.type.capacity() + i->json.capacity();
+    }
+
+    return bytes;
+}
+
+void HitTestCache::countLookup(const Entry* entry)
+{
+    if (entry)
+        m_hits++;
+    else
+        m_misses++;
+}
+
+bool HitTestCache::findInteractive(int x, int y, bool& interactive)
+{
+    Entry* entry = find(WhatInteractive, x, y);
+    if (entry) {
+        interactive = entry->interactive;
+        m_hits++;
+        return true;
+    }
+
+    // Links are interactive
+    entry = find(WhatUrl, x, y);
+    if (entry && entry->url.succeeded && !entry->url.url.empty()) {
+        interactive = true;
+        m_hits++;
+        return true;
+    }
+
+    m_misses++;
+    return false;
+}
+
+const HitTestCache::CachedUrl* HitTestCache::findUrl(int x, int y)
+{
+    Entry* entry = find(WhatUrl, x, y);
+    countLookup(entry);
+    return entry ? &entry->url : 0;
+}
+
+const HitTestCache::CachedElement* HitTestCache::findElement(int x, int y)
+{
+    Entry* entry = find(WhatElement, x, y);
+    countLookup(entry);
+    return entry ? &entry->element : 0;
+}
+
+const char* HitTestCache::findHitTest(int x, int y)
+{
+    Entry* entry = find(WhatHitTest, x, y);
+    countLookup(entry);
+    return entry ? entry->json.c_str() : 0;
+}
@@ -0,0 +1,132 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef HITTESTCACHE_H
+#define HITTESTCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * What BrowserServer last told us about the page under a document point, so
+ * point queries can be answered without a round trip.
+ *
+ * Every entry covers the region its reply is known to hold for: the bounds of
+ * the link for an inspectUrlAtPoint reply, the queried point otherwise. All
+ * entries are dropped when the document generation changes, which includes
+ * every paint, and each one expires kTtlMs after it was stored. The cache holds at most kMaxEntries,
+ * replacing the oldest.
+ */
+class HitTestCache
+{
+public:
+
+    struct CachedUrl {
+        bool succeeded;
+        std::string url;
+        std::string desc;
+        int left, top, right, bottom;
+    };
+
+    struct CachedElement {
+        bool succeeded;
+        std::string element;
+        std::string id;
+        std::string name;
+        std::string cname;
+        std::string type;
+        int left, top, right, bottom;
+        bool isEditable;
+    };
+
+    HitTestCache();
+
+    /**
+     * Drops everything if @a generation differs from that of the cached entries.
+     */
+    void setGeneration(uint32_t generation);
+    void clear();
+
+    /// Like clear(), and gives the memory of the entries back too
+    void trim();
+
+    void putInteractive(int x, int y, bool interactive);
+    void putUrl(int x, int y, const CachedUrl& url);
+    void putElement(int x, int y, const CachedElement& element);
+    void putHitTest(int x, int y, const char* json);
+
+    /// Forget every hit test reply, e.g. once a click may have changed the page
+    void dropHitTests();
+
+    /**
+     * @return true and sets @a interactive if known for (@a x, @a y).
+     */
+    bool findInteractive(int x, int y, bool& interactive);
+
+    /// @return NULL if unknown. Valid until the next put or clear.
+    const CachedUrl* findUrl(int x, int y);
+    const CachedElement* findElement(int x, int y);
+    const char* findHitTest(int x, int y);
+
+    /// Approximate bytes held by the entries
+    size_t memoryUsage() const;
+
+    uint32_t hits() const {
+        return m_hits;
+    }
+    uint32_t misses() const {
+        return m_misses;
+    }
+
+private:
+
+    static const int kMaxEntries = 32;
+    static const uint32_t kTtlMs = 2000;
+
+    enum What {
+        WhatInteractive = 0,
+        WhatUrl,
+        WhatElement,
+        WhatHitTest
+    };
+
+    struct Entry {
+        What what;
+        int left, top, right, bottom;   ///< Region the entry holds for, right/bottom exclusive
+        uint64_t time;                  ///< When stored, see LatencyHistogram::now()
+
+        bool interactive;
+        CachedUrl url;
+        CachedElement element;
+        std::string json;
+    };
+
+    Entry& store(What what, int left, int top, int right, int bottom);
+    Entry* find(What what, int x, int y);
+    void countLookup(const Entry* entry);
+
+    std::vector<Entry> m_entries;
+    int m_next;                 ///< Slot the next entry goes to once full
+    uint32_t m_generation;
+    uint32_t m_hits;
+    uint32_t m_misses;
+};
+
+#endif /* HITTESTCACHE_H */
@@ -19,13 +19,11 @@ LICENSE@@@ */
 #ifndef IMAGEINFO_H
 #define IMAGEINFO_H
 
-#include <npupp.h>
-#include <npapi.h>
-#include <string>
+#include "NPPropertyBag.h"
 
 class BrowserAdapter;
 
-class ImageInfo : public NPObject
+class ImageInfo : public NPPropertyBag<ImageInfo>
 {
 public:
     ImageInfo(BrowserAdapter *adapter);
@@ -35,34 +33,14 @@ public:
 
     void initialize(bool success, const char* baseUri, const char* src, const char* title,
                     const char* altText, int32_t width, int32_t height, const char* mimeType);
-    void invalidate();
-    bool hasMethod(NPIdentifier name);
-    bool invoke(NPIdentifier name, const NPVariant *args, uint32_t argCount, NPVariant *result);
-    bool invokeDefault(const NPVariant *args, uint32_t argCount, NPVariant *result);
-    bool hasProperty(NPIdentifier name);
-    bool getProperty(NPIdentifier name, NPVariant *result);
-    bool setProperty(NPIdentifier name, const NPVariant *value);
-    bool removeProperty(NPIdentifier name);
-    bool enumerate(NPIdentifier **value, uint32_t *count);
-    bool construct(const NPVariant *args, int32_t argCount, NPVariant *result);
 
+private:
+    friend class NPPropertyBag<ImageInfo>;
 
-    // Private NP Object callbacks, used for JavaScript integration.
-    // (these translate into appropriate non-static method calls).
-    static NPObject* PrvObjAllocate(NPP npp, NPClass* klass);
-    static void PrvObjDeallocate(NPObject* obj);
-    static void PrvObjInvalidate(NPObject* obj);
-    static bool PrvObjHasMethod(NPObject* obj, NPIdentifier name);
-    static bool PrvObjInvoke(NPObject *obj, NPIdentifier name, const NPVariant *args, uint32_t argCount, NPVariant *result);
-    static bool PrvObjInvokeDefault(NPObject *obj, const NPVariant *args, uint32_t argCount, NPVariant *result);
-    static bool PrvObjHasProperty(NPObject *obj, NPIdentifier name);
-    static bool PrvObjGetProperty(NPObject *obj, NPIdentifier name, NPVariant *result);
-    static bool PrvObjSetProperty(NPObject *obj, NPIdentifier name, const NPVariant *value);
-    static bool PrvObjRemoveProperty(NPObject *obj, NPIdentifier name);
-    static bool PrvObjEnumerate(NPObject *obj, NPIdentifier **value, uint32_t *count);
-    static bool PrvObjConstruct(NPObject *obj, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const NPPropertyField sFields[];
+    static NPPropertyIndex sIndex;
+    static NPObjectPool<ImageInfo> sPool;
 
-private:
     bool m_success;
     std::string	m_baseUri;
     std::string	m_src;
@@ -74,6 +52,3 @@ private:
 };
 
 #endif
-
-
-
@@ -0,0 +1,344 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <YapPacket.h>
+
+#include "IpcReceiver.h"
+#include "IpcTrace.h"
+#include "JsonSchemaRegistry.h"
+#include "Debug.h"
+
+// Messages whose JSON argument is parsed on the reader thread
+static const int16_t kMsgAddFlashRects = 0x2037;
+static const int16_t kMsgRemoveFlashRects = 0x2038;
+
+// Longest the main thread spends draining messages before it lets other
+// sources (painting, input) run
+static const uint64_t kDrainBudgetUs = 8000;
+
+IpcReceiveThread* IpcReceiveThread::s_instance = 0;
+
+GSourceFuncs IpcReceiver::s_sourceFuncs = {
+    IpcReceiver::sourcePrepare,
+    IpcReceiver::sourceCheck,
+    IpcReceiver::sourceDispatch,
+    NULL
+};
+
+struct IpcReceiverSource {
+    GSource source;
+    IpcReceiver* receiver;
+};
+
+// -----------------------------------------------------------------------------------
+// IpcMessage
+// -----------------------------------------------------------------------------------
+
+IpcMessage::IpcMessage(Type t)
+    : type(t)
+    , msgId(0)
+    , data(0)
+    , length(0)
+    , hasJson(false)
+{
+}
+
+IpcMessage::~IpcMessage()
+{
+    g_free(data);
+}
+
+// -----------------------------------------------------------------------------------
+// IpcMessageQueue
+// -----------------------------------------------------------------------------------
+
+IpcMessageQueue::IpcMessageQueue()
+{
+    m_head = m_tail = new Node;
+    m_head->msg = 0;
+    m_head->next = 0;
+}
+
+IpcMessageQueue::~IpcMessageQueue()
+{
+    while (IpcMessage* msg = pop())
+        delete msg;
+
+    delete m_head;
+}
+
+void IpcMessageQueue::push(IpcMessage* msg)
+{
+    Node* node = new Node;
+    node->msg = msg;
+    node->next = 0;
+
+    // Publish the node only once it is fully written
+    __sync_synchronize();
+    m_tail->next = node;
+    m_tail = node;
+}
+
+IpcMessage* IpcMessageQueue::pop()
+{
+    Node* next = m_head->next;
+    if (!next)
+        return 0;
+
+    __sync_synchronize();
+
+    // next becomes the consumed node, the old one is no longer reachable by the producer
+    IpcMessage* msg = next->msg;
+    next->msg = 0;
+
+    delete m_head;
+    m_head = next;
+
+    return msg;
+}
+
+bool IpcMessageQueue::isEmpty() const
+{
+    return m_head->next == 0;
+}
+
+// -----------------------------------------------------------------------------------
+// IpcReceiveThread
+// -----------------------------------------------------------------------------------
+
+GMainContext* IpcReceiveThread::clientContext(GMainContext* mainCtxt)
+{
+    static bool s_startFailed = false;
+
+    if (!s_instance && !s_startFailed && getenv("BROWSER_ADAPTER_IPC_THREAD")) {
+        IpcReceiveThread* t = new IpcReceiveThread(mainCtxt);
+        if (t->start()) {
+            s_instance = t;
+        }
+        else {
+            // Carry on with the clients on the main loop
+            delete t;
+            s_startFailed = true;
+        }
+    }
+
+    return s_instance ? s_instance->m_ctxt : mainCtxt;
+}
+
+IpcReceiveThread* IpcReceiveThread::instance()
+{
+    return s_instance;
+}
+
+IpcReceiveThread::IpcReceiveThread(GMainContext* mainCtxt)
+    : m_mainCtxt(mainCtxt)
+    , m_ctxt(g_main_context_new())
+    , m_pauseRequested(0)
+    , m_pauseCount(0)
+{
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+IpcReceiveThread::~IpcReceiveThread()
+{
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_lock);
+    g_main_context_unref(m_ctxt);
+}
+
+bool IpcReceiveThread::start()
+{
+    if (pthread_create(&m_thread, NULL, threadMain, this) != 0) {
+        g_critical("Unable to start the IPC reader thread");
+        return false;
+    }
+
+    g_message("IPC reader thread started");
+    return true;
+}
+
+bool IpcReceiveThread::isCurrent() const
+{
+    return pthread_equal(pthread_self(), m_thread);
+}
+
+void* IpcReceiveThread::threadMain(void* data)
+{
+    IpcReceiveThread* t = (IpcReceiveThread*) data;
+
+    pthread_mutex_lock(&t->m_lock);
+
+    for (;;) {
+        while (g_atomic_int_get(&t->m_pauseRequested))
+            pthread_cond_wait(&t->m_cond, &t->m_lock);
+
+        g_main_context_iteration(t->m_ctxt, TRUE);
+    }
+
+    pthread_mutex_unlock(&t->m_lock);
+    return 0;
+}
+
+void IpcReceiveThread::pause()
+{
+    if (m_pauseCount++ > 0)
+        return;
+
+    // Get the reader out of poll() and wait until it parks in pthread_cond_wait()
+    g_atomic_int_set(&m_pauseRequested, 1);
+    g_main_context_wakeup(m_ctxt);
+    pthread_mutex_lock(&m_lock);
+}
+
+void IpcReceiveThread::resume()
+{
+    if (--m_pauseCount > 0)
+        return;
+
+    g_atomic_int_set(&m_pauseRequested, 0);
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void IpcReceiveThread::pauseUntilIdle()
+{
+    pause();
+
+    // By then the client has been destroyed all the way down to YapClient
+    GSource* source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_HIGH);
+    g_source_set_callback(source, resumeCb, this /*data*/, NULL);
+    g_source_attach(source, m_mainCtxt);
+    g_source_unref(source);
+}
+
+gboolean IpcReceiveThread::resumeCb(gpointer data)
+{
+    ((IpcReceiveThread*) data)->resume();
+    return FALSE;
+}
+
+// -----------------------------------------------------------------------------------
+// IpcReceiver
+// -----------------------------------------------------------------------------------
+
+IpcReceiver::IpcReceiver(IpcReceiverListener* listener, GMainContext* mainCtxt)
+    : m_listener(listener)
+    , m_mainCtxt(mainCtxt)
+    , m_source(0)
+{
+    m_source = g_source_new(&s_sourceFuncs, sizeof(IpcReceiverSource));
+    ((IpcReceiverSource*) m_source)->receiver = this;
+    g_source_attach(m_source, m_mainCtxt);
+}
+
+IpcReceiver::~IpcReceiver()
+{
+    g_source_destroy(m_source);
+    g_source_unref(m_source);
+}
+
+void IpcReceiver::post(YapPacket* packet)
+{
+    const uint8_t* bytes = 0;
+    uint32_t length = 0;
+    if (!IpcTracePacketBytes(packet, bytes, length))
+        return;
+
+    IpcMessage* msg = new IpcMessage(IpcMessage::Message);
+    msg->data = (uint8_t*) g_memdup(bytes, length);
+    msg->length = length;
+
+    YapPacket* copy = IpcTraceCreatePacket(msg->data, msg->length);
+    (*copy) >> msg->msgId;
+
+    if (msg->msgId == kMsgAddFlashRects || msg->msgId == kMsgRemoveFlashRects) {
+
+        char* json = 0;
+        (*copy) >> json;
+
+        if (json) {
+            pbnjson::JDomParser parser(NULL);
+            const pbnjson::JSchema& schema = msg->msgId == kMsgAddFlashRects
+                ? JsonSchemaRegistry::forServerMessage(JsonSchemaRegistry::SchemaInteractiveWidgetRect)
+                : JsonSchemaRegistry::get(JsonSchemaRegistry::SchemaAny);
+            bool parsed = parser.parse(json, schema, NULL);
+
+            // A failure is reported again when the main thread parses it
+            if (parsed) {
+                msg->json = parser.getDom();
+                msg->hasJson = true;
+            }
+            free(json);
+        }
+    }
+
+    delete copy;
+
+    push(msg);
+}
+
+void IpcReceiver::postDisconnected()
+{
+    push(new IpcMessage(IpcMessage::Disconnected));
+}
+
+void IpcReceiver::push(IpcMessage* msg)
+{
+    m_queue.push(msg);
+    g_main_context_wakeup(m_mainCtxt);
+}
+
+/**
+ * Delivers queued messages until the queue is empty or the budget is spent.
+ * Whatever is left is picked up by the next main loop iteration.
+ */
+void IpcReceiver::drain()
+{
+    uint64_t deadline = IpcTraceMonotonicTime() + kDrainBudgetUs;
+
+    while (IpcMessage* msg = m_queue.pop()) {
+
+        m_listener->ipcMessageReceived(msg);
+        delete msg;
+
+        if (IpcTraceMonotonicTime() >= deadline)
+            break;
+    }
+}
+
+gboolean IpcReceiver::sourcePrepare(GSource* source, gint* timeout)
+{
+    *timeout = -1;
+    return !((IpcReceiverSource*) source)->receiver->m_queue.isEmpty();
+}
+
+gboolean IpcReceiver::sourceCheck(GSource* source)
+{
+    return !((IpcReceiverSource*) source)->receiver->m_queue.isEmpty();
+}
+
+gboolean IpcReceiver::sourceDispatch(GSource* source, GSourceFunc callback, gpointer data)
+{
+    ((IpcReceiverSource*) source)->receiver->drain();
+    return TRUE;
+}
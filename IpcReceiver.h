@@ -0,0 +1,181 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef IPCRECEIVER_H
+#define IPCRECEIVER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <glib.h>
+#include <pbnjson.hpp>
+
+class YapPacket;
+
+/**
+ * Receiving BrowserServer messages on a dedicated thread.
+ *
+ * When enabled (BROWSER_ADAPTER_IPC_THREAD) every adapter's YapClient is
+ * attached to the GMainContext of a single reader thread. Messages are copied
+ * and partially decoded there, then handed to the GLib main thread through a
+ * per adapter lock-free queue. The main thread drains the queue from its own
+ * GSource with a time budget so a burst of messages can't hold off painting
+ * and input for long. All msg* handlers still run on the main thread.
+ */
+
+struct IpcMessage {
+
+    enum Type {
+        Message = 0,
+        Disconnected        ///< The server connection was lost
+    };
+
+    Type type;
+    int16_t msgId;
+    uint8_t* data;          ///< Serialized message, owned
+    uint32_t length;
+
+    bool hasJson;           ///< json holds the pre-parsed JSON argument
+    pbnjson::JValue json;
+
+    IpcMessage(Type t);
+    ~IpcMessage();
+};
+
+/**
+ * Unbounded single producer, single consumer queue. The producer never
+ * blocks so the reader thread can't stall on a busy main thread.
+ */
+class IpcMessageQueue
+{
+public:
+
+    IpcMessageQueue();
+    ~IpcMessageQueue();
+
+    /// Producer side
+    void push(IpcMessage* msg);
+
+    /// Consumer side, NULL if empty
+    IpcMessage* pop();
+    bool isEmpty() const;
+
+private:
+
+    struct Node {
+        IpcMessage* msg;
+        Node* volatile next;
+    };
+
+    Node* m_head;           ///< Consumer owned, always a consumed node
+    Node* m_tail;           ///< Producer owned
+};
+
+/**
+ * The process wide reader thread.
+ */
+class IpcReceiveThread
+{
+public:
+
+    /**
+     * The context a YapClient should be attached to: the reader thread's if
+     * enabled (starting it on first use), @a mainCtxt otherwise.
+     */
+    static GMainContext* clientContext(GMainContext* mainCtxt);
+
+    /**
+     * @return the reader thread or NULL if not enabled.
+     */
+    static IpcReceiveThread* instance();
+
+    bool isCurrent() const;
+
+    /**
+     * Stops the reader thread from dispatching until the main loop is idle
+     * again. Used while a client is being destroyed.
+     */
+    void pauseUntilIdle();
+
+private:
+
+    IpcReceiveThread(GMainContext* mainCtxt);
+    ~IpcReceiveThread();     ///< Only used when the thread failed to start
+
+    bool start();
+    void pause();
+    void resume();
+
+    static void* threadMain(void* data);
+    static gboolean resumeCb(gpointer data);
+
+    static IpcReceiveThread* s_instance;
+
+    GMainContext* m_mainCtxt;
+    GMainContext* m_ctxt;
+    pthread_t m_thread;
+    pthread_mutex_t m_lock;         ///< Held by the reader thread while dispatching
+    pthread_cond_t m_cond;
+    volatile gint m_pauseRequested;
+    int m_pauseCount;               ///< Main thread only
+};
+
+class IpcReceiverListener
+{
+public:
+
+    IpcReceiverListener() {}
+    virtual ~IpcReceiverListener() {}
+
+    /**
+     * Called on the main thread for every received message, in order.
+     */
+    virtual void ipcMessageReceived(IpcMessage* msg) = 0;
+};
+
+/**
+ * Per client queue between the reader thread and the main thread.
+ */
+class IpcReceiver
+{
+public:
+
+    IpcReceiver(IpcReceiverListener* listener, GMainContext* mainCtxt);
+    ~IpcReceiver();
+
+    /// Reader thread: copies and pre-decodes @a packet
+    void post(YapPacket* packet);
+    void postDisconnected();
+
+private:
+
+    void push(IpcMessage* msg);
+    void drain();
+
+    static gboolean sourcePrepare(GSource* source, gint* timeout);
+    static gboolean sourceCheck(GSource* source);
+    static gboolean sourceDispatch(GSource* source, GSourceFunc callback, gpointer data);
+
+    static GSourceFuncs s_sourceFuncs;
+
+    IpcReceiverListener* m_listener;
+    GMainContext* m_mainCtxt;
+    GSource* m_source;
+    IpcMessageQueue m_queue;
+};
+
+#endif /* IPCRECEIVER_H */
@@ -0,0 +1,329 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <YapPacket.h>
+
+#include "IpcTrace.h"
+#include "Debug.h"
+
+static const uint32_t kIpcTraceMagic = 0x43504942; // "BIPC"
+static const uint16_t kIpcTraceVersion = 1;
+
+// Upper bound for a single record, anything larger is treated as corruption
+static const uint32_t kMaxRecordLength = 64 * 1024 * 1024;
+
+// Records delivered per main loop dispatch when replaying at maximum speed
+static const int kMaxSpeedBatch = 32;
+
+uint64_t IpcTraceMonotonicTime()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool IpcTracePacketBytes(YapPacket* packet, const uint8_t*& data, uint32_t& length)
+{
+    if (!packet)
+        return false;
+
+    data = packet->data();
+    length = packet->length();
+
+    return data != 0;
+}
+
+YapPacket* IpcTraceCreatePacket(uint8_t* data, uint32_t length)
+{
+    YapPacket* packet = new YapPacket(data, length);
+    packet->setReadTotalLength(length);
+    return packet;
+}
+
+YapPacket* IpcTraceCreateWritePacket(uint8_t* data, uint32_t capacity)
+{
+    return new YapPacket(data, capacity);
+}
+
+// -----------------------------------------------------------------------------------
+// IpcTraceRecorder
+// -----------------------------------------------------------------------------------
+
+IpcTraceRecorder* IpcTraceRecorder::create(const char* path)
+{
+    if (!path)
+        return 0;
+
+    FILE* file = ::fopen(path, "wb");
+    if (!file) {
+        g_warning("Unable to create IPC trace file %s", path);
+        return 0;
+    }
+
+    IpcTraceFileHeader header;
+    ::memset(&header, 0, sizeof(header));
+    header.magic = kIpcTraceMagic;
+    header.version = kIpcTraceVersion;
+
+    if (::fwrite(&header, sizeof(header), 1, file) != 1) {
+        g_warning("Unable to write IPC trace header to %s", path);
+        ::fclose(file);
+        return 0;
+    }
+
+    return new IpcTraceRecorder(file, path);
+}
+
+IpcTraceRecorder::IpcTraceRecorder(FILE* file, const char* path)
+    : m_file(file)
+    , m_path(::strdup(path))
+    , m_startTime(IpcTraceMonotonicTime())
+    , m_recordCount(0)
+{
+    g_message("IPC trace started: %s", m_path);
+}
+
+IpcTraceRecorder::~IpcTraceRecorder()
+{
+    g_message("IPC trace stopped: %s, %u records", m_path, m_recordCount);
+
+    ::fclose(m_file);
+    ::free(m_path);
+}
+
+void IpcTraceRecorder::record(IpcTraceDirection direction, YapPacket* packet)
+{
+    const uint8_t* data = 0;
+    uint32_t length = 0;
+
+    if (IpcTracePacketBytes(packet, data, length))
+        record(direction, data, length);
+}
+
+void IpcTraceRecorder::record(IpcTraceDirection direction, const uint8_t* data, uint32_t length)
+{
+    IpcTraceRecordHeader header;
+    ::memset(&header, 0, sizeof(header));
+    header.timestamp = IpcTraceMonotonicTime() - m_startTime;
+    header.length = length;
+    header.direction = direction;
+
+    if (::fwrite(&header, sizeof(header), 1, m_file) != 1
+            || (length && ::fwrite(data, length, 1, m_file) != 1)) {
+        TRACEF("failed to write record %u", m_recordCount);
+        return;
+    }
+
+    m_recordCount++;
+}
+
+// -----------------------------------------------------------------------------------
+// IpcTraceReader
+// -----------------------------------------------------------------------------------
+
+IpcTraceReader* IpcTraceReader::open(const char* path)
+{
+    if (!path)
+        return 0;
+
+    FILE* file = ::fopen(path, "rb");
+    if (!file) {
+        g_warning("Unable to open IPC trace file %s", path);
+        return 0;
+    }
+
+    IpcTraceFileHeader header;
+    if (::fread(&header, sizeof(header), 1, file) != 1
+            || header.magic != kIpcTraceMagic
+            || header.version != kIpcTraceVersion) {
+        g_warning("%s is not a supported IPC trace file", path);
+        ::fclose(file);
+        return 0;
+    }
+
+    return new IpcTraceReader(file);
+}
+
+IpcTraceReader::IpcTraceReader(FILE* file)
+    : m_file(file)
+    , m_buffer(0)
+    , m_bufferSize(0)
+{
+}
+
+IpcTraceReader::~IpcTraceReader()
+{
+    ::fclose(m_file);
+    g_free(m_buffer);
+}
+
+bool IpcTraceReader::next(IpcTraceRecordHeader& header, uint8_t*& data)
+{
+    if (::fread(&header, sizeof(header), 1, m_file) != 1)
+        return false;
+
+    if (header.length > kMaxRecordLength) {
+        g_warning("IPC trace record too large: %u", header.length);
+        return false;
+    }
+
+    if (header.length > m_bufferSize) {
+        m_buffer = (uint8_t*) g_realloc(m_buffer, header.length);
+        m_bufferSize = header.length;
+    }
+
+    if (header.length && ::fread(m_buffer, header.length, 1, m_file) != 1) {
+        TRACEF("truncated record");
+        return false;
+    }
+
+    data = m_buffer;
+    return true;
+}
+
+// -----------------------------------------------------------------------------------
+// IpcTraceReplayer
+// -----------------------------------------------------------------------------------
+
+IpcTraceReplayer::IpcTraceReplayer(IpcTraceReader* reader, IpcTraceDirection direction,
+                                   IpcTraceReplayListener* listener, GMainContext* ctxt,
+                                   bool maxSpeed)
+    : m_reader(reader)
+    , m_direction(direction)
+    , m_listener(listener)
+    , m_glibCtxt(ctxt)
+    , m_maxSpeed(maxSpeed)
+    , m_timerSource(0)
+    , m_startTime(0)
+    , m_replayedCount(0)
+    , m_havePending(false)
+    , m_pendingData(0)
+{
+    ::memset(&m_pendingHeader, 0, sizeof(m_pendingHeader));
+}
+
+IpcTraceReplayer::~IpcTraceReplayer()
+{
+    stop();
+    delete m_reader;
+}
+
+void IpcTraceReplayer::start()
+{
+    if (m_timerSource)
+        return;
+
+    if (!m_havePending && !readNext()) {
+        m_listener->replayFinished();
+        return;
+    }
+
+    // Play the first record right away and keep the relative timing of the rest
+    m_startTime = IpcTraceMonotonicTime() - m_pendingHeader.timestamp;
+    scheduleNext();
+}
+
+void IpcTraceReplayer::stop()
+{
+    if (m_timerSource) {
+        g_source_destroy(m_timerSource);
+        g_source_unref(m_timerSource);
+        m_timerSource = 0;
+    }
+}
+
+/**
+ * Advances to the next record of the replayed direction.
+ */
+bool IpcTraceReplayer::readNext()
+{
+    m_havePending = false;
+
+    while (m_reader->next(m_pendingHeader, m_pendingData)) {
+        if (m_pendingHeader.direction == m_direction) {
+            m_havePending = true;
+            break;
+        }
+    }
+
+    return m_havePending;
+}
+
+void IpcTraceReplayer::scheduleNext()
+{
+    guint delayMs = 0;
+
+    if (!m_maxSpeed) {
+        uint64_t elapsed = IpcTraceMonotonicTime() - m_startTime;
+        if (m_pendingHeader.timestamp > elapsed)
+            delayMs = (m_pendingHeader.timestamp - elapsed) / 1000;
+    }
+
+    m_timerSource = g_timeout_source_new(delayMs);
+    g_source_set_callback(m_timerSource, timeoutCb, this /*data*/, NULL);
+    g_source_attach(m_timerSource, m_glibCtxt);
+}
+
+/**
+ * Delivers every record that is due.
+ *
+ * @return true if there are records left.
+ */
+bool IpcTraceReplayer::replayDue()
+{
+    uint64_t elapsed = IpcTraceMonotonicTime() - m_startTime;
+    int count = 0;
+
+    while (m_havePending) {
+
+        if (m_maxSpeed ? count >= kMaxSpeedBatch : m_pendingHeader.timestamp > elapsed)
+            break;
+
+        m_listener->replayRecord((IpcTraceDirection) m_pendingHeader.direction,
+                                 m_pendingData, m_pendingHeader.length);
+        m_replayedCount++;
+        count++;
+
+        readNext();
+    }
+
+    return m_havePending;
+}
+
+gboolean IpcTraceReplayer::timeoutCb(gpointer data)
+{
+    IpcTraceReplayer* r = (IpcTraceReplayer*) data;
+
+    // Returning FALSE destroys the source, we only drop our reference
+    g_source_unref(r->m_timerSource);
+    r->m_timerSource = 0;
+
+    if (r->replayDue()) {
+        r->scheduleNext();
+    }
+    else {
+        TRACEF("replayed %u records", r->m_replayedCount);
+        r->m_listener->replayFinished(); // may delete r
+    }
+
+    return FALSE;
+}
@@ -0,0 +1,211 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef IPCTRACE_H
+#define IPCTRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <glib.h>
+
+class YapPacket;
+
+/**
+ * Recording and replay of the Yap traffic between BrowserAdapter and BrowserServer.
+ *
+ * A trace file is an IpcTraceFileHeader followed by any number of records. Each
+ * record is an IpcTraceRecordHeader immediately followed by the raw packet bytes,
+ * starting with the 16-bit command or message id. All fields are host endian; a
+ * trace is meant to be replayed on the machine type it was captured on.
+ */
+
+enum IpcTraceDirection {
+    IpcTraceOutgoing = 0,   ///< asyncCmd*/syncCmd* sent to BrowserServer
+    IpcTraceIncoming = 1    ///< Message delivered to handleAsyncMessage
+};
+
+struct IpcTraceFileHeader {
+    uint32_t magic;         ///< kIpcTraceMagic
+    uint16_t version;       ///< kIpcTraceVersion
+    uint16_t reserved;
+};
+
+struct IpcTraceRecordHeader {
+    uint64_t timestamp;     ///< Microseconds since the trace was started (CLOCK_MONOTONIC)
+    uint32_t length;        ///< Number of packet bytes following this header
+    uint8_t direction;      ///< One of IpcTraceDirection
+    uint8_t reserved[3];
+};
+
+/**
+ * Current CLOCK_MONOTONIC time in microseconds.
+ */
+uint64_t IpcTraceMonotonicTime();
+
+/**
+ * Retrieves the serialized bytes of a Yap packet.
+ *
+ * This, IpcTraceCreatePacket() and IpcTraceCreateWritePacket() are the only
+ * functions that depend on the YapPacket buffer layout.
+ */
+bool IpcTracePacketBytes(YapPacket* packet, const uint8_t*& data, uint32_t& length);
+
+/**
+ * Wraps @a length bytes at @a data in a packet positioned for reading. The
+ * packet does not own @a data which must outlive it.
+ */
+YapPacket* IpcTraceCreatePacket(uint8_t* data, uint32_t length);
+
+/**
+ * Wraps an empty buffer of @a capacity bytes in a packet positioned for
+ * writing. Use IpcTracePacketBytes() to retrieve what was written.
+ */
+YapPacket* IpcTraceCreateWritePacket(uint8_t* data, uint32_t capacity);
+
+/**
+ * Appends packets to a trace file.
+ */
+class IpcTraceRecorder
+{
+public:
+
+    /**
+     * Creates (truncating) the trace file at @a path.
+     *
+     * @return the recorder or NULL if the file could not be created.
+     */
+    static IpcTraceRecorder* create(const char* path);
+    ~IpcTraceRecorder();
+
+    void record(IpcTraceDirection direction, YapPacket* packet);
+    void record(IpcTraceDirection direction, const uint8_t* data, uint32_t length);
+
+    const char* path() const {
+        return m_path;
+    }
+    uint32_t recordCount() const {
+        return m_recordCount;
+    }
+
+private:
+
+    IpcTraceRecorder(FILE* file, const char* path);
+
+    FILE* m_file;
+    char* m_path;
+    uint64_t m_startTime;
+    uint32_t m_recordCount;
+};
+
+/**
+ * Sequential reader for trace files.
+ */
+class IpcTraceReader
+{
+public:
+
+    /**
+     * Opens and validates the trace file at @a path.
+     *
+     * @return the reader or NULL if the file is missing or not a trace.
+     */
+    static IpcTraceReader* open(const char* path);
+    ~IpcTraceReader();
+
+    /**
+     * Reads the next record. @a data points to an internal buffer that is
+     * valid until the following call.
+     *
+     * @return false at the end of the trace or on a truncated record.
+     */
+    bool next(IpcTraceRecordHeader& header, uint8_t*& data);
+
+private:
+
+    IpcTraceReader(FILE* file);
+
+    FILE* m_file;
+    uint8_t* m_buffer;
+    uint32_t m_bufferSize;
+};
+
+class IpcTraceReplayListener
+{
+public:
+
+    IpcTraceReplayListener() {}
+    virtual ~IpcTraceReplayListener() {}
+
+    /**
+     * Called for every replayed record. @a data is only valid for the
+     * duration of the call.
+     */
+    virtual void replayRecord(IpcTraceDirection direction, uint8_t* data, uint32_t length) = 0;
+    virtual void replayFinished() = 0;
+};
+
+/**
+ * Feeds one direction of a trace to a listener from the GLib main loop, either
+ * with the original inter-packet timing or as fast as possible.
+ */
+class IpcTraceReplayer
+{
+public:
+
+    /**
+     * Takes ownership of @a reader.
+     */
+    IpcTraceReplayer(IpcTraceReader* reader, IpcTraceDirection direction,
+                     IpcTraceReplayListener* listener, GMainContext* ctxt,
+                     bool maxSpeed);
+    ~IpcTraceReplayer();
+
+    void start();
+    void stop();
+
+    bool isRunning() const {
+        return m_timerSource != 0;
+    }
+    uint32_t replayedCount() const {
+        return m_replayedCount;
+    }
+
+private:
+
+    bool readNext();
+    void scheduleNext();
+    bool replayDue();
+
+    static gboolean timeoutCb(gpointer data);
+
+    IpcTraceReader* m_reader;
+    IpcTraceDirection m_direction;
+    IpcTraceReplayListener* m_listener;
+    GMainContext* m_glibCtxt;
+    bool m_maxSpeed;
+
+    GSource* m_timerSource;
+    uint64_t m_startTime;
+    uint32_t m_replayedCount;
+
+    bool m_havePending;
+    IpcTraceRecordHeader m_pendingHeader;
+    uint8_t* m_pendingData;
+};
+
+#endif /* IPCTRACE_H */
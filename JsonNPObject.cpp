@@ -16,27 +16,39 @@
 *
 LICENSE@@@ */
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <AdapterBase.h>
+
 #include "JsonNPObject.h"
+#include "NPObjectPool.h"
 #include "BrowserAdapter.h"
 #include "Debug.h"
 
+static NPIdentifier sLengthId = 0;
+
+static NPObjectPool<JsonNPObject> sPool("JsonNPObject");
+
 JsonNPObject::JsonNPObject(BrowserAdapter *adapter) :
     m_adapter(adapter)
 {
+    if (!sLengthId) {
+        sLengthId = AdapterBase::NPN_GetStringIdentifier("length");
+    }
 }
 
 JsonNPObject::~JsonNPObject()
 {
-    for (std::map<std::string, NPObject *>::iterator i = m_objects.begin();
-            i != m_objects.end(); m_objects.erase(i++)) {
-        if (i->second != NULL) {
-            m_adapter->NPN_ReleaseObject(i->second);
-            i->second = NULL;
+    for (PropertyMap::iterator i = m_properties.begin(); i != m_properties.end(); ++i) {
+        if (i->second.object != NULL) {
+            m_adapter->NPN_ReleaseObject(i->second.object);
+            i->second.object = NULL;
         }
     }
 }
 
-bool JsonNPObject::initialize(pbnjson::JSchemaFile &schema, const char *json)
+bool JsonNPObject::initialize(const pbnjson::JSchema &schema, const char *json)
 {
     pbnjson::JDomParser parser(NULL);
 
@@ -58,10 +70,55 @@ bool JsonNPObject::initialize(pbnjson::JValue &dom)
     return true;
 }
 
+bool JsonNPObject::isLength(NPIdentifier name) const
+{
+    return name == sLengthId && m_dom.isArray();
+}
+
+JsonNPObject::Property *JsonNPObject::lookup(NPIdentifier name)
+{
+    PropertyMap::iterator i = m_properties.find(name);
+    if (i != m_properties.end()) {
+        return &i->second;
+    }
+
+    pbnjson::JValue value;
+    bool found = false;
+
+    if (m_dom.isArray()) {
+        if (!AdapterBase::NPN_IdentifierIsString(name)) {
+            int32_t index = AdapterBase::NPN_IntFromIdentifier(name);
+            if (index >= 0 && index < m_dom.arraySize()) {
+                value = m_dom[index];
+                found = true;
+            }
+        }
+    } else if (m_dom.isObject() && AdapterBase::NPN_IdentifierIsString(name)) {
+        NPUTF8 *key = m_adapter->NPN_UTF8FromIdentifier(name);
+        if (key != NULL) {
+            if (m_dom.hasKey(key)) {
+                value = m_dom[key];
+                found = true;
+            }
+            AdapterBase::NPN_MemFree(key);
+        }
+    }
+
+    /* misses are not cached, scripts may probe any number of names */
+    if (!found) {
+        return NULL;
+    }
+
+    Property &prop = m_properties[name];
+    prop.value = value;
+    prop.converted = false;
+    prop.object = NULL;
+    return &prop;
+}
+
 bool JsonNPObject::hasProperty(NPIdentifier name)
 {
-    //TRACEF("%s", m_adapter->NPN_UTF8FromIdentifier(name));
-    return m_dom.hasKey(m_adapter->NPN_UTF8FromIdentifier(name));
+    return isLength(name) || lookup(name) != NULL;
 }
 
 bool JsonNPObject::getProperty(NPIdentifier name, NPVariant *result)
@@ -70,10 +127,18 @@ bool JsonNPObject::getProperty(NPIdentifier name, NPVariant *result)
         return false;
     }
 
-    std::string key = m_adapter->NPN_UTF8FromIdentifier(name);
-    pbnjson::JValue val = m_dom[key];
+    if (isLength(name)) {
+        INT32_TO_NPVARIANT((int32_t) m_dom.arraySize(), *result);
+        return true;
+    }
+
+    Property *prop = lookup(name);
+    if (!prop) {
+        NULL_TO_NPVARIANT(*result);
+        return true;
+    }
 
-    //TRACEF("%s", key.c_str());
+    pbnjson::JValue &val = prop->value;
 
     if (val.isNull()) {
         //TRACEF("result is null");
@@ -89,13 +154,24 @@ bool JsonNPObject::getProperty(NPIdentifier name, NPVariant *result)
         }
 
     } else if (val.isString()) {
-        std::string s;
-        if (val.asString(s)) {
+        if (!prop->converted) {
+            if (val.asString(prop->string)) {
+                NULL_TO_NPVARIANT(*result);
+                return true;
+            }
+            prop->converted = true;
+        }
+
+        /* the caller owns the result, so this copy cannot be avoided */
+        uint32_t length = prop->string.size();
+        char *s = (char *) malloc(length + 1);
+        if (!s) {
             NULL_TO_NPVARIANT(*result);
-        } else {
-            //TRACEF("result is string: %s", s.c_str());
-            STRINGZ_TO_NPVARIANT(strdup(s.c_str()), *result);
+            return false;
         }
+        memcpy(s, prop->string.data(), length);
+        s[length] = '\0';
+        STRINGN_TO_NPVARIANT(s, length, *result);
 
     } else if (val.isBoolean()) {
         bool b;
@@ -106,38 +182,71 @@ bool JsonNPObject::getProperty(NPIdentifier name, NPVariant *result)
             BOOLEAN_TO_NPVARIANT(b, *result);
         }
 
-    } else if (val.isObject()) {
-        NPObject *obj = NULL;
-
-        //TRACEF("result is object");
-
-        std::map<std::string, NPObject *>::iterator i = m_objects.find(key);
-        if (i != m_objects.end()) {
-            /* we've accessed this object before */
-            obj = i->second;
-
-        } else {
-            /* we need to construct an NPObject */
+    } else if (val.isObject() || val.isArray()) {
+        if (!prop->object) {
+            /* we need to construct an NPObject, it shares our DOM */
             JsonNPObject *jobj =
                 static_cast<JsonNPObject *>(m_adapter->NPN_CreateObject(
                                                 &JsonNPObject::sJsonNPObjectClass));
             jobj->initialize(val);
+            prop->object = jobj;
+        }
 
-            /* add it into the cached objects */
-            m_objects.insert(std::pair<std::string, NPObject *>(key, jobj));
+        m_adapter->NPN_RetainObject(prop->object);
+        OBJECT_TO_NPVARIANT(prop->object, *result);
+    }
+
+    return true;
+}
 
-            obj = jobj;
+bool JsonNPObject::enumerate(NPIdentifier **value, uint32_t *count)
+{
+    if (!value || !count) {
+        return false;
+    }
+
+    *value = NULL;
+    *count = 0;
+
+    uint32_t n;
+    if (m_dom.isArray()) {
+        n = m_dom.arraySize();
+    } else if (m_dom.isObject()) {
+        n = 0;
+        for (pbnjson::JValue::ObjectIterator i = m_dom.begin(); i != m_dom.end(); ++i) {
+            n++;
         }
+    } else {
+        return true;
+    }
 
-        m_adapter->NPN_RetainObject(obj);
-        OBJECT_TO_NPVARIANT(obj, *result);
+    if (!n) {
+        return true;
+    }
 
-    } else if (val.isArray()) {
-        //TRACEF("array type not supported!\n");
-        NULL_TO_NPVARIANT(*result);
+    /* the caller frees the array */
+    NPIdentifier *ids = (NPIdentifier *) AdapterBase::NPN_MemAlloc(n * sizeof(NPIdentifier));
+    if (!ids) {
         return false;
     }
 
+    if (m_dom.isArray()) {
+        for (uint32_t i = 0; i < n; i++) {
+            ids[i] = AdapterBase::NPN_GetIntIdentifier(i);
+        }
+    } else {
+        uint32_t k = 0;
+        std::string key;
+        for (pbnjson::JValue::ObjectIterator i = m_dom.begin(); i != m_dom.end() && k < n; ++i) {
+            if ((*i).first.asString(key) == 0) {
+                ids[k++] = AdapterBase::NPN_GetStringIdentifier(key.c_str());
+            }
+        }
+        n = k;
+    }
+
+    *value = ids;
+    *count = n;
     return true;
 }
 
@@ -160,7 +269,7 @@ NPClass JsonNPObject::sJsonNPObjectClass = {
 NPObject* JsonNPObject::PrvObjAllocate(NPP npp, NPClass* klass)
 {
     JsonNPObject *obj =
-        new JsonNPObject(static_cast<BrowserAdapter *>(npp->pdata));
+        sPool.create(static_cast<BrowserAdapter *>(npp->pdata));
     //TRACEF("%p", obj);
     return obj;
 }
@@ -168,7 +277,7 @@ NPObject* JsonNPObject::PrvObjAllocate(NPP npp, NPClass* klass)
 void JsonNPObject::PrvObjDeallocate(NPObject* obj)
 {
     //TRACEF("%p", obj);
-    delete static_cast<JsonNPObject *>(obj);
+    sPool.destroy(static_cast<JsonNPObject *>(obj));
 }
 
 void JsonNPObject::PrvObjInvalidate(NPObject* obj)
@@ -223,8 +332,7 @@ bool JsonNPObject::PrvObjRemoveProperty(NPObject *obj, NPIdentifier name)
 bool JsonNPObject::PrvObjEnumerate(NPObject *obj, NPIdentifier **value,
                                    uint32_t *count)
 {
-    /* unsupported */
-    return false;
+    return static_cast<JsonNPObject *>(obj)->enumerate(value, count);
 }
 
 bool JsonNPObject::PrvObjConstruct(NPObject *obj, const NPVariant *args,
@@ -33,8 +33,11 @@ class BrowserAdapter;
  * \brief This class implements a generic NPObject that is initialized
  * with Json.
  *
- * Only getting properties is supported. Methods, and modifying/deleting
- * properties are not supported.
+ * A Json object exposes its members as properties, a Json array its
+ * elements as indexed properties plus "length". Values are only
+ * converted when a script reads them. Only getting and enumerating
+ * properties is supported. Methods, and modifying/deleting properties
+ * are not supported.
  */
 
 class JsonNPObject : public NPObject
@@ -53,7 +56,7 @@ public:
      * \param json Json that represents the object.
      * \return True if successful.
      */
-    bool initialize(pbnjson::JSchemaFile &schema, const char *json);
+    bool initialize(const pbnjson::JSchema &schema, const char *json);
 
     /**
      * Initialize the object with a parsed DOM
@@ -92,21 +95,40 @@ private:
     /*@{*/
     bool hasProperty(NPIdentifier name);
     bool getProperty(NPIdentifier name, NPVariant *result);
+    bool enumerate(NPIdentifier **value, uint32_t *count);
     /*@}*/
 
 private:
+    /**
+     * \brief A member or element that has been looked up.
+     */
+    struct Property {
+        pbnjson::JValue value;
+        bool converted;         ///< string below holds the value
+        std::string string;     ///< Copied out on every get
+        NPObject *object;       ///< Wrapper for an object or array value
+    };
+
+    typedef std::map<NPIdentifier, Property> PropertyMap;
+
+    /**
+     * \return The property for \a name, NULL if there is none.
+     */
+    Property *lookup(NPIdentifier name);
+
+    bool isLength(NPIdentifier name) const;
+
     /**
      * \brief DOM representation of the parsed Json input.
      */
     pbnjson::JValue m_dom;
 
     /**
-     * \brief Map of this object's properties that are objects
-     * themselves.
+     * \brief Properties scripts have asked for, keyed by identifier.
      *
      * This is populated lazily.
      */
-    std::map<std::string, NPObject *> m_objects;
+    PropertyMap m_properties;
 
     /**
      * \brief A reference to the NPP object.
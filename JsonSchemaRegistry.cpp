@@ -0,0 +1,80 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include <QtCore/QDir>
+#include <QtCore/QString>
+
+#include "JsonSchemaRegistry.h"
+
+static const char* const kSchemaFiles[JsonSchemaRegistry::SchemaCount] = {
+    NULL,
+    "InteractiveWidgetRect.schema",
+    "HitTest.schema"
+};
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pbnjson::JSchema* s_schemas[JsonSchemaRegistry::SchemaCount];
+
+pbnjson::JSchema* JsonSchemaRegistry::load(SchemaId id)
+{
+    if (!kSchemaFiles[id])
+        return new pbnjson::JSchemaFragment("{}");
+
+#ifdef ISIS_DESKTOP
+    QString schemaFile = QString("%1/.isis/conf/%2").arg(QDir::homePath()).arg(kSchemaFiles[id]);
+#else
+    QString schemaFile = QString("/etc/palm/browser/%1").arg(kSchemaFiles[id]);
+#endif
+
+    return new pbnjson::JSchemaFile(qPrintable(schemaFile));
+}
+
+const pbnjson::JSchema& JsonSchemaRegistry::get(SchemaId id)
+{
+    if (id < 0 || id >= SchemaCount) {
+        g_critical("%s: bad schema id %d", __FUNCTION__, id);
+        id = SchemaAny;
+    }
+
+    pthread_mutex_lock(&s_lock);
+    if (!s_schemas[id])
+        s_schemas[id] = load(id);
+    pbnjson::JSchema* schema = s_schemas[id];
+    pthread_mutex_unlock(&s_lock);
+
+    return *schema;
+}
+
+const pbnjson::JSchema& JsonSchemaRegistry::forServerMessage(SchemaId id)
+{
+    return get(validateServerMessages() ? id : SchemaAny);
+}
+
+bool JsonSchemaRegistry::validateServerMessages()
+{
+#ifdef NDEBUG
+    static const bool validate = getenv("BROWSER_ADAPTER_VALIDATE_JSON") != NULL;
+    return validate;
+#else
+    return true;
+#endif
+}
@@ -0,0 +1,61 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef JSONSCHEMAREGISTRY_H
+#define JSONSCHEMAREGISTRY_H
+
+#include <pbnjson.hpp>
+
+/**
+ * The JSON schemas the adapter validates against, loaded and compiled once
+ * per process and shared read-only by every adapter and thread.
+ *
+ * Messages from BrowserServer are trusted. Release builds parse them against
+ * the permissive SchemaAny unless BROWSER_ADAPTER_VALIDATE_JSON is set, debug
+ * builds always validate them.
+ */
+class JsonSchemaRegistry
+{
+public:
+
+    enum SchemaId {
+        SchemaAny = 0,                  ///< "{}", accepts any document
+        SchemaInteractiveWidgetRect,
+        SchemaHitTest,
+        SchemaCount
+    };
+
+    /**
+     * The compiled schema @a id, loaded on first use. Safe to call from any
+     * thread, the schema lives until the process exits.
+     */
+    static const pbnjson::JSchema& get(SchemaId id);
+
+    /**
+     * The schema to parse a BrowserServer message of kind @a id with.
+     */
+    static const pbnjson::JSchema& forServerMessage(SchemaId id);
+
+    static bool validateServerMessages();
+
+private:
+
+    static pbnjson::JSchema* load(SchemaId id);
+};
+
+#endif /* JSONSCHEMAREGISTRY_H */
@@ -0,0 +1,98 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <string.h>
+#include <time.h>
+
+#include "LatencyHistogram.h"
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+uint64_t LatencyHistogram::now()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void LatencyHistogram::reset()
+{
+    ::memset(m_buckets, 0, sizeof(m_buckets));
+    m_count = 0;
+    m_sum = 0;
+    m_max = 0;
+}
+
+void LatencyHistogram::record(uint64_t us)
+{
+    m_buckets[bucketIndex(us)]++;
+    m_count++;
+    m_sum += us;
+    if (us > m_max)
+        m_max = us;
+}
+
+/**
+ * Values below kSubBuckets get a bucket each. Above that, value v with its
+ * highest bit at position b lands in bucket (b - kSubBucketBits + 1) *
+ * kSubBuckets plus the kSubBucketBits bits following the highest one.
+ */
+int LatencyHistogram::bucketIndex(uint64_t us)
+{
+    if (us < (uint64_t) kSubBuckets)
+        return (int) us;
+
+    int msb = 63 - __builtin_clzll(us);
+    int shift = msb - kSubBucketBits;
+    int index = (shift + 1) * kSubBuckets + (int) ((us >> shift) & (kSubBuckets - 1));
+
+    return index < kBuckets ? index : kBuckets - 1;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < kSubBuckets)
+        return index;
+
+    int shift = index / kSubBuckets - 1;
+    uint64_t base = (uint64_t) (kSubBuckets + index % kSubBuckets) << shift;
+
+    return base + ((uint64_t) 1 << shift) - 1;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (!m_count)
+        return 0;
+
+    uint64_t rank = (uint64_t) (p / 100.0 * m_count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; i++) {
+        seen += m_buckets[i];
+        if (seen >= rank)
+            return bucketUpperBound(i) < m_max ? bucketUpperBound(i) : m_max;
+    }
+
+    return m_max;
+}
@@ -0,0 +1,76 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <stdint.h>
+
+/**
+ * Fixed size histogram of durations in microseconds.
+ *
+ * Samples go into power of two buckets split into kSubBuckets linear
+ * sub-buckets, so percentiles are accurate to within 1/kSubBuckets of their
+ * order of magnitude. Recording is O(1) and allocation free.
+ */
+class LatencyHistogram
+{
+public:
+
+    LatencyHistogram();
+
+    /**
+     * Current CLOCK_MONOTONIC time in microseconds.
+     */
+    static uint64_t now();
+
+    void record(uint64_t us);
+    void reset();
+
+    uint32_t count() const {
+        return m_count;
+    }
+    uint64_t max() const {
+        return m_max;
+    }
+    uint64_t mean() const {
+        return m_count ? m_sum / m_count : 0;
+    }
+
+    /**
+     * @param p Percentile in the range [0, 100].
+     * @return an upper bound of the @a p th percentile sample, 0 if empty.
+     */
+    uint64_t percentile(double p) const;
+
+private:
+
+    static const int kSubBucketBits = 2;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    static const int kBuckets = 40 * kSubBuckets; ///< Up to 2^40 us, way beyond any reply
+
+    static int bucketIndex(uint64_t us);
+    static uint64_t bucketUpperBound(int index);
+
+    uint32_t m_buckets[kBuckets];
+    uint32_t m_count;
+    uint64_t m_sum;
+    uint64_t m_max;
+};
+
+#endif /* LATENCYHISTOGRAM_H */
@@ -0,0 +1,254 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "MemoryPressureMonitor.h"
+#include "LatencyHistogram.h"
+
+static const char* const kPressurePath = "/proc/pressure/memory";
+static const char* const kMeminfoPath = "/proc/meminfo";
+
+GSourceFuncs MemoryPressureMonitor::s_sourceFuncs = {
+    MemoryPressureMonitor::sourcePrepare,
+    MemoryPressureMonitor::sourceCheck,
+    MemoryPressureMonitor::sourceDispatch,
+    MemoryPressureMonitor::sourceFinalize
+};
+
+MemoryPressureMonitor::MemoryPressureMonitor(MemoryPressureListener* listener, GMainContext* ctxt)
+    : m_listener(listener)
+    , m_ctxt(ctxt)
+    , m_someSource(0)
+    , m_fullSource(0)
+    , m_pollSource(0)
+    , m_hasPsi(::access(kPressurePath, R_OK) == 0)
+    , m_lastLevel(MemoryPressureNone)
+    , m_lastReportTime(0)
+    , m_someCount(0)
+    , m_fullCount(0)
+{
+    if (m_hasPsi) {
+        m_someSource = createTrigger(MemoryPressureSome);
+        if (m_someSource)
+            m_fullSource = createTrigger(MemoryPressureFull);
+    }
+
+    if (!m_fullSource) {
+        destroyTrigger(m_someSource);
+        startPolling();
+    }
+
+    g_message("%s: %s", __FUNCTION__, usesTriggers() ? "PSI triggers"
+              : m_hasPsi ? "polling PSI" : "polling MemAvailable");
+}
+
+MemoryPressureMonitor::~MemoryPressureMonitor()
+{
+    destroyTrigger(m_someSource);
+    destroyTrigger(m_fullSource);
+
+    if (m_pollSource) {
+        g_source_destroy(m_pollSource);
+        g_source_unref(m_pollSource);
+        m_pollSource = 0;
+    }
+}
+
+/**
+ * @return NULL if the kernel does not take the trigger, e.g. before 5.2 or
+ *         for an unprivileged process before 6.4.
+ */
+GSource* MemoryPressureMonitor::createTrigger(MemoryPressure level)
+{
+    int fd = ::open(kPressurePath, O_RDWR | O_NONBLOCK);
+    if (fd < 0)
+        return 0;
+
+    // "<some|full> <stall us> <window us>", the kernel wants the terminating nul
+    int percent = level == MemoryPressureFull ? kFullStallPercent : kSomeStallPercent;
+    char trigger[64];
+    int length = snprintf(trigger, sizeof(trigger), "%s %d %d",
+                          level == MemoryPressureFull ? "full" : "some",
+                          kWindowMs * 10 * percent, kWindowMs * 1000);
+
+    if (::write(fd, trigger, length + 1) < 0) {
+        g_message("%s: %s not accepted: %s", __FUNCTION__, trigger, strerror(errno));
+        ::close(fd);
+        return 0;
+    }
+
+    GSource* source = g_source_new(&s_sourceFuncs, sizeof(TriggerSource));
+    TriggerSource* t = (TriggerSource*) source;
+    t->pollFd.fd = fd;
+    t->pollFd.events = G_IO_PRI;
+    t->pollFd.revents = 0;
+    t->monitor = this;
+    t->level = level;
+
+    g_source_add_poll(source, &t->pollFd);
+    g_source_attach(source, m_ctxt);
+
+    return source;
+}
+
+void MemoryPressureMonitor::destroyTrigger(GSource*& source)
+{
+    if (source) {
+        g_source_destroy(source);
+        g_source_unref(source);     // closes the file in sourceFinalize()
+        source = 0;
+    }
+}
+
+void MemoryPressureMonitor::startPolling()
+{
+    if (m_pollSource)
+        return;
+
+    m_pollSource = g_timeout_source_new(kPollIntervalMs);
+    g_source_set_priority(m_pollSource, G_PRIORITY_LOW);
+    g_source_set_callback(m_pollSource, pollCb, this /*data*/, NULL);
+    g_source_attach(m_pollSource, m_ctxt);
+}
+
+/**
+ * Compares the stall share of the last 10 seconds to the trigger thresholds.
+ */
+MemoryPressure MemoryPressureMonitor::readPressure() const
+{
+    FILE* file = ::fopen(kPressurePath, "r");
+    if (!file)
+        return MemoryPressureNone;
+
+    float some = 0;
+    float full = 0;
+
+    char line[256];
+    while (::fgets(line, sizeof(line), file)) {
+        if (::sscanf(line, "some avg10=%f", &some) == 1)
+            continue;
+        ::sscanf(line, "full avg10=%f", &full);
+    }
+    ::fclose(file);
+
+    if (full >= kFullStallPercent)
+        return MemoryPressureFull;
+    if (some >= kSomeStallPercent)
+        return MemoryPressureSome;
+    return MemoryPressureNone;
+}
+
+MemoryPressure MemoryPressureMonitor::readAvailable() const
+{
+    FILE* file = ::fopen(kMeminfoPath, "r");
+    if (!file)
+        return MemoryPressureNone;
+
+    unsigned long total = 0;
+    unsigned long available = 0;
+    bool hasAvailable = false;
+
+    char line[256];
+    while (::fgets(line, sizeof(line), file)) {
+        if (::sscanf(line, "MemTotal: %lu kB", &total) == 1)
+            continue;
+        if (::sscanf(line, "MemAvailable: %lu kB", &available) == 1)
+            hasAvailable = true;
+    }
+    ::fclose(file);
+
+    // Kernels before 3.14 do not estimate it, free memory alone says little
+    if (!total || !hasAvailable)
+        return MemoryPressureNone;
+
+    if (available * 100 < total * kFullAvailablePercent)
+        return MemoryPressureFull;
+    if (available * 100 < total * kSomeAvailablePercent)
+        return MemoryPressureSome;
+    return MemoryPressureNone;
+}
+
+void MemoryPressureMonitor::report(MemoryPressure level)
+{
+    if (level == MemoryPressureNone)
+        return;
+
+    uint64_t now = LatencyHistogram::now();
+    if (level <= m_lastLevel && now - m_lastReportTime < (uint64_t) kRepeatMs * 1000)
+        return;
+
+    m_lastLevel = level;
+    m_lastReportTime = now;
+
+    if (level == MemoryPressureFull)
+        m_fullCount++;
+    else
+        m_someCount++;
+
+    g_message("%s: %s memory pressure", __FUNCTION__, level == MemoryPressureFull ? "full" : "some");
+    m_listener->memoryPressure(level);
+}
+
+gboolean MemoryPressureMonitor::sourcePrepare(GSource* source, gint* timeout)
+{
+    *timeout = -1;
+    return FALSE;
+}
+
+gboolean MemoryPressureMonitor::sourceCheck(GSource* source)
+{
+    return ((TriggerSource*) source)->pollFd.revents != 0;
+}
+
+gboolean MemoryPressureMonitor::sourceDispatch(GSource* source, GSourceFunc callback, gpointer data)
+{
+    TriggerSource* t = (TriggerSource*) source;
+    MemoryPressureMonitor* monitor = t->monitor;
+
+    gushort revents = t->pollFd.revents;
+    t->pollFd.revents = 0;
+
+    // The pressure file went away, e.g. with the cgroup it belonged to
+    if (revents & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+        g_warning("%s: trigger failed, polling instead", __FUNCTION__);
+        monitor->destroyTrigger(monitor->m_someSource);
+        monitor->destroyTrigger(monitor->m_fullSource);
+        monitor->startPolling();
+        return FALSE;
+    }
+
+    monitor->report(t->level);
+    return TRUE;
+}
+
+void MemoryPressureMonitor::sourceFinalize(GSource* source)
+{
+    ::close(((TriggerSource*) source)->pollFd.fd);
+}
+
+gboolean MemoryPressureMonitor::pollCb(gpointer data)
+{
+    MemoryPressureMonitor* monitor = (MemoryPressureMonitor*) data;
+    monitor->report(monitor->m_hasPsi ? monitor->readPressure() : monitor->readAvailable());
+    return TRUE;
+}
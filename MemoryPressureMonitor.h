@@ -0,0 +1,118 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef MEMORYPRESSUREMONITOR_H
+#define MEMORYPRESSUREMONITOR_H
+
+#include <glib.h>
+#include <stdint.h>
+
+enum MemoryPressure {
+    MemoryPressureNone = 0,
+    MemoryPressureSome,         ///< Some tasks stall on memory
+    MemoryPressureFull          ///< All non-idle tasks stall on memory at once
+};
+
+class MemoryPressureListener
+{
+public:
+
+    MemoryPressureListener() {}
+    virtual ~MemoryPressureListener() {}
+
+    virtual void memoryPressure(MemoryPressure level) = 0;
+};
+
+/**
+ * Tells the listener, on the main loop, when the system runs short of memory.
+ *
+ * Uses Linux pressure stall information: a trigger on /proc/pressure/memory
+ * for each level fires once tasks stall on memory for kSomeStallPercent
+ * (kFullStallPercent) of a kWindowMs window. Where triggers are not
+ * available the file is polled every kPollIntervalMs and its avg10 compared
+ * to the same percentages, and on kernels without PSI the share of
+ * MemAvailable in /proc/meminfo is used instead.
+ *
+ * A level is reported again only after kRepeatMs, unless it got worse.
+ */
+class MemoryPressureMonitor
+{
+public:
+
+    MemoryPressureMonitor(MemoryPressureListener* listener, GMainContext* ctxt);
+    ~MemoryPressureMonitor();
+
+    /// false if the fallback polling is used
+    bool usesTriggers() const {
+        return m_someSource != 0;
+    }
+
+    /// Events reported to the listener, by level
+    uint32_t someCount() const {
+        return m_someCount;
+    }
+    uint32_t fullCount() const {
+        return m_fullCount;
+    }
+
+private:
+
+    static const int kWindowMs = 2000;          ///< Unprivileged triggers need a multiple of 2 s
+    static const int kSomeStallPercent = 10;
+    static const int kFullStallPercent = 5;
+    static const int kSomeAvailablePercent = 10; ///< Without PSI, MemAvailable below this share of MemTotal
+    static const int kFullAvailablePercent = 4;
+    static const guint kPollIntervalMs = 2000;
+    static const uint32_t kRepeatMs = 10000;
+
+    struct TriggerSource {
+        GSource source;
+        GPollFD pollFd;
+        MemoryPressureMonitor* monitor;
+        MemoryPressure level;
+    };
+
+    GSource* createTrigger(MemoryPressure level);
+    void destroyTrigger(GSource*& source);
+    void startPolling();
+
+    MemoryPressure readPressure() const;
+    MemoryPressure readAvailable() const;
+    void report(MemoryPressure level);
+
+    static gboolean sourcePrepare(GSource* source, gint* timeout);
+    static gboolean sourceCheck(GSource* source);
+    static gboolean sourceDispatch(GSource* source, GSourceFunc callback, gpointer data);
+    static void sourceFinalize(GSource* source);
+    static gboolean pollCb(gpointer data);
+
+    static GSourceFuncs s_sourceFuncs;
+
+    MemoryPressureListener* m_listener;
+    GMainContext* m_ctxt;
+    GSource* m_someSource;
+    GSource* m_fullSource;
+    GSource* m_pollSource;
+    bool m_hasPsi;                      ///< /proc/pressure/memory is readable
+    MemoryPressure m_lastLevel;
+    uint64_t m_lastReportTime;          ///< See LatencyHistogram::now()
+    uint32_t m_someCount;
+    uint32_t m_fullCount;
+};
+
+#endif /* MEMORYPRESSUREMONITOR_H */
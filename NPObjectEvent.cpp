@@ -27,126 +27,23 @@ LICENSE@@@ */
 #include "BrowserAdapter.h"
 #include "Debug.h"
 
-static const char *sPropertyIdNames[] = {
-    "type",
-    "pageX",
-    "pageY",
-    "altKey",
-    "shiftKey",
-    "ctrlKey",
-    "metaKey"
+const NPPropertyField NPObjectEvent::sFields[] = {
+    NP_READONLY_PROPERTY(NPObjectEvent, "type", String, m_type),
+    NP_READONLY_PROPERTY(NPObjectEvent, "pageX", Number, m_pageX),
+    NP_READONLY_PROPERTY(NPObjectEvent, "pageY", Number, m_pageY),
+    NP_FLAG_PROPERTY(NPObjectEvent, "altKey", m_modifiers, npPalmAltKeyModifier),
+    NP_FLAG_PROPERTY(NPObjectEvent, "shiftKey", m_modifiers, npPalmShiftKeyModifier),
+    NP_FLAG_PROPERTY(NPObjectEvent, "ctrlKey", m_modifiers, npPalmCtrlKeyModifier),
+    NP_FLAG_PROPERTY(NPObjectEvent, "metaKey", m_modifiers, npPalmMetaKeyModifier)
 };
 
-static const int kNumProperties = G_N_ELEMENTS(sPropertyIdNames);
-static NPIdentifier sPropertyIds[kNumProperties];
-
-static bool sPropertyIdsInitialized = false;
-
-enum PropertyId {
-    PropertyType = 0,
-    PropertyPageX,
-    PropertyPageY,
-    PropertyAltKey,
-    PropertyShiftKey,
-    PropertyCtrlKey,
-    PropertyMetaKey
-};
+NPPropertyIndex NPObjectEvent::sIndex(sFields, G_N_ELEMENTS(sFields));
+NPObjectPool<NPObjectEvent> NPObjectEvent::sPool("NPObjectEvent");
 
 /**
  * Defines methods for NPObjectEvent object.
  */
-NPClass NPObjectEvent::sNPObjectEventClass = {
-    NP_CLASS_STRUCT_VERSION_CTOR,
-    NPObjectEvent::PrvObjAllocate,
-    NPObjectEvent::PrvObjDeallocate,
-    NPObjectEvent::PrvObjInvalidate,
-    NPObjectEvent::PrvObjHasMethod,
-    NPObjectEvent::PrvObjInvoke,
-    NPObjectEvent::PrvObjInvokeDefault,
-    NPObjectEvent::PrvObjHasProperty,
-    NPObjectEvent::PrvObjGetProperty,
-    NPObjectEvent::PrvObjSetProperty,
-    NPObjectEvent::PrvObjRemoveProperty,
-    NPObjectEvent::PrvObjEnumerate,
-    NPObjectEvent::PrvObjConstruct
-};
-
-// NPObjectEvent object static hooks implementation
-// that call actual instance methods
-NPObject* NPObjectEvent::PrvObjAllocate(NPP npp, NPClass* klass)
-{
-    //TRACEF("Entered %s", __FUNCTION__);
-    return new NPObjectEvent(static_cast<BrowserAdapter*>(npp->pdata));
-}
-void NPObjectEvent::PrvObjDeallocate(NPObject* obj)
-{
-    //TRACEF("Entered %s", __FUNCTION__);
-    delete static_cast<NPObjectEvent*>(obj);
-}
-
-void NPObjectEvent::PrvObjInvalidate(NPObject* obj)
-{
-    /* do nothing */
-}
-
-bool NPObjectEvent::PrvObjHasMethod(NPObject* obj, NPIdentifier name)
-{
-    /* unsupported */
-    return false;
-}
-bool NPObjectEvent::PrvObjInvoke(NPObject *obj, NPIdentifier name,
-                                 const NPVariant *args, uint32_t argCount,
-                                 NPVariant *result)
-{
-    /* unsupported */
-    return false;
-}
-
-bool NPObjectEvent::PrvObjInvokeDefault(NPObject *obj, const NPVariant *args,
-                                        uint32_t argCount, NPVariant *result)
-{
-    /* unsupported */
-    return false;
-}
-
-bool NPObjectEvent::PrvObjHasProperty(NPObject *obj, NPIdentifier name)
-{
-    //TRACEF("Entered %s", __FUNCTION__);
-    return static_cast<NPObjectEvent*>(obj)->hasProperty(name);
-}
-
-bool NPObjectEvent::PrvObjGetProperty(NPObject *obj, NPIdentifier name, NPVariant *result)
-{
-    //TRACEF("Entered %s", __FUNCTION__);
-    return static_cast<NPObjectEvent*>(obj)->getProperty(name, result);
-}
-
-bool NPObjectEvent::PrvObjSetProperty(NPObject *obj, NPIdentifier name,
-                                      const NPVariant *value)
-{
-    /* unsupported */
-    return false;
-}
-
-bool NPObjectEvent::PrvObjRemoveProperty(NPObject *obj, NPIdentifier name)
-{
-    /* unsupported */
-    return false;
-}
-
-bool NPObjectEvent::PrvObjEnumerate(NPObject *obj, NPIdentifier **value,
-                                    uint32_t *count)
-{
-    /* unsupported */
-    return false;
-}
-
-bool NPObjectEvent::PrvObjConstruct(NPObject *obj, const NPVariant *args,
-                                    uint32_t argCount, NPVariant *result)
-{
-    /* unsupported */
-    return false;
-}
+NPClass NPObjectEvent::sNPObjectEventClass = NP_PROPERTY_BAG_CLASS(NPObjectEvent);
 
 NPObjectEvent::NPObjectEvent(BrowserAdapter *adapter)
     : m_pageX(0)
@@ -154,12 +51,6 @@ NPObjectEvent::NPObjectEvent(BrowserAdapter *adapter)
     , m_modifiers(0)
 {
     //TRACEF("Entered %s", __FUNCTION__);
-    if (!sPropertyIdsInitialized) {
-        AdapterBase::NPN_GetStringIdentifiers(sPropertyIdNames, kNumProperties,
-                                              sPropertyIds);
-        sPropertyIdsInitialized = true;
-        TRACEF("NPObjectEvent sPropertyIdsInitialized == true");
-    }
 }
 
 NPObjectEvent::~NPObjectEvent()
@@ -177,59 +68,3 @@ void NPObjectEvent::initialize(const char *type, int pageX, int pageY,
     m_pageY = pageY;
     m_modifiers = modifiers;
 }
-
-bool NPObjectEvent::hasProperty(NPIdentifier name)
-{
-    //TRACEF("Entered %s", __FUNCTION__);
-    for (int i = 0; i < kNumProperties; i++) {
-        if (sPropertyIds[i] == name) {
-            return true;
-        }
-    }
-    return false;
-}
-
-bool NPObjectEvent::getProperty(NPIdentifier name, NPVariant *result)
-{
-    //TRACEF("Entered %s", __FUNCTION__);
-    if (result == NULL) {
-        return false;
-    }
-
-    if (sPropertyIds[PropertyType] == name) {
-        if (m_type.empty()) {
-            NULL_TO_NPVARIANT(*result);
-        } else {
-            STRINGZ_TO_NPVARIANT(strdup(m_type.c_str()), *result);
-        }
-        return true;
-
-    } else if (sPropertyIds[PropertyPageX] == name) {
-        double v(m_pageX);
-        DOUBLE_TO_NPVARIANT(v, *result);
-        return true;
-
-    } else if (sPropertyIds[PropertyPageY] == name) {
-        double v(m_pageY);
-        DOUBLE_TO_NPVARIANT(v, *result);
-        return true;
-    } else if (sPropertyIds[PropertyAltKey] == name) {
-        bool b(m_modifiers & npPalmAltKeyModifier);
-        BOOLEAN_TO_NPVARIANT(b, *result);
-        return true;
-    } else if (sPropertyIds[PropertyShiftKey] == name) {
-        bool b(m_modifiers & npPalmShiftKeyModifier);
-        BOOLEAN_TO_NPVARIANT(b, *result);
-        return true;
-    } else if (sPropertyIds[PropertyCtrlKey] == name) {
-        bool b(m_modifiers & npPalmCtrlKeyModifier);
-        BOOLEAN_TO_NPVARIANT(b, *result);
-        return true;
-    } else if (sPropertyIds[PropertyMetaKey] == name) {
-        bool b(m_modifiers & npPalmMetaKeyModifier);
-        BOOLEAN_TO_NPVARIANT(b, *result);
-        return true;
-    }
-
-    return false;
-}
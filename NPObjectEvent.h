@@ -19,9 +19,7 @@ LICENSE@@@ */
 #ifndef NPOBJ_EVENT_H
 #define NPOBJ_EVENT_H
 
-#include <npupp.h>
-#include <npapi.h>
-#include <string>
+#include "NPPropertyBag.h"
 
 class BrowserAdapter;
 
@@ -35,7 +33,7 @@ class BrowserAdapter;
  * \li <b>pageX</b> int
  * \li <b>pageY</b> int
  */
-class NPObjectEvent : public NPObject
+class NPObjectEvent : public NPPropertyBag<NPObjectEvent>
 {
 public:
     NPObjectEvent(BrowserAdapter *adapter);
@@ -45,31 +43,13 @@ public:
 
     void initialize(const char *type, int pageX, int pageY, int modifiers);
 
-    bool hasProperty(NPIdentifier name);
-    bool getProperty(NPIdentifier name, NPVariant *result);
+private:
+    friend class NPPropertyBag<NPObjectEvent>;
 
-    // Private NP Object callbacks, used for JavaScript integration.
-    // (these translate into appropriate non-static method calls).
-    static NPObject* PrvObjAllocate(NPP npp, NPClass* klass);
-    static void PrvObjDeallocate(NPObject* obj);
-    static void PrvObjInvalidate(NPObject* obj);
-    static bool PrvObjHasMethod(NPObject* obj, NPIdentifier name);
-    static bool PrvObjInvoke(NPObject *obj, NPIdentifier name,
-                             const NPVariant *args, uint32_t argCount, NPVariant *result);
-    static bool PrvObjInvokeDefault(NPObject *obj, const NPVariant *args,
-                                    uint32_t argCount, NPVariant *result);
-    static bool PrvObjHasProperty(NPObject *obj, NPIdentifier name);
-    static bool PrvObjGetProperty(NPObject *obj, NPIdentifier name,
-                                  NPVariant *result);
-    static bool PrvObjSetProperty(NPObject *obj, NPIdentifier name,
-                                  const NPVariant *value);
-    static bool PrvObjRemoveProperty(NPObject *obj, NPIdentifier name);
-    static bool PrvObjEnumerate(NPObject *obj, NPIdentifier **value,
-                                uint32_t *count);
-    static bool PrvObjConstruct(NPObject *obj, const NPVariant *args,
-                                uint32_t argCount, NPVariant *result);
+    static const NPPropertyField sFields[];
+    static NPPropertyIndex sIndex;
+    static NPObjectPool<NPObjectEvent> sPool;
 
-private:
     std::string m_type;
     int m_pageX;
     int m_pageY;
@@ -0,0 +1,92 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <stdlib.h>
+#include <glib.h>
+
+#include "NPObjectPool.h"
+
+NPObjectPoolBase* NPObjectPoolBase::s_first = 0;
+
+NPObjectPoolBase::NPObjectPoolBase(const char* name, size_t size)
+    : m_name(name)
+    , m_size(size < sizeof(FreeBlock) ? sizeof(FreeBlock) : size)
+    , m_free(0)
+    , m_pooled(0)
+    , m_live(0)
+    , m_allocated(0)
+    , m_reused(0)
+    , m_next(s_first)
+{
+    s_first = this;
+}
+
+NPObjectPoolBase::~NPObjectPoolBase()
+{
+    if (m_live)
+        g_warning("%s: %u %s objects were never released", __FUNCTION__, m_live, m_name);
+
+    while (m_free) {
+        FreeBlock* block = m_free;
+        m_free = block->next;
+        ::free(block);
+    }
+
+    for (NPObjectPoolBase** p = &s_first; *p; p = &(*p)->m_next) {
+        if (*p == this) {
+            *p = m_next;
+            break;
+        }
+    }
+}
+
+void* NPObjectPoolBase::acquire()
+{
+    void* mem;
+    if (m_free) {
+        FreeBlock* block = m_free;
+        m_free = block->next;
+        m_pooled--;
+        m_reused++;
+        mem = block;
+    }
+    else {
+        mem = ::malloc(m_size);
+        if (!mem)
+            return 0;
+        m_allocated++;
+    }
+
+    m_live++;
+    return mem;
+}
+
+void NPObjectPoolBase::release(void* mem)
+{
+    m_live--;
+
+    if (m_pooled >= kMaxPooled) {
+        ::free(mem);
+        return;
+    }
+
+    FreeBlock* block = (FreeBlock*) mem;
+    block->next = m_free;
+    m_free = block;
+    m_pooled++;
+}
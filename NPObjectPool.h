@@ -0,0 +1,122 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef NPOBJECTPOOL_H
+#define NPOBJECTPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+
+/**
+ * Recycles the memory of one NPObject class.
+ *
+ * Reply objects are usually read once by a callback and released right away,
+ * so up to kMaxPooled freed blocks are kept for the next object instead of
+ * going back to the heap. Only the storage is reused, every object is still
+ * constructed and destroyed normally. Main thread only.
+ *
+ * The pools also count live objects per class, which makes a leaked
+ * NPObject show up in getObjectPoolStats().
+ */
+class NPObjectPoolBase
+{
+public:
+
+    const char* name() const {
+        return m_name;
+    }
+
+    uint32_t live() const {
+        return m_live;
+    }
+    uint32_t pooled() const {
+        return m_pooled;
+    }
+    uint32_t allocated() const {        ///< Objects that needed fresh memory
+        return m_allocated;
+    }
+    uint32_t reused() const {           ///< Objects that got recycled memory
+        return m_reused;
+    }
+
+    /// All pools in the process, in no particular order
+    static NPObjectPoolBase* first() {
+        return s_first;
+    }
+    NPObjectPoolBase* next() const {
+        return m_next;
+    }
+
+protected:
+
+    NPObjectPoolBase(const char* name, size_t size);
+    ~NPObjectPoolBase();
+
+    void* acquire();
+    void release(void* mem);
+
+private:
+
+    static const uint32_t kMaxPooled = 16;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static NPObjectPoolBase* s_first;
+
+    const char* m_name;
+    size_t m_size;
+    FreeBlock* m_free;
+    uint32_t m_pooled;
+    uint32_t m_live;
+    uint32_t m_allocated;
+    uint32_t m_reused;
+    NPObjectPoolBase* m_next;
+};
+
+/**
+ * Pool for objects of class @a T, whose constructor takes a single argument.
+ * Meant to back the PrvObjAllocate()/PrvObjDeallocate() hooks of its NPClass.
+ */
+template <class T>
+class NPObjectPool : public NPObjectPoolBase
+{
+public:
+
+    explicit NPObjectPool(const char* name)
+        : NPObjectPoolBase(name, sizeof(T))
+    {
+    }
+
+    template <class Arg>
+    T* create(Arg arg) {
+        void* mem = acquire();
+        return mem ? new (mem) T(arg) : 0;
+    }
+
+    void destroy(T* obj) {
+        if (!obj)
+            return;
+        obj->~T();
+        release(obj);
+    }
+};
+
+#endif /* NPOBJECTPOOL_H */
@@ -0,0 +1,123 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <vector>
+
+#include "NPPropertyBag.h"
+
+NPPropertyIndex* NPPropertyIndex::s_first = 0;
+
+NPPropertyIndex::NPPropertyIndex(const NPPropertyField* fields, int count)
+    : m_fields(fields)
+    , m_count(count)
+    , m_ids(0)
+    , m_slots(0)
+    , m_mask(0)
+    , m_shift(0)
+    , m_next(s_first)
+{
+    s_first = this;
+}
+
+NPPropertyIndex::~NPPropertyIndex()
+{
+    delete [] m_ids;
+    delete [] m_slots;
+}
+
+void NPPropertyIndex::internAll()
+{
+    for (NPPropertyIndex* index = s_first; index; index = index->m_next)
+        index->intern();
+}
+
+/**
+ * Fibonacci hashing of the identifier pointer, taking the top bits.
+ */
+uint32_t NPPropertyIndex::slotFor(NPIdentifier name) const
+{
+    return ((uint32_t) ((uintptr_t) name >> 2) * 2654435761u) >> m_shift;
+}
+
+void NPPropertyIndex::intern()
+{
+    if (m_slots)
+        return;
+
+    std::vector<const NPUTF8*> names(m_count);
+    for (int i = 0; i < m_count; i++)
+        names[i] = m_fields[i].name;
+
+    m_ids = new NPIdentifier[m_count];
+    AdapterBase::NPN_GetStringIdentifiers(&names[0], m_count, m_ids);
+
+    // At most a quarter full, so a lookup rarely probes past its first slot
+    int bits = 4;
+    while ((1 << bits) < m_count * 4)
+        bits++;
+
+    m_mask = (1u << bits) - 1;
+    m_shift = 32 - bits;
+    m_slots = new Slot[m_mask + 1];
+    for (uint32_t i = 0; i <= m_mask; i++) {
+        m_slots[i].id = NULL;
+        m_slots[i].field = -1;
+    }
+
+    for (int i = 0; i < m_count; i++) {
+        uint32_t s = slotFor(m_ids[i]);
+        while (m_slots[s].id && m_slots[s].id != m_ids[i])
+            s = (s + 1) & m_mask;
+        m_slots[s].id = m_ids[i];
+        m_slots[s].field = i;
+    }
+}
+
+const NPPropertyField* NPPropertyIndex::find(NPIdentifier name)
+{
+    if (!m_slots)
+        intern();
+
+    if (!name)
+        return NULL;
+
+    for (uint32_t s = slotFor(name); m_slots[s].id; s = (s + 1) & m_mask) {
+        if (m_slots[s].id == name)
+            return &m_fields[m_slots[s].field];
+    }
+
+    return NULL;
+}
+
+bool NPPropertyIndex::enumerate(NPIdentifier** value, uint32_t* count)
+{
+    if (!value || !count)
+        return false;
+
+    if (!m_slots)
+        intern();
+
+    NPIdentifier* ids = (NPIdentifier*) AdapterBase::NPN_MemAlloc(m_count * sizeof(NPIdentifier));
+    if (!ids)
+        return false;
+
+    memcpy(ids, m_ids, m_count * sizeof(NPIdentifier));
+    *value = ids;
+    *count = m_count;
+    return true;
+}
@@ -0,0 +1,295 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef NPPROPERTYBAG_H
+#define NPPROPERTYBAG_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include <npupp.h>
+#include <npapi.h>
+#include <npruntime.h>
+#include <AdapterBase.h>
+
+#include "NPObjectPool.h"
+
+class BrowserAdapter;
+
+/**
+ * One property of an NPPropertyBag, see the NP_*_PROPERTY macros below.
+ */
+struct NPPropertyField {
+    const char* name;
+    void (*get)(NPObject* obj, NPVariant* result);
+    bool (*set)(NPObject* obj, const NPVariant* value);    ///< NULL if read-only
+};
+
+/**
+ * Maps the identifiers of a property table to its fields in constant time.
+ *
+ * The identifiers are interned once for every table when the plugin library
+ * is loaded (see internAll()) and kept in a small open addressing hash table,
+ * so a property access costs one hash instead of a scan over all names.
+ */
+class NPPropertyIndex
+{
+public:
+
+    NPPropertyIndex(const NPPropertyField* fields, int count);
+    ~NPPropertyIndex();
+
+    /**
+     * Interns the identifiers of every index in the process.
+     */
+    static void internAll();
+
+    /**
+     * @return the field called @a name, NULL if there is none.
+     */
+    const NPPropertyField* find(NPIdentifier name);
+
+    /**
+     * NPClass enumerate: all property identifiers, in a buffer the caller frees.
+     */
+    bool enumerate(NPIdentifier** value, uint32_t* count);
+
+private:
+
+    struct Slot {
+        NPIdentifier id;
+        int field;
+    };
+
+    void intern();
+    uint32_t slotFor(NPIdentifier name) const;
+
+    static NPPropertyIndex* s_first;
+
+    const NPPropertyField* m_fields;
+    int m_count;
+    NPIdentifier* m_ids;
+    Slot* m_slots;              ///< NULL until interned
+    uint32_t m_mask;
+    int m_shift;
+    NPPropertyIndex* m_next;
+};
+
+/**
+ * Base for plain NPObjects that only expose properties.
+ *
+ * The derived class @a T lists its properties once in a static NPPropertyField
+ * table and gets all NPClass callbacks from here: property access goes
+ * through the table, methods and construction are unsupported, and objects
+ * come from an NPObjectPool. @a T must declare, accessible to this class:
+ *
+ * @code
+ *     static const NPPropertyField sFields[];
+ *     static NPPropertyIndex sIndex;
+ *     static NPObjectPool<T> sPool;
+ * @endcode
+ *
+ * and a constructor taking the @a A* the plugin instance data points to.
+ * Its NPClass is then defined with NP_PROPERTY_BAG_CLASS(T).
+ */
+template <class T, class A = BrowserAdapter>
+class NPPropertyBag : public NPObject
+{
+public:
+
+    static NPObject* PrvObjAllocate(NPP npp, NPClass* klass) {
+        return T::sPool.create(static_cast<A*>(npp->pdata));
+    }
+    static void PrvObjDeallocate(NPObject* obj) {
+        T::sPool.destroy(static_cast<T*>(obj));
+    }
+    static void PrvObjInvalidate(NPObject* obj) {
+    }
+    static bool PrvObjHasMethod(NPObject* obj, NPIdentifier name) {
+        return false;
+    }
+    static bool PrvObjInvoke(NPObject* obj, NPIdentifier name, const NPVariant* args,
+                             uint32_t argCount, NPVariant* result) {
+        return false;
+    }
+    static bool PrvObjInvokeDefault(NPObject* obj, const NPVariant* args,
+                                    uint32_t argCount, NPVariant* result) {
+        return false;
+    }
+    static bool PrvObjHasProperty(NPObject* obj, NPIdentifier name) {
+        return T::sIndex.find(name) != NULL;
+    }
+    static bool PrvObjGetProperty(NPObject* obj, NPIdentifier name, NPVariant* result) {
+        const NPPropertyField* field = T::sIndex.find(name);
+        if (!field || !result)
+            return false;
+        field->get(obj, result);
+        return true;
+    }
+    static bool PrvObjSetProperty(NPObject* obj, NPIdentifier name, const NPVariant* value) {
+        const NPPropertyField* field = T::sIndex.find(name);
+        return field && field->set && value && field->set(obj, value);
+    }
+    static bool PrvObjRemoveProperty(NPObject* obj, NPIdentifier name) {
+        return false;
+    }
+    static bool PrvObjEnumerate(NPObject* obj, NPIdentifier** value, uint32_t* count) {
+        return T::sIndex.enumerate(value, count);
+    }
+    static bool PrvObjConstruct(NPObject* obj, const NPVariant* args,
+                                uint32_t argCount, NPVariant* result) {
+        return false;
+    }
+};
+
+/**
+ * \name Property accessors for the NP_*_PROPERTY macros
+ */
+/*@{*/
+template <class T, bool T::*M>
+void NPGetBool(NPObject* obj, NPVariant* result)
+{
+    BOOLEAN_TO_NPVARIANT(static_cast<T*>(obj)->*M, *result);
+}
+
+template <class T, bool T::*M>
+bool NPSetBool(NPObject* obj, const NPVariant* value)
+{
+    if (!NPVARIANT_IS_BOOLEAN(*value))
+        return false;
+    static_cast<T*>(obj)->*M = NPVARIANT_TO_BOOLEAN(*value);
+    return true;
+}
+
+template <class T, int T::*M>
+void NPGetInt(NPObject* obj, NPVariant* result)
+{
+    INT32_TO_NPVARIANT(static_cast<T*>(obj)->*M, *result);
+}
+
+template <class T, int T::*M>
+bool NPSetInt(NPObject* obj, const NPVariant* value)
+{
+    if (!AdapterBase::IsIntegerVariant(value))
+        return false;
+    static_cast<T*>(obj)->*M = AdapterBase::VariantToInteger(value);
+    return true;
+}
+
+template <class T, int T::*M>
+void NPGetNumber(NPObject* obj, NPVariant* result)
+{
+    DOUBLE_TO_NPVARIANT((double) (static_cast<T*>(obj)->*M), *result);
+}
+
+template <class T, int T::*M>
+bool NPSetNumber(NPObject* obj, const NPVariant* value)
+{
+    if (!NPVARIANT_IS_DOUBLE(*value))
+        return false;
+    static_cast<T*>(obj)->*M = (int) NPVARIANT_TO_DOUBLE(*value);
+    return true;
+}
+
+/// An empty string reads as null
+template <class T, std::string T::*M>
+void NPGetString(NPObject* obj, NPVariant* result)
+{
+    const std::string& s = static_cast<T*>(obj)->*M;
+    if (s.empty()) {
+        NULL_TO_NPVARIANT(*result);
+        return;
+    }
+
+    // Not inside STRINGZ_TO_NPVARIANT, which evaluates its argument twice
+    char* copy = strdup(s.c_str());
+    STRINGZ_TO_NPVARIANT(copy, *result);
+}
+
+template <class T, std::string T::*M>
+bool NPSetString(NPObject* obj, const NPVariant* value)
+{
+    if (!NPVARIANT_IS_STRING(*value))
+        return false;
+    char* s = AdapterBase::NPStringToString(NPVARIANT_TO_STRING(*value));
+    static_cast<T*>(obj)->*M = s;
+    ::free(s);
+    return true;
+}
+
+template <class T, NPObject* T::*M>
+void NPGetObject(NPObject* obj, NPVariant* result)
+{
+    NPObject* value = static_cast<T*>(obj)->*M;
+    if (!value) {
+        NULL_TO_NPVARIANT(*result);
+        return;
+    }
+    AdapterBase::NPN_RetainObject(value);
+    OBJECT_TO_NPVARIANT(value, *result);
+}
+
+/// True if any bit of @a Mask is set in the member
+template <class T, int T::*M, int Mask>
+void NPGetFlag(NPObject* obj, NPVariant* result)
+{
+    BOOLEAN_TO_NPVARIANT((static_cast<T*>(obj)->*M & Mask) != 0, *result);
+}
+/*@}*/
+
+/**
+ * \name Property table entries
+ *
+ * @a Kind is one of Bool, Int (an int read as an int32), Number (an int read
+ * as a double) or String. Objects and flags are read-only.
+ */
+/*@{*/
+#define NP_PROPERTY(T, name, Kind, member) \
+    { name, &NPGet##Kind<T, &T::member>, &NPSet##Kind<T, &T::member> }
+#define NP_READONLY_PROPERTY(T, name, Kind, member) \
+    { name, &NPGet##Kind<T, &T::member>, NULL }
+#define NP_OBJECT_PROPERTY(T, name, member) \
+    { name, &NPGetObject<T, &T::member>, NULL }
+#define NP_FLAG_PROPERTY(T, name, member, mask) \
+    { name, &NPGetFlag<T, &T::member, mask>, NULL }
+#define NP_COMPUTED_PROPERTY(name, getter) \
+    { name, getter, NULL }
+/*@}*/
+
+/**
+ * Initializer of the NPClass of NPPropertyBag @a T.
+ */
+#define NP_PROPERTY_BAG_CLASS(T) { \
+    NP_CLASS_STRUCT_VERSION_CTOR, \
+    T::PrvObjAllocate, \
+    T::PrvObjDeallocate, \
+    T::PrvObjInvalidate, \
+    T::PrvObjHasMethod, \
+    T::PrvObjInvoke, \
+    T::PrvObjInvokeDefault, \
+    T::PrvObjHasProperty, \
+    T::PrvObjGetProperty, \
+    T::PrvObjSetProperty, \
+    T::PrvObjRemoveProperty, \
+    T::PrvObjEnumerate, \
+    T::PrvObjConstruct, \
+}
+
+#endif /* NPPROPERTYBAG_H */
@@ -0,0 +1,432 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <string.h>
+#include <vector>
+
+#include "PendingQueryTable.h"
+
+static const uint32_t kMinCapacity = 16;
+
+// Queries this close to their deadline are expired along with the one that
+// armed the timer, so a burst of lost queries costs a single wakeup
+static const uint64_t kExpirySlackUs = 1000000;
+
+// Big enough for every BrowserServerCallArgs subclass
+static const size_t kSlabBlockSize = 64;
+static const uint32_t kSlabBlocksPerChunk = 64;
+
+/**
+ * Blocks not in use, linked through their first word. Chunks are never given
+ * back, so the slab holds as many blocks as were ever pending at once; the
+ * query deadlines keep that bounded.
+ */
+struct PrvSlabBlock {
+    PrvSlabBlock* next;
+};
+static PrvSlabBlock* s_slabFree = 0;
+
+void* PendingQuery::operator new(size_t size)
+{
+    if (size > kSlabBlockSize)
+        return ::operator new(size);
+
+    if (!s_slabFree) {
+        char* chunk = (char*) g_malloc(kSlabBlockSize * kSlabBlocksPerChunk);
+        for (uint32_t i = 0; i < kSlabBlocksPerChunk; i++) {
+            PrvSlabBlock* block = (PrvSlabBlock*) (chunk + i * kSlabBlockSize);
+            block->next = s_slabFree;
+            s_slabFree = block;
+        }
+    }
+
+    PrvSlabBlock* block = s_slabFree;
+    s_slabFree = block->next;
+    return block;
+}
+
+void PendingQuery::operator delete(void* p, size_t size)
+{
+    if (!p)
+        return;
+
+    if (size > kSlabBlockSize) {
+        ::operator delete(p);
+        return;
+    }
+
+    PrvSlabBlock* block = (PrvSlabBlock*) p;
+    block->next = s_slabFree;
+    s_slabFree = block;
+}
+
+/**
+ * Query numbers are handed out sequentially. Multiplying by an odd constant
+ * maps any run of them that fits the table to distinct slots.
+ */
+static inline uint32_t PrvHash(int queryNum)
+{
+    return (uint32_t) queryNum * 2654435761u;
+}
+
+PendingQueryTable::PendingQueryTable(GMainContext* ctxt, int kindCount, uint32_t timeoutMs)
+    : m_ctxt(ctxt)
+    , m_timeoutUs((uint64_t) timeoutMs * 1000)
+    , m_slots(0)
+    , m_capacity(kMinCapacity)
+    , m_used(0)
+    , m_deleted(0)
+    , m_stats(new KindStats[kindCount])
+    , m_kindCount(kindCount)
+    , m_timeoutSource(0)
+    , m_timeoutDeadline(0)
+{
+    m_slots = (Slot*) g_malloc0(m_capacity * sizeof(Slot)); // all SlotEmpty
+}
+
+PendingQueryTable::~PendingQueryTable()
+{
+    cancelTimeout();
+
+    for (uint32_t i = 0; i < m_capacity; i++) {
+        if (m_slots[i].state == SlotUsed)
+            delete m_slots[i].query;
+    }
+
+    g_free(m_slots);
+    delete [] m_stats;
+}
+
+PendingQueryTable::Slot* PendingQueryTable::find(int queryNum) const
+{
+    // The load factor is kept below 3/4 so an empty slot always ends the probe
+    uint32_t mask = m_capacity - 1;
+    for (uint32_t i = PrvHash(queryNum) & mask; ; i = (i + 1) & mask) {
+        Slot* slot = &m_slots[i];
+        if (slot->state == SlotEmpty)
+            return 0;
+        if (slot->state == SlotUsed && slot->queryNum == queryNum)
+            return slot;
+    }
+}
+
+/**
+ * Moves every entry into a fresh array of @a capacity slots, which also
+ * drops all tombstones.
+ */
+void PendingQueryTable::rehash(uint32_t capacity)
+{
+    Slot* oldSlots = m_slots;
+    uint32_t oldCapacity = m_capacity;
+
+    m_slots = (Slot*) g_malloc0(capacity * sizeof(Slot));
+    m_capacity = capacity;
+    m_deleted = 0;
+
+    uint32_t mask = m_capacity - 1;
+    for (uint32_t i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i].state != SlotUsed)
+            continue;
+
+        uint32_t j = PrvHash(oldSlots[i].queryNum) & mask;
+        while (m_slots[j].state != SlotEmpty)
+            j = (j + 1) & mask;
+        m_slots[j] = oldSlots[i];
+    }
+
+    g_free(oldSlots);
+}
+
+PendingQueryTable::Slot* PendingQueryTable::insert(int kind, PendingQuery* query)
+{
+    if (kind < 0 || kind >= m_kindCount) {
+        g_critical("%s: bad query kind %d", __FUNCTION__, kind);
+        delete query;
+        return 0;
+    }
+
+    PendingQuery* dropped = 0;
+
+    Slot* slot = find(query->m_queryNum);
+    if (slot) {
+        g_warning("%s: query %d is already pending, dropping the older one", __FUNCTION__, query->m_queryNum);
+        unshare(slot);
+        m_stats[slot->kind].pending--;
+        m_stats[slot->kind].lost++;
+        dropped = slot->query;
+        slot->query = 0;
+        slot->state = SlotDeleted;
+        m_used--;
+        m_deleted++;
+    }
+
+    if ((m_used + m_deleted + 1) * 4 > m_capacity * 3)
+        rehash((m_used + 1) * 2 > m_capacity ? m_capacity * 2 : m_capacity);
+
+    uint32_t mask = m_capacity - 1;
+    uint32_t i = PrvHash(query->m_queryNum) & mask;
+    while (m_slots[i].state == SlotUsed)
+        i = (i + 1) & mask;
+
+    slot = &m_slots[i];
+    if (slot->state == SlotDeleted)
+        m_deleted--;
+
+    slot->query = query;
+    slot->deadline = query->m_sentTime + m_timeoutUs;
+    slot->shareKey = 0;
+    slot->queryNum = query->m_queryNum;
+    slot->kind = kind;
+    slot->state = SlotUsed;
+    slot->shared = 0;
+
+    m_used++;
+    m_stats[kind].pending++;
+
+    scheduleTimeout(slot->deadline);
+
+    // Only now that the table is consistent: releasing a callback may call back into us
+    if (dropped) {
+        int queryNum = slot->queryNum;
+        delete dropped;
+        slot = find(queryNum);
+    }
+
+    return slot;
+}
+
+void PendingQueryTable::add(int kind, PendingQuery* query)
+{
+    insert(kind, query);
+}
+
+void PendingQueryTable::addShared(int kind, uint64_t key, PendingQuery* query)
+{
+    Slot* slot = insert(kind, query);
+    if (!slot)
+        return;
+
+    slot->shareKey = key;
+    slot->shared = 1;
+    m_shared[std::make_pair(kind, key)] = slot->queryNum;
+}
+
+bool PendingQueryTable::join(int kind, uint64_t key, PendingQuery* query)
+{
+    ShareMap::iterator it = m_shared.find(std::make_pair(kind, key));
+    if (it == m_shared.end())
+        return false;
+
+    Slot* slot = find(it->second);
+    if (!slot) {
+        m_shared.erase(it);
+        return false;
+    }
+
+    // Keep the chain in call order so callbacks fire in the order they were made
+    PendingQuery* last = slot->query;
+    while (last->m_joined)
+        last = last->m_joined;
+    last->m_joined = query;
+
+    m_stats[kind].joined++;
+    return true;
+}
+
+void PendingQueryTable::unshare(Slot* slot)
+{
+    if (!slot->shared)
+        return;
+
+    ShareMap::iterator it = m_shared.find(std::make_pair((int) slot->kind, slot->shareKey));
+    if (it != m_shared.end() && it->second == slot->queryNum)
+        m_shared.erase(it);
+    slot->shared = 0;
+}
+
+void PendingQueryTable::unshareAll()
+{
+    if (m_shared.empty())
+        return;
+
+    m_shared.clear();
+    for (uint32_t i = 0; i < m_capacity; i++)
+        m_slots[i].shared = 0;
+}
+
+PendingQuery* PendingQueryTable::take(int kind, int queryNum)
+{
+    if (kind < 0 || kind >= m_kindCount) {
+        g_critical("%s: bad query kind %d", __FUNCTION__, kind);
+        return NULL;
+    }
+
+    Slot* slot = find(queryNum);
+    if (!slot || slot->kind != kind) {
+        m_stats[kind].unmatched++;
+        return NULL;	// Not found
+    }
+
+    unshare(slot);
+
+    PendingQuery* query = slot->query;
+    slot->query = 0;
+    slot->state = SlotDeleted;
+    m_used--;
+    m_deleted++;
+
+    m_stats[kind].pending--;
+    m_stats[kind].latency.record(LatencyHistogram::now() - query->m_sentTime);
+
+    if (!m_used) {
+        cancelTimeout();
+        if (m_capacity == kMinCapacity) {
+            ::memset(m_slots, 0, m_capacity * sizeof(Slot));
+            m_deleted = 0;
+        }
+        else {
+            rehash(kMinCapacity);
+        }
+    }
+
+    return query;	// Caller now owns this pointer
+}
+
+void PendingQueryTable::clear()
+{
+    std::vector<PendingQuery*> dropped;
+    dropped.reserve(m_used);
+
+    for (uint32_t i = 0; i < m_capacity; i++) {
+        if (m_slots[i].state != SlotUsed)
+            continue;
+
+        dropped.push_back(m_slots[i].query);
+        m_stats[m_slots[i].kind].pending--;
+        m_stats[m_slots[i].kind].lost++;
+    }
+
+    cancelTimeout();
+    m_shared.clear();
+
+    g_free(m_slots);
+    m_capacity = kMinCapacity;
+    m_slots = (Slot*) g_malloc0(m_capacity * sizeof(Slot));
+    m_used = 0;
+    m_deleted = 0;
+
+    if (!dropped.empty())
+        g_message("%s: dropping %u pending queries", __FUNCTION__, (unsigned) dropped.size());
+
+    // Only now that the table is consistent: releasing a callback may call back into us
+    for (size_t i = 0; i < dropped.size(); i++)
+        delete dropped[i];
+}
+
+/**
+ * Deletes the queries that are past (or about to reach) their deadline, gives
+ * back memory if the table is now mostly empty and re-arms the timer.
+ */
+void PendingQueryTable::expire()
+{
+    uint64_t limit = LatencyHistogram::now() + kExpirySlackUs;
+    uint64_t next = 0;
+    std::vector<PendingQuery*> expired;
+
+    for (uint32_t i = 0; i < m_capacity; i++) {
+        Slot* slot = &m_slots[i];
+        if (slot->state != SlotUsed)
+            continue;
+
+        if (slot->deadline <= limit) {
+            unshare(slot);
+            expired.push_back(slot->query);
+            m_stats[slot->kind].pending--;
+            m_stats[slot->kind].lost++;
+            slot->query = 0;
+            slot->state = SlotDeleted;
+            m_used--;
+            m_deleted++;
+        }
+        else if (!next || slot->deadline < next) {
+            next = slot->deadline;
+        }
+    }
+
+    uint32_t capacity = m_capacity;
+    while (capacity > kMinCapacity && m_used * 4 < capacity)
+        capacity /= 2;
+    if (capacity != m_capacity || m_deleted)
+        rehash(capacity);
+
+    if (m_used)
+        scheduleTimeout(next);
+
+    if (!expired.empty())
+        g_message("%s: %u queries got no reply within %llu ms", __FUNCTION__,
+                  (unsigned) expired.size(), (unsigned long long) (m_timeoutUs / 1000));
+
+    for (size_t i = 0; i < expired.size(); i++)
+        delete expired[i];
+}
+
+size_t PendingQueryTable::memoryUsage() const
+{
+    // Queries are counted at their base size, few subclasses add much
+    return m_capacity * sizeof(Slot)
+           + m_used * sizeof(PendingQuery)
+           + m_shared.size() * sizeof(ShareMap::value_type);
+}
+
+void PendingQueryTable::scheduleTimeout(uint64_t deadline)
+{
+    if (m_timeoutSource) {
+        if (m_timeoutDeadline <= deadline)
+            return;
+        cancelTimeout();
+    }
+
+    uint64_t now = LatencyHistogram::now();
+    guint interval = deadline > now ? (guint) ((deadline - now + 999) / 1000) : 0;
+
+    m_timeoutSource = g_timeout_source_new(interval);
+    g_source_set_callback(m_timeoutSource, timeoutCb, this /*data*/, NULL);
+    g_source_attach(m_timeoutSource, m_ctxt);
+    m_timeoutDeadline = deadline;
+}
+
+void PendingQueryTable::cancelTimeout()
+{
+    if (m_timeoutSource) {
+        g_source_destroy(m_timeoutSource);
+        g_source_unref(m_timeoutSource);
+        m_timeoutSource = 0;
+    }
+}
+
+gboolean PendingQueryTable::timeoutCb(gpointer data)
+{
+    PendingQueryTable* table = (PendingQueryTable*) data;
+
+    g_source_unref(table->m_timeoutSource);
+    table->m_timeoutSource = 0;
+
+    table->expire();
+
+    return FALSE;
+}
@@ -0,0 +1,199 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef PENDINGQUERYTABLE_H
+#define PENDINGQUERYTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <glib.h>
+#include <map>
+#include <utility>
+
+#include "LatencyHistogram.h"
+
+/**
+ * Arguments of a call into BrowserServer that we're waiting for a reply on.
+ * Subclasses release whatever they hold (e.g. JS callbacks) in their destructor.
+ *
+ * Queries come from a process wide slab of fixed size blocks (main thread
+ * only), so the steady stream of them doesn't go through malloc. Subclasses
+ * too big for a block fall back to the heap.
+ */
+struct PendingQuery {
+    PendingQuery(int queryNum) : m_queryNum(queryNum), m_sentTime(LatencyHistogram::now()), m_joined(0) {}
+    virtual ~PendingQuery() {
+        delete m_joined;
+    }
+
+    static void* operator new(size_t size);
+    static void operator delete(void* p, size_t size);
+
+    int			m_queryNum;		///< The query number used to associate the reply with the correct call.
+    uint64_t	m_sentTime;		///< When the query was sent, see LatencyHistogram::now().
+    PendingQuery*	m_joined;	///< Next identical query completed by the same reply, owned.
+};
+
+/**
+ * All the queries an adapter is waiting on, keyed by query number.
+ *
+ * Entries live inline in a single open addressing slot array (linear probing),
+ * so adding and taking a query costs the same no matter how many are
+ * outstanding and no memory is allocated per query besides the query itself.
+ * Every entry has a deadline; a main loop timer armed for the earliest one
+ * deletes queries whose reply never came, which releases their callbacks.
+ *
+ * Each query has a kind (a small integer defined by the owner) that a reply
+ * must match, and per kind reply latency statistics are kept.
+ *
+ * A query may also be added as shared under a key (e.g. a document point).
+ * Until it is answered, identical queries can join it instead of making their
+ * own round trip; they end up in its m_joined chain.
+ */
+class PendingQueryTable
+{
+public:
+
+    PendingQueryTable(GMainContext* ctxt, int kindCount, uint32_t timeoutMs);
+    ~PendingQueryTable();
+
+    /**
+     * Add a query waiting for a reply. We now own the pointer.
+     */
+    void add(int kind, PendingQuery* query);
+
+    /**
+     * Like add() but identical queries may join this one, see join().
+     */
+    void addShared(int kind, uint64_t key, PendingQuery* query);
+
+    /**
+     * Attach @a query to the shared query of @a kind and @a key still waiting
+     * for its reply, if any. The table (and later the caller of take()) then
+     * owns @a query.
+     *
+     * @return false if there is nothing to join, @a query is left untouched.
+     */
+    bool join(int kind, uint64_t key, PendingQuery* query);
+
+    /**
+     * Stop later queries from joining any of those now pending, e.g. because
+     * their answer may have changed since they were sent.
+     */
+    void unshareAll();
+
+    /**
+     * Find the query of @a kind whose query number matches the one provided.
+     * <strong>The caller now owns the query.</strong>
+     *
+     * @return the query, NULL if unknown (e.g. it already timed out).
+     */
+    PendingQuery* take(int kind, int queryNum);
+
+    template<typename T>
+    T* takeAs(int kind, int queryNum) {
+        return static_cast<T*>(take(kind, queryNum));
+    }
+
+    /**
+     * Deletes every pending query, e.g. when the server went away and no
+     * reply will ever come. They are counted as lost.
+     */
+    void clear();
+
+    uint32_t size() const {
+        return m_used;
+    }
+
+    /// Approximate bytes held by the table and its queries
+    size_t memoryUsage() const;
+
+    const LatencyHistogram& latency(int kind) const {
+        return m_stats[kind].latency;
+    }
+    uint32_t pendingCount(int kind) const {
+        return m_stats[kind].pending;
+    }
+    uint32_t lostCount(int kind) const {
+        return m_stats[kind].lost;
+    }
+    uint32_t unmatchedCount(int kind) const {
+        return m_stats[kind].unmatched;
+    }
+    uint32_t joinedCount(int kind) const {
+        return m_stats[kind].joined;
+    }
+
+private:
+
+    enum SlotState {
+        SlotEmpty = 0,
+        SlotUsed,
+        SlotDeleted     ///< Tombstone, keeps probe sequences intact
+    };
+
+    struct Slot {
+        PendingQuery* query;
+        uint64_t deadline;
+        uint64_t shareKey;
+        int queryNum;
+        uint16_t kind;
+        uint8_t state;
+        uint8_t shared;     ///< Registered in m_shared under shareKey
+    };
+
+    typedef std::map<std::pair<int, uint64_t>, int> ShareMap; ///< (kind, key) -> queryNum
+
+    struct KindStats {
+        LatencyHistogram latency;   ///< Time from sending a query to handling its reply
+        uint32_t pending;
+        uint32_t lost;              ///< Timed out or dropped on disconnect
+        uint32_t unmatched;         ///< Replies for which no query was found
+        uint32_t joined;            ///< Queries that shared another one's reply
+
+        KindStats() : pending(0), lost(0), unmatched(0), joined(0) {}
+    };
+
+    Slot* find(int queryNum) const;
+    Slot* insert(int kind, PendingQuery* query);
+    void unshare(Slot* slot);
+    void rehash(uint32_t capacity);
+    void expire();
+    void scheduleTimeout(uint64_t deadline);
+    void cancelTimeout();
+
+    static gboolean timeoutCb(gpointer data);
+
+    GMainContext* m_ctxt;
+    uint64_t m_timeoutUs;
+
+    Slot* m_slots;
+    uint32_t m_capacity;            ///< Always a power of two
+    uint32_t m_used;
+    uint32_t m_deleted;
+
+    ShareMap m_shared;
+
+    KindStats* m_stats;
+    int m_kindCount;
+
+    GSource* m_timeoutSource;
+    uint64_t m_timeoutDeadline;     ///< When m_timeoutSource fires
+};
+
+#endif /* PENDINGQUERYTABLE_H */
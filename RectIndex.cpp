@@ -0,0 +1,225 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <algorithm>
+
+#include "RectIndex.h"
+
+RectIndex::RectIndex()
+{
+}
+
+/**
+ * Cells covered by @a rect. Coordinates may be negative, the shift rounds
+ * them towards negative infinity.
+ */
+RectIndex::CellRange RectIndex::cellRange(const BrowserRect& rect)
+{
+    CellRange range;
+    range.left = rect.x() >> kCellShift;
+    range.top = rect.y() >> kCellShift;
+    range.right = (rect.x() + std::max(rect.w(), 1) - 1) >> kCellShift;
+    range.bottom = (rect.y() + std::max(rect.h(), 1) - 1) >> kCellShift;
+    return range;
+}
+
+uint64_t RectIndex::cellKey(int cx, int cy)
+{
+    return ((uint64_t) (uint32_t) cx << 32) | (uint32_t) cy;
+}
+
+void RectIndex::link(uintptr_t id, const BrowserRect& rect)
+{
+    CellRange range = cellRange(rect);
+    if (range.count() > kMaxCellsPerRect) {
+        m_oversized.push_back(id);
+        return;
+    }
+
+    for (int cy = range.top; cy <= range.bottom; cy++) {
+        for (int cx = range.left; cx <= range.right; cx++)
+            m_cells[cellKey(cx, cy)].push_back(id);
+    }
+}
+
+void RectIndex::unlink(uintptr_t id, const BrowserRect& rect)
+{
+    CellRange range = cellRange(rect);
+    if (range.count() > kMaxCellsPerRect) {
+        m_oversized.erase(std::remove(m_oversized.begin(), m_oversized.end(), id), m_oversized.end());
+        return;
+    }
+
+    for (int cy = range.top; cy <= range.bottom; cy++) {
+        for (int cx = range.left; cx <= range.right; cx++) {
+            CellMap::iterator cell = m_cells.find(cellKey(cx, cy));
+            if (cell == m_cells.end())
+                continue;
+
+            Cell& ids = cell->second;
+            ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+            if (ids.empty())
+                m_cells.erase(cell);
+        }
+    }
+}
+
+void RectIndex::insert(uintptr_t id, const BrowserRect& rect)
+{
+    remove(id);
+
+    m_rects.insert(RectMap::value_type(id, rect));
+    link(id, rect);
+}
+
+bool RectIndex::remove(uintptr_t id)
+{
+    RectMap::iterator it = m_rects.find(id);
+    if (it == m_rects.end())
+        return false;
+
+    unlink(id, it->second);
+    m_rects.erase(it);
+    return true;
+}
+
+void RectIndex::clear()
+{
+    m_rects.clear();
+    m_cells.clear();
+    m_oversized.clear();
+}
+
+size_t RectIndex::memoryUsage() const
+{
+    size_t bytes = m_rects.size() * sizeof(RectMap::value_type)
+                   + m_cells.size() * sizeof(CellMap::value_type)
+                   + m_oversized.capacity() * sizeof(uintptr_t);
+
+    for (CellMap::const_iterator cell = m_cells.begin(); cell != m_cells.end(); ++cell)
+        bytes += cell->second.capacity() * sizeof(uintptr_t);
+
+    return bytes;
+}
+
+bool RectIndex::containsPoint(int x, int y) const
+{
+    if (m_rects.empty())
+        return false;
+
+    BrowserRect point(x, y, 1, 1);
+
+    CellMap::const_iterator cell = m_cells.find(cellKey(x >> kCellShift, y >> kCellShift));
+    if (cell != m_cells.end()) {
+        for (Cell::const_iterator i = cell->second.begin(); i != cell->second.end(); ++i) {
+            if (m_rects.find(*i)->second.overlaps(point))
+                return true;
+        }
+    }
+
+    for (std::vector<uintptr_t>::const_iterator i = m_oversized.begin(); i != m_oversized.end(); ++i) {
+        if (m_rects.find(*i)->second.overlaps(point))
+            return true;
+    }
+
+    return false;
+}
+
+void RectIndex::queryRect(const BrowserRect& rect, std::vector<uintptr_t>& ids) const
+{
+    ids.clear();
+    if (m_rects.empty())
+        return;
+
+    CellRange range = cellRange(rect);
+
+    // Walk whichever is smaller: the cells under the query or the occupied ones
+    if (range.count() <= (int64_t) m_cells.size()) {
+        for (int cy = range.top; cy <= range.bottom; cy++) {
+            for (int cx = range.left; cx <= range.right; cx++) {
+                CellMap::const_iterator cell = m_cells.find(cellKey(cx, cy));
+                if (cell != m_cells.end())
+                    ids.insert(ids.end(), cell->second.begin(), cell->second.end());
+            }
+        }
+    }
+    else {
+        for (CellMap::const_iterator cell = m_cells.begin(); cell != m_cells.end(); ++cell)
+            ids.insert(ids.end(), cell->second.begin(), cell->second.end());
+    }
+    ids.insert(ids.end(), m_oversized.begin(), m_oversized.end());
+
+    // A rect spanning several cells shows up once per cell
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    std::vector<uintptr_t>::iterator out = ids.begin();
+    for (std::vector<uintptr_t>::const_iterator i = ids.begin(); i != ids.end(); ++i) {
+        if (rect.intersects(m_rects.find(*i)->second))
+            *out++ = *i;
+    }
+    ids.erase(out, ids.end());
+}
+
+bool RectIndex::findIntersecting(const BrowserRect& rect, BrowserRect& found) const
+{
+    if (m_rects.empty())
+        return false;
+
+    // Unlike queryRect() there is nothing to collect or sort, and a candidate
+    // is only looked up if it would beat the best one so far
+    const BrowserRect* best = 0;
+    uintptr_t bestId = 0;
+
+    CellRange range = cellRange(rect);
+    if (range.count() <= (int64_t) m_cells.size()) {
+        for (int cy = range.top; cy <= range.bottom; cy++) {
+            for (int cx = range.left; cx <= range.right; cx++) {
+                CellMap::const_iterator cell = m_cells.find(cellKey(cx, cy));
+                if (cell != m_cells.end())
+                    lowestIntersecting(cell->second, rect, best, bestId);
+            }
+        }
+    }
+    else {
+        for (CellMap::const_iterator cell = m_cells.begin(); cell != m_cells.end(); ++cell)
+            lowestIntersecting(cell->second, rect, best, bestId);
+    }
+    lowestIntersecting(m_oversized, rect, best, bestId);
+
+    if (!best)
+        return false;
+
+    found = *best;
+    return true;
+}
+
+void RectIndex::lowestIntersecting(const std::vector<uintptr_t>& ids, const BrowserRect& rect,
+                                   const BrowserRect*& best, uintptr_t& bestId) const
+{
+    for (std::vector<uintptr_t>::const_iterator i = ids.begin(); i != ids.end(); ++i) {
+        if (best && *i >= bestId)
+            continue;
+
+        const BrowserRect& candidate = m_rects.find(*i)->second;
+        if (rect.intersects(candidate)) {
+            best = &candidate;
+            bestId = *i;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef RECTINDEX_H
+#define RECTINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "BrowserRect.h"
+
+/**
+ * Rects in document coordinates, keyed by id, with a uniform grid on top so
+ * point and intersection queries only look at rects near the query.
+ *
+ * The grid is sparse: only cells some rect touches exist. Rects too large
+ * to be worth registering in every cell they cover (e.g. a full page plugin)
+ * are kept aside and always tested.
+ */
+class RectIndex
+{
+public:
+
+    typedef std::map<uintptr_t, BrowserRect> RectMap;
+
+    RectIndex();
+
+    /**
+     * Add the rect @a id, replacing any previous rect with that id.
+     */
+    void insert(uintptr_t id, const BrowserRect& rect);
+
+    /**
+     * @return false if there is no rect @a id.
+     */
+    bool remove(uintptr_t id);
+
+    void clear();
+
+    size_t size() const {
+        return m_rects.size();
+    }
+
+    /// Approximate bytes held by the rects and the grid
+    size_t memoryUsage() const;
+
+    /// All rects, ordered by id
+    const RectMap& rects() const {
+        return m_rects;
+    }
+
+    bool containsPoint(int x, int y) const;
+
+    /**
+     * The rect with the lowest id intersecting @a rect.
+     *
+     * @return false if none does.
+     */
+    bool findIntersecting(const BrowserRect& rect, BrowserRect& found) const;
+
+    /**
+     * Ids of all rects intersecting @a rect, in no particular order.
+     */
+    void queryRect(const BrowserRect& rect, std::vector<uintptr_t>& ids) const;
+
+private:
+
+    static const int kCellShift = 8;            ///< 256 x 256 pixel cells
+    static const int kMaxCellsPerRect = 256;
+
+    typedef std::vector<uintptr_t> Cell;
+    typedef std::map<uint64_t, Cell> CellMap;
+
+    struct CellRange {
+        int left, top, right, bottom;   ///< Inclusive cell coordinates
+
+        int64_t count() const {
+            return (int64_t) (right - left + 1) * (bottom - top + 1);
+        }
+    };
+
+    static CellRange cellRange(const BrowserRect& rect);
+    static uint64_t cellKey(int cx, int cy);
+
+    void link(uintptr_t id, const BrowserRect& rect);
+    void unlink(uintptr_t id, const BrowserRect& rect);
+    void lowestIntersecting(const std::vector<uintptr_t>& ids, const BrowserRect& rect,
+                            const BrowserRect*& best, uintptr_t& bestId) const;
+
+    RectMap m_rects;
+    CellMap m_cells;
+    std::vector<uintptr_t> m_oversized;
+};
+
+#endif /* RECTINDEX_H */
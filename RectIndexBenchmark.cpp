@@ -0,0 +1,170 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+/*
+ * Compares RectIndex queries with the linear scan over a RectMap it
+ * replaced. Build with "make benchmark", then run
+ *
+ *     RectIndexBenchmark [rects] [queries]
+ *
+ * Rects are laid out like the interactive rects of a long page: mostly
+ * small, spread over a tall document, with the odd full page plugin.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <map>
+#include <vector>
+
+#include "RectIndex.h"
+
+static const int kPageWidth = 1024;
+static const int kPageHeight = 20000;
+static const int kOversizedEvery = 500;     ///< One rect in this many covers the page
+
+typedef std::map<uintptr_t, BrowserRect> RectMap;
+
+static uint32_t s_seed = 12345;
+
+/// Same sequence on every run and platform, unlike rand()
+static int PrvRandom(int limit)
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    return (int) ((s_seed >> 8) % (uint32_t) limit);
+}
+
+static uint64_t PrvNow()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool PrvLinearContainsPoint(const RectMap& rects, int x, int y)
+{
+    BrowserRect point(x, y, 1, 1);
+    for (RectMap::const_iterator i = rects.begin(); i != rects.end(); ++i) {
+        if (i->second.overlaps(point))
+            return true;
+    }
+    return false;
+}
+
+static bool PrvLinearFindIntersecting(const RectMap& rects, const BrowserRect& rect, BrowserRect& found)
+{
+    for (RectMap::const_iterator i = rects.begin(); i != rects.end(); ++i) {
+        if (rect.intersects(i->second)) {
+            found = i->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void PrvReport(const char* what, int queries, uint64_t linearUs, uint64_t indexUs)
+{
+    printf("%-18s linear %8.3f us/query   index %8.3f us/query   %6.1fx\n", what,
+           (double) linearUs / queries, (double) indexUs / queries,
+           indexUs ? (double) linearUs / indexUs : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+    int rectCount = argc > 1 ? atoi(argv[1]) : 5000;
+    int queryCount = argc > 2 ? atoi(argv[2]) : 100000;
+    if (rectCount <= 0 || queryCount <= 0) {
+        fprintf(stderr, "usage: %s [rects] [queries]\n", argv[0]);
+        return 2;
+    }
+
+    RectMap rects;
+    RectIndex index;
+    for (int i = 0; i < rectCount; i++) {
+        BrowserRect rect(PrvRandom(kPageWidth), PrvRandom(kPageHeight),
+                         20 + PrvRandom(280), 10 + PrvRandom(50));
+        if (i % kOversizedEvery == kOversizedEvery - 1)
+            rect = BrowserRect(0, PrvRandom(kPageHeight), kPageWidth, kPageHeight / 4);
+
+        rects[i] = rect;
+        index.insert(i, rect);
+    }
+
+    std::vector<BrowserRect> points;
+    std::vector<BrowserRect> areas;
+    points.reserve(queryCount);
+    areas.reserve(queryCount);
+    for (int i = 0; i < queryCount; i++) {
+        points.push_back(BrowserRect(PrvRandom(kPageWidth), PrvRandom(kPageHeight), 1, 1));
+        areas.push_back(BrowserRect(PrvRandom(kPageWidth), PrvRandom(kPageHeight),
+                                    1 + PrvRandom(400), 1 + PrvRandom(400)));
+    }
+
+    printf("%d rects (%u grid bytes), %d queries\n", rectCount,
+           (unsigned) index.memoryUsage(), queryCount);
+
+    int mismatches = 0;
+    int linearHits = 0, indexHits = 0;
+
+    uint64_t start = PrvNow();
+    for (int i = 0; i < queryCount; i++)
+        linearHits += PrvLinearContainsPoint(rects, points[i].x(), points[i].y());
+    uint64_t linearUs = PrvNow() - start;
+
+    start = PrvNow();
+    for (int i = 0; i < queryCount; i++)
+        indexHits += index.containsPoint(points[i].x(), points[i].y());
+    uint64_t indexUs = PrvNow() - start;
+
+    PrvReport("containsPoint", queryCount, linearUs, indexUs);
+    if (linearHits != indexHits)
+        mismatches++;
+
+    // The first hit of the linear scan has the lowest id, so both must agree on the rect
+    std::vector<BrowserRect> linearFound(queryCount);
+    std::vector<BrowserRect> indexFound(queryCount);
+    std::vector<bool> linearGot(queryCount);
+    std::vector<bool> indexGot(queryCount);
+
+    start = PrvNow();
+    for (int i = 0; i < queryCount; i++)
+        linearGot[i] = PrvLinearFindIntersecting(rects, areas[i], linearFound[i]);
+    linearUs = PrvNow() - start;
+
+    start = PrvNow();
+    for (int i = 0; i < queryCount; i++)
+        indexGot[i] = index.findIntersecting(areas[i], indexFound[i]);
+    indexUs = PrvNow() - start;
+
+    PrvReport("findIntersecting", queryCount, linearUs, indexUs);
+    for (int i = 0; i < queryCount; i++) {
+        if (linearGot[i] != indexGot[i]
+                || (linearGot[i] && (linearFound[i].x() != indexFound[i].x()
+                                     || linearFound[i].y() != indexFound[i].y()
+                                     || linearFound[i].w() != indexFound[i].w()
+                                     || linearFound[i].h() != indexFound[i].h())))
+            mismatches++;
+    }
+
+    if (mismatches) {
+        fprintf(stderr, "%d queries disagree with the linear scan\n", mismatches);
+        return 1;
+    }
+
+    return 0;
+}
@@ -23,116 +23,20 @@ LICENSE@@@ */
 #include "Rectangle.h"
 
 
-static const char* sPropertyIdNames[] = {
-    "left",
-    "top",
-    "right",
-    "bottom",
-    "width",
-    "height"
+const NPPropertyField Rectangle::sFields[] = {
+    NP_PROPERTY(Rectangle, "left", Int, m_left),
+    NP_PROPERTY(Rectangle, "top", Int, m_top),
+    NP_PROPERTY(Rectangle, "right", Int, m_right),
+    NP_PROPERTY(Rectangle, "bottom", Int, m_bottom),
+    NP_COMPUTED_PROPERTY("width", Rectangle::getWidth),
+    NP_COMPUTED_PROPERTY("height", Rectangle::getHeight)
 };
 
-static const int kNumProperties = G_N_ELEMENTS(sPropertyIdNames);
-static NPIdentifier sPropertyIds[kNumProperties];
-
-static bool sPropertyIdsInitialized = false;
-
-enum PropertyId {
-    PropertyLeft = 0,
-    PropertyTop,
-    PropertyRight,
-    PropertyBottom,
-    PropertyWidth,
-    PropertyHeight
-};
+NPPropertyIndex Rectangle::sIndex(sFields, G_N_ELEMENTS(sFields));
+NPObjectPool<Rectangle> Rectangle::sPool("Rectangle");
 
 /// structure that defines methods for Rectangle object
-NPClass Rectangle::sRectangleClass = {
-    NP_CLASS_STRUCT_VERSION_CTOR,
-    Rectangle::PrvObjAllocate,
-    Rectangle::PrvObjDeallocate,
-    Rectangle::PrvObjInvalidate,
-    Rectangle::PrvObjHasMethod,
-    Rectangle::PrvObjInvoke,
-    Rectangle::PrvObjInvokeDefault,
-    Rectangle::PrvObjHasProperty,
-    Rectangle::PrvObjGetProperty,
-    Rectangle::PrvObjSetProperty,
-    Rectangle::PrvObjRemoveProperty,
-    Rectangle::PrvObjEnumerate,
-    Rectangle::PrvObjConstruct
-};
-
-// Rectangle object static hooks implementation
-// that call actual instance methods
-NPObject* Rectangle::PrvObjAllocate(NPP npp, NPClass* klass)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return new Rectangle(static_cast<AdapterBase*>(npp->pdata));
-}
-void Rectangle::PrvObjDeallocate(NPObject* obj)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    delete static_cast<Rectangle*>(obj);
-}
-void Rectangle::PrvObjInvalidate(NPObject* obj)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    static_cast<Rectangle*>(obj)->invalidate();
-}
-
-bool Rectangle::PrvObjHasMethod(NPObject* obj, NPIdentifier name)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return static_cast<Rectangle*>(obj)->hasMethod(name);
-}
-bool Rectangle::PrvObjInvoke(NPObject *obj, NPIdentifier name,
-                             const NPVariant *args, uint32_t argCount,
-                             NPVariant *result)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return static_cast<Rectangle*>(obj)->invoke(name, args, argCount, result);
-}
-
-bool Rectangle::PrvObjInvokeDefault(NPObject *obj, const NPVariant *args,
-                                    uint32_t argCount, NPVariant *result)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return static_cast<Rectangle*>(obj)->invokeDefault(args, argCount, result);
-}
-bool Rectangle::PrvObjHasProperty(NPObject *obj, NPIdentifier name)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return static_cast<Rectangle*>(obj)->hasProperty(name);
-}
-bool Rectangle::PrvObjGetProperty(NPObject *obj, NPIdentifier name, NPVariant *result)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return static_cast<Rectangle*>(obj)->getProperty(name, result);
-}
-bool Rectangle::PrvObjSetProperty(NPObject *obj, NPIdentifier name,
-                                  const NPVariant *value)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return static_cast<Rectangle*>(obj)->setProperty(name, value);
-}
-bool Rectangle::PrvObjRemoveProperty(NPObject *obj, NPIdentifier name)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return static_cast<Rectangle*>(obj)->removeProperty(name);
-}
-bool Rectangle::PrvObjEnumerate(NPObject *obj, NPIdentifier **value,
-                                uint32_t *count)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return static_cast<Rectangle*>(obj)->enumerate(value, count);
-}
-bool Rectangle::PrvObjConstruct(NPObject *obj, const NPVariant *args,
-                                uint32_t argCount, NPVariant *result)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return static_cast<Rectangle*>(obj)->construct(args, argCount, result);
-}
+NPClass Rectangle::sRectangleClass = NP_PROPERTY_BAG_CLASS(Rectangle);
 
 /**
  * Constructor.
@@ -144,11 +48,6 @@ Rectangle::Rectangle(AdapterBase* adapter) :
     ,m_bottom(0)
 {
     TRACE("Entered %s", __FUNCTION__);
-    if (!sPropertyIdsInitialized) {
-        AdapterBase::NPN_GetStringIdentifiers(sPropertyIdNames, kNumProperties, sPropertyIds);
-        sPropertyIdsInitialized = true;
-        TRACE("Rectangle sPropertyIdsInitialized == true");
-    }
 }
 
 Rectangle::~Rectangle()
@@ -174,117 +73,14 @@ void Rectangle::set(const Rectangle* r)
     }
 }
 
-void Rectangle::invalidate()
+void Rectangle::getWidth(NPObject* obj, NPVariant* result)
 {
-    TRACE("Entered %s", __FUNCTION__);
+    Rectangle* r = static_cast<Rectangle*>(obj);
+    INT32_TO_NPVARIANT(r->m_right - r->m_left, *result);
 }
 
-bool Rectangle::hasMethod(NPIdentifier name)
+void Rectangle::getHeight(NPObject* obj, NPVariant* result)
 {
-    TRACE("Entered %s", __FUNCTION__);
-    return false;
+    Rectangle* r = static_cast<Rectangle*>(obj);
+    INT32_TO_NPVARIANT(r->m_bottom - r->m_top, *result);
 }
-
-bool Rectangle::invoke(NPIdentifier name, const NPVariant *args,
-                       uint32_t argCount, NPVariant *rm_latitudeesult)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return false;
-}
-
-bool Rectangle::invokeDefault(const NPVariant *args,
-                              uint32_t argCount, NPVariant *result)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return false;
-}
-
-bool Rectangle::hasProperty(NPIdentifier name)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    for (int i = 0; i < kNumProperties; i++) {
-        if (sPropertyIds[i] == name) {
-            return true;
-        }
-    }
-    return false;
-}
-
-bool Rectangle::getProperty(NPIdentifier name, NPVariant *result)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    if (NULL == result) {
-        return false;
-    }
-
-    if (name == sPropertyIds[PropertyLeft]) {
-        INT32_TO_NPVARIANT(m_left, *result);
-        return true;
-    }
-    else if (name == sPropertyIds[PropertyTop]) {
-        INT32_TO_NPVARIANT(m_top, *result);
-        return true;
-    }
-    else if (name == sPropertyIds[PropertyRight]) {
-        INT32_TO_NPVARIANT(m_right, *result);
-        return true;
-    }
-    else if (name == sPropertyIds[PropertyBottom]) {
-        INT32_TO_NPVARIANT(m_bottom, *result);
-        return true;
-    }
-    else if (name == sPropertyIds[PropertyWidth]) {
-        INT32_TO_NPVARIANT(m_right - m_left, *result);
-        return true;
-    }
-    else if (name == sPropertyIds[PropertyHeight]) {
-        INT32_TO_NPVARIANT(m_bottom - m_top, *result);
-        return true;
-    }
-
-    return false;
-}
-
-bool Rectangle::setProperty(NPIdentifier name, const NPVariant *value)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    if (name == sPropertyIds[PropertyLeft] && AdapterBase::IsIntegerVariant(value)) {
-        m_left = AdapterBase::VariantToInteger(value);
-        return true;
-    }
-    else if (name == sPropertyIds[PropertyTop] && AdapterBase::IsIntegerVariant(value)) {
-        m_top = AdapterBase::VariantToInteger(value);
-        return true;
-    }
-    else if (name == sPropertyIds[PropertyRight] && AdapterBase::IsIntegerVariant(value)) {
-        m_right = AdapterBase::VariantToInteger(value);
-        return true;
-    }
-    else if (name == sPropertyIds[PropertyBottom] && AdapterBase::IsIntegerVariant(value)) {
-        m_bottom = AdapterBase::VariantToInteger(value);
-        return true;
-    }
-
-    return false;
-}
-
-bool Rectangle::removeProperty(NPIdentifier name)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return false;
-}
-
-bool Rectangle::enumerate(NPIdentifier **value, uint32_t *count)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return false;
-}
-
-bool Rectangle::construct(const NPVariant *args, int32_t argCount,
-                          NPVariant *result)
-{
-    TRACE("Entered %s", __FUNCTION__);
-    return false;
-}
-
-
@@ -19,15 +19,13 @@ LICENSE@@@ */
 #ifndef RECTANGLE_H
 #define RECTANGLE_H
 
-#include <npupp.h>
-#include <npapi.h>
-#include <string>
+#include "NPPropertyBag.h"
 
 
 /**
  * A simple object to hold the values of a rectangle.
  */
-class Rectangle : public NPObject
+class Rectangle : public NPPropertyBag<Rectangle, AdapterBase>
 {
 public:
     Rectangle(AdapterBase *adapter);
@@ -37,34 +35,17 @@ public:
 
     void initialize(int left, int top, int right, int bottom);
     void set(const Rectangle* r);
-    void invalidate();
-    bool hasMethod(NPIdentifier name);
-    bool invoke(NPIdentifier name, const NPVariant *args, uint32_t argCount, NPVariant *result);
-    bool invokeDefault(const NPVariant *args, uint32_t argCount, NPVariant *result);
-    bool hasProperty(NPIdentifier name);
-    bool getProperty(NPIdentifier name, NPVariant *result);
-    bool setProperty(NPIdentifier name, const NPVariant *value);
-    bool removeProperty(NPIdentifier name);
-    bool enumerate(NPIdentifier **value, uint32_t *count);
-    bool construct(const NPVariant *args, int32_t argCount, NPVariant *result);
 
+private:
+    friend class NPPropertyBag<Rectangle, AdapterBase>;
 
-    // Private NP Object callbacks, used for JavaScript integration.
-    // (these translate into appropriate non-static method calls).
-    static NPObject* PrvObjAllocate(NPP npp, NPClass* klass);
-    static void PrvObjDeallocate(NPObject* obj);
-    static void PrvObjInvalidate(NPObject* obj);
-    static bool PrvObjHasMethod(NPObject* obj, NPIdentifier name);
-    static bool PrvObjInvoke(NPObject *obj, NPIdentifier name, const NPVariant *args, uint32_t argCount, NPVariant *result);
-    static bool PrvObjInvokeDefault(NPObject *obj, const NPVariant *args, uint32_t argCount, NPVariant *result);
-    static bool PrvObjHasProperty(NPObject *obj, NPIdentifier name);
-    static bool PrvObjGetProperty(NPObject *obj, NPIdentifier name, NPVariant *result);
-    static bool PrvObjSetProperty(NPObject *obj, NPIdentifier name, const NPVariant *value);
-    static bool PrvObjRemoveProperty(NPObject *obj, NPIdentifier name);
-    static bool PrvObjEnumerate(NPObject *obj, NPIdentifier **value, uint32_t *count);
-    static bool PrvObjConstruct(NPObject *obj, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const NPPropertyField sFields[];
+    static NPPropertyIndex sIndex;
+    static NPObjectPool<Rectangle> sPool;
+
+    static void getWidth(NPObject* obj, NPVariant* result);
+    static void getHeight(NPObject* obj, NPVariant* result);
 
-private:
     int m_left;
     int m_top;
     int m_right;
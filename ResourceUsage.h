@@ -0,0 +1,80 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef RESOURCEUSAGE_H
+#define RESOURCEUSAGE_H
+
+#include <stddef.h>
+
+/**
+ * Bytes held, by category. Shared memory and frozen surfaces are exact, the
+ * rest are estimates from element counts and sizes. Spilled surfaces are
+ * file backed pages the kernel can reclaim, so they are left out of total().
+ */
+struct ResourceUsage {
+
+    size_t sharedMemory;        ///< Offscreens, background buffer and bulk channel
+    size_t frozenSurface;
+    size_t spilledSurface;      ///< Frozen surface in the FrozenSurfaceCache, not in total()
+    size_t pendingQueries;
+    size_t rects;               ///< Highlight, flash and interactive rects, scrollable layers
+    size_t cachedObjects;       ///< Hit test replies
+
+    ResourceUsage()
+        : sharedMemory(0)
+        , frozenSurface(0)
+        , spilledSurface(0)
+        , pendingQueries(0)
+        , rects(0)
+        , cachedObjects(0)
+    {
+    }
+
+    size_t total() const {
+        return sharedMemory + frozenSurface + pendingQueries + rects + cachedObjects;
+    }
+
+    void add(const ResourceUsage& other) {
+        sharedMemory += other.sharedMemory;
+        frozenSurface += other.frozenSurface;
+        spilledSurface += other.spilledSurface;
+        pendingQueries += other.pendingQueries;
+        rects += other.rects;
+        cachedObjects += other.cachedObjects;
+    }
+
+    /**
+     * Raise every category to at least what it is in @a other.
+     */
+    void raiseTo(const ResourceUsage& other) {
+        if (other.sharedMemory > sharedMemory)
+            sharedMemory = other.sharedMemory;
+        if (other.frozenSurface > frozenSurface)
+            frozenSurface = other.frozenSurface;
+        if (other.spilledSurface > spilledSurface)
+            spilledSurface = other.spilledSurface;
+        if (other.pendingQueries > pendingQueries)
+            pendingQueries = other.pendingQueries;
+        if (other.rects > rects)
+            rects = other.rects;
+        if (other.cachedObjects > cachedObjects)
+            cachedObjects = other.cachedObjects;
+    }
+};
+
+#endif /* RESOURCEUSAGE_H */
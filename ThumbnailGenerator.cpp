@@ -0,0 +1,313 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#include <unistd.h>
+
+#include "ThumbnailGenerator.h"
+
+/**
+ * Per channel average of two packed ARGB pixels, rounded down, without
+ * unpacking them: the bits both have plus half of the others, masked so
+ * nothing shifts into the next channel.
+ */
+static inline uint32_t PrvAverage(uint32_t a, uint32_t b)
+{
+    return (a & b) + (((a ^ b) & 0xFEFEFEFEu) >> 1);
+}
+
+/**
+ * Half the size, every pixel the average of a 2x2 block. An odd last row or
+ * column is dropped.
+ */
+static QImage PrvHalve(const QImage& src)
+{
+    int width = src.width() / 2;
+    int height = src.height() / 2;
+
+    QImage dst(width, height, QImage::Format_ARGB32_Premultiplied);
+    if (dst.isNull())
+        return dst;
+
+    for (int y = 0; y < height; y++) {
+        const uint32_t* row0 = (const uint32_t*) src.scanLine(y * 2);
+        const uint32_t* row1 = (const uint32_t*) src.scanLine(y * 2 + 1);
+        uint32_t* out = (uint32_t*) dst.scanLine(y);
+
+        for (int x = 0; x < width; x++) {
+            out[x] = PrvAverage(PrvAverage(row0[x * 2], row0[x * 2 + 1]),
+                                PrvAverage(row1[x * 2], row1[x * 2 + 1]));
+        }
+    }
+
+    return dst;
+}
+
+ThumbnailGenerator::ThumbnailGenerator(GMainContext* mainCtxt)
+    : m_mainCtxt(mainCtxt)
+    , m_quit(false)
+    , m_building(0)
+    , m_nextBatchId(0)
+    , m_deliverSource(0)
+{
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+ThumbnailGenerator::~ThumbnailGenerator()
+{
+    pthread_mutex_lock(&m_lock);
+    m_quit = true;
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_lock);
+
+    for (size_t i = 0; i < m_workers.size(); i++)
+        pthread_join(m_workers[i], NULL);
+
+    if (m_deliverSource) {
+        g_source_destroy(m_deliverSource);
+        g_source_unref(m_deliverSource);
+    }
+
+    for (size_t i = 0; i < m_jobs.size(); i++)
+        delete m_jobs[i];
+    for (size_t i = 0; i < m_buildingJobs.size(); i++)
+        delete m_buildingJobs[i];
+    for (size_t i = 0; i < m_batches.size(); i++)
+        delete m_batches[i];
+    delete m_building;
+
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_lock);
+}
+
+QImage ThumbnailGenerator::downscale(const QImage& image, int width, int height)
+{
+    QSize size = image.size();
+    size.scale(width, height, Qt::KeepAspectRatio);
+    if (size.isEmpty())
+        return QImage();
+
+    QImage result = image.format() == QImage::Format_ARGB32_Premultiplied
+                    ? image : image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    while (result.width() >= size.width() * 2 && result.height() >= size.height() * 2)
+        result = PrvHalve(result);
+
+    if (result.size() != size)
+        result = result.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+    return result;
+}
+
+void ThumbnailGenerator::startWorkers()
+{
+    if (!m_workers.empty())
+        return;
+
+    int count = CLAMP((int) sysconf(_SC_NPROCESSORS_ONLN), 1, kMaxWorkers);
+
+    for (int i = 0; i < count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerMain, this) != 0) {
+            g_critical("%s: unable to start a thumbnail worker", __FUNCTION__);
+            break;
+        }
+        m_workers.push_back(thread);
+    }
+}
+
+int ThumbnailGenerator::begin(ThumbnailListener* listener)
+{
+    if (m_building) {
+        g_warning("%s: previous batch %d was never committed", __FUNCTION__, m_building->id);
+        commit();
+    }
+
+    m_building = new Batch;
+    m_building->id = ++m_nextBatchId;
+    m_building->listener = listener;
+    m_building->remaining = 0;
+
+    return m_building->id;
+}
+
+void ThumbnailGenerator::add(int32_t pageIdentifier, const QImage& image, const char* path, int width, int height)
+{
+    if (!m_building)
+        return;
+
+    ThumbnailResult result;
+    result.pageIdentifier = pageIdentifier;
+    result.path = path ? path : "";
+    result.succeeded = false;
+    m_building->results.push_back(result);
+
+    if (!path || image.isNull())
+        return;
+
+    // Queued on commit(), workers must not see results grow
+    Job* job = new Job;
+    job->batch = m_building;
+    job->index = m_building->results.size() - 1;
+    job->path = path;
+    job->image = image;
+    job->width = width;
+    job->height = height;
+    m_buildingJobs.push_back(job);
+
+    m_building->remaining++;
+}
+
+void ThumbnailGenerator::commit()
+{
+    if (!m_building)
+        return;
+
+    if (!m_buildingJobs.empty())
+        startWorkers();
+
+    pthread_mutex_lock(&m_lock);
+
+    m_batches.push_back(m_building);
+
+    if (m_workers.empty()) {
+        // Nobody to do them, report them failed
+        for (size_t i = 0; i < m_buildingJobs.size(); i++)
+            delete m_buildingJobs[i];
+        m_building->remaining = 0;
+    }
+    else {
+        m_jobs.insert(m_jobs.end(), m_buildingJobs.begin(), m_buildingJobs.end());
+        pthread_cond_broadcast(&m_cond);
+    }
+
+    if (!m_building->remaining)
+        scheduleDeliver();
+
+    pthread_mutex_unlock(&m_lock);
+
+    m_buildingJobs.clear();
+    m_building = 0;
+}
+
+void ThumbnailGenerator::cancel(ThumbnailListener* listener)
+{
+    if (m_building && m_building->listener == listener)
+        m_building->listener = 0;
+
+    for (size_t i = 0; i < m_delivering.size(); i++) {
+        if (m_delivering[i]->listener == listener)
+            m_delivering[i]->listener = 0;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    for (size_t i = 0; i < m_batches.size(); i++) {
+        if (m_batches[i]->listener == listener)
+            m_batches[i]->listener = 0;
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+/**
+ * Called with m_lock held, from any thread.
+ */
+void ThumbnailGenerator::scheduleDeliver()
+{
+    if (m_deliverSource)
+        return;
+
+    m_deliverSource = g_idle_source_new();
+    g_source_set_callback(m_deliverSource, deliverCb, this /*data*/, NULL);
+    g_source_attach(m_deliverSource, m_mainCtxt);
+}
+
+void* ThumbnailGenerator::workerMain(void* data)
+{
+    ThumbnailGenerator* g = (ThumbnailGenerator*) data;
+
+    pthread_mutex_lock(&g->m_lock);
+
+    for (;;) {
+        while (!g->m_quit && g->m_jobs.empty())
+            pthread_cond_wait(&g->m_cond, &g->m_lock);
+
+        if (g->m_quit)
+            break;
+
+        Job* job = g->m_jobs.front();
+        g->m_jobs.pop_front();
+
+        pthread_mutex_unlock(&g->m_lock);
+
+        QImage thumbnail = downscale(job->image, job->width, job->height);
+        bool succeeded = !thumbnail.isNull() && thumbnail.save(job->path.c_str(), "PNG");
+        if (!succeeded)
+            g_warning("%s: unable to write thumbnail %s", __FUNCTION__, job->path.c_str());
+
+        pthread_mutex_lock(&g->m_lock);
+
+        job->batch->results[job->index].succeeded = succeeded;
+        if (--job->batch->remaining == 0)
+            g->scheduleDeliver();
+
+        delete job;
+    }
+
+    pthread_mutex_unlock(&g->m_lock);
+    return 0;
+}
+
+gboolean ThumbnailGenerator::deliverCb(gpointer data)
+{
+    ((ThumbnailGenerator*) data)->deliver();
+    return FALSE;
+}
+
+/**
+ * Hands every finished batch to its listener, in the order they were
+ * committed.
+ */
+void ThumbnailGenerator::deliver()
+{
+    pthread_mutex_lock(&m_lock);
+
+    g_source_unref(m_deliverSource);
+    m_deliverSource = 0;
+
+    std::vector<Batch*>::iterator out = m_batches.begin();
+    for (std::vector<Batch*>::iterator i = m_batches.begin(); i != m_batches.end(); ++i) {
+        if ((*i)->remaining)
+            *out++ = *i;
+        else
+            m_delivering.push_back(*i);
+    }
+    m_batches.erase(out, m_batches.end());
+
+    pthread_mutex_unlock(&m_lock);
+
+    // Unlocked: a listener may well start another batch, or cancel() one
+    for (size_t i = 0; i < m_delivering.size(); i++) {
+        Batch* batch = m_delivering[i];
+        if (batch->listener)
+            batch->listener->thumbnailsReady(batch->id, batch->results);
+    }
+
+    for (size_t i = 0; i < m_delivering.size(); i++)
+        delete m_delivering[i];
+    m_delivering.clear();
+}
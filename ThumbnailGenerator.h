@@ -0,0 +1,129 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef THUMBNAILGENERATOR_H
+#define THUMBNAILGENERATOR_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <glib.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <QImage>
+
+struct ThumbnailResult {
+    int32_t pageIdentifier;
+    std::string path;
+    bool succeeded;
+};
+
+class ThumbnailListener
+{
+public:
+
+    ThumbnailListener() {}
+    virtual ~ThumbnailListener() {}
+
+    /**
+     * Called on the main thread once every thumbnail of @a batchId has been
+     * written or failed, in the order they were added.
+     */
+    virtual void thumbnailsReady(int batchId, const std::vector<ThumbnailResult>& results) = 0;
+};
+
+/**
+ * Scales pixels we already have down to thumbnails and writes them as PNG
+ * files on worker threads, so a batch of cards costs neither a BrowserServer
+ * round trip nor main thread time per card beyond copying its pixels.
+ *
+ * Images are halved with a 2x2 box filter while they are at least twice the
+ * requested size, then smoothly scaled the rest of the way. The aspect ratio
+ * is kept.
+ */
+class ThumbnailGenerator
+{
+public:
+
+    ThumbnailGenerator(GMainContext* mainCtxt);
+    ~ThumbnailGenerator();
+
+    /**
+     * Start a batch, then add() to it and commit() it.
+     *
+     * @return the batch id passed to the listener.
+     */
+    int begin(ThumbnailListener* listener);
+
+    /**
+     * @param image copied pixels, shared with the worker from now on.
+     * @param path PNG file to write, NULL to report a failure for
+     *        @a pageIdentifier, e.g. an adapter with nothing to show.
+     */
+    void add(int32_t pageIdentifier, const QImage& image, const char* path, int width, int height);
+    void commit();
+
+    /**
+     * @a listener is going away: its pending results are dropped.
+     */
+    void cancel(ThumbnailListener* listener);
+
+    static QImage downscale(const QImage& image, int width, int height);
+
+private:
+
+    static const int kMaxWorkers = 4;
+
+    struct Batch {
+        int id;
+        ThumbnailListener* listener;    ///< NULL once cancelled
+        int remaining;                  ///< Jobs not done yet
+        std::vector<ThumbnailResult> results;
+    };
+
+    struct Job {
+        Batch* batch;
+        size_t index;                   ///< Into batch->results
+        std::string path;
+        QImage image;
+        int width;
+        int height;
+    };
+
+    void startWorkers();
+    void scheduleDeliver();
+    static void* workerMain(void* data);
+    static gboolean deliverCb(gpointer data);
+    void deliver();
+
+    GMainContext* m_mainCtxt;
+    pthread_mutex_t m_lock;             ///< Guards everything below
+    pthread_cond_t m_cond;
+    std::vector<pthread_t> m_workers;
+    bool m_quit;
+    std::deque<Job*> m_jobs;
+    std::vector<Batch*> m_batches;      ///< Not delivered yet
+    Batch* m_building;                  ///< Between begin() and commit(), main thread only
+    std::vector<Job*> m_buildingJobs;
+    std::vector<Batch*> m_delivering;   ///< Handed to listeners right now, main thread only
+    int m_nextBatchId;
+    GSource* m_deliverSource;           ///< Attached by the worker finishing a batch
+};
+
+#endif /* THUMBNAILGENERATOR_H */
@@ -19,13 +19,11 @@ LICENSE@@@ */
 #ifndef URLINFO_H
 #define URLINFO_H
 
-#include <npupp.h>
-#include <npapi.h>
-#include <string>
+#include "NPPropertyBag.h"
 
 class BrowserAdapter;
 
-class UrlInfo : public NPObject
+class UrlInfo : public NPPropertyBag<UrlInfo>
 {
 public:
     UrlInfo(BrowserAdapter *adapter);
@@ -35,34 +33,14 @@ public:
 
     void initialize(bool success, const char* url, const char* desc,
                     int left, int top, int right, int bottom);
-    void invalidate();
-    bool hasMethod(NPIdentifier name);
-    bool invoke(NPIdentifier name, const NPVariant *args, uint32_t argCount, NPVariant *result);
-    bool invokeDefault(const NPVariant *args, uint32_t argCount, NPVariant *result);
-    bool hasProperty(NPIdentifier name);
-    bool getProperty(NPIdentifier name, NPVariant *result);
-    bool setProperty(NPIdentifier name, const NPVariant *value);
-    bool removeProperty(NPIdentifier name);
-    bool enumerate(NPIdentifier **value, uint32_t *count);
-    bool construct(const NPVariant *args, int32_t argCount, NPVariant *result);
 
+private:
+    friend class NPPropertyBag<UrlInfo>;
 
-    // Private NP Object callbacks, used for JavaScript integration.
-    // (these translate into appropriate non-static method calls).
-    static NPObject* PrvObjAllocate(NPP npp, NPClass* klass);
-    static void PrvObjDeallocate(NPObject* obj);
-    static void PrvObjInvalidate(NPObject* obj);
-    static bool PrvObjHasMethod(NPObject* obj, NPIdentifier name);
-    static bool PrvObjInvoke(NPObject *obj, NPIdentifier name, const NPVariant *args, uint32_t argCount, NPVariant *result);
-    static bool PrvObjInvokeDefault(NPObject *obj, const NPVariant *args, uint32_t argCount, NPVariant *result);
-    static bool PrvObjHasProperty(NPObject *obj, NPIdentifier name);
-    static bool PrvObjGetProperty(NPObject *obj, NPIdentifier name, NPVariant *result);
-    static bool PrvObjSetProperty(NPObject *obj, NPIdentifier name, const NPVariant *value);
-    static bool PrvObjRemoveProperty(NPObject *obj, NPIdentifier name);
-    static bool PrvObjEnumerate(NPObject *obj, NPIdentifier **value, uint32_t *count);
-    static bool PrvObjConstruct(NPObject *obj, const NPVariant *args, uint32_t argCount, NPVariant *result);
+    static const NPPropertyField sFields[];
+    static NPPropertyIndex sIndex;
+    static NPObjectPool<UrlInfo> sPool;
 
-private:
     bool m_success;
     std::string	m_url;
     std::string	m_desc;
@@ -70,6 +48,3 @@ private:
 };
 
 #endif
-
-
-
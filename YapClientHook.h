@@ -0,0 +1,69 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+LICENSE@@@ */
+
+#ifndef YAPCLIENTHOOK_H
+#define YAPCLIENTHOOK_H
+
+#include <YapClient.h>
+#include <YapPacket.h>
+
+/**
+ * Sits between YapClient and the generated BrowserClientBase and reports
+ * every serialized command through commandSent() right before it is sent.
+ *
+ * The generated code calls packetCommand() and sendAsyncCommand() or
+ * sendSyncCommand() unqualified, so the versions here are the ones it
+ * picks up. This keeps the hook out of the generated file itself.
+ */
+class YapClientHook : public YapClient
+{
+public:
+
+    YapClientHook(const char* name) : YapClient(name), m_command(0) {}
+    YapClientHook(const char* name, GMainContext *ctxt) : YapClient(name, ctxt), m_command(0) {}
+    virtual ~YapClientHook() {}
+
+    /**
+     * Called with every serialized command right before it is sent.
+     * The packet must not be modified.
+     */
+    virtual void commandSent(YapPacket* cmd) {}
+
+protected:
+
+    YapPacket* packetCommand() {
+        m_command = YapClient::packetCommand();
+        return m_command;
+    }
+
+    void sendAsyncCommand() {
+        commandSent(m_command);
+        YapClient::sendAsyncCommand();
+    }
+
+    void sendSyncCommand() {
+        commandSent(m_command);
+        YapClient::sendSyncCommand();
+    }
+
+private:
+
+    YapPacket* m_command; ///< Command being built since the last packetCommand()
+};
+
+#endif /* YAPCLIENTHOOK_H */